@@ -0,0 +1,254 @@
+#include "postgres.h"
+
+#include "bitutils.h"
+#include "port/pg_bitutils.h"
+#include "vectorutils.h"
+
+#ifdef USE_DISPATCH
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_POPCNT
+#define TARGET_AVX512VPOPCNTDQ
+#else
+#define TARGET_POPCNT __attribute__((target("popcnt")))
+#define TARGET_AVX512VPOPCNTDQ __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+#endif
+#endif
+
+uint64		(*BitHammingDistance) (const unsigned char *ax, const unsigned char *bx, uint32 bytes);
+double		(*BitJaccardDistance) (const unsigned char *ax, const unsigned char *bx, uint32 bytes);
+
+/*
+ * Get the Jaccard distance from bit counts
+ */
+static inline double
+JaccardDistance(uint64 ab, uint64 aa, uint64 bb)
+{
+	/* Also covers when both are all zeros */
+	if (ab == 0)
+		return 1;
+
+	return 1 - (ab / ((double) (aa + bb - ab)));
+}
+
+static uint64
+BitHammingDistanceDefault(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	uint64		distance = 0;
+	uint32		i = 0;
+
+	/* pg_popcount64 uses POPCNT when available, but through a pointer */
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		/* Avoid unaligned loads */
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		distance += pg_popcount64(axs ^ bxs);
+	}
+
+	for (; i < bytes; i++)
+		distance += pg_number_of_ones[ax[i] ^ bx[i]];
+
+	return distance;
+}
+
+static double
+BitJaccardDistanceDefault(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	uint64		ab = 0;
+	uint64		aa = 0;
+	uint64		bb = 0;
+	uint32		i = 0;
+
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		ab += pg_popcount64(axs & bxs);
+		aa += pg_popcount64(axs);
+		bb += pg_popcount64(bxs);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += pg_number_of_ones[ax[i] & bx[i]];
+		aa += pg_number_of_ones[ax[i]];
+		bb += pg_number_of_ones[bx[i]];
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+
+#ifdef USE_DISPATCH
+TARGET_POPCNT static uint64
+BitHammingDistancePopcnt(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	uint64		distance = 0;
+	uint32		i = 0;
+
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		distance += _mm_popcnt_u64(axs ^ bxs);
+	}
+
+	for (; i < bytes; i++)
+		distance += _mm_popcnt_u32(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+TARGET_POPCNT static double
+BitJaccardDistancePopcnt(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	uint64		ab = 0;
+	uint64		aa = 0;
+	uint64		bb = 0;
+	uint32		i = 0;
+
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		ab += _mm_popcnt_u64(axs & bxs);
+		aa += _mm_popcnt_u64(axs);
+		bb += _mm_popcnt_u64(bxs);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += _mm_popcnt_u32(ax[i] & bx[i]);
+		aa += _mm_popcnt_u32(ax[i]);
+		bb += _mm_popcnt_u32(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+
+TARGET_AVX512VPOPCNTDQ static uint64
+BitHammingDistanceAvx512Vpopcntdq(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	__m512i		dist = _mm512_setzero_si512();
+	uint64		distance;
+	uint32		i = 0;
+
+	/* 512 bits per iteration */
+	for (; i + sizeof(__m512i) <= bytes; i += sizeof(__m512i))
+	{
+		__m512i		axs = _mm512_loadu_si512((const void *) (ax + i));
+		__m512i		bxs = _mm512_loadu_si512((const void *) (bx + i));
+
+		dist = _mm512_add_epi64(dist, _mm512_popcnt_epi64(_mm512_xor_si512(axs, bxs)));
+	}
+
+	distance = _mm512_reduce_add_epi64(dist);
+
+	/* Remaining bytes are handled with POPCNT */
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		distance += _mm_popcnt_u64(axs ^ bxs);
+	}
+
+	for (; i < bytes; i++)
+		distance += _mm_popcnt_u32(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+TARGET_AVX512VPOPCNTDQ static double
+BitJaccardDistanceAvx512Vpopcntdq(const unsigned char *ax, const unsigned char *bx, uint32 bytes)
+{
+	__m512i		abv = _mm512_setzero_si512();
+	__m512i		aav = _mm512_setzero_si512();
+	__m512i		bbv = _mm512_setzero_si512();
+	uint64		ab;
+	uint64		aa;
+	uint64		bb;
+	uint32		i = 0;
+
+	for (; i + sizeof(__m512i) <= bytes; i += sizeof(__m512i))
+	{
+		__m512i		axs = _mm512_loadu_si512((const void *) (ax + i));
+		__m512i		bxs = _mm512_loadu_si512((const void *) (bx + i));
+
+		abv = _mm512_add_epi64(abv, _mm512_popcnt_epi64(_mm512_and_si512(axs, bxs)));
+		aav = _mm512_add_epi64(aav, _mm512_popcnt_epi64(axs));
+		bbv = _mm512_add_epi64(bbv, _mm512_popcnt_epi64(bxs));
+	}
+
+	ab = _mm512_reduce_add_epi64(abv);
+	aa = _mm512_reduce_add_epi64(aav);
+	bb = _mm512_reduce_add_epi64(bbv);
+
+	for (; i + sizeof(uint64) <= bytes; i += sizeof(uint64))
+	{
+		uint64		axs;
+		uint64		bxs;
+
+		memcpy(&axs, ax + i, sizeof(uint64));
+		memcpy(&bxs, bx + i, sizeof(uint64));
+
+		ab += _mm_popcnt_u64(axs & bxs);
+		aa += _mm_popcnt_u64(axs);
+		bb += _mm_popcnt_u64(bxs);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += _mm_popcnt_u32(ax[i] & bx[i]);
+		aa += _mm_popcnt_u32(ax[i]);
+		bb += _mm_popcnt_u32(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+#endif
+
+/*
+ * Choose the bit distance functions for the CPU
+ *
+ * Must be called after VectorInit, which detects the CPU features
+ */
+void
+BitvecInit(void)
+{
+	BitHammingDistance = BitHammingDistanceDefault;
+	BitJaccardDistance = BitJaccardDistanceDefault;
+
+#ifdef USE_DISPATCH
+	if (SupportsCpuFeature(CPU_FEATURE_AVX512VPOPCNTDQ | CPU_FEATURE_POPCNT))
+	{
+		BitHammingDistance = BitHammingDistanceAvx512Vpopcntdq;
+		BitJaccardDistance = BitJaccardDistanceAvx512Vpopcntdq;
+	}
+	else if (SupportsCpuFeature(CPU_FEATURE_POPCNT))
+	{
+		BitHammingDistance = BitHammingDistancePopcnt;
+		BitJaccardDistance = BitJaccardDistancePopcnt;
+	}
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef BITUTILS_H
+#define BITUTILS_H
+
+#include "vectorutils.h"
+
+extern uint64 (*BitHammingDistance) (const unsigned char *ax, const unsigned char *bx, uint32 bytes);
+extern double (*BitJaccardDistance) (const unsigned char *ax, const unsigned char *bx, uint32 bytes);
+
+void		BitvecInit(void);
+
+#endif
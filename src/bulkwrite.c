@@ -0,0 +1,150 @@
+#include "postgres.h"
+
+#include "access/xloginsert.h"
+#include "bulkwrite.h"
+#include "storage/bufmgr.h"
+#include "storage/smgr.h"
+
+#if PG_VERSION_NUM >= 160000
+#define BulkWriterRelFile(index) (&(index)->rd_locator)
+#else
+#define BulkWriterRelFile(index) (&(index)->rd_node)
+#endif
+
+/*
+ * Get the storage manager relation
+ */
+static SMgrRelation
+BulkWriterSmgr(Relation index)
+{
+#if PG_VERSION_NUM >= 150000
+	return RelationGetSmgr(index);
+#else
+	RelationOpenSmgr(index);
+	return index->rd_smgr;
+#endif
+}
+
+/*
+ * Start writing pages after the end of the index
+ *
+ * Pages before the first one written can still be accessed through shared
+ * buffers, but the index must not be extended any other way until the writer
+ * is finished. Pages of the initialization fork are always WAL-logged and
+ * synced, since it must survive a crash even for unlogged indexes.
+ */
+void
+InitBulkWriter(BulkWriter * writer, Relation index, ForkNumber forkNum, bool useWal)
+{
+	writer->index = index;
+	writer->forkNum = forkNum;
+	writer->useWal = useWal || forkNum == INIT_FORKNUM;
+	writer->extend = true;
+	writer->blkno = smgrnblocks(BulkWriterSmgr(index), forkNum);
+	MemSet(writer->buf.data, 0, BLCKSZ);
+}
+
+/*
+ * Start writing pages reserved with ReserveBulkPages
+ *
+ * Writers for different ranges of pages can run concurrently in different
+ * processes. The caller is responsible for SyncBulkPages.
+ */
+void
+InitBulkWriterAt(BulkWriter * writer, Relation index, ForkNumber forkNum, bool useWal, BlockNumber blkno)
+{
+	writer->index = index;
+	writer->forkNum = forkNum;
+	writer->useWal = useWal || forkNum == INIT_FORKNUM;
+	writer->extend = false;
+	writer->blkno = blkno;
+	MemSet(writer->buf.data, 0, BLCKSZ);
+}
+
+/*
+ * Write the current page
+ */
+static void
+WritePage(BulkWriter * writer)
+{
+	Page		page = BulkWriterGetPage(writer);
+	SMgrRelation smgr = BulkWriterSmgr(writer->index);
+
+	/* Sets the LSN of the page */
+	if (writer->useWal)
+		log_newpage(BulkWriterRelFile(writer->index), writer->forkNum, writer->blkno, page, true);
+
+	PageSetChecksumInplace(page, writer->blkno);
+
+	if (writer->extend)
+		smgrextend(smgr, writer->forkNum, writer->blkno, (char *) page, true);
+	else
+		smgrwrite(smgr, writer->forkNum, writer->blkno, (char *) page, true);
+}
+
+/*
+ * Write the current page and start the next one
+ *
+ * The next page is zeroed and must be initialized by the caller
+ */
+void
+BulkWriterNextPage(BulkWriter * writer)
+{
+	WritePage(writer);
+
+	writer->blkno++;
+	MemSet(writer->buf.data, 0, BLCKSZ);
+
+	/* Can take a while, so ensure we can interrupt */
+	CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * Write the last page and sync the index
+ */
+void
+FinishBulkWriter(BulkWriter * writer)
+{
+	WritePage(writer);
+
+	if (writer->extend && writer->useWal)
+		SyncBulkPages(writer->index, writer->forkNum);
+}
+
+/*
+ * Extend the index with zeroed pages to be written later
+ *
+ * Returns the first page
+ */
+BlockNumber
+ReserveBulkPages(Relation index, ForkNumber forkNum, BlockNumber nblocks)
+{
+	SMgrRelation smgr = BulkWriterSmgr(index);
+	BlockNumber start = smgrnblocks(smgr, forkNum);
+
+#if PG_VERSION_NUM >= 160000
+	if (nblocks > 0)
+		smgrzeroextend(smgr, forkNum, start, nblocks, true);
+#else
+	PGAlignedBlock zerobuf;
+
+	MemSet(zerobuf.data, 0, BLCKSZ);
+	for (BlockNumber i = 0; i < nblocks; i++)
+		smgrextend(smgr, forkNum, start + i, zerobuf.data, true);
+#endif
+
+	return start;
+}
+
+/*
+ * Sync pages written by bulk writers
+ *
+ * Pages were written without shared buffers, so a checkpoint after they were
+ * WAL-logged would not flush them. Without WAL, the index is synced at commit
+ * if needed, except for the initialization fork, which must always be synced.
+ */
+void
+SyncBulkPages(Relation index, ForkNumber forkNum)
+{
+	smgrimmedsync(BulkWriterSmgr(index), forkNum);
+}
@@ -0,0 +1,32 @@
+#ifndef BULKWRITE_H
+#define BULKWRITE_H
+
+#include "common/relpath.h"
+#include "storage/block.h"
+#include "storage/bufpage.h"
+#include "utils/rel.h"
+
+/*
+ * Writes new pages of an index sequentially from local memory, bypassing
+ * shared buffers, and optionally WAL-logs each page as it is written
+ */
+typedef struct BulkWriter
+{
+	Relation	index;
+	ForkNumber	forkNum;
+	bool		useWal;
+	bool		extend;			/* append pages rather than fill reserved ones */
+	BlockNumber blkno;			/* block number of the current page */
+	PGAlignedBlock buf;
+}			BulkWriter;
+
+#define BulkWriterGetPage(writer) ((Page) (writer)->buf.data)
+
+void		InitBulkWriter(BulkWriter * writer, Relation index, ForkNumber forkNum, bool useWal);
+void		InitBulkWriterAt(BulkWriter * writer, Relation index, ForkNumber forkNum, bool useWal, BlockNumber blkno);
+void		BulkWriterNextPage(BulkWriter * writer);
+void		FinishBulkWriter(BulkWriter * writer);
+BlockNumber ReserveBulkPages(Relation index, ForkNumber forkNum, BlockNumber nblocks);
+void		SyncBulkPages(Relation index, ForkNumber forkNum);
+
+#endif
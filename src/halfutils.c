@@ -0,0 +1,260 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "halfutils.h"
+#include "vectorutils.h"
+
+#ifdef USE_DISPATCH
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_F16C
+#else
+#define TARGET_F16C __attribute__((target("avx,f16c,fma")))
+#endif
+#endif
+
+float		(*HalfvecL2SquaredDistance) (const half *ax, const half *bx, int dim);
+float		(*HalfvecInnerProduct) (const half *ax, const half *bx, int dim);
+double		(*HalfvecCosineSimilarity) (const half *ax, const half *bx, int dim);
+float		(*HalfvecL1Distance) (const half *ax, const half *bx, int dim);
+
+static float
+HalfvecL2SquaredDistanceDefault(const half *ax, const half *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		float		diff = HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]);
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static float
+HalfvecInnerProductDefault(const half *ax, const half *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += HalfToFloat4(ax[i]) * HalfToFloat4(bx[i]);
+
+	return distance;
+}
+
+static double
+HalfvecCosineSimilarityDefault(const half *ax, const half *bx, int dim)
+{
+	float		similarity = 0.0;
+	float		norma = 0.0;
+	float		normb = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		float		axi = HalfToFloat4(ax[i]);
+		float		bxi = HalfToFloat4(bx[i]);
+
+		similarity += axi * bxi;
+		norma += axi * axi;
+		normb += bxi * bxi;
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+static float
+HalfvecL1DistanceDefault(const half *ax, const half *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += fabsf(HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]));
+
+	return distance;
+}
+
+#ifdef USE_DISPATCH
+/*
+ * Convert eight halfs to floats
+ */
+#define LoadHalf8(x) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (x)))
+
+TARGET_F16C static inline float
+HorizontalSumF16c(__m256 v)
+{
+	__m128		sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+TARGET_F16C static float
+HalfvecL2SquaredDistanceF16c(const half *ax, const half *bx, int dim)
+{
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256		diff0 = _mm256_sub_ps(LoadHalf8(ax + i), LoadHalf8(bx + i));
+		__m256		diff1 = _mm256_sub_ps(LoadHalf8(ax + i + 8), LoadHalf8(bx + i + 8));
+
+		dist0 = _mm256_fmadd_ps(diff0, diff0, dist0);
+		dist1 = _mm256_fmadd_ps(diff1, diff1, dist1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		diff = _mm256_sub_ps(LoadHalf8(ax + i), LoadHalf8(bx + i));
+
+		dist0 = _mm256_fmadd_ps(diff, diff, dist0);
+	}
+
+	distance = HorizontalSumF16c(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+	{
+		float		diff = HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]);
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+TARGET_F16C static float
+HalfvecInnerProductF16c(const half *ax, const half *bx, int dim)
+{
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 16 <= dim; i += 16)
+	{
+		dist0 = _mm256_fmadd_ps(LoadHalf8(ax + i), LoadHalf8(bx + i), dist0);
+		dist1 = _mm256_fmadd_ps(LoadHalf8(ax + i + 8), LoadHalf8(bx + i + 8), dist1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+		dist0 = _mm256_fmadd_ps(LoadHalf8(ax + i), LoadHalf8(bx + i), dist0);
+
+	distance = HorizontalSumF16c(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += HalfToFloat4(ax[i]) * HalfToFloat4(bx[i]);
+
+	return distance;
+}
+
+TARGET_F16C static double
+HalfvecCosineSimilarityF16c(const half *ax, const half *bx, int dim)
+{
+	__m256		sim = _mm256_setzero_ps();
+	__m256		na = _mm256_setzero_ps();
+	__m256		nb = _mm256_setzero_ps();
+	float		similarity;
+	float		norma;
+	float		normb;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		a = LoadHalf8(ax + i);
+		__m256		b = LoadHalf8(bx + i);
+
+		sim = _mm256_fmadd_ps(a, b, sim);
+		na = _mm256_fmadd_ps(a, a, na);
+		nb = _mm256_fmadd_ps(b, b, nb);
+	}
+
+	similarity = HorizontalSumF16c(sim);
+	norma = HorizontalSumF16c(na);
+	normb = HorizontalSumF16c(nb);
+
+	for (; i < dim; i++)
+	{
+		float		axi = HalfToFloat4(ax[i]);
+		float		bxi = HalfToFloat4(bx[i]);
+
+		similarity += axi * bxi;
+		norma += axi * axi;
+		normb += bxi * bxi;
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+TARGET_F16C static float
+HalfvecL1DistanceF16c(const half *ax, const half *bx, int dim)
+{
+	__m256		signMask = _mm256_set1_ps(-0.0f);
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256		diff0 = _mm256_sub_ps(LoadHalf8(ax + i), LoadHalf8(bx + i));
+		__m256		diff1 = _mm256_sub_ps(LoadHalf8(ax + i + 8), LoadHalf8(bx + i + 8));
+
+		dist0 = _mm256_add_ps(dist0, _mm256_andnot_ps(signMask, diff0));
+		dist1 = _mm256_add_ps(dist1, _mm256_andnot_ps(signMask, diff1));
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		diff = _mm256_sub_ps(LoadHalf8(ax + i), LoadHalf8(bx + i));
+
+		dist0 = _mm256_add_ps(dist0, _mm256_andnot_ps(signMask, diff));
+	}
+
+	distance = HorizontalSumF16c(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += fabsf(HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]));
+
+	return distance;
+}
+#endif
+
+/*
+ * Choose the halfvec distance functions for the CPU
+ *
+ * Must be called after VectorInit, which detects the CPU features
+ */
+void
+HalfvecInit(void)
+{
+	HalfvecL2SquaredDistance = HalfvecL2SquaredDistanceDefault;
+	HalfvecInnerProduct = HalfvecInnerProductDefault;
+	HalfvecCosineSimilarity = HalfvecCosineSimilarityDefault;
+	HalfvecL1Distance = HalfvecL1DistanceDefault;
+
+#ifdef USE_DISPATCH
+	/* Elements are widened to float, so accumulation stays in single precision */
+	if (SupportsCpuFeature(CPU_FEATURE_F16C | CPU_FEATURE_FMA))
+	{
+		HalfvecL2SquaredDistance = HalfvecL2SquaredDistanceF16c;
+		HalfvecInnerProduct = HalfvecInnerProductF16c;
+		HalfvecCosineSimilarity = HalfvecCosineSimilarityF16c;
+		HalfvecL1Distance = HalfvecL1DistanceF16c;
+	}
+#endif
+}
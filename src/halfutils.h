@@ -0,0 +1,189 @@
+#ifndef HALFUTILS_H
+#define HALFUTILS_H
+
+#include <math.h>
+
+#include "halfvec.h"
+#include "vectorutils.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+extern float (*HalfvecL2SquaredDistance) (const half *ax, const half *bx, int dim);
+extern float (*HalfvecInnerProduct) (const half *ax, const half *bx, int dim);
+extern double (*HalfvecCosineSimilarity) (const half *ax, const half *bx, int dim);
+extern float (*HalfvecL1Distance) (const half *ax, const half *bx, int dim);
+
+void		HalfvecInit(void);
+
+/*
+ * Check if a half is NaN
+ */
+static inline bool
+HalfIsNan(half num)
+{
+	return (num & 0x7C00) == 0x7C00 && (num & 0x03FF) != 0;
+}
+
+/*
+ * Check if a half is infinite
+ */
+static inline bool
+HalfIsInf(half num)
+{
+	return (num & 0x7FFF) == 0x7C00;
+}
+
+/*
+ * Check if a half is zero
+ */
+static inline bool
+HalfIsZero(half num)
+{
+	return (num & 0x7FFF) == 0x0000;
+}
+
+/*
+ * Convert a half to a float4
+ */
+static inline float
+HalfToFloat4(half num)
+{
+#if defined(__F16C__)
+	return _cvtsh_ss(num);
+#else
+	union
+	{
+		float		f;
+		uint32		i;
+	}			swapfloat;
+	uint32		sign = ((uint32) (num & 0x8000)) << 16;
+	int			exponent = (num & 0x7C00) >> 10;
+	uint32		mantissa = num & 0x03FF;
+
+	if (exponent == 31)
+	{
+		/* Infinite or NaN */
+		swapfloat.i = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else if (exponent == 0)
+	{
+		if (mantissa == 0)
+		{
+			/* Zero */
+			swapfloat.i = sign;
+		}
+		else
+		{
+			/* Subnormal, so normalize the mantissa */
+			exponent = -14;
+
+			while ((mantissa & 0x0400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+
+			swapfloat.i = sign | ((uint32) (exponent + 127) << 23) | ((mantissa & 0x03FF) << 13);
+		}
+	}
+	else
+	{
+		/* Normal */
+		swapfloat.i = sign | ((uint32) (exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	return swapfloat.f;
+#endif
+}
+
+/*
+ * Convert a float4 to a half without checking for overflow
+ *
+ * Rounds to nearest, ties to even
+ */
+static inline half
+Float4ToHalfUnchecked(float num)
+{
+#if defined(__F16C__)
+	return _cvtss_sh(num, _MM_FROUND_TO_NEAREST_INT);
+#else
+	union
+	{
+		float		f;
+		uint32		i;
+	}			swapfloat;
+	uint32		bin;
+	uint32		exponent;
+	uint32		mantissa;
+	half		sign;
+
+	swapfloat.f = num;
+	bin = swapfloat.i;
+	exponent = bin & 0x7F800000;
+	sign = (bin & 0x80000000) >> 16;
+
+	/* Overflow, infinite, or NaN */
+	if (exponent >= 0x47800000)
+	{
+		if (exponent == 0x7F800000 && (bin & 0x007FFFFF) != 0)
+		{
+			/* Keep the top bits of the payload and make sure it stays NaN */
+			mantissa = (bin & 0x007FFFFF) >> 13;
+			return sign | 0x7C00 | 0x0200 | mantissa;
+		}
+
+		return sign | 0x7C00;
+	}
+
+	/* Subnormal or zero */
+	if (exponent <= 0x38000000)
+	{
+		/* Too small to round up to the smallest subnormal */
+		if (exponent < 0x33000000)
+			return sign;
+
+		exponent >>= 23;
+		mantissa = 0x00800000 | (bin & 0x007FFFFF);
+
+		/* Leave one extra bit for rounding */
+		mantissa >>= (113 - exponent);
+
+		/* Round up unless exactly halfway with an even result */
+		if ((mantissa & 0x00003FFF) != 0x00001000 || (bin & 0x000007FF) != 0)
+			mantissa += 0x00001000;
+
+		/* A carry into the exponent gives the smallest normal */
+		return sign + (half) (mantissa >> 13);
+	}
+
+	/* Normal */
+	mantissa = bin & 0x007FFFFF;
+
+	/* Round up unless exactly halfway with an even result */
+	if ((mantissa & 0x00003FFF) != 0x00001000)
+		mantissa += 0x00001000;
+
+	/* A carry into the exponent is correct and can overflow to infinity */
+	return sign + (half) (((exponent - 0x38000000) >> 13) + (mantissa >> 13));
+#endif
+}
+
+/*
+ * Convert a float4 to a half
+ */
+static inline half
+Float4ToHalf(float num)
+{
+	half		result = Float4ToHalfUnchecked(num);
+
+	if (unlikely(HalfIsInf(result)) && !isinf(num))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("\"%g\" is out of range for type halfvec", num)));
+
+	return result;
+}
+
+#endif
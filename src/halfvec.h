@@ -0,0 +1,24 @@
+#ifndef HALFVEC_H
+#define HALFVEC_H
+
+#define HALFVEC_MAX_DIM 16000
+
+/* Stored as IEEE 754 binary16 bits */
+typedef uint16 half;
+
+#define HALFVEC_SIZE(_dim)		(offsetof(HalfVector, x) + sizeof(half)*(_dim))
+#define DatumGetHalfVector(x)	((HalfVector *) PG_DETOAST_DATUM(x))
+#define PG_GETARG_HALFVEC_P(x)	DatumGetHalfVector(PG_GETARG_DATUM(x))
+#define PG_RETURN_HALFVEC_P(x)	PG_RETURN_POINTER(x)
+
+typedef struct HalfVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int16		dim;			/* number of dimensions */
+	int16		unused;
+	half		x[FLEXIBLE_ARRAY_MEMBER];
+}			HalfVector;
+
+HalfVector *InitHalfVector(int dim);
+
+#endif
@@ -5,8 +5,10 @@
 
 #include "access/amapi.h"
 #include "access/reloptions.h"
+#include "bitvec.h"
 #include "commands/progress.h"
 #include "commands/vacuum.h"
+#include "halfvec.h"
 #include "hnsw.h"
 #include "miscadmin.h"
 #include "utils/guc.h"
@@ -17,9 +19,21 @@
 #endif
 
 int			hnsw_ef_search;
+int			hnsw_iterative_scan;
+int			hnsw_max_scan_tuples;
+bool		hnsw_build_reorder;
+int			hnsw_max_build_memory;
+bool		hnsw_build_spill;
+int			hnsw_build_partitions;
 int			hnsw_lock_tranche_id;
 static relopt_kind hnsw_relopt_kind;
 
+static const struct config_enum_entry hnsw_iterative_scan_options[] = {
+	{"off", HNSW_ITERATIVE_SCAN_OFF, false},
+	{"relaxed_order", HNSW_ITERATIVE_SCAN_RELAXED, false},
+	{NULL, 0, false}
+};
+
 /*
  * Assign a tranche ID for our LWLocks. This only needs to be done by one
  * backend, as the tranche ID is remembered in shared memory.
@@ -48,6 +62,22 @@ HnswInitLockTranche(void)
 	LWLockRegisterTranche(hnsw_lock_tranche_id, "HnswBuild");
 }
 
+/*
+ * Validate the quantization option
+ */
+static void
+HnswQuantizationValidator(const char *value)
+{
+	if (value == NULL)
+		return;
+
+	if (strcmp(value, "none") != 0 && strcmp(value, "int8") != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for \"quantization\" option"),
+				 errdetail("Valid values are \"none\" and \"int8\".")));
+}
+
 /*
  * Initialize index options and variables
  */
@@ -68,6 +98,24 @@ HnswInit(void)
 					  HNSW_DEFAULT_EF_CONSTRUCTION, HNSW_MIN_EF_CONSTRUCTION, HNSW_MAX_EF_CONSTRUCTION
 #if PG_VERSION_NUM >= 130000
 					  ,AccessExclusiveLock
+#endif
+		);
+	add_string_reloption(hnsw_relopt_kind, "quantization", "Quantization for values in the graph",
+						 "none", HnswQuantizationValidator
+#if PG_VERSION_NUM >= 130000
+						 ,AccessExclusiveLock
+#endif
+		);
+	add_bool_reloption(hnsw_relopt_kind, "separate_neighbors", "Store neighbors on separate pages from vectors",
+					   false
+#if PG_VERSION_NUM >= 130000
+					   ,AccessExclusiveLock
+#endif
+		);
+	add_bool_reloption(hnsw_relopt_kind, "fastupdate", "Enables fast update feature for this HNSW index",
+					   false
+#if PG_VERSION_NUM >= 130000
+					   ,AccessExclusiveLock
 #endif
 		);
 
@@ -75,6 +123,38 @@ HnswInit(void)
 							"Valid range is 1..1000.", &hnsw_ef_search,
 							HNSW_DEFAULT_EF_SEARCH, HNSW_MIN_EF_SEARCH, HNSW_MAX_EF_SEARCH, PGC_USERSET, 0, NULL, NULL, NULL);
 
+	DefineCustomEnumVariable("hnsw.iterative_scan", "Sets the mode for iterative scans",
+							 NULL, &hnsw_iterative_scan,
+							 HNSW_ITERATIVE_SCAN_OFF, hnsw_iterative_scan_options, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("hnsw.max_scan_tuples", "Sets the max number of tuples to visit for iterative scans",
+							NULL, &hnsw_max_scan_tuples,
+							HNSW_DEFAULT_MAX_SCAN_TUPLES, HNSW_MIN_MAX_SCAN_TUPLES, HNSW_MAX_MAX_SCAN_TUPLES, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("hnsw.upper_cache_size", "Sets the max memory to cache the upper layers of each index",
+							"Zero disables the cache.", &hnsw_upper_cache_size,
+							HNSW_DEFAULT_UPPER_CACHE_SIZE, 0, HNSW_MAX_UPPER_CACHE_SIZE, PGC_SIGHUP, GUC_UNIT_KB, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("hnsw.build_reorder", "Reorders elements by graph locality when writing pages during builds",
+							 NULL, &hnsw_build_reorder,
+							 true, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("hnsw.max_build_memory", "Sets the max memory for the graph during index builds",
+							"-1 uses maintenance_work_mem.", &hnsw_max_build_memory,
+							-1, -1, MAX_KILOBYTES, PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("hnsw.build_spill", "Uses memory-mapped temporary files when the graph no longer fits into memory during builds",
+							 NULL, &hnsw_build_spill,
+							 false, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("hnsw.build_partitions", "Sets the number of partitions for HNSW index builds",
+							"Zero and one build the graph without partitions.", &hnsw_build_partitions,
+							0, 0, HNSW_MAX_BUILD_PARTITIONS, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("hnsw.pending_list_limit", "Sets the max size of the pending list for HNSW indexes",
+							NULL, &hnsw_pending_list_limit,
+							HNSW_DEFAULT_PENDING_LIST_LIMIT, HNSW_MIN_PENDING_LIST_LIMIT, MAX_KILOBYTES, PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
 	MarkGUCPrefixReserved("hnsw");
 }
 
@@ -123,7 +203,7 @@ hnswcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 	MemSet(&costs, 0, sizeof(costs));
 
 	index = index_open(path->indexinfo->indexoid, NoLock);
-	HnswGetMetaPageInfo(index, &m, NULL);
+	HnswGetMetaPageInfo(index, &m, NULL, NULL);
 	index_close(index, NoLock);
 
 	/* Approximate entry level */
@@ -152,6 +232,9 @@ hnswoptions(Datum reloptions, bool validate)
 	static const relopt_parse_elt tab[] = {
 		{"m", RELOPT_TYPE_INT, offsetof(HnswOptions, m)},
 		{"ef_construction", RELOPT_TYPE_INT, offsetof(HnswOptions, efConstruction)},
+		{"quantization", RELOPT_TYPE_STRING, offsetof(HnswOptions, quantizationOffset)},
+		{"separate_neighbors", RELOPT_TYPE_BOOL, offsetof(HnswOptions, separateNeighbors)},
+		{"fastupdate", RELOPT_TYPE_BOOL, offsetof(HnswOptions, fastupdate)},
 	};
 
 #if PG_VERSION_NUM >= 130000
@@ -194,7 +277,7 @@ hnswhandler(PG_FUNCTION_ARGS)
 	IndexAmRoutine *amroutine = makeNode(IndexAmRoutine);
 
 	amroutine->amstrategies = 0;
-	amroutine->amsupport = 2;
+	amroutine->amsupport = 3;
 #if PG_VERSION_NUM >= 130000
 	amroutine->amoptsprocnum = 0;
 #endif
@@ -209,7 +292,7 @@ hnswhandler(PG_FUNCTION_ARGS)
 	amroutine->amstorage = false;
 	amroutine->amclusterable = false;
 	amroutine->ampredlocks = false;
-	amroutine->amcanparallel = false;
+	amroutine->amcanparallel = true;
 	amroutine->amcaninclude = false;
 #if PG_VERSION_NUM >= 130000
 	amroutine->amusemaintenanceworkmem = false; /* not used during VACUUM */
@@ -241,9 +324,63 @@ hnswhandler(PG_FUNCTION_ARGS)
 	amroutine->amrestrpos = NULL;
 
 	/* Interface functions to support parallel index scans */
-	amroutine->amestimateparallelscan = NULL;
-	amroutine->aminitparallelscan = NULL;
-	amroutine->amparallelrescan = NULL;
+	amroutine->amestimateparallelscan = hnswestimateparallelscan;
+	amroutine->aminitparallelscan = hnswinitparallelscan;
+	amroutine->amparallelrescan = hnswparallelrescan;
 
 	PG_RETURN_POINTER(amroutine);
 }
+
+PGDLLEXPORT Datum halfvec_l2_normalize(PG_FUNCTION_ARGS);
+
+/*
+ * Get a zero half vector
+ */
+static Datum
+HalfvecZeroValue(int dimensions)
+{
+	return PointerGetDatum(InitHalfVector(dimensions));
+}
+
+/*
+ * Get type info for halfvec
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(hnsw_halfvec_support);
+Datum
+hnsw_halfvec_support(PG_FUNCTION_ARGS)
+{
+	static const HnswTypeInfo typeInfo = {
+		/* Elements are half the size, so twice as many fit on a page */
+		.maxDimensions = HNSW_MAX_DIM * 2,
+		.normalize = halfvec_l2_normalize,
+		.zeroValue = HalfvecZeroValue
+	};
+
+	PG_RETURN_POINTER(&typeInfo);
+}
+
+/*
+ * Get a zero bit vector
+ */
+static Datum
+BitZeroValue(int dimensions)
+{
+	return PointerGetDatum(InitBitVector(dimensions));
+}
+
+/*
+ * Get type info for bit
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(hnsw_bit_support);
+Datum
+hnsw_bit_support(PG_FUNCTION_ARGS)
+{
+	static const HnswTypeInfo typeInfo = {
+		/* Elements use one bit per dimension */
+		.maxDimensions = HNSW_MAX_DIM * 32,
+		.normalize = NULL,
+		.zeroValue = BitZeroValue
+	};
+
+	PG_RETURN_POINTER(&typeInfo);
+}
@@ -7,10 +7,14 @@
 #include "access/parallel.h"
 #include "lib/pairingheap.h"
 #include "nodes/execnodes.h"
+#include "port/atomics.h"
 #include "port.h"				/* for random() */
+#include "quantutils.h"
+#include "utils/dsa.h"
 #include "utils/relptr.h"
 #include "utils/sampling.h"
 #include "vector.h"
+#include "vectorutils.h"
 
 #if PG_VERSION_NUM < 120000
 #error "Requires PostgreSQL 12+"
@@ -21,6 +25,7 @@
 /* Support functions */
 #define HNSW_DISTANCE_PROC 1
 #define HNSW_NORM_PROC 2
+#define HNSW_TYPE_INFO_PROC 3
 
 #define HNSW_VERSION	1
 #define HNSW_MAGIC_NUMBER 0xA953A953
@@ -33,6 +38,8 @@
 /* Must correspond to page numbers since page lock is used */
 #define HNSW_UPDATE_LOCK 	0
 #define HNSW_SCAN_LOCK		1
+#define HNSW_CACHE_LOCK		2	/* one backend at a time builds a cache copy */
+#define HNSW_PENDING_LOCK	3	/* prevents appends while merging */
 
 /* HNSW parameters */
 #define HNSW_DEFAULT_M	16
@@ -44,16 +51,61 @@
 #define HNSW_DEFAULT_EF_SEARCH	40
 #define HNSW_MIN_EF_SEARCH		1
 #define HNSW_MAX_EF_SEARCH		1000
+#define HNSW_DEFAULT_MAX_SCAN_TUPLES	20000
+#define HNSW_MIN_MAX_SCAN_TUPLES	1
+#define HNSW_MAX_MAX_SCAN_TUPLES	INT_MAX
+
+/* Parallel scans */
+#define HNSW_PARALLEL_MIN_EF	10	/* min ef for each entry point */
+#define HNSW_PARALLEL_MAX_ENTRIES	16
+#define HNSW_PARALLEL_MAX_VISITED	(1 << 22)
+
+/* Upper layer cache */
+#define HNSW_DEFAULT_UPPER_CACHE_SIZE	(16 * 1024) /* kB */
+#define HNSW_MAX_UPPER_CACHE_SIZE	(1024 * 1024)	/* kB */
+#define HNSW_UPPER_CACHE_SLOTS	8
+#define HNSW_UPPER_VERSIONS	4
+
+/* Pending list */
+#define HNSW_DEFAULT_PENDING_LIST_LIMIT	(4 * 1024)	/* kB */
+#define HNSW_MIN_PENDING_LIST_LIMIT	64	/* kB */
+
+/* Shared graph for parallel builds */
+#define HNSW_MAX_SEGMENTS	32
+#if SIZEOF_SIZE_T >= 8
+#define HNSW_SEGMENT_OFFSET_BITS	40
+#else
+#define HNSW_SEGMENT_OFFSET_BITS	27
+#endif
+#define HNSW_MAX_SEGMENT_SIZE	((Size) 1 << (HNSW_SEGMENT_OFFSET_BITS - 1))
+
+/* Page writing for parallel builds */
+#define HNSW_MAX_PAGE_RANGES	64
+#define HNSW_WRITE_WAITING	0
+#define HNSW_WRITE_READY	1
+#define HNSW_WRITE_DONE		2
+
+/* Partitioned builds */
+#define HNSW_MAX_BUILD_PARTITIONS	1024
+#define HNSW_PARTITION_SAMPLE_BLOCKS	3000
+#define HNSW_PARTITION_SAMPLES	50	/* per partition */
+
+/* Quantization */
+#define HNSW_QUANTIZATION_NONE	0
+#define HNSW_QUANTIZATION_INT8	1
+#define HNSW_QUANTIZATION_SAMPLE_BLOCKS	3000
 
 /* Tuple types */
 #define HNSW_ELEMENT_TUPLE_TYPE  1
 #define HNSW_NEIGHBOR_TUPLE_TYPE 2
+#define HNSW_PENDING_TUPLE_TYPE  3
 
 /* Make graph robust against non-HOT updates */
 #define HNSW_HEAPTIDS 10
 
 #define HNSW_UPDATE_ENTRY_GREATER 1
 #define HNSW_UPDATE_ENTRY_ALWAYS 2
+#define HNSW_UPDATE_UPPER 3
 
 /* Build phases */
 /* PROGRESS_CREATEIDX_SUBPHASE_INITIALIZE is 1 */
@@ -72,9 +124,11 @@
 
 #if PG_VERSION_NUM >= 150000
 #define RandomDouble() pg_prng_double(&pg_global_prng_state)
+#define RandomInt() pg_prng_uint32(&pg_global_prng_state)
 #define SeedRandom(seed) pg_prng_seed(&pg_global_prng_state, seed)
 #else
 #define RandomDouble() (((double) random()) / MAX_RANDOM_VALUE)
+#define RandomInt() random()
 #define SeedRandom(seed) srandom(seed)
 #endif
 
@@ -85,6 +139,7 @@
 
 #define HnswIsElementTuple(tup) ((tup)->type == HNSW_ELEMENT_TUPLE_TYPE)
 #define HnswIsNeighborTuple(tup) ((tup)->type == HNSW_NEIGHBOR_TUPLE_TYPE)
+#define HnswIsPendingTuple(tup) ((tup)->type == HNSW_PENDING_TUPLE_TYPE)
 
 /* 2 * M connections for ground layer */
 #define HnswGetLayerM(m, layer) (layer == 0 ? (m) * 2 : (m))
@@ -102,8 +157,9 @@
 #endif
 
 /* Pointer macros */
-#define HnswPtrAccess(base, hp) ((base) == NULL ? (hp).ptr : relptr_access(base, (hp).relptr))
-#define HnswPtrStore(base, hp, value) ((base) == NULL ? (void) ((hp).ptr = (value)) : (void) relptr_store(base, (hp).relptr, value))
+/* Relative pointers are relative to their segment (see HnswAreaBase) */
+#define HnswPtrAccess(base, hp) ((base) == NULL ? (hp).ptr : relptr_access(HnswAreaBase(base, (hp).relptr.relptr_off), (hp).relptr))
+#define HnswPtrStore(base, hp, value) ((base) == NULL ? (void) ((hp).ptr = (value)) : (void) relptr_store(HnswAreaStoreBase(base, value), (hp).relptr, value))
 #define HnswPtrIsNull(base, hp) ((base) == NULL ? (hp).ptr == NULL : relptr_is_null((hp).relptr))
 #define HnswPtrEqual(base, hp1, hp2) ((base) == NULL ? (hp1).ptr == (hp2).ptr : relptr_offset((hp1).relptr) == relptr_offset((hp2).relptr))
 
@@ -113,8 +169,22 @@
 
 /* Variables */
 extern int	hnsw_ef_search;
+extern int	hnsw_iterative_scan;
+extern int	hnsw_max_scan_tuples;
+extern int	hnsw_upper_cache_size;
+extern bool hnsw_build_reorder;
+extern int	hnsw_max_build_memory;
+extern bool hnsw_build_spill;
+extern int	hnsw_build_partitions;
+extern int	hnsw_pending_list_limit;
 extern int	hnsw_lock_tranche_id;
 
+typedef enum HnswIterativeScanMode
+{
+	HNSW_ITERATIVE_SCAN_OFF,
+	HNSW_ITERATIVE_SCAN_RELAXED
+}			HnswIterativeScanMode;
+
 typedef struct HnswElementData HnswElementData;
 typedef struct HnswNeighborArray HnswNeighborArray;
 
@@ -137,13 +207,14 @@ typedef struct HnswElementData
 	uint8		level;
 	uint8		deleted;
 	uint32		hash;
+	uint32		visited;		/* epoch of last search in non-parallel builds */
 	HnswNeighborsPtr neighbors;
 	BlockNumber blkno;
 	OffsetNumber offno;
 	OffsetNumber neighborOffno;
 	BlockNumber neighborPage;
 	DatumPtr	value;
-	LWLock		lock;
+	pg_atomic_uint32 version;	/* odd while neighbors are being updated */
 }			HnswElementData;
 
 typedef HnswElementData * HnswElement;
@@ -168,12 +239,46 @@ typedef struct HnswPairingHeapNode
 	HnswCandidate *inner;
 }			HnswPairingHeapNode;
 
+/* Type-specific behavior, returned by the optional TYPE_INFO_PROC */
+typedef struct HnswTypeInfo
+{
+	int			maxDimensions;
+	PGFunction	normalize;
+	Datum		(*zeroValue) (int dimensions);
+}			HnswTypeInfo;
+
+/* Support functions */
+typedef struct HnswSupport
+{
+	FmgrInfo   *procinfo;
+	FmgrInfo   *normprocinfo;
+	Oid			collation;
+	VectorDistanceFunc distfunc;	/* kernel for procinfo if available */
+	const HnswTypeInfo *typeInfo;
+
+	/* Quantization (values in the graph are quantized if not none) */
+	int			quantization;
+	float		scale;
+	float		offset;
+}			HnswSupport;
+
+/* Quantization cached in rd_amcache */
+typedef struct HnswQuantizationCache
+{
+	int			quantization;
+	float		scale;
+	float		offset;
+}			HnswQuantizationCache;
+
 /* HNSW index options */
 typedef struct HnswOptions
 {
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
 	int			m;				/* number of connections */
 	int			efConstruction; /* size of dynamic candidate list */
+	int			quantizationOffset; /* offset to quantization string */
+	bool		separateNeighbors;	/* store neighbors on separate pages */
+	bool		fastupdate;		/* add inserts to pending list */
 }			HnswOptions;
 
 typedef struct HnswGraph
@@ -188,24 +293,73 @@ typedef struct HnswGraph
 	HnswElementPtr entryPoint;
 
 	/* Allocations state */
-	LWLock		allocatorLock;
+	pg_atomic_uint64 nextChunk;
 	long		memoryUsed;
 	long		memoryTotal;
 
+	/* Segments state for parallel builds */
+	LWLock		segmentLock;
+	int			nsegments;
+	dsa_pointer segments[HNSW_MAX_SEGMENTS];
+	Size		segmentSizes[HNSW_MAX_SEGMENTS];
+
 	/* Flushed state */
 	LWLock		flushLock;
 	bool		flushed;
 }			HnswGraph;
 
+/* Backend-local mappings of the shared graph segments */
+typedef struct HnswAreaData
+{
+	dsa_area   *dsa;
+	HnswGraph  *graph;
+	int			nsegments;
+	int			lastSegment;
+	char	   *segments[HNSW_MAX_SEGMENTS];
+	Size		segmentSizes[HNSW_MAX_SEGMENTS];
+}			HnswAreaData;
+
+typedef HnswAreaData * HnswArea;
+
+/* Memory-mapped temporary files for the graph in non-parallel builds */
+typedef struct HnswSpillData
+{
+	MemoryContextCallback callback;
+	int			nsegments;
+	Size		total;
+	char	   *segments[HNSW_MAX_SEGMENTS];
+	Size		segmentSizes[HNSW_MAX_SEGMENTS];
+}			HnswSpillData;
+
+typedef HnswSpillData * HnswSpill;
+
+/*
+ * Contiguous pages for a run of elements in the graph
+ */
+typedef struct HnswPageRange
+{
+	HnswElementPtr start;		/* first element */
+	Size		count;			/* number of elements */
+	BlockNumber startPage;
+	BlockNumber endPage;		/* inclusive */
+	bool		neighbors;		/* only neighbor tuples */
+}			HnswPageRange;
+
 typedef struct HnswShared
 {
 	/* Immutable state */
 	Oid			heaprelid;
 	Oid			indexrelid;
 	bool		isconcurrent;
+	float		quantizationScale;
+	float		quantizationOffset;
+	int			npartitions;
+	int			partition;
+	BlockNumber partitionStart;
 
 	/* Worker progress */
 	ConditionVariable workersdonecv;
+	ConditionVariable pagescv;
 
 	/* Mutex for mutable state */
 	slock_t		mutex;
@@ -214,6 +368,15 @@ typedef struct HnswShared
 	int			nparticipantsdone;
 	double		reltuples;
 	HnswGraph	graphData;
+
+	/* Pages written by all participants after the graph is built */
+	int			writeState;
+	bool		logPages;
+	BlockNumber lastPage;
+	int			nranges;
+	int			nextRange;
+	int			nrangesdone;
+	HnswPageRange ranges[HNSW_MAX_PAGE_RANGES];
 }			HnswShared;
 
 #define ParallelTableScanFromHnswShared(shared) \
@@ -246,32 +409,45 @@ typedef struct HnswBuildState
 	int			dimensions;
 	int			m;
 	int			efConstruction;
+	bool		separateNeighbors;
+	bool		logPages;		/* WAL-log graph pages as they are written */
 
 	/* Statistics */
 	double		indtuples;
 	double		reltuples;
 
 	/* Support functions */
-	FmgrInfo   *procinfo;
-	FmgrInfo   *normprocinfo;
-	Oid			collation;
+	HnswSupport support;
+
+	/* Quantization sample */
+	float		sampleMin;
+	float		sampleMax;
 
 	/* Variables */
 	HnswGraph	graphData;
 	HnswGraph  *graph;
 	double		ml;
 	int			maxLevel;
-	Vector	   *normvec;
 
 	/* Memory */
 	MemoryContext graphCtx;
 	MemoryContext tmpCtx;
 	HnswAllocator allocator;
+	HnswSpill	spill;
+
+	/* Partitions */
+	int			npartitions;
+	int			partition;
+	Datum	   *centers;
+	BlockNumber partitionStart; /* first page of the current partition */
+	BlockNumber *partitionStarts;	/* only set in the leader */
 
 	/* Parallel builds */
 	HnswLeader *hnswleader;
 	HnswShared *hnswshared;
 	char	   *hnswarea;
+	char	   *chunk;
+	Size		chunkFree;
 }			HnswBuildState;
 
 typedef struct HnswMetaPageData
@@ -285,6 +461,15 @@ typedef struct HnswMetaPageData
 	OffsetNumber entryOffno;
 	int16		entryLevel;
 	BlockNumber insertPage;
+	uint16		quantization;	/* zero for indexes created before it existed */
+	uint16		unused;
+	float		quantizationScale;
+	float		quantizationOffset;
+	uint32		upperVersions[HNSW_UPPER_VERSIONS]; /* changes to layers 1+, 2+, ... */
+	BlockNumber pendingHead;	/* zero or invalid if no pending list */
+	BlockNumber pendingTail;
+	uint32		pendingPages;	/* from head to tail */
+	uint32		pendingTuples;
 }			HnswMetaPageData;
 
 typedef HnswMetaPageData * HnswMetaPage;
@@ -322,6 +507,85 @@ typedef struct HnswNeighborTupleData
 
 typedef HnswNeighborTupleData * HnswNeighborTuple;
 
+/*
+ * Shared state for parallel index scans
+ *
+ * The visited set is an open addressing table of index TIDs, so each element
+ * is visited and returned by only one participant
+ */
+typedef struct HnswParallelScanData
+{
+	pg_atomic_uint32 nextEntry;
+	pg_atomic_uint32 pendingClaimed;	/* pending list is returned once */
+	uint32		visitedSize;	/* power of two */
+	pg_atomic_uint64 visited[FLEXIBLE_ARRAY_MEMBER];
+}			HnswParallelScanData;
+
+typedef HnswParallelScanData * HnswParallelScan;
+
+/* Hash tables */
+typedef struct TidHashEntry
+{
+	ItemPointerData tid;
+	char		status;
+}			TidHashEntry;
+
+#define SH_PREFIX tidhash
+#define SH_ELEMENT_TYPE TidHashEntry
+#define SH_KEY_TYPE ItemPointerData
+#define SH_SCOPE extern
+#define SH_DECLARE
+#include "lib/simplehash.h"
+
+typedef struct OffsetHashEntry
+{
+	Size		offset;
+	char		status;
+}			OffsetHashEntry;
+
+#define SH_PREFIX offsethash
+#define SH_ELEMENT_TYPE OffsetHashEntry
+#define SH_KEY_TYPE Size
+#define SH_SCOPE extern
+#define SH_DECLARE
+#include "lib/simplehash.h"
+
+/*
+ * Visited set for searches on disk
+ *
+ * An open addressing table of index TIDs. Slots from earlier searches are
+ * treated as empty, so the table is reused by starting a new epoch.
+ */
+typedef struct HnswVisitedSlot
+{
+	uint64		key;
+	uint32		epoch;
+}			HnswVisitedSlot;
+
+typedef struct HnswVisitedTable
+{
+	MemoryContext ctx;
+	HnswVisitedSlot *slots;
+	uint32		size;			/* power of two */
+	uint32		count;
+	uint32		epoch;
+}			HnswVisitedTable;
+
+typedef struct
+{
+	HnswVisitedTable *table;	/* on disk */
+	offsethash_hash *offsets;	/* parallel in-memory builds */
+	uint32		epoch;			/* in-memory builds, compared to each element */
+	HnswParallelScan shared;	/* used instead of table when set */
+}			visited_hash;
+
+/* Heap TID with the distance to its heap value, for re-ranking */
+typedef struct HnswRerankItem
+{
+	ItemPointerData heaptid;
+	double		distance;
+}			HnswRerankItem;
+
 typedef struct HnswScanOpaqueData
 {
 	bool		first;
@@ -329,9 +593,27 @@ typedef struct HnswScanOpaqueData
 	MemoryContext tmpCtx;
 
 	/* Support functions */
-	FmgrInfo   *procinfo;
-	FmgrInfo   *normprocinfo;
-	Oid			collation;
+	HnswSupport support;
+
+	/* Re-ranking for quantized indexes */
+	IndexInfo  *indexInfo;
+	EState	   *estate;
+	struct IndexFetchTableData *fetch;
+	TupleTableSlot *slot;
+	HnswRerankItem *rerankItems;
+	int			rerankLength;
+	int			rerankPos;
+
+	/* Iterative scans */
+	Datum		value;
+	Datum		q;
+	visited_hash v;
+	pairingheap *discarded;
+	int64		tuples;
+	int			m;
+
+	/* Heap TIDs in the pending list */
+	struct tidhash_hash *pendingTids;
 }			HnswScanOpaqueData;
 
 typedef HnswScanOpaqueData * HnswScanOpaque;
@@ -349,8 +631,7 @@ typedef struct HnswVacuumState
 	int			efConstruction;
 
 	/* Support functions */
-	FmgrInfo   *procinfo;
-	Oid			collation;
+	HnswSupport support;
 
 	/* Variables */
 	struct tidhash_hash *deleted;
@@ -365,31 +646,50 @@ typedef struct HnswVacuumState
 /* Methods */
 int			HnswGetM(Relation index);
 int			HnswGetEfConstruction(Relation index);
+int			HnswGetQuantization(Relation index);
+bool		HnswGetSeparateNeighbors(Relation index);
+bool		HnswGetFastUpdate(Relation index);
 FmgrInfo   *HnswOptionalProcInfo(Relation index, uint16 procnum);
-bool		HnswNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result);
+void		HnswInitSupport(HnswSupport * support, Relation index);
+const HnswTypeInfo *HnswGetTypeInfo(Relation index);
+bool		HnswNormValue(HnswSupport * support, Datum *value);
+void		HnswInitQuantization(HnswSupport * support, Relation index);
+void		HnswSetQuantizationScale(HnswSupport * support, float min, float max);
+void		HnswInitQuantizationRange(HnswSupport * support, Relation index, Datum value);
+Datum		HnswQuantizeValue(HnswSupport * support, Datum value);
 Buffer		HnswNewBuffer(Relation index, ForkNumber forkNum);
 void		HnswInitPage(Buffer buf, Page page);
 void		HnswInit(void);
-List	   *HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, FmgrInfo *procinfo, Oid collation, int m, bool inserting, HnswElement skipElement);
+bool		HnswParallelVisit(HnswParallelScan pscan, BlockNumber blkno, OffsetNumber offno);
+HnswVisitedTable *HnswCreateVisitedTable(MemoryContext ctx);
+List	   *HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, HnswSupport * support, int m, bool inserting, HnswElement skipElement, visited_hash * v, pairingheap **discarded, bool initVisited, int64 *tuples);
 HnswElement HnswGetEntryPoint(Relation index);
-void		HnswGetMetaPageInfo(Relation index, int *m, HnswElement * entryPoint);
+void		HnswGetMetaPageInfo(Relation index, int *m, HnswElement * entryPoint, uint32 *upperVersions);
 void	   *HnswAlloc(HnswAllocator * allocator, Size size);
 HnswElement HnswInitElement(char *base, ItemPointer tid, int m, double ml, int maxLevel, HnswAllocator * alloc);
 HnswElement HnswInitElementFromBlock(BlockNumber blkno, OffsetNumber offno);
-void		HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint, Relation index, FmgrInfo *procinfo, Oid collation, int m, int efConstruction, bool existing);
-HnswCandidate *HnswEntryCandidate(char *base, HnswElement em, Datum q, Relation rel, FmgrInfo *procinfo, Oid collation, bool loadVec);
+void		HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint, Relation index, HnswSupport * support, int m, int efConstruction, bool existing);
+HnswCandidate *HnswEntryCandidate(char *base, HnswElement em, Datum q, Relation rel, HnswSupport * support, bool loadVec);
 void		HnswUpdateMetaPage(Relation index, int updateEntry, HnswElement entryPoint, BlockNumber insertPage, ForkNumber forkNum, bool building);
 void		HnswSetNeighborTuple(char *base, HnswNeighborTuple ntup, HnswElement e, int m);
 void		HnswAddHeapTid(HnswElement element, ItemPointer heaptid);
 void		HnswInitNeighbors(char *base, HnswElement element, int m, HnswAllocator * alloc);
-bool		HnswInsertTupleOnDisk(Relation index, Datum value, Datum *values, bool *isnull, ItemPointer heap_tid, bool building);
-void		HnswUpdateNeighborsOnDisk(Relation index, FmgrInfo *procinfo, Oid collation, HnswElement e, int m, bool checkExisting, bool building);
+bool		HnswInsertTupleOnDisk(Relation index, HnswSupport * support, Datum value, Datum *values, bool *isnull, ItemPointer heap_tid, bool building);
+void		HnswUpdateNeighborsOnDisk(Relation index, HnswSupport * support, HnswElement e, int m, bool checkExisting, bool building);
 void		HnswLoadElementFromTuple(HnswElement element, HnswElementTuple etup, bool loadHeaptids, bool loadVec);
-void		HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index, FmgrInfo *procinfo, Oid collation, bool loadVec);
+void		HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index, HnswSupport * support, bool loadVec);
 void		HnswSetElementTuple(char *base, HnswElementTuple etup, HnswElement element);
-void		HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm, int lc, int *updateIdx, Relation index, FmgrInfo *procinfo, Oid collation);
+void		HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm, int lc, int *updateIdx, Relation index, HnswSupport * support);
 void		HnswLoadNeighbors(HnswElement element, Relation index, int m);
 void		HnswInitLockTranche(void);
+double		HnswDistance(HnswSupport * support, Datum a, Datum b);
+void		HnswSetMetaPageLower(Page page);
+bool		HnswInsertPending(Relation index, Datum value, ItemPointer heaptid);
+int64		HnswMergePending(Relation index, bool wait);
+List	   *HnswGetPendingItems(Relation index, HnswSupport * support, Datum q);
+HnswElement HnswCacheSearch(Relation index, HnswSupport * support, Datum q, HnswElement entryPoint, uint32 *upperVersions, int m, int minLevel, int *level);
+char	   *HnswAreaMapSegment(HnswArea area, int segno);
+int			HnswAreaFindSegment(HnswArea area, void *ptr);
 PGDLLEXPORT void HnswParallelBuildMain(dsm_segment *seg, shm_toc *toc);
 
 /* Index access methods */
@@ -407,55 +707,65 @@ IndexScanDesc hnswbeginscan(Relation index, int nkeys, int norderbys);
 void		hnswrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys);
 bool		hnswgettuple(IndexScanDesc scan, ScanDirection dir);
 void		hnswendscan(IndexScanDesc scan);
-
-static inline HnswNeighborArray *
-HnswGetNeighbors(char *base, HnswElement element, int lc)
+#if PG_VERSION_NUM >= 180000
+Size		hnswestimateparallelscan(Relation index, int nkeys, int norderbys);
+#elif PG_VERSION_NUM >= 170000
+Size		hnswestimateparallelscan(int nkeys, int norderbys);
+#else
+Size		hnswestimateparallelscan(void);
+#endif
+void		hnswinitparallelscan(void *target);
+void		hnswparallelrescan(IndexScanDesc scan);
+
+/*
+ * Get the base for a relative pointer in a parallel build
+ *
+ * The shared graph is made of segments that can be mapped at different
+ * addresses in each process, so relative pointers store the segment number
+ * in the high bits and the offset within the segment in the low bits.
+ * Segments are at most half the offset range, so the segment number is not
+ * affected by how relptr.h encodes offsets.
+ */
+static inline char *
+HnswAreaBase(char *base, Size relptrOff)
 {
-	HnswNeighborArrayPtr *neighborList = HnswPtrAccess(base, element->neighbors);
+	HnswArea	area = (HnswArea) base;
+	int			segno = relptrOff >> HNSW_SEGMENT_OFFSET_BITS;
+	char	   *segment = area->segments[segno];
 
-	Assert(element->level >= lc);
+	if (unlikely(segment == NULL))
+		segment = HnswAreaMapSegment(area, segno);
 
-	return HnswPtrAccess(base, neighborList[lc]);
+	return segment - ((Size) segno << HNSW_SEGMENT_OFFSET_BITS);
 }
 
-/* Hash tables */
-typedef struct TidHashEntry
+/*
+ * Get the base for storing a relative pointer in a parallel build
+ */
+static inline char *
+HnswAreaStoreBase(char *base, void *ptr)
 {
-	ItemPointerData tid;
-	char		status;
-}			TidHashEntry;
+	HnswArea	area = (HnswArea) base;
+	int			segno = area->lastSegment;
 
-#define SH_PREFIX tidhash
-#define SH_ELEMENT_TYPE TidHashEntry
-#define SH_KEY_TYPE ItemPointerData
-#define SH_SCOPE extern
-#define SH_DECLARE
-#include "lib/simplehash.h"
+	if (ptr == NULL)
+		return base;
 
-typedef struct PointerHashEntry
-{
-	uintptr_t	ptr;
-	char		status;
-}			PointerHashEntry;
+	/* Most pointers are to the segment of the previous one */
+	if ((char *) ptr < area->segments[segno] || (char *) ptr >= area->segments[segno] + area->segmentSizes[segno])
+		segno = HnswAreaFindSegment(area, ptr);
 
-#define SH_PREFIX pointerhash
-#define SH_ELEMENT_TYPE PointerHashEntry
-#define SH_KEY_TYPE uintptr_t
-#define SH_SCOPE extern
-#define SH_DECLARE
-#include "lib/simplehash.h"
+	return area->segments[segno] - ((Size) segno << HNSW_SEGMENT_OFFSET_BITS);
+}
 
-typedef struct OffsetHashEntry
+static inline HnswNeighborArray *
+HnswGetNeighbors(char *base, HnswElement element, int lc)
 {
-	Size		offset;
-	char		status;
-}			OffsetHashEntry;
+	HnswNeighborArrayPtr *neighborList = HnswPtrAccess(base, element->neighbors);
 
-#define SH_PREFIX offsethash
-#define SH_ELEMENT_TYPE OffsetHashEntry
-#define SH_KEY_TYPE Size
-#define SH_SCOPE extern
-#define SH_DECLARE
-#include "lib/simplehash.h"
+	Assert(element->level >= lc);
+
+	return HnswPtrAccess(base, neighborList[lc]);
+}
 
 #endif
@@ -5,24 +5,31 @@
  *
  * In this first phase, the graph is held completely in memory. When the graph
  * is fully built, or we run out of memory reserved for the build (determined
- * by maintenance_work_mem), we materialize the graph to disk (see
- * FlushPages()), and switch to the on-disk phase.
+ * by hnsw.max_build_memory or maintenance_work_mem), we materialize the graph
+ * to disk (see FlushPages()), and switch to the on-disk phase.
  *
- * In a parallel build, a large contiguous chunk of shared memory is allocated
- * to hold the graph. Each worker process has its own HnswBuildState struct in
- * private memory, which contains information that doesn't change throughout
- * the build, and pointers to the shared structs in shared memory. The shared
- * memory area is mapped to a different address in each worker process, and
- * 'HnswBuildState.hnswarea' points to the beginning of the shared area in the
- * worker process's address space. All pointers used in the graph are
- * "relative pointers", stored as an offset from 'hnswarea'.
+ * In a parallel build, the graph is held in a DSA area that grows in segments
+ * as needed, with each segment twice the size of the previous one. Each worker
+ * process has its own HnswBuildState struct in private memory, which contains
+ * information that doesn't change throughout the build, and pointers to the
+ * shared structs in shared memory. Segments are mapped to different addresses
+ * in each worker process, and 'HnswBuildState.hnswarea' points to the
+ * process's HnswArea, which tracks the mappings. All pointers used in the
+ * graph are "relative pointers", stored as a segment number and an offset
+ * within the segment (see HnswAreaBase()). Each worker reserves chunks of the
+ * current segment with an atomic counter and allocates elements from its own
+ * chunk.
  *
- * Each element is protected by an LWLock. It must be held when reading or
- * modifying the element's neighbors or 'heaptids'.
+ * Each element has a version that is odd while its neighbors or 'heaptids'
+ * are being modified. Writers take it like a spinlock, and readers copy the
+ * neighbors without locking and retry if the version changed.
  *
  * In a non-parallel build, the graph is held in backend-private memory. All
  * the elements are allocated in a dedicated memory context, 'graphCtx', and
- * the pointers used in the graph are regular pointers.
+ * the pointers used in the graph are regular pointers. If hnsw.build_spill is
+ * enabled, elements that no longer fit are allocated from memory-mapped
+ * temporary files instead, so the in-memory phase can continue with the OS
+ * page cache holding the graph.
  *
  * 2. On-disk phase
  *
@@ -31,26 +38,52 @@
  * WAL-log the individual inserts. If the graph fit completely in memory and
  * was fully built in the in-memory phase, the on-disk phase is skipped.
  *
- * After we have finished building the graph, we perform one more scan through
- * the index and write all the pages to the WAL.
+ * Graph pages are assembled in local memory and written sequentially, without
+ * going through shared buffers (see CreateGraphPages()). In a parallel build,
+ * the pages are split into ranges that are written by the leader and workers
+ * concurrently once the graph is fully built. If the graph was fully built in
+ * memory, the pages are WAL-logged as they are written. Otherwise, after we
+ * have finished building the graph, we perform one more scan through the index
+ * and write all the pages to the WAL.
+ *
+ * Partitioned builds
+ *
+ * If hnsw.build_partitions is set, centers are chosen from a sample of rows,
+ * and each row belongs to the partition of its nearest center. The phases
+ * above run once per partition, each with its own graph (and workers in a
+ * parallel build), and pages of later partitions are appended to the index.
+ * Finally, the upper layers of later partitions are linked to the rest of the
+ * graph on disk (see StitchPartitions()), which also links their layer 0 to
+ * nearby partitions. The page chain of each partition is linked to the end of
+ * the previous one, so inserts and vacuum see all pages.
  */
 #include "postgres.h"
 
+#include <float.h>
 #include <math.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "access/parallel.h"
 #include "access/table.h"
 #include "access/tableam.h"
 #include "access/xact.h"
 #include "access/xloginsert.h"
+#include "bulkwrite.h"
 #include "catalog/index.h"
 #include "commands/progress.h"
 #include "hnsw.h"
 #include "miscadmin.h"
 #include "optimizer/optimizer.h"
 #include "storage/bufmgr.h"
+#include "storage/fd.h"
 #include "tcop/tcopprot.h"
 #include "utils/datum.h"
+#include "utils/guc.h"
 #include "utils/memutils.h"
 
 #if PG_VERSION_NUM >= 140000
@@ -73,11 +106,39 @@
 #define PARALLEL_KEY_HNSW_SHARED		UINT64CONST(0xA000000000000001)
 #define PARALLEL_KEY_HNSW_AREA			UINT64CONST(0xA000000000000002)
 #define PARALLEL_KEY_QUERY_TEXT			UINT64CONST(0xA000000000000003)
+#define PARALLEL_KEY_HNSW_CENTERS		UINT64CONST(0xA000000000000004)
+
+#define HNSW_BUILD_CHUNK_SIZE			(64 * 1024)
+#define HNSW_INITIAL_SEGMENT_SIZE		(8 * 1024 * 1024)
 
 #if PG_VERSION_NUM < 130000
 #define GENERATIONCHUNK_RAWSIZE (SIZEOF_SIZE_T + SIZEOF_VOID_P * 2)
 #endif
 
+typedef struct HnswCenterSample
+{
+	HnswBuildState *buildstate;
+	Datum	   *values;
+	int			count;
+	int			max;
+	double		seen;
+}			HnswCenterSample;
+
+typedef struct HnswPageLayout
+{
+	BlockNumber blkno;
+	OffsetNumber maxoffno;
+	Size		lower;
+	Size		upper;
+}			HnswPageLayout;
+
+typedef struct HnswStitchElement
+{
+	BlockNumber blkno;
+	OffsetNumber offno;
+	uint8		level;
+}			HnswStitchElement;
+
 /*
  * Create the metapage
  */
@@ -105,6 +166,16 @@ CreateMetaPage(HnswBuildState * buildstate)
 	metap->entryOffno = InvalidOffsetNumber;
 	metap->entryLevel = -1;
 	metap->insertPage = InvalidBlockNumber;
+	metap->quantization = buildstate->support.quantization;
+	metap->unused = 0;
+	metap->quantizationScale = buildstate->support.scale;
+	metap->quantizationOffset = buildstate->support.offset;
+	for (int i = 0; i < HNSW_UPPER_VERSIONS; i++)
+		metap->upperVersions[i] = 0;
+	metap->pendingHead = InvalidBlockNumber;
+	metap->pendingTail = InvalidBlockNumber;
+	metap->pendingPages = 0;
+	metap->pendingTuples = 0;
 	((PageHeader) page)->pd_lower =
 		((char *) metap + sizeof(HnswMetaPageData)) - (char *) page;
 
@@ -113,62 +184,112 @@ CreateMetaPage(HnswBuildState * buildstate)
 }
 
 /*
- * Add a new page
+ * Start the layout of a page
  */
 static void
-HnswBuildAppendPage(Relation index, Buffer *buf, Page *page, ForkNumber forkNum)
+InitPageLayout(HnswPageLayout * layout, BlockNumber blkno)
 {
-	/* Add a new page */
-	Buffer		newbuf = HnswNewBuffer(index, forkNum);
+	layout->blkno = blkno;
+	layout->maxoffno = InvalidOffsetNumber;
+	layout->lower = SizeOfPageHeaderData;
+	layout->upper = BLCKSZ - MAXALIGN(sizeof(HnswPageOpaqueData));
+}
 
-	/* Update previous page */
-	HnswPageGetOpaque(*page)->nextblkno = BufferGetBlockNumber(newbuf);
+/*
+ * Get the free space of a page, like PageGetFreeSpace
+ */
+static Size
+PageLayoutFreeSpace(HnswPageLayout * layout)
+{
+	Size		space = layout->upper - layout->lower;
 
-	/* Commit */
-	MarkBufferDirty(*buf);
-	UnlockReleaseBuffer(*buf);
+	if (space < sizeof(ItemIdData))
+		return 0;
+
+	return space - sizeof(ItemIdData);
+}
 
-	/* Can take a while, so ensure we can interrupt */
-	/* Needs to be called when no buffer locks are held */
-	LockBuffer(newbuf, BUFFER_LOCK_UNLOCK);
-	CHECK_FOR_INTERRUPTS();
-	LockBuffer(newbuf, BUFFER_LOCK_EXCLUSIVE);
+/*
+ * Add an item to a page, like PageAddItem
+ */
+static OffsetNumber
+PageLayoutAddItem(HnswPageLayout * layout, Size size)
+{
+	Assert(MAXALIGN(size) + sizeof(ItemIdData) <= layout->upper - layout->lower);
 
-	/* Prepare new page */
-	*buf = newbuf;
-	*page = BufferGetPage(*buf);
-	HnswInitPage(*buf, *page);
+	layout->lower += sizeof(ItemIdData);
+	layout->upper -= MAXALIGN(size);
+	layout->maxoffno = OffsetNumberNext(layout->maxoffno);
+	return layout->maxoffno;
 }
 
 /*
- * Create graph pages
+ * Add an element to the current range of pages, or start a new range
+ *
+ * New ranges start on a new page once the current range has enough elements
  */
 static void
-CreateGraphPages(HnswBuildState * buildstate)
+AddToPageRange(char *base, HnswPageRange * ranges, int *nranges, int maxRanges, Size perRange, HnswElement element, HnswPageLayout * layout, bool neighbors)
 {
-	Relation	index = buildstate->index;
-	ForkNumber	forkNum = buildstate->forkNum;
-	Size		maxSize;
-	HnswElementTuple etup;
-	HnswNeighborTuple ntup;
-	BlockNumber insertPage;
-	HnswElement entryPoint;
-	Buffer		buf;
-	Page		page;
+	HnswPageRange *range = *nranges > 0 ? &ranges[*nranges - 1] : NULL;
+
+	if (range == NULL || range->neighbors != neighbors || (layout->maxoffno == InvalidOffsetNumber && range->count >= perRange && *nranges < maxRanges))
+	{
+		range = &ranges[(*nranges)++];
+		HnswPtrStore(base, range->start, element);
+		range->count = 0;
+		range->startPage = layout->blkno;
+		range->endPage = InvalidBlockNumber;
+		range->neighbors = neighbors;
+	}
+
+	range->count++;
+}
+
+/*
+ * Assign locations to elements and neighbors
+ *
+ * Elements are also split into ranges of contiguous pages that can be written
+ * independently, with up to rangesPerRegion ranges for neighbors on their own
+ * pages and for elements. Returns the number of ranges.
+ */
+static int
+AssignLocations(HnswBuildState * buildstate, BlockNumber blkno, HnswPageRange * ranges, int rangesPerRegion, Size perRange)
+{
+	Size		maxSize = HNSW_MAX_SIZE;
 	HnswElementPtr iter = buildstate->graph->head;
 	char	   *base = buildstate->hnswarea;
+	HnswPageLayout layout;
+	int			nranges = 0;
+	int			maxRanges = rangesPerRegion;
 
-	/* Calculate sizes */
-	maxSize = HNSW_MAX_SIZE;
+	InitPageLayout(&layout, blkno);
 
-	/* Allocate once */
-	etup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
-	ntup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+	/* Add neighbors first, so elements can reference them */
+	if (buildstate->separateNeighbors && !HnswPtrIsNull(base, iter))
+	{
+		while (!HnswPtrIsNull(base, iter))
+		{
+			HnswElement element = HnswPtrAccess(base, iter);
+			Size		ntupSize = HNSW_NEIGHBOR_TUPLE_SIZE(element->level, buildstate->m);
 
-	/* Prepare first page */
-	buf = HnswNewBuffer(index, forkNum);
-	page = BufferGetPage(buf);
-	HnswInitPage(buf, page);
+			/* Update iterator */
+			iter = element->next;
+
+			if (PageLayoutFreeSpace(&layout) < ntupSize)
+				InitPageLayout(&layout, layout.blkno + 1);
+
+			AddToPageRange(base, ranges, &nranges, maxRanges, perRange, element, &layout, true);
+
+			element->neighborPage = layout.blkno;
+			element->neighborOffno = PageLayoutAddItem(&layout, ntupSize);
+		}
+
+		/* Start elements on a new page */
+		InitPageLayout(&layout, layout.blkno + 1);
+		iter = buildstate->graph->head;
+		maxRanges = nranges + rangesPerRegion;
+	}
 
 	while (!HnswPtrIsNull(base, iter))
 	{
@@ -181,9 +302,6 @@ CreateGraphPages(HnswBuildState * buildstate)
 		/* Update iterator */
 		iter = element->next;
 
-		/* Zero memory for each element */
-		MemSet(etup, 0, HNSW_TUPLE_ALLOC_SIZE);
-
 		/* Calculate sizes */
 		etupSize = HNSW_ELEMENT_TUPLE_SIZE(VARSIZE_ANY(valuePtr));
 		ntupSize = HNSW_NEIGHBOR_TUPLE_SIZE(element->level, buildstate->m);
@@ -193,227 +311,608 @@ CreateGraphPages(HnswBuildState * buildstate)
 		if (etupSize > HNSW_TUPLE_ALLOC_SIZE)
 			elog(ERROR, "index tuple too large");
 
-		HnswSetElementTuple(base, etup, element);
+		if (buildstate->separateNeighbors)
+		{
+			if (PageLayoutFreeSpace(&layout) < etupSize)
+				InitPageLayout(&layout, layout.blkno + 1);
 
-		/* Keep element and neighbors on the same page if possible */
-		if (PageGetFreeSpace(page) < etupSize || (combinedSize <= maxSize && PageGetFreeSpace(page) < combinedSize))
-			HnswBuildAppendPage(index, &buf, &page, forkNum);
+			AddToPageRange(base, ranges, &nranges, maxRanges, perRange, element, &layout, false);
 
-		/* Calculate offsets */
-		element->blkno = BufferGetBlockNumber(buf);
-		element->offno = OffsetNumberNext(PageGetMaxOffsetNumber(page));
-		if (combinedSize <= maxSize)
-		{
-			element->neighborPage = element->blkno;
-			element->neighborOffno = OffsetNumberNext(element->offno);
-		}
-		else
-		{
-			element->neighborPage = element->blkno + 1;
-			element->neighborOffno = FirstOffsetNumber;
+			element->blkno = layout.blkno;
+			element->offno = PageLayoutAddItem(&layout, etupSize);
+			continue;
 		}
 
-		ItemPointerSet(&etup->neighbortid, element->neighborPage, element->neighborOffno);
+		/* Keep element and neighbors on the same page if possible */
+		if (PageLayoutFreeSpace(&layout) < etupSize || (combinedSize <= maxSize && PageLayoutFreeSpace(&layout) < combinedSize))
+			InitPageLayout(&layout, layout.blkno + 1);
+
+		AddToPageRange(base, ranges, &nranges, maxRanges, perRange, element, &layout, false);
 
-		/* Add element */
-		if (PageAddItem(page, (Item) etup, etupSize, InvalidOffsetNumber, false, false) != element->offno)
-			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+		element->blkno = layout.blkno;
+		element->offno = PageLayoutAddItem(&layout, etupSize);
 
 		/* Add new page if needed */
-		if (PageGetFreeSpace(page) < ntupSize)
-			HnswBuildAppendPage(index, &buf, &page, forkNum);
+		if (PageLayoutFreeSpace(&layout) < ntupSize)
+			InitPageLayout(&layout, layout.blkno + 1);
 
-		/* Add placeholder for neighbors */
-		if (PageAddItem(page, (Item) ntup, ntupSize, InvalidOffsetNumber, false, false) != element->neighborOffno)
-			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+		element->neighborPage = layout.blkno;
+		element->neighborOffno = PageLayoutAddItem(&layout, ntupSize);
 	}
 
-	insertPage = BufferGetBlockNumber(buf);
+	/* Empty graph still has a page */
+	if (nranges == 0)
+	{
+		HnswPtrStore(base, ranges[0].start, (HnswElement) NULL);
+		ranges[0].count = 0;
+		ranges[0].startPage = blkno;
+		ranges[0].neighbors = false;
+		nranges = 1;
+	}
 
-	/* Commit */
-	MarkBufferDirty(buf);
-	UnlockReleaseBuffer(buf);
+	/* Ranges are contiguous */
+	for (int i = 0; i < nranges - 1; i++)
+		ranges[i].endPage = ranges[i + 1].startPage - 1;
+	ranges[nranges - 1].endPage = layout.blkno;
 
-	entryPoint = HnswPtrAccess(base, buildstate->graph->entryPoint);
-	HnswUpdateMetaPage(index, HNSW_UPDATE_ENTRY_ALWAYS, entryPoint, insertPage, forkNum, true);
+	return nranges;
+}
 
-	pfree(etup);
-	pfree(ntup);
+/*
+ * Init a page that is not in shared buffers
+ */
+static void
+InitBulkPage(Page page)
+{
+	PageInit(page, BLCKSZ, sizeof(HnswPageOpaqueData));
+	HnswPageGetOpaque(page)->nextblkno = InvalidBlockNumber;
+	HnswPageGetOpaque(page)->page_id = HNSW_PAGE_ID;
 }
 
 /*
- * Write neighbor tuples
+ * Add a tuple at its assigned location
  */
 static void
-WriteNeighborTuples(HnswBuildState * buildstate)
+AddBulkTuple(BulkWriter * writer, BlockNumber blkno, OffsetNumber offno, Item item, Size size)
 {
-	Relation	index = buildstate->index;
-	ForkNumber	forkNum = buildstate->forkNum;
-	int			m = buildstate->m;
-	HnswElementPtr iter = buildstate->graph->head;
-	char	   *base = buildstate->hnswarea;
-	HnswNeighborTuple ntup;
+	/* Pages are written in order */
+	while (writer->blkno < blkno)
+	{
+		HnswPageGetOpaque(BulkWriterGetPage(writer))->nextblkno = writer->blkno + 1;
+		BulkWriterNextPage(writer);
+		InitBulkPage(BulkWriterGetPage(writer));
+	}
 
-	/* Allocate once */
-	ntup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+	if (PageAddItem(BulkWriterGetPage(writer), item, size, InvalidOffsetNumber, false, false) != offno)
+		elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(writer->index));
+}
 
-	while (!HnswPtrIsNull(base, iter))
+/*
+ * Write the pages for a range of elements
+ *
+ * The writer must be positioned at the first page of the range
+ */
+static void
+WritePageRange(BulkWriter * writer, HnswPageRange * range, char *base, int m, bool separateNeighbors, BlockNumber lastPage, HnswElementTuple etup, HnswNeighborTuple ntup)
+{
+	HnswElementPtr iter = range->start;
+
+	Assert(writer->blkno == range->startPage);
+	InitBulkPage(BulkWriterGetPage(writer));
+
+	for (Size i = 0; i < range->count; i++)
 	{
 		HnswElement element = HnswPtrAccess(base, iter);
-		Buffer		buf;
-		Page		page;
-		Size		ntupSize = HNSW_NEIGHBOR_TUPLE_SIZE(element->level, m);
 
 		/* Update iterator */
 		iter = element->next;
 
-		/* Zero memory for each element */
-		MemSet(ntup, 0, HNSW_TUPLE_ALLOC_SIZE);
+		if (!range->neighbors)
+		{
+			Pointer		valuePtr = HnswPtrAccess(base, element->value);
 
-		/* Can take a while, so ensure we can interrupt */
-		/* Needs to be called when no buffer locks are held */
-		CHECK_FOR_INTERRUPTS();
+			/* Zero memory for each element */
+			MemSet(etup, 0, HNSW_TUPLE_ALLOC_SIZE);
 
-		buf = ReadBufferExtended(index, forkNum, element->neighborPage, RBM_NORMAL, NULL);
-		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
-		page = BufferGetPage(buf);
+			HnswSetElementTuple(base, etup, element);
+			ItemPointerSet(&etup->neighbortid, element->neighborPage, element->neighborOffno);
+			AddBulkTuple(writer, element->blkno, element->offno, (Item) etup, HNSW_ELEMENT_TUPLE_SIZE(VARSIZE_ANY(valuePtr)));
 
-		HnswSetNeighborTuple(base, ntup, element, m);
+			/* Neighbors are on their own pages before elements */
+			if (separateNeighbors)
+				continue;
+		}
 
-		if (!PageIndexTupleOverwrite(page, element->neighborOffno, (Item) ntup, ntupSize))
-			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+		/* Zero memory for each element */
+		MemSet(ntup, 0, HNSW_TUPLE_ALLOC_SIZE);
 
-		/* Commit */
-		MarkBufferDirty(buf);
-		UnlockReleaseBuffer(buf);
+		HnswSetNeighborTuple(base, ntup, element, m);
+		AddBulkTuple(writer, element->neighborPage, element->neighborOffno, (Item) ntup, HNSW_NEIGHBOR_TUPLE_SIZE(element->level, m));
 	}
 
-	pfree(ntup);
+	Assert(writer->blkno == range->endPage);
+
+	/* Link to the next range */
+	if (range->endPage != lastPage)
+		HnswPageGetOpaque(BulkWriterGetPage(writer))->nextblkno = range->endPage + 1;
 }
 
 /*
- * Flush pages
+ * Write ranges of pages until none are left
+ *
+ * Called by each participant of a parallel build
  */
 static void
-FlushPages(HnswBuildState * buildstate)
+WritePageRanges(Relation index, HnswShared * hnswshared, char *base)
 {
-#ifdef HNSW_MEMORY
-	elog(INFO, "memory: %zu MB", buildstate->graph->memoryUsed / (1024 * 1024));
-#endif
+	int			m = HnswGetM(index);
+	bool		separateNeighbors = HnswGetSeparateNeighbors(index);
+	HnswElementTuple etup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+	HnswNeighborTuple ntup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+	BulkWriter	writer;
 
-	CreateMetaPage(buildstate);
-	CreateGraphPages(buildstate);
-	WriteNeighborTuples(buildstate);
+	for (;;)
+	{
+		HnswPageRange *range;
+		int			i;
 
-	buildstate->graph->flushed = true;
-	MemoryContextReset(buildstate->graphCtx);
+		SpinLockAcquire(&hnswshared->mutex);
+		i = hnswshared->nextRange++;
+		SpinLockRelease(&hnswshared->mutex);
+
+		/* Ranges do not change once published */
+		if (i >= hnswshared->nranges)
+			break;
+
+		range = &hnswshared->ranges[i];
+		InitBulkWriterAt(&writer, index, MAIN_FORKNUM, hnswshared->logPages, range->startPage);
+		WritePageRange(&writer, range, base, m, separateNeighbors, hnswshared->lastPage, etup, ntup);
+		FinishBulkWriter(&writer);
+
+		SpinLockAcquire(&hnswshared->mutex);
+		hnswshared->nrangesdone++;
+		SpinLockRelease(&hnswshared->mutex);
+
+		ConditionVariableSignal(&hnswshared->workersdonecv);
+	}
+
+	pfree(etup);
+	pfree(ntup);
 }
 
 /*
- * Add a heap TID to an existing element
+ * Write graph pages in this process
+ *
+ * Returns the last page
  */
-static bool
-AddDuplicateInMemory(HnswElement element, HnswElement dup)
+static BlockNumber
+WriteGraphPages(HnswBuildState * buildstate)
 {
-	LWLockAcquire(&dup->lock, LW_EXCLUSIVE);
+	HnswPageRange ranges[2];
+	int			nranges;
+	BlockNumber lastPage;
+	BulkWriter	writer;
+	HnswElementTuple etup;
+	HnswNeighborTuple ntup;
 
-	if (dup->heaptidsLength == HNSW_HEAPTIDS)
+	InitBulkWriter(&writer, buildstate->index, buildstate->forkNum, buildstate->logPages);
+
+	nranges = AssignLocations(buildstate, writer.blkno, ranges, 1, 1);
+	lastPage = ranges[nranges - 1].endPage;
+
+	/* Allocate once */
+	etup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+	ntup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+
+	for (int i = 0; i < nranges; i++)
 	{
-		LWLockRelease(&dup->lock);
-		return false;
+		if (i > 0)
+			BulkWriterNextPage(&writer);
+
+		WritePageRange(&writer, &ranges[i], buildstate->hnswarea, buildstate->m, buildstate->separateNeighbors, lastPage, etup, ntup);
 	}
 
-	HnswAddHeapTid(dup, &element->heaptids[0]);
+	/* Write last page */
+	FinishBulkWriter(&writer);
 
-	LWLockRelease(&dup->lock);
+	pfree(etup);
+	pfree(ntup);
 
-	return true;
+	return lastPage;
 }
 
 /*
- * Find duplicate element
+ * Write graph pages with all participants of a parallel build
+ *
+ * The index is extended first, so each participant can write its ranges of
+ * pages in place. Returns the last page.
  */
-static bool
-FindDuplicateInMemory(char *base, HnswElement element)
+static BlockNumber
+WriteGraphPagesParallel(HnswBuildState * buildstate)
 {
-	HnswNeighborArray *neighbors = HnswGetNeighbors(base, element, 0);
-	Datum		value = HnswGetValue(base, element);
+	Relation	index = buildstate->index;
+	HnswShared *hnswshared = buildstate->hnswleader->hnswshared;
+	char	   *base = buildstate->hnswarea;
+	int			rangesPerRegion = buildstate->separateNeighbors ? HNSW_MAX_PAGE_RANGES / 2 : HNSW_MAX_PAGE_RANGES;
+	HnswElementPtr iter = buildstate->graph->head;
+	Size		count = 0;
+	BlockNumber start;
+	BlockNumber lastPage;
+	int			nranges;
 
-	for (int i = 0; i < neighbors->length; i++)
+	Assert(buildstate->forkNum == MAIN_FORKNUM);
+
+	/* Count elements */
+	while (!HnswPtrIsNull(base, iter))
 	{
-		HnswCandidate *neighbor = &neighbors->items[i];
-		HnswElement neighborElement = HnswPtrAccess(base, neighbor->element);
-		Datum		neighborValue = HnswGetValue(base, neighborElement);
+		HnswElement element = HnswPtrAccess(base, iter);
 
-		/* Exit early since ordered by distance */
-		if (!datumIsEqual(value, neighborValue, false, -1))
-			return false;
+		iter = element->next;
+		count++;
+	}
 
-		/* Check for space */
-		if (AddDuplicateInMemory(element, neighborElement))
-			return true;
+	/* Workers are waiting, so shared ranges can be updated without the lock */
+	start = RelationGetNumberOfBlocks(index);
+	nranges = AssignLocations(buildstate, start, hnswshared->ranges, rangesPerRegion, Max(count / rangesPerRegion, 1));
+	lastPage = hnswshared->ranges[nranges - 1].endPage;
+
+	if (ReserveBulkPages(index, MAIN_FORKNUM, lastPage - start + 1) != start)
+		elog(ERROR, "unexpected number of pages in \"%s\"", RelationGetRelationName(index));
+
+	SpinLockAcquire(&hnswshared->mutex);
+	hnswshared->logPages = buildstate->logPages;
+	hnswshared->lastPage = lastPage;
+	hnswshared->nranges = nranges;
+	hnswshared->nextRange = 0;
+	hnswshared->nrangesdone = 0;
+	hnswshared->writeState = HNSW_WRITE_READY;
+	SpinLockRelease(&hnswshared->mutex);
+
+	ConditionVariableBroadcast(&hnswshared->pagescv);
+
+	/* Leader writes ranges too */
+	WritePageRanges(index, hnswshared, base);
+
+	/* Wait for other participants to finish their ranges */
+	for (;;)
+	{
+		bool		done;
+
+		SpinLockAcquire(&hnswshared->mutex);
+		done = hnswshared->nrangesdone == nranges;
+		SpinLockRelease(&hnswshared->mutex);
+
+		if (done)
+			break;
+
+		ConditionVariableSleep(&hnswshared->workersdonecv, WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN);
 	}
 
-	return false;
+	ConditionVariableCancelSleep();
+
+	if (buildstate->logPages)
+		SyncBulkPages(index, MAIN_FORKNUM);
+
+	return lastPage;
 }
 
 /*
- * Add to element list
+ * Link the page chain of earlier partitions to the first page of this one
+ *
+ * Inserts and vacuum follow nextblkno from the head of the index, so pages of
+ * every partition must be on a single chain. The tail is found from the
+ * insert page, since pages are only appended after it.
  */
 static void
-AddElementInMemory(char *base, HnswGraph * graph, HnswElement element)
+LinkPartition(HnswBuildState * buildstate, BlockNumber startPage)
 {
-	SpinLockAcquire(&graph->lock);
-	element->next = graph->head;
-	HnswPtrStore(base, graph->head, element);
-	SpinLockRelease(&graph->lock);
+	Relation	index = buildstate->index;
+	ForkNumber	forkNum = buildstate->forkNum;
+	Buffer		buf;
+	Page		page;
+	BlockNumber blkno;
+
+	/* Nothing to link if no pages were written */
+	if (startPage >= RelationGetNumberOfBlocksInFork(index, forkNum))
+		return;
+
+	buf = ReadBufferExtended(index, forkNum, HNSW_METAPAGE_BLKNO, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	blkno = HnswPageGetMeta(BufferGetPage(buf))->insertPage;
+	UnlockReleaseBuffer(buf);
+
+	for (;;)
+	{
+		buf = ReadBufferExtended(index, forkNum, blkno, RBM_NORMAL, NULL);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = BufferGetPage(buf);
+
+		if (!BlockNumberIsValid(HnswPageGetOpaque(page)->nextblkno))
+			break;
+
+		blkno = HnswPageGetOpaque(page)->nextblkno;
+		UnlockReleaseBuffer(buf);
+	}
+
+	/* Not WAL-logged, since all pages are logged after a partitioned build */
+	HnswPageGetOpaque(page)->nextblkno = startPage;
+	MarkBufferDirty(buf);
+	UnlockReleaseBuffer(buf);
 }
 
 /*
- * Update neighbors
+ * Create graph pages
+ *
+ * Locations are assigned to all elements first, so each page can be
+ * assembled in local memory with its neighbor tuples and written once. When
+ * the graph is fully built in a parallel build, pages are written by all
+ * participants.
  */
 static void
-UpdateNeighborsInMemory(char *base, FmgrInfo *procinfo, Oid collation, HnswElement e, int m)
+CreateGraphPages(HnswBuildState * buildstate)
 {
-	for (int lc = e->level; lc >= 0; lc--)
-	{
-		int			lm = HnswGetLayerM(m, lc);
-		HnswNeighborArray *neighbors = HnswGetNeighbors(base, e, lc);
+	BlockNumber insertPage;
+	HnswElement entryPoint;
 
-		for (int i = 0; i < neighbors->length; i++)
-		{
-			HnswCandidate *hc = &neighbors->items[i];
-			HnswElement neighborElement = HnswPtrAccess(base, hc->element);
+	if (buildstate->hnswleader != NULL)
+		insertPage = WriteGraphPagesParallel(buildstate);
+	else
+		insertPage = WriteGraphPages(buildstate);
 
-			/* Keep scan-build happy on Mac x86-64 */
-			Assert(neighborElement);
+	if (buildstate->partition > 0)
+		LinkPartition(buildstate, buildstate->partitionStart);
 
-			/* Use element for lock instead of hc since hc can be replaced */
-			LWLockAcquire(&neighborElement->lock, LW_EXCLUSIVE);
-			HnswUpdateConnection(base, e, hc, lm, lc, NULL, NULL, procinfo, collation);
-			LWLockRelease(&neighborElement->lock);
-		}
-	}
+	/* Later partitions are linked to the entry point when stitched */
+	entryPoint = HnswPtrAccess(buildstate->hnswarea, buildstate->graph->entryPoint);
+	HnswUpdateMetaPage(buildstate->index, buildstate->partition == 0 ? HNSW_UPDATE_ENTRY_ALWAYS : 0, entryPoint, insertPage, buildstate->forkNum, true);
 }
 
 /*
- * Update graph in memory
+ * Reorder elements so neighbors are written to nearby pages
+ *
+ * Elements are relinked in breadth-first order of layer 0, starting from the
+ * entry point. Elements not reachable from it start a new traversal.
  */
 static void
-UpdateGraphInMemory(FmgrInfo *procinfo, Oid collation, HnswElement element, int m, int efConstruction, HnswElement entryPoint, HnswBuildState * buildstate)
+ReorderGraph(HnswBuildState * buildstate)
 {
 	HnswGraph  *graph = buildstate->graph;
 	char	   *base = buildstate->hnswarea;
+	HnswElementPtr iter = graph->head;
+	HnswElement *order;
+	Size		count = 0;
+	Size		n = 0;
+	Size		pos = 0;
 
-	/* Look for duplicate */
-	if (FindDuplicateInMemory(base, element))
-		return;
+	/* Count elements and reset marks */
+	while (!HnswPtrIsNull(base, iter))
+	{
+		HnswElement element = HnswPtrAccess(base, iter);
+
+		element->visited = 0;
+		iter = element->next;
+		count++;
+	}
+
+	if (count == 0)
+		return;
+
+	order = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(HnswElement) * count);
+
+	/* Start from entry point */
+	order[n] = HnswPtrAccess(base, graph->entryPoint);
+	order[n++]->visited = 1;
+
+	iter = graph->head;
+	for (;;)
+	{
+		while (pos < n)
+		{
+			HnswElement element = order[pos++];
+			HnswNeighborArray *neighbors = HnswGetNeighbors(base, element, 0);
+
+			for (int i = 0; i < neighbors->length; i++)
+			{
+				HnswElement e = HnswPtrAccess(base, neighbors->items[i].element);
+
+				if (e->visited == 0)
+				{
+					e->visited = 1;
+					order[n++] = e;
+				}
+			}
+
+			if ((pos & 1023) == 0)
+				CHECK_FOR_INTERRUPTS();
+		}
+
+		/* Find next unreached element */
+		while (!HnswPtrIsNull(base, iter) && HnswPtrAccess(base, iter)->visited)
+			iter = HnswPtrAccess(base, iter)->next;
+
+		if (HnswPtrIsNull(base, iter))
+			break;
+
+		order[n] = HnswPtrAccess(base, iter);
+		order[n++]->visited = 1;
+	}
+
+	Assert(n == count);
+
+	/* Relink elements */
+	HnswPtrStore(base, graph->head, order[0]);
+	for (Size i = 0; i + 1 < count; i++)
+		HnswPtrStore(base, order[i]->next, order[i + 1]);
+	HnswPtrStore(base, order[count - 1]->next, (HnswElement) NULL);
+
+	pfree(order);
+}
+
+/*
+ * Flush pages
+ */
+static void
+FlushPages(HnswBuildState * buildstate)
+{
+#ifdef HNSW_MEMORY
+	elog(INFO, "memory: %zu MB", buildstate->graph->memoryUsed / (1024 * 1024));
+#endif
+
+	if (hnsw_build_reorder)
+		ReorderGraph(buildstate);
+
+	if (buildstate->partition == 0)
+		CreateMetaPage(buildstate);
+	CreateGraphPages(buildstate);
+
+	buildstate->graph->flushed = true;
+	MemoryContextReset(buildstate->graphCtx);
+
+	/* Spill files are unmapped when graphCtx is reset */
+	buildstate->spill = NULL;
+	buildstate->chunk = NULL;
+	buildstate->chunkFree = 0;
+}
+
+/*
+ * Lock an element for updates
+ *
+ * The version is odd while an update is in progress. Writers spin instead of
+ * sleeping since updates are short, and readers copy neighbors without
+ * locking and retry if the version changed (see HnswSearchLayer).
+ */
+static void
+LockElementInMemory(HnswElement element)
+{
+	SpinDelayStatus delayStatus;
+	uint32		version = pg_atomic_read_u32(&element->version);
+
+	init_local_spin_delay(&delayStatus);
+
+	while ((version & 1) != 0 || !pg_atomic_compare_exchange_u32(&element->version, &version, version + 1))
+	{
+		perform_spin_delay(&delayStatus);
+		version = pg_atomic_read_u32(&element->version);
+	}
+
+	finish_spin_delay(&delayStatus);
+}
+
+/*
+ * Unlock an element
+ */
+static void
+UnlockElementInMemory(HnswElement element)
+{
+	/* Full barrier, so updates are visible before the new version */
+	pg_atomic_fetch_add_u32(&element->version, 1);
+}
+
+/*
+ * Add a heap TID to an existing element
+ */
+static bool
+AddDuplicateInMemory(HnswElement element, HnswElement dup)
+{
+	LockElementInMemory(dup);
+
+	if (dup->heaptidsLength == HNSW_HEAPTIDS)
+	{
+		UnlockElementInMemory(dup);
+		return false;
+	}
+
+	HnswAddHeapTid(dup, &element->heaptids[0]);
+
+	UnlockElementInMemory(dup);
+
+	return true;
+}
+
+/*
+ * Find duplicate element
+ */
+static bool
+FindDuplicateInMemory(char *base, HnswElement element)
+{
+	HnswNeighborArray *neighbors = HnswGetNeighbors(base, element, 0);
+	Datum		value = HnswGetValue(base, element);
+
+	for (int i = 0; i < neighbors->length; i++)
+	{
+		HnswCandidate *neighbor = &neighbors->items[i];
+		HnswElement neighborElement = HnswPtrAccess(base, neighbor->element);
+		Datum		neighborValue = HnswGetValue(base, neighborElement);
+
+		/* Exit early since ordered by distance */
+		if (!datumIsEqual(value, neighborValue, false, -1))
+			return false;
+
+		/* Check for space */
+		if (AddDuplicateInMemory(element, neighborElement))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Add to element list
+ */
+static void
+AddElementInMemory(char *base, HnswGraph * graph, HnswElement element)
+{
+	SpinLockAcquire(&graph->lock);
+	element->next = graph->head;
+	HnswPtrStore(base, graph->head, element);
+	SpinLockRelease(&graph->lock);
+}
+
+/*
+ * Update neighbors
+ */
+static void
+UpdateNeighborsInMemory(char *base, HnswSupport * support, HnswElement e, int m)
+{
+	for (int lc = e->level; lc >= 0; lc--)
+	{
+		int			lm = HnswGetLayerM(m, lc);
+		HnswNeighborArray *neighbors = HnswGetNeighbors(base, e, lc);
+
+		for (int i = 0; i < neighbors->length; i++)
+		{
+			HnswCandidate *hc = &neighbors->items[i];
+			HnswElement neighborElement = HnswPtrAccess(base, hc->element);
+
+			/* Keep scan-build happy on Mac x86-64 */
+			Assert(neighborElement);
+
+			/* Use element for lock instead of hc since hc can be replaced */
+			LockElementInMemory(neighborElement);
+			HnswUpdateConnection(base, e, hc, lm, lc, NULL, NULL, support);
+			UnlockElementInMemory(neighborElement);
+		}
+	}
+}
+
+/*
+ * Update graph in memory
+ */
+static void
+UpdateGraphInMemory(HnswSupport * support, HnswElement element, int m, int efConstruction, HnswElement entryPoint, HnswBuildState * buildstate)
+{
+	HnswGraph  *graph = buildstate->graph;
+	char	   *base = buildstate->hnswarea;
+
+	/* Look for duplicate */
+	if (FindDuplicateInMemory(base, element))
+		return;
 
 	/* Add element */
 	AddElementInMemory(base, graph, element);
 
 	/* Update neighbors */
-	UpdateNeighborsInMemory(base, procinfo, collation, element, m);
+	UpdateNeighborsInMemory(base, support, element, m);
 
 	/* Update entry point if needed (already have lock) */
 	if (entryPoint == NULL || element->level > entryPoint->level)
@@ -426,8 +925,7 @@ UpdateGraphInMemory(FmgrInfo *procinfo, Oid collation, HnswElement element, int
 static void
 InsertTupleInMemory(HnswBuildState * buildstate, HnswElement element)
 {
-	FmgrInfo   *procinfo = buildstate->procinfo;
-	Oid			collation = buildstate->collation;
+	HnswSupport *support = &buildstate->support;
 	HnswGraph  *graph = buildstate->graph;
 	HnswElement entryPoint;
 	LWLock	   *entryLock = &graph->entryLock;
@@ -453,15 +951,336 @@ InsertTupleInMemory(HnswBuildState * buildstate, HnswElement element)
 	}
 
 	/* Find neighbors for element */
-	HnswFindElementNeighbors(base, element, entryPoint, NULL, procinfo, collation, m, efConstruction, false);
+	HnswFindElementNeighbors(base, element, entryPoint, NULL, support, m, efConstruction, false);
 
 	/* Update graph in memory */
-	UpdateGraphInMemory(procinfo, collation, element, m, efConstruction, entryPoint, buildstate);
+	UpdateGraphInMemory(support, element, m, efConstruction, entryPoint, buildstate);
 
 	/* Release entry lock */
 	LWLockRelease(entryLock);
 }
 
+/*
+ * Get the memory limit for the graph
+ */
+static long
+HnswBuildMemory(void)
+{
+	if (hnsw_max_build_memory == -1)
+		return maintenance_work_mem * 1024L;
+
+	return hnsw_max_build_memory * 1024L;
+}
+
+/*
+ * Get the name of the setting that limits memory for the graph
+ */
+static const char *
+HnswBuildMemoryName(void)
+{
+	if (hnsw_max_build_memory == -1)
+		return "maintenance_work_mem";
+
+	return "hnsw.max_build_memory";
+}
+
+/*
+ * Get the maximum memory needed for an element
+ */
+static Size
+ElementMaxSize(HnswBuildState * buildstate, Size valueSize)
+{
+	int			maxLevel = buildstate->maxLevel;
+	Size		size = MAXALIGN(sizeof(HnswElementData)) + MAXALIGN(sizeof(HnswNeighborArrayPtr) * (maxLevel + 1)) + MAXALIGN(valueSize);
+
+	for (int lc = 0; lc <= maxLevel; lc++)
+		size += MAXALIGN(HNSW_NEIGHBOR_ARRAY_SIZE(HnswGetLayerM(buildstate->m, lc)));
+
+	return size;
+}
+
+/*
+ * Add a segment to the shared graph
+ *
+ * Returns false if the graph cannot grow any further.
+ */
+static bool
+AddSegment(HnswArea area, int segno, Size minSize)
+{
+	HnswGraph  *graph = area->graph;
+	int			newno;
+	Size		size;
+	dsa_pointer dp;
+
+	LWLockAcquire(&graph->segmentLock, LW_EXCLUSIVE);
+
+	/* Check if another process added a segment */
+	newno = graph->nsegments;
+	if (newno > segno + 1)
+	{
+		LWLockRelease(&graph->segmentLock);
+		return true;
+	}
+
+	/* Double the size of each segment to limit the number of segments */
+	size = newno == 0 ? HNSW_INITIAL_SEGMENT_SIZE : graph->segmentSizes[newno - 1] * 2;
+	size = Min(Max(size, minSize), HNSW_MAX_SEGMENT_SIZE);
+	size = Min(size, (Size) (graph->memoryTotal - graph->memoryUsed));
+
+	if (newno == HNSW_MAX_SEGMENTS || size < minSize)
+	{
+		LWLockRelease(&graph->segmentLock);
+		return false;
+	}
+
+	dp = dsa_allocate_extended(area->dsa, size, DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+	if (!DsaPointerIsValid(dp))
+	{
+		LWLockRelease(&graph->segmentLock);
+		return false;
+	}
+
+	graph->segments[newno] = dp;
+	graph->segmentSizes[newno] = size;
+	graph->memoryUsed += size;
+	graph->nsegments = newno + 1;
+
+	/* Make segment visible before chunks are reserved from it */
+	pg_write_barrier();
+	pg_atomic_write_u64(&graph->nextChunk, (uint64) newno << HNSW_SEGMENT_OFFSET_BITS);
+
+	LWLockRelease(&graph->segmentLock);
+
+	return true;
+}
+
+/*
+ * Reserve a chunk of the shared graph
+ */
+static char *
+ReserveChunk(HnswArea area, Size size)
+{
+	HnswGraph  *graph = area->graph;
+
+	for (;;)
+	{
+		uint64		position = pg_atomic_fetch_add_u64(&graph->nextChunk, size);
+		int			segno = position >> HNSW_SEGMENT_OFFSET_BITS;
+		Size		offset = position & (((Size) 1 << HNSW_SEGMENT_OFFSET_BITS) - 1);
+
+		if (offset + size <= graph->segmentSizes[segno])
+		{
+			char	   *segment = area->segments[segno];
+
+			if (segment == NULL)
+				segment = HnswAreaMapSegment(area, segno);
+
+			return segment + offset;
+		}
+
+		if (!AddSegment(area, segno, size))
+			return NULL;
+	}
+}
+
+/*
+ * Unmap spill files
+ */
+static void
+ReleaseSpill(void *arg)
+{
+#ifndef WIN32
+	HnswSpill	spill = (HnswSpill) arg;
+
+	for (int i = 0; i < spill->nsegments; i++)
+		munmap(spill->segments[i], spill->segmentSizes[i]);
+#endif
+}
+
+/*
+ * Add a memory-mapped temporary file for the graph
+ *
+ * Returns NULL if the file cannot be created or would exceed
+ * temp_file_limit.
+ */
+static char *
+AddSpillSegment(HnswBuildState * buildstate, Size minSize)
+{
+#ifndef WIN32
+	HnswSpill	spill = buildstate->spill;
+	Size		size;
+	File		file;
+	int			fd;
+	int			rc;
+	char	   *segment = NULL;
+
+	if (spill->nsegments == HNSW_MAX_SEGMENTS)
+		return NULL;
+
+	/* Double the size of each file to limit the number of mappings */
+	if (spill->nsegments == 0)
+		size = Max(buildstate->graph->memoryTotal, HNSW_INITIAL_SEGMENT_SIZE);
+	else
+		size = spill->segmentSizes[spill->nsegments - 1] * 2;
+	size = Max(size, minSize);
+
+	/* Writes through the mapping are not counted towards temp_file_limit */
+	if (temp_file_limit >= 0)
+	{
+		Size		limit = (Size) temp_file_limit * 1024;
+
+		size = Min(size, limit > spill->total ? limit - spill->total : 0);
+		if (size < minSize)
+			return NULL;
+	}
+
+	file = OpenTemporaryFile(false);
+	fd = FileGetRawDesc(file);
+
+	/* Allocate space upfront since writing to a hole fails with SIGBUS */
+#ifdef HAVE_POSIX_FALLOCATE
+	rc = posix_fallocate(fd, 0, size);
+#else
+	rc = ftruncate(fd, size) == 0 ? 0 : errno;
+#endif
+
+	if (rc == 0)
+	{
+		segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (segment == MAP_FAILED)
+			rc = errno;
+	}
+
+	/* The file is removed once it is unmapped */
+	FileClose(file);
+
+	if (rc != 0)
+	{
+		errno = rc;
+		ereport(DEBUG1,
+				(errmsg("could not map hnsw spill file of %zu bytes: %m", size)));
+		return NULL;
+	}
+
+	spill->segments[spill->nsegments] = segment;
+	spill->segmentSizes[spill->nsegments] = size;
+	spill->nsegments++;
+	spill->total += size;
+
+	return segment;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Check that spill files have space for a new element
+ */
+static bool
+ReserveSpill(HnswBuildState * buildstate, Size valueSize)
+{
+	Size		size;
+	char	   *segment;
+
+	if (!hnsw_build_spill)
+		return false;
+
+	/* Use current file if element fits */
+	size = ElementMaxSize(buildstate, valueSize);
+	if (buildstate->spill != NULL && buildstate->chunkFree >= size)
+		return true;
+
+	if (buildstate->spill == NULL)
+	{
+		HnswSpill	spill = MemoryContextAllocZero(buildstate->graphCtx, sizeof(HnswSpillData));
+
+		/* Unmap files when graph is flushed or on error */
+		spill->callback.func = ReleaseSpill;
+		spill->callback.arg = spill;
+		MemoryContextRegisterResetCallback(buildstate->graphCtx, &spill->callback);
+		buildstate->spill = spill;
+	}
+
+	segment = AddSpillSegment(buildstate, size);
+	if (segment == NULL)
+	{
+		buildstate->chunkFree = 0;
+		return false;
+	}
+
+	if (buildstate->spill->nsegments == 1)
+		ereport(NOTICE,
+				(errmsg("hnsw graph no longer fits into %s after " INT64_FORMAT " tuples", HnswBuildMemoryName(), (int64) buildstate->graph->indtuples),
+				 errdetail("Building will continue using temporary files."),
+				 errhint("Increase %s to speed up builds.", HnswBuildMemoryName())));
+
+	buildstate->chunk = segment;
+	buildstate->chunkFree = buildstate->spill->segmentSizes[buildstate->spill->nsegments - 1];
+	return true;
+}
+
+/*
+ * Check that memory is available for a new element
+ *
+ * In a parallel build, each participant reserves chunks of the shared graph
+ * with an atomic counter and allocates elements from its own chunk, so
+ * allocations do not need to coordinate with other processes.
+ */
+static bool
+ReserveMemory(HnswBuildState * buildstate, Size valueSize)
+{
+	HnswGraph  *graph = buildstate->graph;
+	Size		size;
+
+	if (buildstate->hnswarea == NULL)
+	{
+		if (buildstate->spill == NULL && graph->memoryUsed < graph->memoryTotal)
+			return true;
+
+		return ReserveSpill(buildstate, valueSize);
+	}
+
+	/* Use current chunk if element fits */
+	size = ElementMaxSize(buildstate, valueSize);
+	if (buildstate->chunkFree >= size)
+		return true;
+
+	/* Reserve a new chunk */
+	size = Max(size, HNSW_BUILD_CHUNK_SIZE);
+	buildstate->chunk = ReserveChunk((HnswArea) buildstate->hnswarea, size);
+	if (buildstate->chunk == NULL)
+	{
+		buildstate->chunkFree = 0;
+		return false;
+	}
+
+	buildstate->chunkFree = size;
+	return true;
+}
+
+/*
+ * Find the partition of a value
+ */
+static int
+FindPartition(HnswBuildState * buildstate, Datum value)
+{
+	int			partition = 0;
+	double		minDistance = DBL_MAX;
+
+	for (int i = 0; i < buildstate->npartitions; i++)
+	{
+		double		distance = HnswDistance(&buildstate->support, value, buildstate->centers[i]);
+
+		if (distance < minDistance)
+		{
+			minDistance = distance;
+			partition = i;
+		}
+	}
+
+	return partition;
+}
+
 /*
  * Insert tuple
  */
@@ -480,12 +1299,20 @@ InsertTuple(Relation index, Datum *values, bool *isnull, ItemPointer heaptid, Hn
 	Datum		value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
 
 	/* Normalize if needed */
-	if (buildstate->normprocinfo != NULL)
+	if (buildstate->support.normprocinfo != NULL)
 	{
-		if (!HnswNormValue(buildstate->normprocinfo, buildstate->collation, &value, buildstate->normvec))
+		if (!HnswNormValue(&buildstate->support, &value))
 			return false;
 	}
 
+	/* Quantize if needed */
+	if (buildstate->support.quantization != HNSW_QUANTIZATION_NONE)
+		value = HnswQuantizeValue(&buildstate->support, value);
+
+	/* Skip values in other partitions */
+	if (buildstate->npartitions > 1 && FindPartition(buildstate, value) != buildstate->partition)
+		return false;
+
 	/* Get datum size */
 	valueSize = VARSIZE_ANY(DatumGetPointer(value));
 
@@ -497,58 +1324,43 @@ InsertTuple(Relation index, Datum *values, bool *isnull, ItemPointer heaptid, Hn
 	{
 		LWLockRelease(flushLock);
 
-		return HnswInsertTupleOnDisk(index, value, values, isnull, heaptid, true);
+		return HnswInsertTupleOnDisk(index, &buildstate->support, value, values, isnull, heaptid, true);
 	}
 
 	/*
-	 * In a parallel build, the HnswElement is allocated from the shared
-	 * memory area, so we need to coordinate with other processes.
-	 */
-	LWLockAcquire(&graph->allocatorLock, LW_EXCLUSIVE);
-
-	/*
-	 * Check that we have enough memory available for the new element now that
-	 * we have the allocator lock, and flush pages if needed.
+	 * Check that we have enough memory available for the new element, and
+	 * flush pages if needed.
 	 */
-	if (graph->memoryUsed >= graph->memoryTotal)
+	if (!ReserveMemory(buildstate, valueSize))
 	{
-		LWLockRelease(&graph->allocatorLock);
-
 		LWLockRelease(flushLock);
 		LWLockAcquire(flushLock, LW_EXCLUSIVE);
 
 		if (!graph->flushed)
 		{
 			ereport(NOTICE,
-					(errmsg("hnsw graph no longer fits into maintenance_work_mem after " INT64_FORMAT " tuples", (int64) graph->indtuples),
+					(errmsg("hnsw graph no longer fits into %s after " INT64_FORMAT " tuples", HnswBuildMemoryName(), (int64) graph->indtuples),
 					 errdetail("Building will take significantly more time."),
-					 errhint("Increase maintenance_work_mem to speed up builds.")));
+					 errhint("Increase %s to speed up builds.", HnswBuildMemoryName())));
 
 			FlushPages(buildstate);
 		}
 
 		LWLockRelease(flushLock);
 
-		return HnswInsertTupleOnDisk(index, value, values, isnull, heaptid, true);
+		return HnswInsertTupleOnDisk(index, &buildstate->support, value, values, isnull, heaptid, true);
 	}
 
 	/* Ok, we can proceed to allocate the element */
 	element = HnswInitElement(base, heaptid, buildstate->m, buildstate->ml, buildstate->maxLevel, allocator);
 	valuePtr = HnswAlloc(allocator, valueSize);
 
-	/*
-	 * We have now allocated the space needed for the element, so we don't
-	 * need the allocator lock anymore. Release it and initialize the rest of
-	 * the element.
-	 */
-	LWLockRelease(&graph->allocatorLock);
-
 	/* Copy the datum */
 	memcpy(valuePtr, DatumGetPointer(value), valueSize);
 	HnswPtrStore(base, element->value, valuePtr);
 
-	/* Create a lock for the element */
-	LWLockInitialize(&element->lock, hnsw_lock_tranche_id);
+	/* Initialize the version for the element */
+	pg_atomic_init_u32(&element->version, 0);
 
 	/* Insert tuple */
 	InsertTupleInMemory(buildstate, element);
@@ -574,25 +1386,275 @@ BuildCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
 	ItemPointer tid = &hup->t_self;
 #endif
 
-	/* Skip nulls */
-	if (isnull[0])
-		return;
+	/* Skip nulls */
+	if (isnull[0])
+		return;
+
+	/* Use memory context */
+	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+	/* Insert tuple */
+	if (InsertTuple(index, values, isnull, tid, buildstate))
+	{
+		/* Update progress */
+		SpinLockAcquire(&graph->lock);
+		pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_DONE, ++graph->indtuples);
+		SpinLockRelease(&graph->lock);
+	}
+
+	/* Reset memory context */
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextReset(buildstate->tmpCtx);
+}
+
+/*
+ * Callback for sampling the range of values
+ */
+static void
+SampleCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
+			   bool *isnull, bool tupleIsAlive, void *state)
+{
+	HnswBuildState *buildstate = (HnswBuildState *) state;
+	MemoryContext oldCtx;
+	Datum		value;
+	Vector	   *vec;
+
+	/* Skip nulls */
+	if (isnull[0])
+		return;
+
+	/* Use memory context since detoast can allocate */
+	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+	/* Detoast once for all calls */
+	value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+
+	/* Use the range after normalization, since that is what is quantized */
+	if (buildstate->support.normprocinfo == NULL || HnswNormValue(&buildstate->support, &value))
+	{
+		vec = DatumGetVector(value);
+
+		for (int i = 0; i < vec->dim; i++)
+		{
+			if (vec->x[i] < buildstate->sampleMin)
+				buildstate->sampleMin = vec->x[i];
+
+			if (vec->x[i] > buildstate->sampleMax)
+				buildstate->sampleMax = vec->x[i];
+		}
+	}
+
+	/* Reset memory context */
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextReset(buildstate->tmpCtx);
+}
+
+/*
+ * Set the quantization range from a sample of rows
+ *
+ * Elements outside the range of the sample are clamped when quantized
+ */
+static void
+SetQuantizationRange(HnswBuildState * buildstate)
+{
+	HnswSupport *support = &buildstate->support;
+	BlockSamplerData bs;
+	BlockNumber nblocks;
+
+	buildstate->sampleMin = FLT_MAX;
+	buildstate->sampleMax = -FLT_MAX;
+
+	if (buildstate->heap != NULL)
+	{
+		nblocks = RelationGetNumberOfBlocks(buildstate->heap);
+		BlockSampler_Init(&bs, nblocks, HNSW_QUANTIZATION_SAMPLE_BLOCKS, RandomInt());
+
+		while (BlockSampler_HasMore(&bs))
+		{
+			BlockNumber targblock = BlockSampler_Next(&bs);
+
+			table_index_build_range_scan(buildstate->heap, buildstate->index, buildstate->indexInfo,
+										 false, true, false, targblock, 1, SampleCallback, (void *) buildstate, NULL);
+		}
+
+		/* Scan the rest if the sampled blocks had no values */
+		if (buildstate->sampleMin > buildstate->sampleMax && nblocks > HNSW_QUANTIZATION_SAMPLE_BLOCKS)
+			table_index_build_scan(buildstate->heap, buildstate->index, buildstate->indexInfo,
+								   false, true, SampleCallback, (void *) buildstate, NULL);
+	}
+
+	/* Leave the range unset if there is no data, so the first insert sets it */
+	if (buildstate->sampleMin > buildstate->sampleMax)
+	{
+		support->scale = 0;
+		support->offset = 0;
+		return;
+	}
+
+	HnswSetQuantizationScale(support, buildstate->sampleMin, buildstate->sampleMax);
+}
+
+/*
+ * Callback for sampling centers
+ */
+static void
+CenterSampleCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
+					 bool *isnull, bool tupleIsAlive, void *state)
+{
+	HnswCenterSample *sample = (HnswCenterSample *) state;
+	HnswBuildState *buildstate = sample->buildstate;
+	MemoryContext oldCtx;
+	Datum		value;
+	int			j;
+
+	/* Skip nulls */
+	if (isnull[0])
+		return;
+
+	/* Use memory context since detoast can allocate */
+	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+	/* Detoast once for all calls */
+	value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+
+	/* Use the same value as the graph */
+	if (buildstate->support.normprocinfo != NULL && !HnswNormValue(&buildstate->support, &value))
+	{
+		MemoryContextSwitchTo(oldCtx);
+		MemoryContextReset(buildstate->tmpCtx);
+		return;
+	}
+
+	if (buildstate->support.quantization != HNSW_QUANTIZATION_NONE)
+		value = HnswQuantizeValue(&buildstate->support, value);
+
+	MemoryContextSwitchTo(oldCtx);
+
+	/* Reservoir sampling */
+	sample->seen++;
+	if (sample->count < sample->max)
+		j = sample->count++;
+	else
+	{
+		j = (int) (RandomDouble() * sample->seen);
+		if (j >= sample->max)
+			j = -1;
+		else
+			pfree(DatumGetPointer(sample->values[j]));
+	}
+
+	if (j >= 0)
+		sample->values[j] = datumCopy(value, false, -1);
+
+	/* Reset memory context */
+	MemoryContextReset(buildstate->tmpCtx);
+}
+
+/*
+ * Choose partition centers from a sample of rows
+ *
+ * Centers are chosen with k-means++ seeding, which only needs the distance
+ * function of the index, so it works for all types and quantization.
+ */
+static void
+ChooseCenters(HnswBuildState * buildstate)
+{
+	HnswSupport *support = &buildstate->support;
+	HnswCenterSample sample;
+	BlockSamplerData bs;
+	float	   *minDistances;
+	int			npartitions = hnsw_build_partitions;
+
+	sample.buildstate = buildstate;
+	sample.max = npartitions * HNSW_PARTITION_SAMPLES;
+	sample.values = palloc(sizeof(Datum) * sample.max);
+	sample.count = 0;
+	sample.seen = 0;
+
+	BlockSampler_Init(&bs, RelationGetNumberOfBlocks(buildstate->heap), HNSW_PARTITION_SAMPLE_BLOCKS, RandomInt());
+
+	while (BlockSampler_HasMore(&bs))
+	{
+		BlockNumber targblock = BlockSampler_Next(&bs);
+
+		table_index_build_range_scan(buildstate->heap, buildstate->index, buildstate->indexInfo,
+									 false, true, false, targblock, 1, CenterSampleCallback, (void *) &sample, NULL);
+	}
+
+	/* Not enough rows to partition */
+	if (sample.count < 2)
+		return;
+
+	buildstate->centers = palloc(sizeof(Datum) * npartitions);
+	buildstate->centers[0] = sample.values[RandomInt() % sample.count];
+	buildstate->npartitions = 1;
+
+	minDistances = palloc(sizeof(float) * sample.count);
+	for (int i = 0; i < sample.count; i++)
+		minDistances[i] = FLT_MAX;
+
+	while (buildstate->npartitions < npartitions)
+	{
+		Datum		center = buildstate->centers[buildstate->npartitions - 1];
+		float		lowest = FLT_MAX;
+		double		sum = 0;
+		double		target;
+		int			chosen = -1;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (int i = 0; i < sample.count; i++)
+		{
+			float		distance = (float) HnswDistance(support, sample.values[i], center);
+
+			if (distance < minDistances[i])
+				minDistances[i] = distance;
+
+			if (minDistances[i] < lowest)
+				lowest = minDistances[i];
+		}
+
+		/*
+		 * Choose values with probability proportional to squared distance.
+		 * Distances are relative to the lowest one, since inner product
+		 * distances can be negative.
+		 */
+		for (int i = 0; i < sample.count; i++)
+		{
+			double		weight = minDistances[i] - lowest;
+
+			sum += weight * weight;
+		}
 
-	/* Use memory context */
-	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+		/* Remaining values are duplicates of centers */
+		if (sum == 0)
+			break;
 
-	/* Insert tuple */
-	if (InsertTuple(index, values, isnull, tid, buildstate))
-	{
-		/* Update progress */
-		SpinLockAcquire(&graph->lock);
-		pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_DONE, ++graph->indtuples);
-		SpinLockRelease(&graph->lock);
+		target = RandomDouble() * sum;
+		for (int i = 0; i < sample.count; i++)
+		{
+			double		weight = minDistances[i] - lowest;
+
+			if (weight > 0)
+			{
+				chosen = i;
+				target -= weight * weight;
+				if (target < 0)
+					break;
+			}
+		}
+
+		buildstate->centers[buildstate->npartitions++] = sample.values[chosen];
 	}
 
-	/* Reset memory context */
-	MemoryContextSwitchTo(oldCtx);
-	MemoryContextReset(buildstate->tmpCtx);
+	pfree(minDistances);
+
+	ereport(DEBUG1, (errmsg("using %d partitions from a sample of %d rows", buildstate->npartitions, sample.count)));
+
+	if (buildstate->npartitions < 2)
+		buildstate->npartitions = 0;
+	else
+		buildstate->partitionStarts = palloc0(sizeof(BlockNumber) * (buildstate->npartitions + 1));
 }
 
 /*
@@ -606,16 +1668,70 @@ InitGraph(HnswGraph * graph, char *base, long memoryTotal)
 
 	HnswPtrStore(base, graph->head, (HnswElement) NULL);
 	HnswPtrStore(base, graph->entryPoint, (HnswElement) NULL);
+	pg_atomic_init_u64(&graph->nextChunk, 0);
 	graph->memoryUsed = 0;
 	graph->memoryTotal = memoryTotal;
+	graph->nsegments = 0;
+	MemSet(graph->segmentSizes, 0, sizeof(graph->segmentSizes));
 	graph->flushed = false;
 	graph->indtuples = 0;
 	SpinLockInit(&graph->lock);
 	LWLockInitialize(&graph->entryLock, hnsw_lock_tranche_id);
-	LWLockInitialize(&graph->allocatorLock, hnsw_lock_tranche_id);
+	LWLockInitialize(&graph->segmentLock, hnsw_lock_tranche_id);
 	LWLockInitialize(&graph->flushLock, hnsw_lock_tranche_id);
 }
 
+/*
+ * Map a segment of the shared graph
+ */
+char *
+HnswAreaMapSegment(HnswArea area, int segno)
+{
+	HnswGraph  *graph = area->graph;
+
+	Assert(segno < graph->nsegments);
+
+	area->segments[segno] = dsa_get_address(area->dsa, graph->segments[segno]);
+	area->segmentSizes[segno] = graph->segmentSizes[segno];
+	area->nsegments = Max(area->nsegments, segno + 1);
+
+	return area->segments[segno];
+}
+
+/*
+ * Find the segment of the shared graph containing a pointer
+ */
+int
+HnswAreaFindSegment(HnswArea area, void *ptr)
+{
+	for (int i = 0; i < area->nsegments; i++)
+	{
+		char	   *segment = area->segments[i];
+
+		if (segment != NULL && (char *) ptr >= segment && (char *) ptr < segment + area->segmentSizes[i])
+		{
+			area->lastSegment = i;
+			return i;
+		}
+	}
+
+	elog(ERROR, "pointer not in hnsw graph");
+	return 0;					/* keep compiler quiet */
+}
+
+/*
+ * Create backend-local state for the shared graph
+ */
+static HnswArea
+CreateArea(dsa_area *dsa, HnswGraph * graph)
+{
+	HnswArea	area = palloc0(sizeof(HnswAreaData));
+
+	area->dsa = dsa;
+	area->graph = graph;
+	return area;
+}
+
 /*
  * Initialize an allocator
  */
@@ -627,33 +1743,43 @@ InitAllocator(HnswAllocator * allocator, void *(*alloc) (Size size, void *state)
 }
 
 /*
- * Memory context allocator
+ * Chunk allocator
  */
 static void *
-HnswMemoryContextAlloc(Size size, void *state)
+HnswChunkAlloc(Size size, void *state)
 {
 	HnswBuildState *buildstate = (HnswBuildState *) state;
-	void	   *chunk = MemoryContextAlloc(buildstate->graphCtx, size);
+	void	   *chunk = buildstate->chunk;
 
-#if PG_VERSION_NUM >= 130000
-	buildstate->graphData.memoryUsed = MemoryContextMemAllocated(buildstate->graphCtx, false);
-#else
-	buildstate->graphData.memoryUsed += MAXALIGN(size);
-#endif
+	/* Space was reserved by ReserveMemory */
+	Assert(MAXALIGN(size) <= buildstate->chunkFree);
 
+	buildstate->chunk += MAXALIGN(size);
+	buildstate->chunkFree -= MAXALIGN(size);
 	return chunk;
 }
 
 /*
- * Shared memory allocator
+ * Memory context allocator
  */
 static void *
-HnswSharedMemoryAlloc(Size size, void *state)
+HnswMemoryContextAlloc(Size size, void *state)
 {
 	HnswBuildState *buildstate = (HnswBuildState *) state;
-	void	   *chunk = buildstate->hnswarea + buildstate->graph->memoryUsed;
+	void	   *chunk;
+
+	/* Allocate from spill files once the graph no longer fits */
+	if (buildstate->spill != NULL)
+		return HnswChunkAlloc(size, state);
+
+	chunk = MemoryContextAlloc(buildstate->graphCtx, size);
+
+#if PG_VERSION_NUM >= 130000
+	buildstate->graphData.memoryUsed = MemoryContextMemAllocated(buildstate->graphCtx, false);
+#else
+	buildstate->graphData.memoryUsed += MAXALIGN(size);
+#endif
 
-	buildstate->graph->memoryUsed += MAXALIGN(size);
 	return chunk;
 }
 
@@ -663,6 +1789,8 @@ HnswSharedMemoryAlloc(Size size, void *state)
 static void
 InitBuildState(HnswBuildState * buildstate, Relation heap, Relation index, IndexInfo *indexInfo, ForkNumber forkNum)
 {
+	int			maxDimensions;
+
 	buildstate->heap = heap;
 	buildstate->index = index;
 	buildstate->indexInfo = indexInfo;
@@ -670,14 +1798,34 @@ InitBuildState(HnswBuildState * buildstate, Relation heap, Relation index, Index
 
 	buildstate->m = HnswGetM(index);
 	buildstate->efConstruction = HnswGetEfConstruction(index);
+	buildstate->separateNeighbors = HnswGetSeparateNeighbors(index);
+	buildstate->logPages = false;
 	buildstate->dimensions = TupleDescAttr(index->rd_att, 0)->atttypmod;
 
 	/* Require column to have dimensions to be indexed */
 	if (buildstate->dimensions < 0)
 		elog(ERROR, "column does not have dimensions");
 
-	if (buildstate->dimensions > HNSW_MAX_DIM)
-		elog(ERROR, "column cannot have more than %d dimensions for hnsw index", HNSW_MAX_DIM);
+	/* Get support functions */
+	HnswInitSupport(&buildstate->support, index);
+
+	/* Range is set by the leader */
+	buildstate->support.quantization = HnswGetQuantization(index);
+
+	/* Quantized distances are only implemented for the vector kernels */
+	if (buildstate->support.quantization != HNSW_QUANTIZATION_NONE && buildstate->support.distfunc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("int8 quantization requires vector with L2 distance, inner product, or cosine distance")));
+
+	maxDimensions = buildstate->support.typeInfo->maxDimensions;
+
+	/* Codes are a quarter of the size of elements */
+	if (buildstate->support.quantization == HNSW_QUANTIZATION_INT8)
+		maxDimensions = HNSW_MAX_DIM * 4;
+
+	if (buildstate->dimensions > maxDimensions)
+		elog(ERROR, "column cannot have more than %d dimensions for hnsw index", maxDimensions);
 
 	if (buildstate->efConstruction < 2 * buildstate->m)
 		elog(ERROR, "ef_construction must be greater than or equal to 2 * m");
@@ -685,19 +1833,11 @@ InitBuildState(HnswBuildState * buildstate, Relation heap, Relation index, Index
 	buildstate->reltuples = 0;
 	buildstate->indtuples = 0;
 
-	/* Get support functions */
-	buildstate->procinfo = index_getprocinfo(index, 1, HNSW_DISTANCE_PROC);
-	buildstate->normprocinfo = HnswOptionalProcInfo(index, HNSW_NORM_PROC);
-	buildstate->collation = index->rd_indcollation[0];
-
-	InitGraph(&buildstate->graphData, NULL, maintenance_work_mem * 1024L);
+	InitGraph(&buildstate->graphData, NULL, HnswBuildMemory());
 	buildstate->graph = &buildstate->graphData;
 	buildstate->ml = HnswGetMl(buildstate->m);
 	buildstate->maxLevel = HnswGetMaxLevel(buildstate->m);
 
-	/* Reuse for each tuple */
-	buildstate->normvec = InitVector(buildstate->dimensions);
-
 	buildstate->graphCtx = GenerationContextCreate(CurrentMemoryContext,
 												   "Hnsw build graph context",
 #if PG_VERSION_NUM >= 150000
@@ -713,6 +1853,15 @@ InitBuildState(HnswBuildState * buildstate, Relation heap, Relation index, Index
 	buildstate->hnswleader = NULL;
 	buildstate->hnswshared = NULL;
 	buildstate->hnswarea = NULL;
+	buildstate->spill = NULL;
+	buildstate->chunk = NULL;
+	buildstate->chunkFree = 0;
+
+	buildstate->npartitions = 0;
+	buildstate->partition = 0;
+	buildstate->centers = NULL;
+	buildstate->partitionStart = InvalidBlockNumber;
+	buildstate->partitionStarts = NULL;
 }
 
 /*
@@ -721,7 +1870,6 @@ InitBuildState(HnswBuildState * buildstate, Relation heap, Relation index, Index
 static void
 FreeBuildState(HnswBuildState * buildstate)
 {
-	pfree(buildstate->normvec);
 	MemoryContextDelete(buildstate->graphCtx);
 	MemoryContextDelete(buildstate->tmpCtx);
 }
@@ -763,7 +1911,7 @@ ParallelHeapScan(HnswBuildState * buildstate)
  * Perform a worker's portion of a parallel insert
  */
 static void
-HnswParallelScanAndInsert(Relation heapRel, Relation indexRel, HnswShared * hnswshared, char *hnswarea, bool progress)
+HnswParallelScanAndInsert(Relation heapRel, Relation indexRel, HnswShared * hnswshared, char *hnswarea, Datum *centers, bool progress)
 {
 	HnswBuildState buildstate;
 	TableScanDesc scan;
@@ -774,9 +1922,15 @@ HnswParallelScanAndInsert(Relation heapRel, Relation indexRel, HnswShared * hnsw
 	indexInfo = BuildIndexInfo(indexRel);
 	indexInfo->ii_Concurrent = hnswshared->isconcurrent;
 	InitBuildState(&buildstate, heapRel, indexRel, indexInfo, MAIN_FORKNUM);
+	buildstate.support.scale = hnswshared->quantizationScale;
+	buildstate.support.offset = hnswshared->quantizationOffset;
 	buildstate.graph = &hnswshared->graphData;
 	buildstate.hnswarea = hnswarea;
-	InitAllocator(&buildstate.allocator, &HnswSharedMemoryAlloc, &buildstate);
+	buildstate.npartitions = hnswshared->npartitions;
+	buildstate.partition = hnswshared->partition;
+	buildstate.partitionStart = hnswshared->partitionStart;
+	buildstate.centers = centers;
+	InitAllocator(&buildstate.allocator, &HnswChunkAlloc, &buildstate);
 	scan = table_beginscan_parallel(heapRel,
 									ParallelTableScanFromHnswShared(hnswshared));
 	reltuples = table_index_build_scan(heapRel, indexRel, indexInfo,
@@ -801,6 +1955,33 @@ HnswParallelScanAndInsert(Relation heapRel, Relation indexRel, HnswShared * hnsw
 	FreeBuildState(&buildstate);
 }
 
+/*
+ * Within a worker, help write pages once the graph is built
+ */
+static void
+HnswParallelWritePages(Relation indexRel, HnswShared * hnswshared, char *hnswarea)
+{
+	int			writeState;
+
+	for (;;)
+	{
+		SpinLockAcquire(&hnswshared->mutex);
+		writeState = hnswshared->writeState;
+		SpinLockRelease(&hnswshared->mutex);
+
+		if (writeState != HNSW_WRITE_WAITING)
+			break;
+
+		ConditionVariableSleep(&hnswshared->pagescv, WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN);
+	}
+
+	ConditionVariableCancelSleep();
+
+	/* Pages were already written if the graph did not fit into memory */
+	if (writeState == HNSW_WRITE_READY)
+		WritePageRanges(indexRel, hnswshared, hnswarea);
+}
+
 /*
  * Perform work within a launched parallel process
  */
@@ -809,7 +1990,9 @@ HnswParallelBuildMain(dsm_segment *seg, shm_toc *toc)
 {
 	char	   *sharedquery;
 	HnswShared *hnswshared;
-	char	   *hnswarea;
+	void	   *place;
+	HnswArea	area;
+	Datum	   *centers = NULL;
 	Relation	heapRel;
 	Relation	indexRel;
 	LOCKMODE	heapLockmode;
@@ -841,10 +2024,31 @@ HnswParallelBuildMain(dsm_segment *seg, shm_toc *toc)
 	heapRel = table_open(hnswshared->heaprelid, heapLockmode);
 	indexRel = index_open(hnswshared->indexrelid, indexLockmode);
 
-	hnswarea = shm_toc_lookup(toc, PARALLEL_KEY_HNSW_AREA, false);
+	/* Attach to shared graph */
+	place = shm_toc_lookup(toc, PARALLEL_KEY_HNSW_AREA, false);
+	area = CreateArea(dsa_attach_in_place(place, seg), &hnswshared->graphData);
+
+	/* Look up partition centers */
+	if (hnswshared->npartitions > 1)
+	{
+		char	   *ptr = shm_toc_lookup(toc, PARALLEL_KEY_HNSW_CENTERS, false);
+
+		centers = palloc(sizeof(Datum) * hnswshared->npartitions);
+		for (int i = 0; i < hnswshared->npartitions; i++)
+		{
+			centers[i] = PointerGetDatum(ptr);
+			ptr += MAXALIGN(VARSIZE_ANY(ptr));
+		}
+	}
 
 	/* Perform inserts */
-	HnswParallelScanAndInsert(heapRel, indexRel, hnswshared, hnswarea, false);
+	HnswParallelScanAndInsert(heapRel, indexRel, hnswshared, (char *) area, centers, false);
+
+	/* Write pages */
+	HnswParallelWritePages(indexRel, hnswshared, (char *) area);
+
+	/* Detach from shared graph */
+	dsa_detach(area->dsa);
 
 	/* Close relations within worker */
 	index_close(indexRel, indexLockmode);
@@ -860,6 +2064,9 @@ HnswEndParallel(HnswLeader * hnswleader)
 	/* Shutdown worker processes */
 	WaitForParallelWorkersToFinish(hnswleader->pcxt);
 
+	/* Detach from shared graph */
+	dsa_detach(((HnswArea) hnswleader->hnswarea)->dsa);
+
 	/* Free last reference to MVCC snapshot, if one was used */
 	if (IsMVCCSnapshot(hnswleader->snapshot))
 		UnregisterSnapshot(hnswleader->snapshot);
@@ -885,7 +2092,7 @@ HnswLeaderParticipateAsWorker(HnswBuildState * buildstate)
 	HnswLeader *hnswleader = buildstate->hnswleader;
 
 	/* Perform work common to all participants */
-	HnswParallelScanAndInsert(buildstate->heap, buildstate->index, hnswleader->hnswshared, hnswleader->hnswarea, true);
+	HnswParallelScanAndInsert(buildstate->heap, buildstate->index, hnswleader->hnswshared, hnswleader->hnswarea, buildstate->centers, true);
 }
 
 /*
@@ -898,9 +2105,12 @@ HnswBeginParallel(HnswBuildState * buildstate, bool isconcurrent, int request)
 	Snapshot	snapshot;
 	Size		esthnswshared;
 	Size		esthnswarea;
-	Size		estother;
+	Size		estcenters = 0;
+	long		memoryTotal;
+	long		estother;
 	HnswShared *hnswshared;
-	char	   *hnswarea;
+	void	   *place;
+	HnswArea	area;
 	HnswLeader *hnswleader = (HnswLeader *) palloc0(sizeof(HnswLeader));
 	bool		leaderparticipates = true;
 	int			querylen;
@@ -924,17 +2134,21 @@ HnswBeginParallel(HnswBuildState * buildstate, bool isconcurrent, int request)
 	esthnswshared = ParallelEstimateShared(buildstate->heap, snapshot);
 	shm_toc_estimate_chunk(&pcxt->estimator, esthnswshared);
 
-	/* Leave space for other objects in shared memory */
-	/* Docker has a default limit of 64 MB for shm_size */
-	/* which happens to be the default value of maintenance_work_mem */
-	esthnswarea = maintenance_work_mem * 1024L;
-	estother = 3 * 1024 * 1024;
-	if (esthnswarea > estother)
-		esthnswarea -= estother;
-
+	/* Graph segments are allocated from the DSA area as needed */
+	esthnswarea = dsa_minimum_size();
 	shm_toc_estimate_chunk(&pcxt->estimator, esthnswarea);
 	shm_toc_estimate_keys(&pcxt->estimator, 2);
 
+	/* Estimate space for partition centers */
+	if (buildstate->npartitions > 1)
+	{
+		for (int i = 0; i < buildstate->npartitions; i++)
+			estcenters = add_size(estcenters, MAXALIGN(VARSIZE_ANY(DatumGetPointer(buildstate->centers[i]))));
+
+		shm_toc_estimate_chunk(&pcxt->estimator, estcenters);
+		shm_toc_estimate_keys(&pcxt->estimator, 1);
+	}
+
 	/* Finally, estimate PARALLEL_KEY_QUERY_TEXT space */
 	if (debug_query_string)
 	{
@@ -964,21 +2178,58 @@ HnswBeginParallel(HnswBuildState * buildstate, bool isconcurrent, int request)
 	hnswshared->heaprelid = RelationGetRelid(buildstate->heap);
 	hnswshared->indexrelid = RelationGetRelid(buildstate->index);
 	hnswshared->isconcurrent = isconcurrent;
+	hnswshared->quantizationScale = buildstate->support.scale;
+	hnswshared->quantizationOffset = buildstate->support.offset;
+	hnswshared->npartitions = buildstate->npartitions;
+	hnswshared->partition = buildstate->partition;
+	hnswshared->partitionStart = buildstate->partitionStart;
 	ConditionVariableInit(&hnswshared->workersdonecv);
+	ConditionVariableInit(&hnswshared->pagescv);
 	SpinLockInit(&hnswshared->mutex);
 	/* Initialize mutable state */
 	hnswshared->nparticipantsdone = 0;
 	hnswshared->reltuples = 0;
+	hnswshared->writeState = HNSW_WRITE_WAITING;
+	hnswshared->nranges = 0;
+	hnswshared->nextRange = 0;
+	hnswshared->nrangesdone = 0;
 	table_parallelscan_initialize(buildstate->heap,
 								  ParallelTableScanFromHnswShared(hnswshared),
 								  snapshot);
 
-	hnswarea = (char *) shm_toc_allocate(pcxt->toc, esthnswarea);
-	/* Report less than allocated so never fails */
-	InitGraph(&hnswshared->graphData, hnswarea, esthnswarea - 1024 * 1024);
+	/* Leave space for other objects in shared memory */
+	/* Docker has a default limit of 64 MB for shm_size */
+	/* which happens to be the default value of maintenance_work_mem */
+	memoryTotal = HnswBuildMemory();
+	estother = 3 * 1024 * 1024;
+	if (memoryTotal > estother)
+		memoryTotal -= estother;
+
+	place = shm_toc_allocate(pcxt->toc, esthnswarea);
+	area = CreateArea(NULL, &hnswshared->graphData);
+	InitGraph(&hnswshared->graphData, (char *) area, memoryTotal);
+	hnswshared->graphData.indtuples = buildstate->indtuples;
+	area->dsa = dsa_create_in_place(place, esthnswarea, hnsw_lock_tranche_id, pcxt->seg);
 
 	shm_toc_insert(pcxt->toc, PARALLEL_KEY_HNSW_SHARED, hnswshared);
-	shm_toc_insert(pcxt->toc, PARALLEL_KEY_HNSW_AREA, hnswarea);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_HNSW_AREA, place);
+
+	/* Store partition centers for workers */
+	if (buildstate->npartitions > 1)
+	{
+		char	   *sharedcenters = (char *) shm_toc_allocate(pcxt->toc, estcenters);
+		char	   *ptr = sharedcenters;
+
+		for (int i = 0; i < buildstate->npartitions; i++)
+		{
+			Pointer		center = DatumGetPointer(buildstate->centers[i]);
+
+			memcpy(ptr, center, VARSIZE_ANY(center));
+			ptr += MAXALIGN(VARSIZE_ANY(center));
+		}
+
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_HNSW_CENTERS, sharedcenters);
+	}
 
 	/* Store query string for workers */
 	if (debug_query_string)
@@ -998,7 +2249,7 @@ HnswBeginParallel(HnswBuildState * buildstate, bool isconcurrent, int request)
 		hnswleader->nparticipanttuplesorts++;
 	hnswleader->hnswshared = hnswshared;
 	hnswleader->snapshot = snapshot;
-	hnswleader->hnswarea = hnswarea;
+	hnswleader->hnswarea = (char *) area;
 
 	/* If no workers were successfully launched, back out (do serial build) */
 	if (pcxt->nworkers_launched == 0)
@@ -1043,14 +2294,247 @@ ComputeParallelWorkers(Relation heap, Relation index)
 }
 
 /*
- * Build graph
+ * Report the estimated memory for the graph
  */
 static void
-BuildGraph(HnswBuildState * buildstate, ForkNumber forkNum)
+ReportMemoryEstimate(HnswBuildState * buildstate)
+{
+	int			m = buildstate->m;
+	BlockNumber pages;
+	double		tuples;
+	double		allvisfrac;
+	Datum		value;
+	Size		elementSize;
+	double		estimate;
+
+	table_relation_estimate_size(buildstate->heap, NULL, &pages, &tuples, &allvisfrac);
+
+	/* Use a zero value for the size of each value */
+	value = buildstate->support.typeInfo->zeroValue(buildstate->dimensions);
+	if (buildstate->support.quantization != HNSW_QUANTIZATION_NONE)
+		value = HnswQuantizeValue(&buildstate->support, value);
+
+	/* Each element has layer 0 and 1 / (m - 1) upper layers on average */
+	elementSize = MAXALIGN(sizeof(HnswElementData)) + MAXALIGN(sizeof(HnswNeighborArrayPtr) * 2) + MAXALIGN(HNSW_NEIGHBOR_ARRAY_SIZE(HnswGetLayerM(m, 0))) + MAXALIGN(VARSIZE_ANY(DatumGetPointer(value)));
+	estimate = tuples * (elementSize + MAXALIGN(HNSW_NEIGHBOR_ARRAY_SIZE(HnswGetLayerM(m, 1))) / (double) (m - 1));
+
+	ereport(DEBUG1, (errmsg("hnsw graph estimated to use %.0f MB for %.0f tuples", estimate / (1024 * 1024), tuples)));
+
+	/* Each partition has its own graph */
+	if (buildstate->npartitions > 1)
+		estimate /= buildstate->npartitions;
+
+	if (estimate > HnswBuildMemory())
+		ereport(NOTICE,
+				(errmsg("hnsw graph estimated to use %.0f MB, which is more than %s", estimate / (1024 * 1024), HnswBuildMemoryName()),
+				 errhint("Increase %s to speed up builds.", HnswBuildMemoryName())));
+}
+
+/*
+ * Compare stitch elements by level, highest first
+ */
+static int
+CompareStitchElements(const void *a, const void *b)
+{
+	const HnswStitchElement *ea = (const HnswStitchElement *) a;
+	const HnswStitchElement *eb = (const HnswStitchElement *) b;
+
+	if (ea->level != eb->level)
+		return ea->level > eb->level ? -1 : 1;
+
+	if (ea->blkno != eb->blkno)
+		return ea->blkno < eb->blkno ? -1 : 1;
+
+	if (ea->offno != eb->offno)
+		return ea->offno < eb->offno ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Collect elements to stitch from a range of pages
+ */
+static Size
+CollectStitchElements(HnswBuildState * buildstate, BlockNumber start, BlockNumber end, int minLevel, HnswStitchElement * *elements, Size *count, Size *max)
+{
+	Relation	index = buildstate->index;
+	Size		added = 0;
+
+	for (BlockNumber blkno = start; blkno < end; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(index, buildstate->forkNum, blkno, RBM_NORMAL, NULL);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			HnswElementTuple etup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (!HnswIsElementTuple(etup) || etup->level < minLevel)
+				continue;
+
+			if (*count == *max)
+			{
+				*max *= 2;
+				*elements = repalloc_huge(*elements, sizeof(HnswStitchElement) * *max);
+			}
+
+			(*elements)[*count].blkno = blkno;
+			(*elements)[*count].offno = offno;
+			(*elements)[*count].level = etup->level;
+			(*count)++;
+			added++;
+		}
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	return added;
+}
+
+/*
+ * Link an element of a later partition to the rest of the graph
+ */
+static void
+StitchElement(HnswBuildState * buildstate, HnswElement element, HnswNeighborTuple ntup)
+{
+	Relation	index = buildstate->index;
+	ForkNumber	forkNum = buildstate->forkNum;
+	HnswSupport *support = &buildstate->support;
+	int			m = buildstate->m;
+	HnswElement entryPoint = HnswGetEntryPoint(index);
+	Size		ntupSize;
+	Buffer		buf;
+	Page		page;
+	char	   *base = NULL;
+
+	/* Skip if element is entry point */
+	if (entryPoint != NULL && element->blkno == entryPoint->blkno && element->offno == entryPoint->offno)
+		return;
+
+	/* Load element */
+	HnswLoadElement(element, NULL, NULL, index, support, true);
+	ntupSize = HNSW_NEIGHBOR_TUPLE_SIZE(element->level, m);
+
+	/* Keep neighbors from the partition if earlier partitions are empty */
+	if (entryPoint == NULL)
+	{
+		HnswUpdateMetaPage(index, HNSW_UPDATE_ENTRY_GREATER, element, InvalidBlockNumber, forkNum, true);
+		return;
+	}
+
+	/* Init fields */
+	HnswInitNeighbors(base, element, m, NULL);
+	element->heaptidsLength = 0;
+
+	/* Find neighbors in all partitions, skipping itself */
+	HnswFindElementNeighbors(base, element, entryPoint, index, support, m, buildstate->efConstruction, true);
+
+	/* Zero memory for each element */
+	MemSet(ntup, 0, HNSW_TUPLE_ALLOC_SIZE);
+
+	HnswSetNeighborTuple(base, ntup, element, m);
+
+	/* Overwrite neighbors from the partition */
+	buf = ReadBufferExtended(index, forkNum, element->neighborPage, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	page = BufferGetPage(buf);
+
+	if (!PageIndexTupleOverwrite(page, element->neighborOffno, (Item) ntup, ntupSize))
+		elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+	/* Commit */
+	MarkBufferDirty(buf);
+	UnlockReleaseBuffer(buf);
+
+	/* Update neighbors */
+	HnswUpdateNeighborsOnDisk(index, support, element, m, true, true);
+
+	/* Update entry point if needed */
+	if (element->level > entryPoint->level)
+		HnswUpdateMetaPage(index, HNSW_UPDATE_ENTRY_GREATER, element, InvalidBlockNumber, forkNum, true);
+}
+
+/*
+ * Link partitions together
+ *
+ * Elements in the upper layers of later partitions are linked to the rest of
+ * the graph like on vacuum, highest levels first, which connects every
+ * partition to the entry point and gives layer 0 links between partitions.
+ * If a partition has no upper layers, all of its elements are linked.
+ */
+static void
+StitchPartitions(HnswBuildState * buildstate)
+{
+	HnswStitchElement *elements;
+	Size		count = 0;
+	Size		max = 1024;
+	HnswNeighborTuple ntup;
+
+	elements = palloc(sizeof(HnswStitchElement) * max);
+
+	for (int p = 1; p < buildstate->npartitions; p++)
+	{
+		BlockNumber start = buildstate->partitionStarts[p];
+		BlockNumber end = buildstate->partitionStarts[p + 1];
+
+		if (CollectStitchElements(buildstate, start, end, 1, &elements, &count, &max) == 0)
+			CollectStitchElements(buildstate, start, end, 0, &elements, &count, &max);
+	}
+
+	ereport(DEBUG1, (errmsg("linking %zu elements across %d partitions", count, buildstate->npartitions)));
+
+	qsort(elements, count, sizeof(HnswStitchElement), CompareStitchElements);
+
+	/* Allocate once */
+	ntup = palloc0(HNSW_TUPLE_ALLOC_SIZE);
+
+	for (Size i = 0; i < count; i++)
+	{
+		MemoryContext oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+		HnswElement element = HnswInitElementFromBlock(elements[i].blkno, elements[i].offno);
+
+		/* Can take a while, so ensure we can interrupt */
+		CHECK_FOR_INTERRUPTS();
+
+		StitchElement(buildstate, element, ntup);
+
+		/* Reset memory context */
+		MemoryContextSwitchTo(oldCtx);
+		MemoryContextReset(buildstate->tmpCtx);
+	}
+
+	pfree(ntup);
+	pfree(elements);
+}
+
+/*
+ * Build the graph for a partition, or the whole graph without partitions
+ */
+static void
+BuildPartition(HnswBuildState * buildstate)
 {
 	int			parallel_workers = 0;
 
-	pgstat_progress_update_param(PROGRESS_CREATEIDX_SUBPHASE, PROGRESS_HNSW_PHASE_LOAD);
+	/* Start a new graph after the previous partition */
+	if (buildstate->partition > 0)
+	{
+		InitGraph(&buildstate->graphData, NULL, HnswBuildMemory());
+		buildstate->graphData.indtuples = buildstate->indtuples;
+		buildstate->graph = &buildstate->graphData;
+		buildstate->hnswleader = NULL;
+		buildstate->hnswarea = NULL;
+
+		buildstate->partitionStart = RelationGetNumberOfBlocks(buildstate->index);
+		buildstate->partitionStarts[buildstate->partition] = buildstate->partitionStart;
+	}
 
 	/* Calculate parallel workers */
 	if (buildstate->heap != NULL)
@@ -1074,11 +2558,57 @@ BuildGraph(HnswBuildState * buildstate, ForkNumber forkNum)
 
 	/* Flush pages */
 	if (!buildstate->graph->flushed)
+	{
+		/* Log pages as they are written if nothing changes them afterwards */
+		buildstate->logPages = (RelationNeedsWAL(buildstate->index) || buildstate->forkNum == INIT_FORKNUM) && buildstate->npartitions < 2;
 		FlushPages(buildstate);
+	}
 
 	/* End parallel build */
 	if (buildstate->hnswleader)
+	{
+		HnswShared *hnswshared = buildstate->hnswleader->hnswshared;
+
+		/* Release workers waiting to write pages */
+		SpinLockAcquire(&hnswshared->mutex);
+		hnswshared->writeState = HNSW_WRITE_DONE;
+		SpinLockRelease(&hnswshared->mutex);
+		ConditionVariableBroadcast(&hnswshared->pagescv);
+
 		HnswEndParallel(buildstate->hnswleader);
+	}
+}
+
+/*
+ * Build graph
+ */
+static void
+BuildGraph(HnswBuildState * buildstate, ForkNumber forkNum)
+{
+	pgstat_progress_update_param(PROGRESS_CREATEIDX_SUBPHASE, PROGRESS_HNSW_PHASE_LOAD);
+
+	/* Choose partitions if needed */
+	if (buildstate->heap != NULL && hnsw_build_partitions > 1)
+		ChooseCenters(buildstate);
+
+	/* Report memory estimate before building */
+	if (buildstate->heap != NULL)
+		ReportMemoryEstimate(buildstate);
+
+	/* Build each partition */
+	do
+	{
+		BuildPartition(buildstate);
+		buildstate->partition++;
+	}
+	while (buildstate->partition < buildstate->npartitions);
+
+	/* Link partitions */
+	if (buildstate->npartitions > 1)
+	{
+		buildstate->partitionStarts[buildstate->npartitions] = RelationGetNumberOfBlocks(buildstate->index);
+		StitchPartitions(buildstate);
+	}
 }
 
 /*
@@ -1094,10 +2624,15 @@ BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
 
 	InitBuildState(buildstate, heap, index, indexInfo, forkNum);
 
+	if (buildstate->support.quantization != HNSW_QUANTIZATION_NONE)
+		SetQuantizationRange(buildstate);
+
 	BuildGraph(buildstate, forkNum);
 
-	if (RelationNeedsWAL(index))
-		log_newpage_range(index, forkNum, 0, RelationGetNumberOfBlocks(index), true);
+	/* Only the metapage needs to be logged if graph pages were logged */
+	/* GenericXLog functions do not write WAL for the initialization fork */
+	if (RelationNeedsWAL(index) || forkNum == INIT_FORKNUM)
+		log_newpage_range(index, forkNum, 0, buildstate->logPages ? 1 : RelationGetNumberOfBlocksInFork(index, forkNum), true);
 
 	FreeBuildState(buildstate);
 }
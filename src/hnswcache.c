@@ -0,0 +1,622 @@
+/*
+ * Cache of the upper layers of HNSW indexes in shared memory
+ *
+ * Every scan descends from the entry point to layer 1 with ef = 1 before
+ * searching layer 0. The upper layers are small, but are read by every scan,
+ * so the buffer mapping and content locks for their pages are contended with
+ * many concurrent scans.
+ *
+ * The cache holds a decoded copy of the upper layers (element locations,
+ * neighbor indexes, and values) in a dynamic shared memory area, so the
+ * descent needs no buffer access. Each copy is a single chunk with offsets
+ * instead of pointers, since the area is mapped at different addresses in
+ * each backend. When the upper layers do not fit in hnsw.upper_cache_size,
+ * only the highest layers that fit are cached, and the remaining layers are
+ * searched on disk.
+ *
+ * The metapage has a version for layers 1+, 2+, and so on, which is bumped
+ * by changes to those layers (inserts of elements above layer 0, entry point
+ * changes, and vacuum). A copy is valid while the version for its lowest
+ * layer and the entry point match the metapage. The element found is loaded
+ * from disk before searching further, so a stale copy only affects where the
+ * search on disk starts.
+ *
+ * The lock on the slots is only held to find a copy and pin it, so scans do
+ * not block a backend publishing a copy while they search. A copy replaced
+ * while pinned is freed by the last scan to unpin it. Slots are evicted by
+ * an epoch that advances with each copy published, and scans only write
+ * the epoch to a slot the first time they use it in an epoch.
+ */
+#include "postgres.h"
+
+#include "hnsw.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "storage/shmem.h"
+#include "utils/dsa.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#if PG_VERSION_NUM >= 160000
+typedef RelFileLocator HnswRelFile;
+#define HnswGetRelFile(index) ((index)->rd_locator)
+#define HnswRelFileEquals(a, b) RelFileLocatorEquals(a, b)
+#else
+typedef RelFileNode HnswRelFile;
+#define HnswGetRelFile(index) ((index)->rd_node)
+#define HnswRelFileEquals(a, b) RelFileNodeEquals(a, b)
+#endif
+
+#define HnswCacheVersionIndex(minLevel) (Min(minLevel, HNSW_UPPER_VERSIONS) - 1)
+#define HnswCacheNeighbors(cache, ce, lc) ((int32 *) ((char *) (cache) + (ce)->neighbors) + ((ce)->layer - (lc)) * ((cache)->m + 1))
+#define HnswCacheValue(cache, ce) PointerGetDatum((char *) (cache) + (ce)->value)
+
+typedef struct HnswCacheElementData
+{
+	BlockNumber blkno;
+	OffsetNumber offno;
+	uint8		layer;			/* highest layer it is reached in */
+	Size		neighbors;		/* count and m indexes for each layer */
+	Size		value;
+}			HnswCacheElementData;
+
+typedef HnswCacheElementData * HnswCacheElement;
+
+/* Position-independent copy of the upper layers, with the entry point first */
+typedef struct HnswCacheData
+{
+	pg_atomic_uint32 refcount;	/* slot and scans using a shared copy */
+	int			m;
+	int			minLevel;
+	int			count;
+	HnswCacheElementData elements[FLEXIBLE_ARRAY_MEMBER];
+}			HnswCacheData;
+
+typedef HnswCacheData * HnswCache;
+
+typedef struct HnswCacheSlot
+{
+	HnswRelFile relfile;
+	BlockNumber entryBlkno;
+	OffsetNumber entryOffno;
+	int			entryLevel;
+	int			minLevel;
+	uint32		version;
+	dsa_pointer ptr;			/* invalid if empty */
+	pg_atomic_uint64 lastUsed;	/* epoch */
+}			HnswCacheSlot;
+
+typedef struct HnswCacheShared
+{
+	LWLock		lock;
+	bool		areaCreated;
+	dsa_handle	area;
+	pg_atomic_uint64 epoch;		/* advances when a copy is published */
+	HnswCacheSlot slots[HNSW_UPPER_CACHE_SLOTS];
+}			HnswCacheShared;
+
+/* Element being added to a copy */
+typedef struct HnswCacheTidEntry
+{
+	ItemPointerData tid;
+	HnswElement element;
+	int			index;			/* -1 if not added yet */
+}			HnswCacheTidEntry;
+
+int			hnsw_upper_cache_size;
+
+static HnswCacheShared *hnsw_cache_shared = NULL;
+static dsa_area *hnsw_cache_area = NULL;
+
+/*
+ * Attach to the shared area, creating it if needed
+ *
+ * Like the tranche ID, the shared struct is small enough to allocate from
+ * the "slop" that PostgreSQL reserves for small allocations
+ */
+static void
+AttachCache(void)
+{
+	MemoryContext oldCtx;
+
+	if (hnsw_cache_area != NULL)
+		return;
+
+	if (hnsw_cache_shared == NULL)
+	{
+		bool		found;
+
+		HnswInitLockTranche();
+
+		LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+		hnsw_cache_shared = ShmemInitStruct("hnsw upper cache",
+											sizeof(HnswCacheShared),
+											&found);
+		if (!found)
+		{
+			LWLockInitialize(&hnsw_cache_shared->lock, hnsw_lock_tranche_id);
+			hnsw_cache_shared->areaCreated = false;
+			pg_atomic_init_u64(&hnsw_cache_shared->epoch, 0);
+			for (int i = 0; i < HNSW_UPPER_CACHE_SLOTS; i++)
+			{
+				hnsw_cache_shared->slots[i].ptr = InvalidDsaPointer;
+				pg_atomic_init_u64(&hnsw_cache_shared->slots[i].lastUsed, 0);
+			}
+		}
+		LWLockRelease(AddinShmemInitLock);
+	}
+
+	/* Keep the mapping for the life of the backend */
+	oldCtx = MemoryContextSwitchTo(TopMemoryContext);
+	LWLockAcquire(&hnsw_cache_shared->lock, LW_EXCLUSIVE);
+	if (hnsw_cache_shared->areaCreated)
+		hnsw_cache_area = dsa_attach(hnsw_cache_shared->area);
+	else
+	{
+		hnsw_cache_area = dsa_create(hnsw_lock_tranche_id);
+		dsa_pin(hnsw_cache_area);
+		hnsw_cache_shared->area = dsa_get_handle(hnsw_cache_area);
+		hnsw_cache_shared->areaCreated = true;
+	}
+	dsa_pin_mapping(hnsw_cache_area);
+	LWLockRelease(&hnsw_cache_shared->lock);
+	MemoryContextSwitchTo(oldCtx);
+}
+
+/*
+ * Find the slot for an index
+ */
+static HnswCacheSlot *
+FindSlot(Relation index)
+{
+	HnswRelFile relfile = HnswGetRelFile(index);
+
+	for (int i = 0; i < HNSW_UPPER_CACHE_SLOTS; i++)
+	{
+		HnswCacheSlot *slot = &hnsw_cache_shared->slots[i];
+
+		if (DsaPointerIsValid(slot->ptr) && HnswRelFileEquals(slot->relfile, relfile))
+			return slot;
+	}
+
+	return NULL;
+}
+
+/*
+ * Check if a slot matches the metapage
+ */
+static bool
+SlotIsValid(HnswCacheSlot * slot, HnswElement entryPoint, uint32 *upperVersions)
+{
+	return slot->entryBlkno == entryPoint->blkno &&
+		slot->entryOffno == entryPoint->offno &&
+		slot->entryLevel == entryPoint->level &&
+		slot->version == upperVersions[HnswCacheVersionIndex(slot->minLevel)];
+}
+
+/*
+ * Get the size of a copy
+ */
+static Size
+CacheSize(int count, Size neighborSlots, Size valuesSize, int m)
+{
+	return MAXALIGN(offsetof(HnswCacheData, elements) + count * sizeof(HnswCacheElementData)) +
+		MAXALIGN(neighborSlots * (m + 1) * sizeof(int32)) +
+		valuesSize;
+}
+
+/*
+ * Load an element and its neighbors
+ */
+static HnswElement
+LoadCacheElement(Relation index, BlockNumber blkno, OffsetNumber offno, int m)
+{
+	HnswElement element = HnswInitElementFromBlock(blkno, offno);
+
+	HnswLoadElement(element, NULL, NULL, index, NULL, true);
+	HnswLoadNeighbors(element, index, m);
+	return element;
+}
+
+/*
+ * Build a copy of the upper layers in local memory
+ *
+ * Each layer is added with a breadth-first search from the elements in the
+ * layers above it, so only elements reachable from the entry point are
+ * included. Returns NULL if the highest layer does not fit.
+ */
+static HnswCache
+BuildCache(Relation index, HnswElement entryPoint, int m, Size maxSize, Size *size)
+{
+	MemoryContext tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+												 "Hnsw cache temporary context",
+												 ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldCtx = MemoryContextSwitchTo(tmpCtx);
+	HASHCTL		hash_ctl;
+	HTAB	   *tids;
+	HnswElement *elements;
+	int		   *layers;
+	int			maxElements = 256;
+	int			count = 0;
+	int			topLevel = entryPoint->level;
+	int			minLevel = topLevel + 1;
+	Size		neighborSlots = 0;
+	Size		valuesSize = 0;
+	HnswCache	cache = NULL;
+	char	   *base = NULL;
+	char	   *ptr;
+	HnswCacheTidEntry *entry;
+	ItemPointerData tid;
+	bool		found;
+
+	hash_ctl.keysize = sizeof(ItemPointerData);
+	hash_ctl.entrysize = sizeof(HnswCacheTidEntry);
+	hash_ctl.hcxt = tmpCtx;
+	tids = hash_create("hnsw cache tids", 256, &hash_ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	elements = palloc(sizeof(HnswElement) * maxElements);
+	layers = palloc(sizeof(int) * maxElements);
+
+	/* Add entry point */
+	elements[0] = LoadCacheElement(index, entryPoint->blkno, entryPoint->offno, m);
+	layers[0] = topLevel;
+	count = 1;
+	valuesSize += MAXALIGN(VARSIZE_ANY(HnswPtrAccess(base, elements[0]->value)));
+
+	ItemPointerSet(&tid, entryPoint->blkno, entryPoint->offno);
+	entry = hash_search(tids, &tid, HASH_ENTER, &found);
+	entry->element = elements[0];
+	entry->index = 0;
+
+	/* Make robust to issues */
+	if (elements[0]->level < topLevel)
+		topLevel = 0;
+
+	for (int lc = topLevel; lc >= 1; lc--)
+	{
+		int			layerStart = count;
+		bool		overflow;
+
+		/* Elements from layers above have neighbors in this layer */
+		neighborSlots += count;
+		overflow = CacheSize(count, neighborSlots, valuesSize, m) > maxSize;
+
+		for (int i = 0; i < count && !overflow; i++)
+		{
+			HnswNeighborArray *neighbors = HnswGetNeighbors(base, elements[i], lc);
+
+			CHECK_FOR_INTERRUPTS();
+
+			for (int j = 0; j < neighbors->length; j++)
+			{
+				HnswElement e = HnswPtrAccess(base, neighbors->items[j].element);
+
+				ItemPointerSet(&tid, e->blkno, e->offno);
+				entry = hash_search(tids, &tid, HASH_ENTER, &found);
+				if (!found)
+				{
+					entry->element = LoadCacheElement(index, e->blkno, e->offno, m);
+					entry->index = -1;
+				}
+
+				if (entry->index >= 0)
+					continue;
+
+				/* Make robust to issues */
+				e = entry->element;
+				if (e->level < lc)
+					continue;
+
+				if (count == maxElements)
+				{
+					maxElements *= 2;
+					elements = repalloc(elements, sizeof(HnswElement) * maxElements);
+					layers = repalloc(layers, sizeof(int) * maxElements);
+				}
+
+				entry->index = count;
+				elements[count] = e;
+				layers[count] = lc;
+				count++;
+				neighborSlots++;
+				valuesSize += MAXALIGN(VARSIZE_ANY(HnswPtrAccess(base, e->value)));
+
+				if (CacheSize(count, neighborSlots, valuesSize, m) > maxSize)
+				{
+					overflow = true;
+					break;
+				}
+			}
+		}
+
+		if (overflow)
+		{
+			count = layerStart;
+			break;
+		}
+
+		minLevel = lc;
+	}
+
+	/* Highest layer does not fit */
+	if (minLevel > entryPoint->level)
+	{
+		MemoryContextSwitchTo(oldCtx);
+		MemoryContextDelete(tmpCtx);
+		return NULL;
+	}
+
+	/* Recount for the cached layers */
+	neighborSlots = 0;
+	valuesSize = 0;
+	for (int i = 0; i < count; i++)
+	{
+		neighborSlots += layers[i] - minLevel + 1;
+		valuesSize += MAXALIGN(VARSIZE_ANY(HnswPtrAccess(base, elements[i]->value)));
+	}
+
+	/* Write the copy */
+	*size = CacheSize(count, neighborSlots, valuesSize, m);
+	cache = MemoryContextAllocZero(oldCtx, *size);
+	cache->m = m;
+	cache->minLevel = minLevel;
+	cache->count = count;
+
+	ptr = (char *) cache + MAXALIGN(offsetof(HnswCacheData, elements) + count * sizeof(HnswCacheElementData));
+	for (int i = 0; i < count; i++)
+	{
+		HnswCacheElement ce = &cache->elements[i];
+
+		ce->blkno = elements[i]->blkno;
+		ce->offno = elements[i]->offno;
+		ce->layer = layers[i];
+		ce->neighbors = ptr - (char *) cache;
+
+		for (int lc = layers[i]; lc >= minLevel; lc--)
+		{
+			HnswNeighborArray *neighbors = HnswGetNeighbors(base, elements[i], lc);
+			int32	   *indexes = HnswCacheNeighbors(cache, ce, lc);
+
+			indexes[0] = 0;
+			for (int j = 0; j < neighbors->length; j++)
+			{
+				HnswElement e = HnswPtrAccess(base, neighbors->items[j].element);
+
+				ItemPointerSet(&tid, e->blkno, e->offno);
+				entry = hash_search(tids, &tid, HASH_FIND, &found);
+				/* Skip elements not in this layer */
+				if (found && entry->index >= 0 && entry->index < count && layers[entry->index] >= lc)
+					indexes[1 + indexes[0]++] = entry->index;
+			}
+		}
+
+		ptr += (layers[i] - minLevel + 1) * (m + 1) * sizeof(int32);
+	}
+
+	ptr = (char *) cache + MAXALIGN(ptr - (char *) cache);
+	for (int i = 0; i < count; i++)
+	{
+		Pointer		value = HnswPtrAccess(base, elements[i]->value);
+
+		cache->elements[i].value = ptr - (char *) cache;
+		memcpy(ptr, value, VARSIZE_ANY(value));
+		ptr += MAXALIGN(VARSIZE_ANY(value));
+	}
+
+	Assert(ptr - (char *) cache == *size);
+
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextDelete(tmpCtx);
+
+	return cache;
+}
+
+/*
+ * Release a reference to a shared copy, freeing it if it was the last
+ */
+static void
+UnpinCache(dsa_pointer ptr)
+{
+	HnswCache	cache = dsa_get_address(hnsw_cache_area, ptr);
+
+	if (pg_atomic_sub_fetch_u32(&cache->refcount, 1) == 0)
+		dsa_free(hnsw_cache_area, ptr);
+}
+
+/*
+ * Mark a slot as used in the current epoch
+ *
+ * Reading the epoch does not contend like incrementing a clock would, and
+ * the slot is only written once per epoch
+ */
+static inline void
+TouchSlot(HnswCacheSlot * slot)
+{
+	uint64		epoch = pg_atomic_read_u64(&hnsw_cache_shared->epoch);
+
+	if (pg_atomic_read_u64(&slot->lastUsed) != epoch)
+		pg_atomic_write_u64(&slot->lastUsed, epoch);
+}
+
+/*
+ * Publish a copy, replacing the one for the index or the least recently used
+ */
+static void
+PublishCache(Relation index, HnswCache cache, Size size, HnswElement entryPoint, uint32 *upperVersions)
+{
+	HnswCacheSlot *slot;
+	dsa_pointer ptr;
+
+	LWLockAcquire(&hnsw_cache_shared->lock, LW_EXCLUSIVE);
+
+	slot = FindSlot(index);
+	if (slot == NULL)
+	{
+		slot = &hnsw_cache_shared->slots[0];
+		for (int i = 1; i < HNSW_UPPER_CACHE_SLOTS; i++)
+		{
+			HnswCacheSlot *s = &hnsw_cache_shared->slots[i];
+
+			if (!DsaPointerIsValid(slot->ptr))
+				break;
+
+			if (!DsaPointerIsValid(s->ptr) || pg_atomic_read_u64(&s->lastUsed) < pg_atomic_read_u64(&slot->lastUsed))
+				slot = s;
+		}
+	}
+
+	ptr = dsa_allocate_extended(hnsw_cache_area, size, DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+	if (DsaPointerIsValid(ptr))
+	{
+		HnswCache	shared = dsa_get_address(hnsw_cache_area, ptr);
+
+		memcpy(shared, cache, size);
+		pg_atomic_init_u32(&shared->refcount, 1);
+	}
+
+	/* Scans still searching the old copy free it */
+	if (DsaPointerIsValid(slot->ptr))
+		UnpinCache(slot->ptr);
+
+	slot->relfile = HnswGetRelFile(index);
+	slot->entryBlkno = entryPoint->blkno;
+	slot->entryOffno = entryPoint->offno;
+	slot->entryLevel = entryPoint->level;
+	slot->minLevel = cache->minLevel;
+	slot->version = upperVersions[HnswCacheVersionIndex(cache->minLevel)];
+	slot->ptr = ptr;
+
+	/* Slots used since the last copy was published rank above the rest */
+	pg_atomic_write_u64(&slot->lastUsed, pg_atomic_add_fetch_u64(&hnsw_cache_shared->epoch, 1));
+
+	LWLockRelease(&hnsw_cache_shared->lock);
+}
+
+/*
+ * Search the cached layers with ef = 1
+ *
+ * Returns the index of the nearest element found
+ */
+static int
+SearchCache(HnswCache cache, HnswSupport * support, Datum q, int topLevel, int minLevel)
+{
+	int			c = 0;
+	double		cDistance = HnswDistance(support, q, HnswCacheValue(cache, &cache->elements[0]));
+
+	for (int lc = topLevel; lc >= minLevel; lc--)
+	{
+		bool		changed = true;
+
+		while (changed)
+		{
+			int32	   *neighbors = HnswCacheNeighbors(cache, &cache->elements[c], lc);
+
+			changed = false;
+
+			for (int i = 1; i <= neighbors[0]; i++)
+			{
+				HnswCacheElement e = &cache->elements[neighbors[i]];
+				double		eDistance = HnswDistance(support, q, HnswCacheValue(cache, e));
+
+				if (eDistance < cDistance)
+				{
+					c = neighbors[i];
+					cDistance = eDistance;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	return c;
+}
+
+/*
+ * Descend the upper layers using the cache
+ *
+ * Searches the cached layers down to minLevel and returns the element found,
+ * with level set to the next layer to search. Returns NULL if the cache
+ * cannot be used, in which case the caller should search from the entry
+ * point.
+ */
+HnswElement
+HnswCacheSearch(Relation index, HnswSupport * support, Datum q, HnswElement entryPoint, uint32 *upperVersions, int m, int minLevel, int *level)
+{
+	HnswCacheSlot *slot;
+	HnswCache	cache;
+	HnswCacheElement ce;
+	dsa_pointer ptr = InvalidDsaPointer;
+	BlockNumber blkno;
+	OffsetNumber offno;
+	Size		size;
+	int			c;
+
+	minLevel = Max(minLevel, 1);
+
+	if (hnsw_upper_cache_size == 0 || entryPoint->level < minLevel || RelationUsesLocalBuffers(index))
+		return NULL;
+
+	AttachCache();
+
+	/* Pin the shared copy if valid */
+	LWLockAcquire(&hnsw_cache_shared->lock, LW_SHARED);
+	slot = FindSlot(index);
+	if (slot != NULL && SlotIsValid(slot, entryPoint, upperVersions))
+	{
+		ptr = slot->ptr;
+		pg_atomic_fetch_add_u32(&((HnswCache) dsa_get_address(hnsw_cache_area, ptr))->refcount, 1);
+		TouchSlot(slot);
+	}
+	LWLockRelease(&hnsw_cache_shared->lock);
+
+	/* Search it without holding the lock */
+	if (DsaPointerIsValid(ptr))
+	{
+		cache = dsa_get_address(hnsw_cache_area, ptr);
+
+		PG_TRY();
+		{
+			minLevel = Max(minLevel, cache->minLevel);
+			c = SearchCache(cache, support, q, entryPoint->level, minLevel);
+		}
+		PG_CATCH();
+		{
+			UnpinCache(ptr);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		ce = &cache->elements[c];
+		blkno = ce->blkno;
+		offno = ce->offno;
+		UnpinCache(ptr);
+
+		*level = minLevel - 1;
+		return HnswInitElementFromBlock(blkno, offno);
+	}
+
+	/* Let other scans use the disk while one backend builds the copy */
+	if (!ConditionalLockPage(index, HNSW_CACHE_LOCK, ExclusiveLock))
+		return NULL;
+
+	cache = BuildCache(index, entryPoint, m, (Size) hnsw_upper_cache_size * 1024, &size);
+
+	UnlockPage(index, HNSW_CACHE_LOCK, ExclusiveLock);
+
+	if (cache == NULL)
+		return NULL;
+
+	PublishCache(index, cache, size, entryPoint, upperVersions);
+
+	/* Search the local copy */
+	minLevel = Max(minLevel, cache->minLevel);
+	c = SearchCache(cache, support, q, entryPoint->level, minLevel);
+	ce = &cache->elements[c];
+
+	*level = minLevel - 1;
+	entryPoint = HnswInitElementFromBlock(ce->blkno, ce->offno);
+	pfree(cache);
+	return entryPoint;
+}
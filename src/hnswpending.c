@@ -0,0 +1,516 @@
+/*
+ * Pending list for HNSW indexes
+ *
+ * Inserting into the graph searches it with ef_construction and updates the
+ * neighbors of the new element, so inserts are much slower than for a B-tree.
+ * With fastupdate enabled, inserts instead append the value and heap TID to a
+ * list of pages, like the pending list of GIN indexes. Scans compute the
+ * distance to every tuple in the list and merge them with the results from
+ * the graph. The list is merged into the graph when it grows larger than
+ * hnsw.pending_list_limit, by vacuum, or by hnsw_merge_pending().
+ *
+ * The pages form a chain from the metapage, separate from the chain of graph
+ * pages. Tuples are marked as merged after they are inserted into the graph,
+ * and the pages are cleared (but kept in the chain for reuse) once every
+ * tuple is merged, so a scan that reads the list before searching the graph
+ * sees each tuple in at least one of them. Scans skip heap TIDs in the graph
+ * that they also found in the list.
+ *
+ * A tuple is also marked as merging before it is inserted, so if a merge
+ * fails in between, the next one checks the graph for its heap TID instead
+ * of inserting it twice. Only one tuple at a time can be in this state.
+ */
+#include "postgres.h"
+
+#include "access/generic_xlog.h"
+#include "access/genam.h"
+#include "access/xlog.h"
+#include "fmgr.h"
+#include "hnsw.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/acl.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#if PG_VERSION_NUM >= 160000
+#define HnswOwnerCheck(relid) object_ownercheck(RelationRelationId, relid, GetUserId())
+#else
+#define HnswOwnerCheck(relid) pg_class_ownercheck(relid, GetUserId())
+#endif
+
+/* States of pending tuples, stored in deleted */
+#define HNSW_PENDING_MERGED		1
+#define HNSW_PENDING_MERGING	2	/* may already be in the graph */
+
+/* Indexes created before the pending list existed have zeros */
+#define HnswHasPendingList(metap) (BlockNumberIsValid((metap)->pendingHead) && (metap)->pendingHead != HNSW_METAPAGE_BLKNO)
+
+int			hnsw_pending_list_limit;
+
+/*
+ * Add a new page to the pending list
+ */
+static void
+AppendPendingPage(Relation index, GenericXLogState *state, Buffer *buf, Page *page)
+{
+	LockRelationForExtension(index, ExclusiveLock);
+	*buf = HnswNewBuffer(index, MAIN_FORKNUM);
+	UnlockRelationForExtension(index, ExclusiveLock);
+
+	*page = GenericXLogRegisterBuffer(state, *buf, GENERIC_XLOG_FULL_IMAGE);
+	HnswInitPage(*buf, *page);
+}
+
+/*
+ * Add a value to the pending list
+ *
+ * Returns false if the list is being merged, in which case the value should
+ * be inserted into the graph instead
+ */
+bool
+HnswInsertPending(Relation index, Datum value, ItemPointer heaptid)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	HnswMetaPage metap;
+	Buffer		buf;
+	Page		page;
+	Buffer		prevbuf = InvalidBuffer;
+	GenericXLogState *state;
+	HnswElementTuple etup;
+	Size		etupSize = HNSW_ELEMENT_TUPLE_SIZE(VARSIZE_ANY(DatumGetPointer(value)));
+	bool		merge;
+
+	/* Appends are serialized by the metapage buffer lock */
+	if (!ConditionalLockPage(index, HNSW_PENDING_LOCK, ShareLock))
+		return false;
+
+	/* Prepare tuple */
+	etup = palloc0(etupSize);
+	etup->type = HNSW_PENDING_TUPLE_TYPE;
+	etup->heaptids[0] = *heaptid;
+	for (int i = 1; i < HNSW_HEAPTIDS; i++)
+		ItemPointerSetInvalid(&etup->heaptids[i]);
+	ItemPointerSetInvalid(&etup->neighbortid);
+	memcpy(&etup->data, DatumGetPointer(value), VARSIZE_ANY(DatumGetPointer(value)));
+
+	metabuf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+	metap = HnswPageGetMeta(metapage);
+	HnswSetMetaPageLower(metapage);
+
+	if (!HnswHasPendingList(metap))
+	{
+		AppendPendingPage(index, state, &buf, &page);
+		metap->pendingHead = BufferGetBlockNumber(buf);
+		metap->pendingTail = metap->pendingHead;
+		metap->pendingPages = 1;
+		metap->pendingTuples = 0;
+	}
+	else
+	{
+		buf = ReadBuffer(index, metap->pendingTail);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+	}
+
+	/* Move to the next page, reusing pages from earlier lists */
+	if (PageGetFreeSpace(page) < etupSize)
+	{
+		BlockNumber nextblkno = HnswPageGetOpaque(page)->nextblkno;
+		Page		prevpage = page;
+
+		prevbuf = buf;
+
+		if (BlockNumberIsValid(nextblkno))
+		{
+			buf = ReadBuffer(index, nextblkno);
+			LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+			page = GenericXLogRegisterBuffer(state, buf, 0);
+		}
+		else
+		{
+			AppendPendingPage(index, state, &buf, &page);
+			HnswPageGetOpaque(prevpage)->nextblkno = BufferGetBlockNumber(buf);
+		}
+
+		metap->pendingTail = BufferGetBlockNumber(buf);
+		metap->pendingPages++;
+	}
+
+	if (PageAddItem(page, (Item) etup, etupSize, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+		elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+	metap->pendingTuples++;
+	merge = (Size) metap->pendingPages * BLCKSZ > (Size) hnsw_pending_list_limit * 1024;
+
+	/* Commit */
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+	if (BufferIsValid(prevbuf))
+		UnlockReleaseBuffer(prevbuf);
+	UnlockReleaseBuffer(metabuf);
+
+	UnlockPage(index, HNSW_PENDING_LOCK, ShareLock);
+
+	/* Skip if another backend is already merging */
+	if (merge)
+		HnswMergePending(index, false);
+
+	return true;
+}
+
+/*
+ * Set the state of a pending tuple
+ */
+static void
+SetPendingState(Relation index, BlockNumber blkno, OffsetNumber offno, uint8 mergeState)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	HnswElementTuple etup;
+
+	buf = ReadBuffer(index, blkno);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	etup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+	Assert(HnswIsPendingTuple(etup));
+	etup->deleted = mergeState;
+
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Check if an element in the graph has a heap TID
+ *
+ * Reads every page, but is only needed after a merge fails
+ */
+static bool
+GraphHasHeapTid(Relation index, ItemPointer heaptid)
+{
+	BlockNumber nblocks = RelationGetNumberOfBlocks(index);
+	BufferAccessStrategy bas = GetAccessStrategy(BAS_BULKREAD);
+	bool		found = false;
+
+	for (BlockNumber blkno = HNSW_HEAD_BLKNO; blkno < nblocks && !found; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, bas);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageIsNew(page) ? InvalidOffsetNumber : PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno && !found; offno = OffsetNumberNext(offno))
+		{
+			HnswElementTuple etup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (!HnswIsElementTuple(etup))
+				continue;
+
+			for (int i = 0; i < HNSW_HEAPTIDS; i++)
+			{
+				if (ItemPointerIsValid(&etup->heaptids[i]) && ItemPointerEquals(&etup->heaptids[i], heaptid))
+				{
+					found = true;
+					break;
+				}
+			}
+		}
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	FreeAccessStrategy(bas);
+
+	return found;
+}
+
+/*
+ * Clear the pending list after every tuple is merged
+ */
+static void
+ClearPendingList(Relation index)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	HnswMetaPage metap;
+	GenericXLogState *state;
+	BlockNumber blkno;
+	BlockNumber tail;
+
+	metabuf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+	metap = HnswPageGetMeta(BufferGetPage(metabuf));
+	blkno = metap->pendingHead;
+	tail = metap->pendingTail;
+	LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+
+	/* Clear pages, keeping the chain */
+	for (;;)
+	{
+		Buffer		buf;
+		Page		page;
+		BlockNumber nextblkno;
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, GENERIC_XLOG_FULL_IMAGE);
+
+		nextblkno = HnswPageGetOpaque(page)->nextblkno;
+		HnswInitPage(buf, page);
+		HnswPageGetOpaque(page)->nextblkno = nextblkno;
+
+		GenericXLogFinish(state);
+		UnlockReleaseBuffer(buf);
+
+		if (blkno == tail)
+			break;
+
+		blkno = nextblkno;
+	}
+
+	/* Start over at the head */
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+	metap = HnswPageGetMeta(metapage);
+	HnswSetMetaPageLower(metapage);
+	metap->pendingTail = metap->pendingHead;
+	metap->pendingPages = 1;
+	metap->pendingTuples = 0;
+	GenericXLogFinish(state);
+
+	UnlockReleaseBuffer(metabuf);
+}
+
+/*
+ * Merge the pending list into the graph
+ *
+ * Returns the number of tuples merged
+ */
+int64
+HnswMergePending(Relation index, bool wait)
+{
+	Buffer		buf;
+	Page		page;
+	HnswMetaPage metap;
+	BlockNumber blkno;
+	BlockNumber tail;
+	HnswSupport support;
+	MemoryContext tmpCtx;
+	MemoryContext oldCtx;
+	char	   *copy;
+	int64		merged = 0;
+
+	if (wait)
+		LockPage(index, HNSW_PENDING_LOCK, ExclusiveLock);
+	else if (!ConditionalLockPage(index, HNSW_PENDING_LOCK, ExclusiveLock))
+		return 0;
+
+	buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	metap = HnswPageGetMeta(BufferGetPage(buf));
+	if (!HnswHasPendingList(metap) || metap->pendingTuples == 0)
+	{
+		UnlockReleaseBuffer(buf);
+		UnlockPage(index, HNSW_PENDING_LOCK, ExclusiveLock);
+		return 0;
+	}
+	blkno = metap->pendingHead;
+	tail = metap->pendingTail;
+	UnlockReleaseBuffer(buf);
+
+	/* Values are already normalized and quantized */
+	HnswInitSupport(&support, index);
+	HnswInitQuantization(&support, index);
+
+	tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+								   "Hnsw pending merge temporary context",
+								   ALLOCSET_DEFAULT_SIZES);
+	copy = palloc(BLCKSZ);
+
+	for (;;)
+	{
+		OffsetNumber maxoffno;
+		BlockNumber nextblkno;
+
+		/* Copy the page, since inserts lock other pages */
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		memcpy(copy, page, BLCKSZ);
+		UnlockReleaseBuffer(buf);
+
+		page = (Page) copy;
+		maxoffno = PageGetMaxOffsetNumber(page);
+		nextblkno = HnswPageGetOpaque(page)->nextblkno;
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			HnswElementTuple etup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (!HnswIsPendingTuple(etup) || etup->deleted == HNSW_PENDING_MERGED)
+				continue;
+
+			/* Can take a while, so ensure we can interrupt */
+			CHECK_FOR_INTERRUPTS();
+
+			/* Skip the insert if an earlier merge failed after it */
+			if (etup->deleted != HNSW_PENDING_MERGING || !GraphHasHeapTid(index, &etup->heaptids[0]))
+			{
+				SetPendingState(index, blkno, offno, HNSW_PENDING_MERGING);
+
+				oldCtx = MemoryContextSwitchTo(tmpCtx);
+				HnswInsertTupleOnDisk(index, &support, PointerGetDatum(&etup->data), NULL, NULL, &etup->heaptids[0], false);
+				MemoryContextSwitchTo(oldCtx);
+				MemoryContextReset(tmpCtx);
+			}
+
+			SetPendingState(index, blkno, offno, HNSW_PENDING_MERGED);
+			merged++;
+		}
+
+		if (blkno == tail)
+			break;
+
+		blkno = nextblkno;
+	}
+
+	ClearPendingList(index);
+
+	pfree(copy);
+	MemoryContextDelete(tmpCtx);
+
+	UnlockPage(index, HNSW_PENDING_LOCK, ExclusiveLock);
+
+	return merged;
+}
+
+/*
+ * Get candidates for the tuples in the pending list
+ *
+ * Must be called before searching the graph, so tuples merged concurrently
+ * are found in one or the other
+ */
+List *
+HnswGetPendingItems(Relation index, HnswSupport * support, Datum q)
+{
+	Buffer		buf;
+	Page		page;
+	HnswMetaPage metap;
+	BlockNumber blkno;
+	BlockNumber tail;
+	List	   *items = NIL;
+	char	   *base = NULL;
+
+	buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	metap = HnswPageGetMeta(BufferGetPage(buf));
+	if (!HnswHasPendingList(metap) || metap->pendingTuples == 0)
+	{
+		UnlockReleaseBuffer(buf);
+		return NIL;
+	}
+	blkno = metap->pendingHead;
+	tail = metap->pendingTail;
+	UnlockReleaseBuffer(buf);
+
+	for (;;)
+	{
+		OffsetNumber maxoffno;
+		BlockNumber nextblkno;
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+		nextblkno = HnswPageGetOpaque(page)->nextblkno;
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			HnswElementTuple etup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+			HnswElement element;
+			HnswCandidate *hc;
+
+			/* Tuples being merged may not be in the graph yet */
+			if (!HnswIsPendingTuple(etup) || etup->deleted == HNSW_PENDING_MERGED)
+				continue;
+
+			element = HnswInitElementFromBlock(blkno, offno);
+			element->level = 0;
+			element->deleted = 0;
+			element->heaptidsLength = 0;
+			HnswAddHeapTid(element, &etup->heaptids[0]);
+
+			hc = palloc(sizeof(HnswCandidate));
+			HnswPtrStore(base, hc->element, element);
+			hc->distance = (float) HnswDistance(support, q, PointerGetDatum(&etup->data));
+			items = lappend(items, hc);
+		}
+
+		UnlockReleaseBuffer(buf);
+
+		/* Appends may have moved the tail, but those tuples are not visible */
+		if (blkno == tail || !BlockNumberIsValid(nextblkno))
+			break;
+
+		blkno = nextblkno;
+	}
+
+	return items;
+}
+
+/*
+ * Merge the pending list of an index into the graph
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(hnsw_merge_pending);
+Datum
+hnsw_merge_pending(PG_FUNCTION_ARGS)
+{
+	Oid			indexoid = PG_GETARG_OID(0);
+	Relation	index;
+	int64		merged;
+
+	if (RecoveryInProgress())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("recovery is in progress"),
+				 errhint("HNSW pending list cannot be merged during recovery.")));
+
+	index = index_open(indexoid, RowExclusiveLock);
+
+	if (index->rd_rel->relkind != RELKIND_INDEX || index->rd_indam->ambuild != hnswbuild)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not an HNSW index", RelationGetRelationName(index))));
+
+	/* Same privileges as vacuum */
+	if (!HnswOwnerCheck(indexoid))
+		aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_INDEX, RelationGetRelationName(index));
+
+	/* Other sessions' temporary indexes cannot be accessed */
+	if (RELATION_IS_OTHER_TEMP(index))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary indexes of other sessions")));
+
+	merged = HnswMergePending(index, true);
+
+	index_close(index, RowExclusiveLock);
+
+	PG_RETURN_INT64(merged);
+}
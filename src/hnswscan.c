@@ -1,12 +1,136 @@
 #include "postgres.h"
 
 #include "access/relscan.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "executor/executor.h"
 #include "hnsw.h"
+#include "optimizer/cost.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
 #include "utils/memutils.h"
 
+/*
+ * Get the shared state of a parallel scan
+ */
+static inline HnswParallelScan
+GetParallelScan(IndexScanDesc scan)
+{
+#if PG_VERSION_NUM >= 180000
+	return (HnswParallelScan) OffsetToPointer(scan->parallel_scan, scan->parallel_scan->ps_offset_am);
+#else
+	return (HnswParallelScan) OffsetToPointer(scan->parallel_scan, scan->parallel_scan->ps_offset);
+#endif
+}
+
+/*
+ * Compare candidates by distance, furthest first
+ */
+static int
+CompareFurthestCandidates(const void *a, const void *b)
+{
+	const HnswCandidate *hca = *((HnswCandidate * const *) a);
+	const HnswCandidate *hcb = *((HnswCandidate * const *) b);
+
+	if (hca->distance > hcb->distance)
+		return -1;
+
+	if (hca->distance < hcb->distance)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Sort candidates from several searches, furthest first
+ */
+static List *
+SortCandidates(List *w)
+{
+	int			length = list_length(w);
+	HnswCandidate **items;
+	List	   *result = NIL;
+	ListCell   *lc;
+	int			i = 0;
+
+	if (length <= 1)
+		return w;
+
+	items = palloc(sizeof(HnswCandidate *) * length);
+	foreach(lc, w)
+		items[i++] = lfirst(lc);
+
+	qsort(items, length, sizeof(HnswCandidate *), CompareFurthestCandidates);
+
+	for (i = 0; i < length; i++)
+		result = lappend(result, items[i]);
+
+	return result;
+}
+
+/*
+ * Search layer 0 from the entry points claimed by this participant
+ *
+ * The closest elements in layer 1 are handed out to participants, and the
+ * search from each uses a share of ef_search. The visited set is shared, so
+ * each element is returned by only one participant.
+ */
+static List *
+GetParallelScanItems(IndexScanDesc scan, Datum q, List *ep, int level, int m)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	Relation	index = scan->indexRelation;
+	HnswSupport *support = &so->support;
+	HnswParallelScan pscan = GetParallelScan(scan);
+	int			maxEntries = Min(Max(hnsw_ef_search / HNSW_PARALLEL_MIN_EF, 1), HNSW_PARALLEL_MAX_ENTRIES);
+	pairingheap **discarded = NULL;
+	List	   *entries;
+	List	   *w = NIL;
+	int			numEntries;
+	int			ef;
+	char	   *base = NULL;
+
+	/* Keep discarded candidates for iterative scans */
+	if (hnsw_iterative_scan != HNSW_ITERATIVE_SCAN_OFF)
+		discarded = &so->discarded;
+
+	for (int lc = level; lc >= 2; lc--)
+		ep = HnswSearchLayer(base, q, ep, 1, lc, index, support, m, false, NULL, NULL, NULL, true, NULL);
+
+	if (level >= 1)
+		entries = HnswSearchLayer(base, q, ep, maxEntries, 1, index, support, m, false, NULL, NULL, NULL, true, NULL);
+	else
+		entries = ep;
+
+	numEntries = list_length(entries);
+	ef = (hnsw_ef_search + numEntries - 1) / numEntries;
+
+	so->v.shared = pscan;
+
+	for (;;)
+	{
+		uint32		i = pg_atomic_fetch_add_u32(&pscan->nextEntry, 1);
+		HnswCandidate *hc;
+		HnswElement element;
+
+		if (i >= (uint32) numEntries)
+			break;
+
+		/* Entries are ordered furthest first */
+		hc = list_nth(entries, numEntries - 1 - i);
+		element = HnswPtrAccess(base, hc->element);
+
+		/* Skip if another participant reached it first */
+		if (!HnswParallelVisit(pscan, element->blkno, element->offno))
+			continue;
+
+		w = list_concat(w, HnswSearchLayer(base, q, list_make1(hc), ef, 0, index, support, m, false, NULL, &so->v, discarded, false, &so->tuples));
+	}
+
+	return SortCandidates(w);
+}
+
 /*
  * Algorithm 5 from paper
  */
@@ -15,29 +139,160 @@ GetScanItems(IndexScanDesc scan, Datum q)
 {
 	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
 	Relation	index = scan->indexRelation;
-	FmgrInfo   *procinfo = so->procinfo;
-	Oid			collation = so->collation;
+	HnswSupport *support = &so->support;
 	List	   *ep;
 	List	   *w;
 	int			m;
 	HnswElement entryPoint;
+	HnswElement cached;
+	uint32		upperVersions[HNSW_UPPER_VERSIONS];
+	int			level;
 	char	   *base = NULL;
 
 	/* Get m and entry point */
-	HnswGetMetaPageInfo(index, &m, &entryPoint);
+	HnswGetMetaPageInfo(index, &m, &entryPoint, upperVersions);
 
 	if (entryPoint == NULL)
 		return NIL;
 
-	ep = list_make1(HnswEntryCandidate(base, entryPoint, q, index, procinfo, collation, false));
+	so->m = m;
+	level = entryPoint->level;
 
-	for (int lc = entryPoint->level; lc >= 1; lc--)
+	/* Parallel scans use the disk, so all participants find the same entries */
+	if (scan->parallel_scan != NULL)
 	{
-		w = HnswSearchLayer(base, q, ep, 1, lc, index, procinfo, collation, m, false, NULL);
+		ep = list_make1(HnswEntryCandidate(base, entryPoint, q, index, support, false));
+		return GetParallelScanItems(scan, q, ep, level, m);
+	}
+
+	/* Descend the upper layers in shared memory if cached */
+	cached = HnswCacheSearch(index, support, q, entryPoint, upperVersions, m, 1, &level);
+	if (cached != NULL)
+		entryPoint = cached;
+
+	ep = list_make1(HnswEntryCandidate(base, entryPoint, q, index, support, false));
+
+	/* The cached element may have been replaced since the cache was built */
+	level = Min(level, entryPoint->level);
+
+	for (int lc = level; lc >= 1; lc--)
+	{
+		w = HnswSearchLayer(base, q, ep, 1, lc, index, support, m, false, NULL, NULL, NULL, true, NULL);
 		ep = w;
 	}
 
-	return HnswSearchLayer(base, q, ep, hnsw_ef_search, 0, index, procinfo, collation, m, false, NULL);
+	/* Keep the visited set and discarded candidates for iterative scans */
+	if (hnsw_iterative_scan != HNSW_ITERATIVE_SCAN_OFF)
+		return HnswSearchLayer(base, q, ep, hnsw_ef_search, 0, index, support, m, false, NULL, &so->v, &so->discarded, true, &so->tuples);
+
+	return HnswSearchLayer(base, q, ep, hnsw_ef_search, 0, index, support, m, false, NULL, NULL, NULL, true, NULL);
+}
+
+/*
+ * Resume the search at layer 0 from the nearest discarded candidates
+ *
+ * Results from each batch are in order, but a later batch can have closer
+ * elements than an earlier one
+ */
+static List *
+ResumeScanItems(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	Relation	index = scan->indexRelation;
+	HnswSupport *support = &so->support;
+	List	   *ep = NIL;
+	char	   *base = NULL;
+
+	if (so->discarded == NULL)
+		return NIL;
+
+	for (int i = 0; i < hnsw_ef_search && !pairingheap_is_empty(so->discarded); i++)
+	{
+		HnswPairingHeapNode *node = (HnswPairingHeapNode *) pairingheap_remove_first(so->discarded);
+
+		ep = lappend(ep, node->inner);
+	}
+
+	if (ep == NIL)
+		return NIL;
+
+	return HnswSearchLayer(base, so->q, ep, hnsw_ef_search, 0, index, support, so->m, false, NULL, &so->v, &so->discarded, false, &so->tuples);
+}
+
+/*
+ * Get candidates from the pending list
+ */
+static List *
+GetPendingItems(IndexScanDesc scan, Datum q)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	List	   *pending = HnswGetPendingItems(scan->indexRelation, &so->support, q);
+	ListCell   *lc;
+	char	   *base = NULL;
+
+	so->pendingTids = NULL;
+
+	if (pending == NIL)
+		return NIL;
+
+	so->pendingTids = tidhash_create(CurrentMemoryContext, list_length(pending), NULL);
+
+	foreach(lc, pending)
+	{
+		HnswCandidate *hc = (HnswCandidate *) lfirst(lc);
+		HnswElement element = HnswPtrAccess(base, hc->element);
+		bool		found;
+
+		tidhash_insert(so->pendingTids, element->heaptids[0], &found);
+	}
+
+	return pending;
+}
+
+/*
+ * Remove heap TIDs that were found in the pending list
+ *
+ * A tuple can be in both the pending list and the graph while it is merged
+ */
+static void
+RemovePendingTids(HnswScanOpaque so, List *w)
+{
+	ListCell   *lc;
+	char	   *base = NULL;
+
+	if (so->pendingTids == NULL)
+		return;
+
+	foreach(lc, w)
+	{
+		HnswCandidate *hc = (HnswCandidate *) lfirst(lc);
+		HnswElement element = HnswPtrAccess(base, hc->element);
+		int			length = 0;
+
+		for (int i = 0; i < element->heaptidsLength; i++)
+		{
+			if (tidhash_lookup(so->pendingTids, element->heaptids[i]) == NULL)
+				element->heaptids[length++] = element->heaptids[i];
+		}
+
+		element->heaptidsLength = length;
+	}
+}
+
+/*
+ * Add candidates from the pending list to the first batch
+ */
+static List *
+AddPendingItems(IndexScanDesc scan, List *w, List *pending)
+{
+	if (pending == NIL)
+		return w;
+
+	/* Only one participant returns the pending list */
+	if (scan->parallel_scan != NULL && pg_atomic_exchange_u32(&GetParallelScan(scan)->pendingClaimed, 1) != 0)
+		return w;
+
+	return SortCandidates(list_concat(w, pending));
 }
 
 /*
@@ -73,7 +328,7 @@ GetScanValue(IndexScanDesc scan)
 	Datum		value;
 
 	if (scan->orderByData->sk_flags & SK_ISNULL)
-		value = PointerGetDatum(InitVector(GetDimensions(scan->indexRelation)));
+		value = so->support.typeInfo->zeroValue(GetDimensions(scan->indexRelation));
 	else
 	{
 		value = scan->orderByData->sk_argument;
@@ -83,13 +338,134 @@ GetScanValue(IndexScanDesc scan)
 		Assert(!VARATT_IS_EXTENDED(DatumGetPointer(value)));
 
 		/* Fine if normalization fails */
-		if (so->normprocinfo != NULL)
-			HnswNormValue(so->normprocinfo, so->collation, &value, NULL);
+		if (so->support.normprocinfo != NULL)
+			HnswNormValue(&so->support, &value);
 	}
 
 	return value;
 }
 
+/*
+ * Compare re-rank items by distance
+ */
+static int
+CompareRerankItems(const void *a, const void *b)
+{
+	if (((const HnswRerankItem *) a)->distance < ((const HnswRerankItem *) b)->distance)
+		return -1;
+
+	if (((const HnswRerankItem *) a)->distance > ((const HnswRerankItem *) b)->distance)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Set up fetching heap values for re-ranking
+ *
+ * The heap relation is not available until after beginscan
+ */
+static void
+InitRerank(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	MemoryContext oldCtx = MemoryContextSwitchTo(GetMemoryChunkContext(so));
+
+	so->indexInfo = BuildIndexInfo(scan->indexRelation);
+	so->estate = CreateExecutorState();
+	so->slot = table_slot_create(scan->heapRelation, NULL);
+	GetPerTupleExprContext(so->estate)->ecxt_scantuple = so->slot;
+	so->fetch = table_index_fetch_begin(scan->heapRelation);
+
+	MemoryContextSwitchTo(oldCtx);
+}
+
+/*
+ * Re-rank candidates by the distance to their heap values
+ *
+ * Quantized distances are approximate, and elements with the same codes are
+ * merged into one element, so each heap TID is ranked separately
+ */
+static void
+RerankScanItems(IndexScanDesc scan, Datum q)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	HnswSupport *support = &so->support;
+	ExprContext *econtext;
+	ListCell   *lc;
+	int			maxLength = 0;
+	char	   *base = NULL;
+
+	if (so->fetch == NULL)
+		InitRerank(scan);
+
+	econtext = GetPerTupleExprContext(so->estate);
+
+	foreach(lc, so->w)
+	{
+		HnswCandidate *hc = (HnswCandidate *) lfirst(lc);
+		HnswElement element = HnswPtrAccess(base, hc->element);
+
+		maxLength += element->heaptidsLength;
+	}
+
+	if (so->rerankItems != NULL)
+		pfree(so->rerankItems);
+
+	so->rerankItems = palloc(sizeof(HnswRerankItem) * Max(maxLength, 1));
+	so->rerankLength = 0;
+	so->rerankPos = 0;
+
+	foreach(lc, so->w)
+	{
+		HnswCandidate *hc = (HnswCandidate *) lfirst(lc);
+		HnswElement element = HnswPtrAccess(base, hc->element);
+
+		for (int i = 0; i < element->heaptidsLength; i++)
+		{
+			ItemPointerData heaptid = element->heaptids[i];
+			bool		call_again = false;
+			bool		all_dead = false;
+			Datum		values[INDEX_MAX_KEYS];
+			bool		isnull[INDEX_MAX_KEYS];
+			Datum		value;
+			HnswRerankItem *item;
+			MemoryContext oldCtx;
+
+			/* Skip if no visible tuple, like the executor would */
+			if (!table_index_fetch_tuple(so->fetch, &heaptid, scan->xs_snapshot, so->slot, &call_again, &all_dead))
+				continue;
+
+			oldCtx = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+			/* Get the indexed value, which may be an expression */
+			FormIndexDatum(so->indexInfo, so->slot, so->estate, values, isnull);
+
+			if (!isnull[0])
+			{
+				value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+
+				/* Fine if normalization fails */
+				if (support->normprocinfo != NULL)
+					HnswNormValue(support, &value);
+
+				item = &so->rerankItems[so->rerankLength++];
+				item->heaptid = heaptid;
+				item->distance = VectorDistance(support->distfunc, support->procinfo, support->collation, q, value);
+			}
+
+			MemoryContextSwitchTo(oldCtx);
+			ResetExprContext(econtext);
+		}
+	}
+
+	/* Release the heap buffer */
+	ExecClearTuple(so->slot);
+	table_index_fetch_reset(so->fetch);
+
+	qsort(so->rerankItems, so->rerankLength, sizeof(HnswRerankItem), CompareRerankItems);
+}
+
 /*
  * Prepare for an index scan
  */
@@ -108,9 +484,20 @@ hnswbeginscan(Relation index, int nkeys, int norderbys)
 									   ALLOCSET_DEFAULT_SIZES);
 
 	/* Set support functions */
-	so->procinfo = index_getprocinfo(index, 1, HNSW_DISTANCE_PROC);
-	so->normprocinfo = HnswOptionalProcInfo(index, HNSW_NORM_PROC);
-	so->collation = index->rd_indcollation[0];
+	HnswInitSupport(&so->support, index);
+
+	/* Set up on first scan of a quantized index */
+	so->indexInfo = NULL;
+	so->estate = NULL;
+	so->fetch = NULL;
+	so->slot = NULL;
+	so->rerankItems = NULL;
+	so->rerankLength = 0;
+	so->rerankPos = 0;
+	so->pendingTids = NULL;
+
+	/* Reuse the visited set across batches and rescans */
+	so->v.table = HnswCreateVisitedTable(CurrentMemoryContext);
 
 	scan->opaque = so;
 
@@ -127,6 +514,7 @@ hnswrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int no
 
 	so->first = true;
 	MemoryContextReset(so->tmpCtx);
+	so->rerankItems = NULL;
 
 	if (keys && scan->numberOfKeys > 0)
 		memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
@@ -152,7 +540,7 @@ hnswgettuple(IndexScanDesc scan, ScanDirection dir)
 
 	if (so->first)
 	{
-		Datum		value;
+		List	   *pending;
 
 		/* Count index scan for stats */
 		pgstat_count_index_scan(scan->indexRelation);
@@ -166,8 +554,27 @@ hnswgettuple(IndexScanDesc scan, ScanDirection dir)
 		if (!IsMVCCSnapshot(scan->xs_snapshot))
 			elog(ERROR, "non-MVCC snapshots are not supported with hnsw");
 
+		/* Get after the snapshot, since the first insert can set the range */
+		HnswInitQuantization(&so->support, scan->indexRelation);
+
+		/* Nothing visible was inserted if the range is not set */
+		if (so->support.quantization != HNSW_QUANTIZATION_NONE && so->support.scale == 0)
+		{
+			MemoryContextSwitchTo(oldCtx);
+			return false;
+		}
+
 		/* Get scan value */
-		value = GetScanValue(scan);
+		so->value = GetScanValue(scan);
+
+		/* Search the graph with the quantized value */
+		if (so->support.quantization != HNSW_QUANTIZATION_NONE)
+			so->q = HnswQuantizeValue(&so->support, so->value);
+		else
+			so->q = so->value;
+
+		so->discarded = NULL;
+		so->tuples = 0;
 
 		/*
 		 * Get a shared lock. This allows vacuum to ensure no in-flight scans
@@ -175,36 +582,80 @@ hnswgettuple(IndexScanDesc scan, ScanDirection dir)
 		 */
 		LockPage(scan->indexRelation, HNSW_SCAN_LOCK, ShareLock);
 
-		so->w = GetScanItems(scan, value);
+		/* Read the pending list first, so tuples being merged are not missed */
+		pending = GetPendingItems(scan, so->q);
+
+		so->w = GetScanItems(scan, so->q);
+		RemovePendingTids(so, so->w);
+		so->w = AddPendingItems(scan, so->w, pending);
 
 		/* Release shared lock */
 		UnlockPage(scan->indexRelation, HNSW_SCAN_LOCK, ShareLock);
 
+		/* Order the candidates by exact distance */
+		if (so->support.quantization != HNSW_QUANTIZATION_NONE)
+			RerankScanItems(scan, so->value);
+
 		so->first = false;
 	}
 
-	while (list_length(so->w) > 0)
+	for (;;)
 	{
-		char	   *base = NULL;
-		HnswCandidate *hc = llast(so->w);
-		HnswElement element = HnswPtrAccess(base, hc->element);
-		ItemPointer heaptid;
+		if (so->support.quantization != HNSW_QUANTIZATION_NONE)
+		{
+			if (so->rerankPos < so->rerankLength)
+			{
+				ItemPointer heaptid = &so->rerankItems[so->rerankPos++].heaptid;
 
-		/* Move to next element if no valid heap TIDs */
-		if (element->heaptidsLength == 0)
+				MemoryContextSwitchTo(oldCtx);
+
+				scan->xs_heaptid = *heaptid;
+				scan->xs_recheck = false;
+				scan->xs_recheckorderby = false;
+				return true;
+			}
+		}
+		else
 		{
-			so->w = list_delete_last(so->w);
-			continue;
+			while (list_length(so->w) > 0)
+			{
+				char	   *base = NULL;
+				HnswCandidate *hc = llast(so->w);
+				HnswElement element = HnswPtrAccess(base, hc->element);
+				ItemPointer heaptid;
+
+				/* Move to next element if no valid heap TIDs */
+				if (element->heaptidsLength == 0)
+				{
+					so->w = list_delete_last(so->w);
+					continue;
+				}
+
+				heaptid = &element->heaptids[--element->heaptidsLength];
+
+				MemoryContextSwitchTo(oldCtx);
+
+				scan->xs_heaptid = *heaptid;
+				scan->xs_recheck = false;
+				scan->xs_recheckorderby = false;
+				return true;
+			}
 		}
 
-		heaptid = &element->heaptids[--element->heaptidsLength];
+		/* Stop unless iterative scans can visit more tuples */
+		if (hnsw_iterative_scan == HNSW_ITERATIVE_SCAN_OFF || so->tuples >= hnsw_max_scan_tuples)
+			break;
 
-		MemoryContextSwitchTo(oldCtx);
+		LockPage(scan->indexRelation, HNSW_SCAN_LOCK, ShareLock);
+		so->w = ResumeScanItems(scan);
+		RemovePendingTids(so, so->w);
+		UnlockPage(scan->indexRelation, HNSW_SCAN_LOCK, ShareLock);
 
-		scan->xs_heaptid = *heaptid;
-		scan->xs_recheck = false;
-		scan->xs_recheckorderby = false;
-		return true;
+		if (so->w == NIL)
+			break;
+
+		if (so->support.quantization != HNSW_QUANTIZATION_NONE)
+			RerankScanItems(scan, so->value);
 	}
 
 	MemoryContextSwitchTo(oldCtx);
@@ -219,8 +670,92 @@ hnswendscan(IndexScanDesc scan)
 {
 	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
 
+	if (so->fetch != NULL)
+	{
+		table_index_fetch_end(so->fetch);
+		ExecDropSingleTupleTableSlot(so->slot);
+		FreeExecutorState(so->estate);
+	}
+
 	MemoryContextDelete(so->tmpCtx);
 
+	if (so->v.table->slots != NULL)
+		pfree(so->v.table->slots);
+	pfree(so->v.table);
+
 	pfree(so);
 	scan->opaque = NULL;
 }
+
+/*
+ * Get the number of slots in the shared visited set
+ */
+static uint32
+GetParallelVisitedSize(void)
+{
+	/*
+	 * Each candidate expanded at layer 0 visits up to 2 * m neighbors. The
+	 * index is not available when initializing, so use the max m.
+	 */
+	int64		capacity = (int64) hnsw_ef_search * HNSW_MAX_M * 2;
+	uint32		size = 1;
+
+	/* Iterative scans visit up to max scan tuples in each participant */
+	if (hnsw_iterative_scan != HNSW_ITERATIVE_SCAN_OFF)
+		capacity = Max(capacity, (int64) hnsw_max_scan_tuples * (max_parallel_workers_per_gather + 1));
+
+	/* Keep the load factor at most 0.5 */
+	while (size < capacity * 2 && size < HNSW_PARALLEL_MAX_VISITED)
+		size <<= 1;
+
+	return size;
+}
+
+/*
+ * Reset the shared state of a parallel scan
+ */
+static void
+ResetParallelScan(HnswParallelScan pscan)
+{
+	pg_atomic_init_u32(&pscan->nextEntry, 0);
+	pg_atomic_init_u32(&pscan->pendingClaimed, 0);
+
+	for (uint32 i = 0; i < pscan->visitedSize; i++)
+		pg_atomic_init_u64(&pscan->visited[i], 0);
+}
+
+/*
+ * Estimate the size of the shared state for a parallel scan
+ */
+Size
+#if PG_VERSION_NUM >= 180000
+hnswestimateparallelscan(Relation index, int nkeys, int norderbys)
+#elif PG_VERSION_NUM >= 170000
+hnswestimateparallelscan(int nkeys, int norderbys)
+#else
+hnswestimateparallelscan(void)
+#endif
+{
+	return add_size(offsetof(HnswParallelScanData, visited), mul_size(sizeof(pg_atomic_uint64), GetParallelVisitedSize()));
+}
+
+/*
+ * Initialize the shared state for a parallel scan
+ */
+void
+hnswinitparallelscan(void *target)
+{
+	HnswParallelScan pscan = (HnswParallelScan) target;
+
+	pscan->visitedSize = GetParallelVisitedSize();
+	ResetParallelScan(pscan);
+}
+
+/*
+ * Reset the shared state before a parallel scan is restarted
+ */
+void
+hnswparallelrescan(IndexScanDesc scan)
+{
+	ResetParallelScan(GetParallelScan(scan));
+}
@@ -1,5 +1,6 @@
 #include "postgres.h"
 
+#include <float.h>
 #include <math.h>
 
 #include "access/generic_xlog.h"
@@ -8,6 +9,7 @@
 #include "storage/bufmgr.h"
 #include "utils/datum.h"
 #include "utils/memdebug.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "vector.h"
 
@@ -17,6 +19,32 @@
 #include "utils/hashutils.h"
 #endif
 
+PGDLLEXPORT Datum l2_normalize(PG_FUNCTION_ARGS);
+
+#define SearchItemBefore(queue, a, b) ((queue)->furthest ? (a)->distance > (b)->distance : (a)->distance < (b)->distance)
+
+/* Element in a search queue */
+typedef struct HnswSearchItem
+{
+	HnswElement element;
+	float		distance;
+}			HnswSearchItem;
+
+/* Binary heap of elements */
+typedef struct HnswSearchQueue
+{
+	HnswSearchItem *items;
+	int			length;
+	int			capacity;
+	bool		furthest;		/* furthest first instead of nearest first */
+}			HnswSearchQueue;
+
+/* Visited sets and queues reused by searches, which do not overlap within a backend */
+static HnswVisitedTable * localVisited = NULL;
+static uint32 buildEpoch = 0;
+static HnswSearchQueue searchCandidates = {NULL, 0, 0, false};
+static HnswSearchQueue searchResults = {NULL, 0, 0, true};
+
 #if PG_VERSION_NUM < 170000
 static inline uint64
 murmurhash64(uint64 data)
@@ -60,27 +88,6 @@ hash_tid(ItemPointerData tid)
 #define SH_DEFINE
 #include "lib/simplehash.h"
 
-/* Pointer hash table */
-static uint32
-hash_pointer(uintptr_t ptr)
-{
-#if SIZEOF_VOID_P == 8
-	return murmurhash64((uint64) ptr);
-#else
-	return murmurhash32((uint32) ptr);
-#endif
-}
-
-#define SH_PREFIX		pointerhash
-#define SH_ELEMENT_TYPE	PointerHashEntry
-#define SH_KEY_TYPE		uintptr_t
-#define	SH_KEY			ptr
-#define SH_HASH_KEY(tb, key)	hash_pointer(key)
-#define SH_EQUAL(tb, a, b)		(a == b)
-#define	SH_SCOPE		extern
-#define SH_DEFINE
-#include "lib/simplehash.h"
-
 /* Offset hash table */
 static uint32
 hash_offset(Size offset)
@@ -102,13 +109,6 @@ hash_offset(Size offset)
 #define SH_DEFINE
 #include "lib/simplehash.h"
 
-typedef union
-{
-	pointerhash_hash *pointers;
-	offsethash_hash *offsets;
-	tidhash_hash *tids;
-}			visited_hash;
-
 /*
  * Get the max number of connections in an upper layer for each element in the index
  */
@@ -137,6 +137,57 @@ HnswGetEfConstruction(Relation index)
 	return HNSW_DEFAULT_EF_CONSTRUCTION;
 }
 
+/*
+ * Get the quantization in the index options
+ *
+ * Only used when building, since the metapage records the quantization used
+ */
+int
+HnswGetQuantization(Relation index)
+{
+	HnswOptions *opts = (HnswOptions *) index->rd_options;
+
+	if (opts && opts->quantizationOffset > 0)
+	{
+		char	   *quantization = (char *) opts + opts->quantizationOffset;
+
+		if (strcmp(quantization, "int8") == 0)
+			return HNSW_QUANTIZATION_INT8;
+	}
+
+	return HNSW_QUANTIZATION_NONE;
+}
+
+/*
+ * Get whether to store neighbors on separate pages
+ *
+ * Only used when building, since tuples are found through their TIDs
+ */
+bool
+HnswGetSeparateNeighbors(Relation index)
+{
+	HnswOptions *opts = (HnswOptions *) index->rd_options;
+
+	if (opts)
+		return opts->separateNeighbors;
+
+	return false;
+}
+
+/*
+ * Get whether to add inserts to the pending list
+ */
+bool
+HnswGetFastUpdate(Relation index)
+{
+	HnswOptions *opts = (HnswOptions *) index->rd_options;
+
+	if (opts)
+		return opts->fastupdate;
+
+	return false;
+}
+
 /*
  * Get proc
  */
@@ -149,6 +200,193 @@ HnswOptionalProcInfo(Relation index, uint16 procnum)
 	return index_getprocinfo(index, 1, procnum);
 }
 
+/*
+ * Get a zero vector
+ */
+static Datum
+VectorZeroValue(int dimensions)
+{
+	return PointerGetDatum(InitVector(dimensions));
+}
+
+/*
+ * Get type info
+ */
+const HnswTypeInfo *
+HnswGetTypeInfo(Relation index)
+{
+	FmgrInfo   *procinfo = HnswOptionalProcInfo(index, HNSW_TYPE_INFO_PROC);
+
+	if (procinfo == NULL)
+	{
+		static const HnswTypeInfo typeInfo = {
+			.maxDimensions = HNSW_MAX_DIM,
+			.normalize = l2_normalize,
+			.zeroValue = VectorZeroValue
+		};
+
+		return (&typeInfo);
+	}
+	else
+		return (const HnswTypeInfo *) DatumGetPointer(FunctionCall0Coll(procinfo, InvalidOid));
+}
+
+/*
+ * Init support functions
+ */
+void
+HnswInitSupport(HnswSupport * support, Relation index)
+{
+	support->procinfo = index_getprocinfo(index, 1, HNSW_DISTANCE_PROC);
+	support->normprocinfo = HnswOptionalProcInfo(index, HNSW_NORM_PROC);
+	support->collation = index->rd_indcollation[0];
+	support->distfunc = VectorGetDistanceFunc(support->procinfo);
+	support->typeInfo = HnswGetTypeInfo(index);
+	support->quantization = HNSW_QUANTIZATION_NONE;
+	support->scale = 1;
+	support->offset = 0;
+}
+
+/*
+ * Get the quantization from the metapage
+ *
+ * The quantization does not change once the range is set, so it is cached in
+ * the relcache entry, which is rebuilt when the index is
+ */
+void
+HnswInitQuantization(HnswSupport * support, Relation index)
+{
+	HnswQuantizationCache *cache = (HnswQuantizationCache *) index->rd_amcache;
+
+	if (cache == NULL)
+	{
+		Buffer		buf;
+		HnswMetaPage metap;
+		HnswQuantizationCache info;
+
+		buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		metap = HnswPageGetMeta(BufferGetPage(buf));
+		info.quantization = metap->quantization;
+		info.scale = metap->quantizationScale;
+		info.offset = metap->quantizationOffset;
+		UnlockReleaseBuffer(buf);
+
+		/* A scale of zero means the index was built empty */
+		if (info.quantization != HNSW_QUANTIZATION_NONE && info.scale == 0)
+		{
+			support->quantization = info.quantization;
+			support->scale = 0;
+			support->offset = 0;
+			return;
+		}
+
+		cache = MemoryContextAlloc(index->rd_indexcxt, sizeof(HnswQuantizationCache));
+		*cache = info;
+		index->rd_amcache = cache;
+	}
+
+	if (cache->quantization != HNSW_QUANTIZATION_NONE)
+	{
+		support->quantization = cache->quantization;
+		support->scale = cache->scale;
+		support->offset = cache->offset;
+	}
+}
+
+/*
+ * Set the scale and offset for a range of values
+ */
+void
+HnswSetQuantizationScale(HnswSupport * support, float min, float max)
+{
+	support->offset = min;
+	support->scale = (max - min) / PG_UINT8_MAX;
+
+	/* All elements have the same value */
+	if (support->scale == 0)
+		support->scale = 1;
+}
+
+/*
+ * Set the range from the first value inserted into an index built empty
+ *
+ * Later values outside of it are clamped, so indexes should be built after
+ * loading data
+ */
+void
+HnswInitQuantizationRange(HnswSupport * support, Relation index, Datum value)
+{
+	Vector	   *vec = DatumGetVector(value);
+	Buffer		buf;
+	GenericXLogState *state;
+	HnswMetaPage metap;
+
+	buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	metap = HnswPageGetMeta(GenericXLogRegisterBuffer(state, buf, 0));
+
+	/* Another backend may have set it */
+	if (metap->quantizationScale == 0)
+	{
+		float		min = FLT_MAX;
+		float		max = -FLT_MAX;
+
+		for (int i = 0; i < vec->dim; i++)
+		{
+			if (vec->x[i] < min)
+				min = vec->x[i];
+
+			if (vec->x[i] > max)
+				max = vec->x[i];
+		}
+
+		HnswSetQuantizationScale(support, min, max);
+		metap->quantizationScale = support->scale;
+		metap->quantizationOffset = support->offset;
+		GenericXLogFinish(state);
+	}
+	else
+	{
+		support->scale = metap->quantizationScale;
+		support->offset = metap->quantizationOffset;
+		GenericXLogAbort(state);
+	}
+
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Quantize a value for the graph
+ *
+ * Elements outside the range of the index are clamped
+ */
+Datum
+HnswQuantizeValue(HnswSupport * support, Datum value)
+{
+	Vector	   *vec = DatumGetVector(value);
+	QuantizedVector *result = InitQuantizedVector(vec->dim);
+	int32		sum = 0;
+
+	for (int i = 0; i < vec->dim; i++)
+	{
+		float		code = rint((vec->x[i] - support->offset) / support->scale);
+
+		if (code < 0)
+			code = 0;
+		else if (code > PG_UINT8_MAX)
+			code = PG_UINT8_MAX;
+
+		result->x[i] = (uint8) code;
+		sum += result->x[i];
+	}
+
+	result->sum = sum;
+
+	return PointerGetDatum(result);
+}
+
 /*
  * Divide by the norm
  *
@@ -158,21 +396,13 @@ HnswOptionalProcInfo(Relation index, uint16 procnum)
  * if it's different than the original value
  */
 bool
-HnswNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result)
+HnswNormValue(HnswSupport * support, Datum *value)
 {
-	double		norm = DatumGetFloat8(FunctionCall1Coll(procinfo, collation, *value));
+	double		norm = DatumGetFloat8(FunctionCall1Coll(support->normprocinfo, support->collation, *value));
 
 	if (norm > 0)
 	{
-		Vector	   *v = DatumGetVector(*value);
-
-		if (result == NULL)
-			result = InitVector(v->dim);
-
-		for (int i = 0; i < v->dim; i++)
-			result->x[i] = v->x[i] / norm;
-
-		*value = PointerGetDatum(result);
+		*value = DirectFunctionCall1Coll(support->typeInfo->normalize, support->collation, *value);
 
 		return true;
 	}
@@ -262,6 +492,7 @@ HnswInitElement(char *base, ItemPointer heaptid, int m, double ml, int maxLevel,
 
 	element->level = level;
 	element->deleted = 0;
+	element->visited = 0;
 
 	HnswInitNeighbors(base, element, m, allocator);
 
@@ -299,7 +530,7 @@ HnswInitElementFromBlock(BlockNumber blkno, OffsetNumber offno)
  * Get the metapage info
  */
 void
-HnswGetMetaPageInfo(Relation index, int *m, HnswElement * entryPoint)
+HnswGetMetaPageInfo(Relation index, int *m, HnswElement * entryPoint, uint32 *upperVersions)
 {
 	Buffer		buf;
 	Page		page;
@@ -324,6 +555,9 @@ HnswGetMetaPageInfo(Relation index, int *m, HnswElement * entryPoint)
 			*entryPoint = NULL;
 	}
 
+	if (upperVersions != NULL)
+		memcpy(upperVersions, metap->upperVersions, sizeof(metap->upperVersions));
+
 	UnlockReleaseBuffer(buf);
 }
 
@@ -335,20 +569,51 @@ HnswGetEntryPoint(Relation index)
 {
 	HnswElement entryPoint;
 
-	HnswGetMetaPageInfo(index, NULL, &entryPoint);
+	HnswGetMetaPageInfo(index, NULL, &entryPoint, NULL);
 
 	return entryPoint;
 }
 
+/*
+ * Include all metapage fields in the page
+ *
+ * Indexes created before the later fields existed have a shorter metapage,
+ * and generic WAL records only include data before pd_lower
+ */
+void
+HnswSetMetaPageLower(Page page)
+{
+	char	   *metaEnd = (char *) HnswPageGetMeta(page) + sizeof(HnswMetaPageData);
+
+	if (((PageHeader) page)->pd_lower < metaEnd - (char *) page)
+		((PageHeader) page)->pd_lower = metaEnd - (char *) page;
+}
+
 /*
  * Update the metapage info
+ *
+ * With HNSW_UPDATE_UPPER, the entry point is not changed, and only the
+ * versions for the layers of entryPoint (or all layers if NULL) are bumped
  */
 static void
 HnswUpdateMetaPageInfo(Page page, int updateEntry, HnswElement entryPoint, BlockNumber insertPage)
 {
 	HnswMetaPage metap = HnswPageGetMeta(page);
 
-	if (updateEntry)
+	HnswSetMetaPageLower(page);
+
+	if (updateEntry == HNSW_UPDATE_UPPER)
+	{
+		int			levels = HNSW_UPPER_VERSIONS;
+
+		if (entryPoint != NULL)
+			levels = Min(entryPoint->level, HNSW_UPPER_VERSIONS);
+
+		/* Invalidate cached copies of the changed layers */
+		for (int i = 0; i < levels; i++)
+			metap->upperVersions[i]++;
+	}
+	else if (updateEntry)
 	{
 		if (entryPoint == NULL)
 		{
@@ -362,6 +627,9 @@ HnswUpdateMetaPageInfo(Page page, int updateEntry, HnswElement entryPoint, Block
 			metap->entryOffno = entryPoint->offno;
 			metap->entryLevel = entryPoint->level;
 		}
+
+		for (int i = 0; i < HNSW_UPPER_VERSIONS; i++)
+			metap->upperVersions[i]++;
 	}
 
 	if (BlockNumberIsValid(insertPage))
@@ -551,11 +819,50 @@ HnswLoadElementFromTuple(HnswElement element, HnswElementTuple etup, bool loadHe
 	}
 }
 
+/*
+ * Calculate the distance between quantized values
+ *
+ * Element i is offset + scale * x[i], so the offset cancels out for L2
+ * distance and only needs the sums of the codes for inner product
+ */
+static double
+HnswQuantizedDistance(HnswSupport * support, Datum a, Datum b)
+{
+	QuantizedVector *av = (QuantizedVector *) DatumGetPointer(a);
+	QuantizedVector *bv = (QuantizedVector *) DatumGetPointer(b);
+	double		scale = support->scale;
+	double		offset = support->offset;
+
+	if (av->dim != bv->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different vector dimensions %d and %d", av->dim, bv->dim)));
+
+	if (support->distfunc == VectorL2SquaredDistance)
+		return scale * scale * QuantizedL2SquaredDistance(av->x, bv->x, av->dim);
+
+	/* Negative inner product */
+	return -(av->dim * offset * offset + offset * scale * ((double) av->sum + bv->sum) +
+			 scale * scale * QuantizedInnerProduct(av->x, bv->x, av->dim));
+}
+
+/*
+ * Calculate the distance between values
+ */
+double
+HnswDistance(HnswSupport * support, Datum a, Datum b)
+{
+	if (support->quantization != HNSW_QUANTIZATION_NONE)
+		return HnswQuantizedDistance(support, a, b);
+
+	return VectorDistance(support->distfunc, support->procinfo, support->collation, a, b);
+}
+
 /*
  * Load an element and optionally get its distance from q
  */
 void
-HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index, FmgrInfo *procinfo, Oid collation, bool loadVec)
+HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index, HnswSupport * support, bool loadVec)
 {
 	Buffer		buf;
 	Page		page;
@@ -575,7 +882,7 @@ HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index,
 
 	/* Calculate distance */
 	if (distance != NULL)
-		*distance = (float) DatumGetFloat8(FunctionCall2Coll(procinfo, collation, *q, PointerGetDatum(&etup->data)));
+		*distance = (float) HnswDistance(support, *q, PointerGetDatum(&etup->data));
 
 	UnlockReleaseBuffer(buf);
 }
@@ -584,27 +891,27 @@ HnswLoadElement(HnswElement element, float *distance, Datum *q, Relation index,
  * Get the distance for a candidate
  */
 static float
-GetCandidateDistance(char *base, HnswCandidate * hc, Datum q, FmgrInfo *procinfo, Oid collation)
+GetCandidateDistance(char *base, HnswCandidate * hc, Datum q, HnswSupport * support)
 {
 	HnswElement hce = HnswPtrAccess(base, hc->element);
 	Datum		value = HnswGetValue(base, hce);
 
-	return DatumGetFloat8(FunctionCall2Coll(procinfo, collation, q, value));
+	return (float) HnswDistance(support, q, value);
 }
 
 /*
  * Create a candidate for the entry point
  */
 HnswCandidate *
-HnswEntryCandidate(char *base, HnswElement entryPoint, Datum q, Relation index, FmgrInfo *procinfo, Oid collation, bool loadVec)
+HnswEntryCandidate(char *base, HnswElement entryPoint, Datum q, Relation index, HnswSupport * support, bool loadVec)
 {
 	HnswCandidate *hc = palloc(sizeof(HnswCandidate));
 
 	HnswPtrStore(base, hc->element, entryPoint);
 	if (index == NULL)
-		hc->distance = GetCandidateDistance(base, hc, q, procinfo, collation);
+		hc->distance = GetCandidateDistance(base, hc, q, support);
 	else
-		HnswLoadElement(entryPoint, &hc->distance, &q, index, procinfo, collation, loadVec);
+		HnswLoadElement(entryPoint, &hc->distance, &q, index, support, loadVec);
 	return hc;
 }
 
@@ -624,30 +931,301 @@ CompareNearestCandidates(const pairingheap_node *a, const pairingheap_node *b, v
 }
 
 /*
- * Compare candidate distances
+ * Create a pairing heap node for a candidate
  */
-static int
-CompareFurthestCandidates(const pairingheap_node *a, const pairingheap_node *b, void *arg)
+static HnswPairingHeapNode *
+CreatePairingHeapNode(HnswCandidate * c)
 {
-	if (((const HnswPairingHeapNode *) a)->inner->distance < ((const HnswPairingHeapNode *) b)->inner->distance)
-		return -1;
+	HnswPairingHeapNode *node = palloc(sizeof(HnswPairingHeapNode));
 
-	if (((const HnswPairingHeapNode *) a)->inner->distance > ((const HnswPairingHeapNode *) b)->inner->distance)
-		return 1;
+	node->inner = c;
+	return node;
+}
 
-	return 0;
+/*
+ * Create a candidate
+ */
+static HnswCandidate *
+CreateCandidate(char *base, HnswElement element, float distance)
+{
+	HnswCandidate *hc = palloc(sizeof(HnswCandidate));
+
+	HnswPtrStore(base, hc->element, element);
+	hc->distance = distance;
+	hc->closer = false;
+	return hc;
 }
 
 /*
- * Create a pairing heap node for a candidate
+ * Grow a search queue
  */
-static HnswPairingHeapNode *
-CreatePairingHeapNode(HnswCandidate * c)
+static void
+GrowSearchQueue(HnswSearchQueue * queue, int capacity)
 {
-	HnswPairingHeapNode *node = palloc(sizeof(HnswPairingHeapNode));
+	if (queue->capacity >= capacity)
+		return;
 
-	node->inner = c;
-	return node;
+	capacity = Max(Max(capacity, queue->capacity * 2), 64);
+
+	if (queue->items == NULL)
+		queue->items = MemoryContextAlloc(TopMemoryContext, sizeof(HnswSearchItem) * capacity);
+	else
+		queue->items = repalloc(queue->items, sizeof(HnswSearchItem) * capacity);
+
+	queue->capacity = capacity;
+}
+
+/*
+ * Add an element to a search queue
+ */
+static inline void
+PushSearchItem(HnswSearchQueue * queue, HnswElement element, float distance)
+{
+	HnswSearchItem item;
+	HnswSearchItem *items;
+	int			i;
+
+	if (queue->length == queue->capacity)
+		GrowSearchQueue(queue, queue->length + 1);
+
+	item.element = element;
+	item.distance = distance;
+
+	items = queue->items;
+	i = queue->length++;
+
+	/* Sift up */
+	while (i > 0)
+	{
+		int			parent = (i - 1) / 2;
+
+		if (!SearchItemBefore(queue, &item, &items[parent]))
+			break;
+
+		items[i] = items[parent];
+		i = parent;
+	}
+
+	items[i] = item;
+}
+
+/*
+ * Get the first element of a search queue without removing it
+ *
+ * Returns NULL if the queue is empty
+ */
+static inline HnswElement
+PeekSearchItem(HnswSearchQueue * queue)
+{
+	return queue->length > 0 ? queue->items[0].element : NULL;
+}
+
+/*
+ * Remove the first element from a search queue
+ */
+static inline HnswSearchItem
+PopSearchItem(HnswSearchQueue * queue)
+{
+	HnswSearchItem *items = queue->items;
+	HnswSearchItem first = items[0];
+	HnswSearchItem last = items[--queue->length];
+	int			i = 0;
+
+	/* Sift down */
+	for (;;)
+	{
+		int			child = 2 * i + 1;
+
+		if (child >= queue->length)
+			break;
+
+		if (child + 1 < queue->length && SearchItemBefore(queue, &items[child + 1], &items[child]))
+			child++;
+
+		if (!SearchItemBefore(queue, &items[child], &last))
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+
+	if (queue->length > 0)
+		items[i] = last;
+
+	return first;
+}
+
+/*
+ * Add an element to the shared visited set of a parallel scan
+ *
+ * Returns false if it was already visited. The set is sized so it does not
+ * fill up for the settings of the scan, but if it does, the scan errors,
+ * since treating elements as visited would skip them and treating them as
+ * unvisited could return them twice.
+ */
+bool
+HnswParallelVisit(HnswParallelScan pscan, BlockNumber blkno, OffsetNumber offno)
+{
+	/* Zero marks an empty slot */
+	uint64		key = ((((uint64) blkno) << 16) | offno) + 1;
+	uint32		mask = pscan->visitedSize - 1;
+	uint32		i = (uint32) murmurhash64(key) & mask;
+
+	for (uint32 probes = 0; probes < pscan->visitedSize; probes++)
+	{
+		pg_atomic_uint64 *slot = &pscan->visited[i];
+		uint64		expected = pg_atomic_read_u64(slot);
+
+		if (expected == 0)
+		{
+			if (pg_atomic_compare_exchange_u64(slot, &expected, key))
+				return true;
+
+			/* Another participant filled the slot */
+		}
+
+		if (expected == key)
+			return false;
+
+		i = (i + 1) & mask;
+	}
+
+	ereport(ERROR,
+			(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+			 errmsg("parallel hnsw index scan visited too many elements"),
+			 errhint("Decrease hnsw.ef_search or hnsw.max_scan_tuples, or disable parallel scans with max_parallel_workers_per_gather = 0.")));
+
+	return false;
+}
+
+/*
+ * Create a visited table
+ */
+HnswVisitedTable *
+HnswCreateVisitedTable(MemoryContext ctx)
+{
+	HnswVisitedTable *table = MemoryContextAllocZero(ctx, sizeof(HnswVisitedTable));
+
+	table->ctx = ctx;
+	return table;
+}
+
+/*
+ * Get the visited table for searches on disk that do not keep their visited
+ * set, which lasts for the life of the backend
+ */
+static HnswVisitedTable *
+GetLocalVisitedTable(void)
+{
+	if (localVisited == NULL)
+		localVisited = HnswCreateVisitedTable(TopMemoryContext);
+
+	return localVisited;
+}
+
+static bool AddToVisitedTable(HnswVisitedTable * table, BlockNumber blkno, OffsetNumber offno);
+
+/*
+ * Resize a visited table, keeping the entries for the current epoch
+ */
+static void
+ResizeVisitedTable(HnswVisitedTable * table, uint32 size)
+{
+	HnswVisitedSlot *oldSlots = table->slots;
+	uint32		oldSize = table->size;
+	uint32		oldEpoch = table->epoch;
+
+	table->slots = MemoryContextAllocExtended(table->ctx, sizeof(HnswVisitedSlot) * size, MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	table->size = size;
+	table->count = 0;
+	table->epoch = 1;
+
+	for (uint32 i = 0; i < oldSize; i++)
+	{
+		HnswVisitedSlot *slot = &oldSlots[i];
+
+		if (slot->epoch == oldEpoch)
+			AddToVisitedTable(table, (BlockNumber) (slot->key >> 16), (OffsetNumber) (slot->key & 0xFFFF));
+	}
+
+	if (oldSlots != NULL)
+		pfree(oldSlots);
+}
+
+/*
+ * Start a new search with a visited table
+ */
+static void
+StartVisitedTable(HnswVisitedTable * table, int expected)
+{
+	uint32		size = Max(table->size, 1024);
+
+	while (size < (uint32) expected * 2)
+		size *= 2;
+
+	table->count = 0;
+	table->epoch++;
+
+	/* Clear slots on wraparound */
+	if (table->epoch == 0)
+	{
+		if (table->slots != NULL)
+			memset(table->slots, 0, sizeof(HnswVisitedSlot) * table->size);
+		table->epoch = 1;
+	}
+
+	if (size > table->size)
+		ResizeVisitedTable(table, size);
+}
+
+/*
+ * Add an index TID to a visited table
+ *
+ * Returns true if it was already visited
+ */
+static bool
+AddToVisitedTable(HnswVisitedTable * table, BlockNumber blkno, OffsetNumber offno)
+{
+	uint64		key = (((uint64) blkno) << 16) | offno;
+	uint32		mask = table->size - 1;
+	uint32		i = (uint32) murmurhash64(key) & mask;
+
+	for (;;)
+	{
+		HnswVisitedSlot *slot = &table->slots[i];
+
+		if (slot->epoch != table->epoch)
+		{
+			slot->key = key;
+			slot->epoch = table->epoch;
+
+			/* Keep the load factor at most 0.5 */
+			if (++table->count * 2 > table->size)
+				ResizeVisitedTable(table, table->size * 2);
+
+			return false;
+		}
+
+		if (slot->key == key)
+			return true;
+
+		i = (i + 1) & mask;
+	}
+}
+
+/*
+ * Get the next epoch for non-parallel in-memory builds
+ *
+ * After wraparound, an element that was last visited exactly 2^32 searches
+ * earlier is skipped once, which only affects recall
+ */
+static uint32
+NextVisitedEpoch(void)
+{
+	if (++buildEpoch == 0)
+		buildEpoch = 1;
+
+	return buildEpoch;
 }
 
 /*
@@ -656,12 +1234,14 @@ CreatePairingHeapNode(HnswCandidate * c)
 static inline void
 InitVisited(char *base, visited_hash * v, Relation index, int ef, int m)
 {
+	v->shared = NULL;
+
 	if (index != NULL)
-		v->tids = tidhash_create(CurrentMemoryContext, ef * m * 2, NULL);
+		StartVisitedTable(v->table, ef * m * 2);
 	else if (base != NULL)
 		v->offsets = offsethash_create(CurrentMemoryContext, ef * m * 2, NULL);
 	else
-		v->pointers = pointerhash_create(CurrentMemoryContext, ef * m * 2, NULL);
+		v->epoch = NextVisitedEpoch();
 }
 
 /*
@@ -670,13 +1250,17 @@ InitVisited(char *base, visited_hash * v, Relation index, int ef, int m)
 static inline void
 AddToVisited(char *base, visited_hash * v, HnswCandidate * hc, Relation index, bool *found)
 {
-	if (index != NULL)
+	if (v->shared != NULL)
 	{
 		HnswElement element = HnswPtrAccess(base, hc->element);
-		ItemPointerData indextid;
 
-		ItemPointerSet(&indextid, element->blkno, element->offno);
-		tidhash_insert(v->tids, indextid, found);
+		*found = !HnswParallelVisit(v->shared, element->blkno, element->offno);
+	}
+	else if (index != NULL)
+	{
+		HnswElement element = HnswPtrAccess(base, hc->element);
+
+		*found = AddToVisitedTable(v->table, element->blkno, element->offno);
 	}
 	else if (base != NULL)
 	{
@@ -690,13 +1274,10 @@ AddToVisited(char *base, visited_hash * v, HnswCandidate * hc, Relation index, b
 	}
 	else
 	{
-#if PG_VERSION_NUM >= 130000
-		HnswElement element = HnswPtrAccess(base, hc->element);
+		HnswElement element = HnswPtrPointer(hc->element);
 
-		pointerhash_insert_hash(v->pointers, (uintptr_t) HnswPtrPointer(hc->element), element->hash, found);
-#else
-		pointerhash_insert(v->pointers, (uintptr_t) HnswPtrPointer(hc->element), found);
-#endif
+		*found = element->visited == v->epoch;
+		element->visited = v->epoch;
 	}
 }
 
@@ -704,36 +1285,90 @@ AddToVisited(char *base, visited_hash * v, HnswCandidate * hc, Relation index, b
  * Count element towards ef
  */
 static inline bool
-CountElement(char *base, HnswElement skipElement, HnswCandidate * hc)
+CountElement(HnswElement skipElement, HnswElement e)
 {
-	HnswElement e;
-
 	if (skipElement == NULL)
 		return true;
 
 	/* Ensure does not access heaptidsLength during in-memory build */
 	pg_memory_barrier();
 
-	e = HnswPtrAccess(base, hc->element);
 	return e->heaptidsLength != 0;
 }
 
+/*
+ * Copy a neighborhood from an in-memory graph
+ *
+ * Retries if the element was updated during the copy instead of locking, so
+ * concurrent searches do not contend with each other.
+ */
+static void
+CopyNeighborhood(HnswElement element, HnswNeighborArray * dest, HnswNeighborArray * src, Size size)
+{
+	SpinDelayStatus delayStatus;
+
+	init_local_spin_delay(&delayStatus);
+
+	for (;;)
+	{
+		uint32		version = pg_atomic_read_u32(&element->version);
+
+		if ((version & 1) == 0)
+		{
+			pg_read_barrier();
+			memcpy(dest, src, size);
+			pg_read_barrier();
+
+			if (pg_atomic_read_u32(&element->version) == version)
+				break;
+		}
+
+		perform_spin_delay(&delayStatus);
+	}
+
+	finish_spin_delay(&delayStatus);
+}
+
 /*
  * Algorithm 2 from paper
+ *
+ * For iterative scans, the caller passes the visited set and a heap that
+ * receives candidates not kept in W, so the search can be resumed from them
  */
 List *
-HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, FmgrInfo *procinfo, Oid collation, int m, bool inserting, HnswElement skipElement)
+HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, HnswSupport * support, int m, bool inserting, HnswElement skipElement, visited_hash * v, pairingheap **discarded, bool initVisited, int64 *tuples)
 {
 	List	   *w = NIL;
-	pairingheap *C = pairingheap_allocate(CompareNearestCandidates, NULL);
-	pairingheap *W = pairingheap_allocate(CompareFurthestCandidates, NULL);
+	HnswSearchQueue *C = &searchCandidates;
+	HnswSearchQueue *W = &searchResults;
+	HnswCandidate *results;
 	int			wlen = 0;
-	visited_hash v;
+	visited_hash vh;
 	ListCell   *lc2;
 	HnswNeighborArray *neighborhoodData = NULL;
 	Size		neighborhoodSize;
+	bool		visited[HNSW_MAX_M * 2];
+	BlockNumber prefetchBlkno = InvalidBlockNumber;
+
+	/* Use local visited set if not resuming */
+	if (v == NULL)
+	{
+		v = &vh;
+		v->table = index != NULL ? GetLocalVisitedTable() : NULL;
+		initVisited = true;
+	}
+
+	if (initVisited)
+		InitVisited(base, v, index, ef, m);
+
+	if (discarded != NULL && *discarded == NULL)
+		*discarded = pairingheap_allocate(CompareNearestCandidates, NULL);
 
-	InitVisited(base, &v, index, ef, m);
+	/* Reuse queues from previous searches */
+	C->length = 0;
+	W->length = 0;
+	GrowSearchQueue(C, ef + list_length(ep));
+	GrowSearchQueue(W, ef + list_length(ep));
 
 	/* Create local memory for neighborhood if needed */
 	if (index == NULL)
@@ -746,34 +1381,32 @@ HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, F
 	foreach(lc2, ep)
 	{
 		HnswCandidate *hc = (HnswCandidate *) lfirst(lc2);
+		HnswElement hce = HnswPtrAccess(base, hc->element);
 		bool		found;
 
-		AddToVisited(base, &v, hc, index, &found);
+		AddToVisited(base, v, hc, index, &found);
 
-		pairingheap_add(C, &(CreatePairingHeapNode(hc)->ph_node));
-		pairingheap_add(W, &(CreatePairingHeapNode(hc)->ph_node));
+		PushSearchItem(C, hce, hc->distance);
+		PushSearchItem(W, hce, hc->distance);
 
 		/*
 		 * Do not count elements being deleted towards ef when vacuuming. It
 		 * would be ideal to do this for inserts as well, but this could
 		 * affect insert performance.
 		 */
-		if (CountElement(base, skipElement, hc))
+		if (CountElement(skipElement, hce))
 			wlen++;
 	}
 
-	while (!pairingheap_is_empty(C))
+	while (C->length > 0)
 	{
 		HnswNeighborArray *neighborhood;
-		HnswCandidate *c = ((HnswPairingHeapNode *) pairingheap_remove_first(C))->inner;
-		HnswCandidate *f = ((HnswPairingHeapNode *) pairingheap_first(W))->inner;
-		HnswElement cElement;
+		HnswSearchItem c = PopSearchItem(C);
+		HnswElement cElement = c.element;
 
-		if (c->distance > f->distance)
+		if (c.distance > W->items[0].distance)
 			break;
 
-		cElement = HnswPtrAccess(base, c->element);
-
 		if (HnswPtrIsNull(base, cElement->neighbors))
 			HnswLoadNeighbors(cElement, index, m);
 
@@ -783,70 +1416,103 @@ HnswSearchLayer(char *base, Datum q, List *ep, int ef, int lc, Relation index, F
 		/* Copy neighborhood to local memory if needed */
 		if (index == NULL)
 		{
-			LWLockAcquire(&cElement->lock, LW_SHARED);
-			memcpy(neighborhoodData, neighborhood, neighborhoodSize);
-			LWLockRelease(&cElement->lock);
+			CopyNeighborhood(cElement, neighborhoodData, neighborhood, neighborhoodSize);
 			neighborhood = neighborhoodData;
 		}
 
+		Assert(neighborhood->length <= HNSW_MAX_M * 2);
+
 		for (int i = 0; i < neighborhood->length; i++)
 		{
 			HnswCandidate *e = &neighborhood->items[i];
-			bool		visited;
 
-			AddToVisited(base, &v, e, index, &visited);
+			AddToVisited(base, v, e, index, &visited[i]);
 
-			if (!visited)
+			/* Start reading element pages before loading any of them */
+			if (index != NULL && !visited[i])
+			{
+				BlockNumber blkno = HnswPtrAccess(base, e->element)->blkno;
+
+				if (blkno != prefetchBlkno)
+				{
+					PrefetchBuffer(index, MAIN_FORKNUM, blkno);
+					prefetchBlkno = blkno;
+				}
+			}
+		}
+
+		/* Also start reading the neighbors of the next candidate */
+		if (index != NULL)
+		{
+			HnswElement next = PeekSearchItem(C);
+
+			if (next != NULL && HnswPtrIsNull(base, next->neighbors))
+				PrefetchBuffer(index, MAIN_FORKNUM, next->neighborPage);
+		}
+
+		for (int i = 0; i < neighborhood->length; i++)
+		{
+			HnswCandidate *e = &neighborhood->items[i];
+
+			if (!visited[i])
 			{
 				float		eDistance;
 				HnswElement eElement = HnswPtrAccess(base, e->element);
 
-				f = ((HnswPairingHeapNode *) pairingheap_first(W))->inner;
-
 				if (index == NULL)
-					eDistance = GetCandidateDistance(base, e, q, procinfo, collation);
+					eDistance = GetCandidateDistance(base, e, q, support);
 				else
-					HnswLoadElement(eElement, &eDistance, &q, index, procinfo, collation, inserting);
+					HnswLoadElement(eElement, &eDistance, &q, index, support, inserting);
 
 				Assert(!eElement->deleted);
 
+				if (tuples != NULL)
+					(*tuples)++;
+
 				/* Make robust to issues */
 				if (eElement->level < lc)
 					continue;
 
-				if (eDistance < f->distance || wlen < ef)
+				if (eDistance < W->items[0].distance || wlen < ef)
 				{
-					/* Copy e */
-					HnswCandidate *ec = palloc(sizeof(HnswCandidate));
-
-					HnswPtrStore(base, ec->element, eElement);
-					ec->distance = eDistance;
-
-					pairingheap_add(C, &(CreatePairingHeapNode(ec)->ph_node));
-					pairingheap_add(W, &(CreatePairingHeapNode(ec)->ph_node));
+					PushSearchItem(C, eElement, eDistance);
+					PushSearchItem(W, eElement, eDistance);
 
 					/*
 					 * Do not count elements being deleted towards ef when
 					 * vacuuming. It would be ideal to do this for inserts as
 					 * well, but this could affect insert performance.
 					 */
-					if (CountElement(base, skipElement, e))
+					if (CountElement(skipElement, eElement))
 					{
 						wlen++;
 
 						/* No need to decrement wlen */
 						if (wlen > ef)
-							pairingheap_remove_first(W);
+						{
+							HnswSearchItem f = PopSearchItem(W);
+
+							if (discarded != NULL)
+								pairingheap_add(*discarded, &(CreatePairingHeapNode(CreateCandidate(base, f.element, f.distance))->ph_node));
+						}
 					}
 				}
+				else if (discarded != NULL)
+					pairingheap_add(*discarded, &(CreatePairingHeapNode(CreateCandidate(base, eElement, eDistance))->ph_node));
 			}
 		}
 	}
 
-	/* Add each element of W to w */
-	while (!pairingheap_is_empty(W))
+	/* Add each element of W to w, furthest first */
+	results = palloc(sizeof(HnswCandidate) * Max(W->length, 1));
+	for (int i = 0; W->length > 0; i++)
 	{
-		HnswCandidate *hc = ((HnswPairingHeapNode *) pairingheap_remove_first(W))->inner;
+		HnswSearchItem item = PopSearchItem(W);
+		HnswCandidate *hc = &results[i];
+
+		HnswPtrStore(base, hc->element, item.element);
+		hc->distance = item.distance;
+		hc->closer = false;
 
 		w = lappend(w, hc);
 	}
@@ -914,19 +1580,19 @@ CompareCandidateDistancesOffset(const void *a, const void *b)
  * Calculate the distance between elements
  */
 static float
-HnswGetDistance(char *base, HnswElement a, HnswElement b, FmgrInfo *procinfo, Oid collation)
+HnswGetDistance(char *base, HnswElement a, HnswElement b, HnswSupport * support)
 {
 	Datum		aValue = HnswGetValue(base, a);
 	Datum		bValue = HnswGetValue(base, b);
 
-	return DatumGetFloat8(FunctionCall2Coll(procinfo, collation, aValue, bValue));
+	return (float) HnswDistance(support, aValue, bValue);
 }
 
 /*
  * Check if an element is closer to q than any element from R
  */
 static bool
-CheckElementCloser(char *base, HnswCandidate * e, List *r, FmgrInfo *procinfo, Oid collation)
+CheckElementCloser(char *base, HnswCandidate * e, List *r, HnswSupport * support)
 {
 	HnswElement eElement = HnswPtrAccess(base, e->element);
 	ListCell   *lc2;
@@ -935,7 +1601,7 @@ CheckElementCloser(char *base, HnswCandidate * e, List *r, FmgrInfo *procinfo, O
 	{
 		HnswCandidate *ri = lfirst(lc2);
 		HnswElement riElement = HnswPtrAccess(base, ri->element);
-		float		distance = HnswGetDistance(base, eElement, riElement, procinfo, collation);
+		float		distance = HnswGetDistance(base, eElement, riElement, support);
 
 		if (distance <= e->distance)
 			return false;
@@ -948,7 +1614,7 @@ CheckElementCloser(char *base, HnswCandidate * e, List *r, FmgrInfo *procinfo, O
  * Algorithm 4 from paper
  */
 static List *
-SelectNeighbors(char *base, List *c, int lm, int lc, FmgrInfo *procinfo, Oid collation, HnswElement e2, HnswCandidate * newCandidate, HnswCandidate * *pruned, bool sortCandidates)
+SelectNeighbors(char *base, List *c, int lm, int lc, HnswSupport * support, HnswElement e2, HnswCandidate * newCandidate, HnswCandidate * *pruned, bool sortCandidates)
 {
 	List	   *r = NIL;
 	List	   *w = list_copy(c);
@@ -981,7 +1647,7 @@ SelectNeighbors(char *base, List *c, int lm, int lc, FmgrInfo *procinfo, Oid col
 
 		/* Use previous state of r and wd to skip work when possible */
 		if (mustCalculate)
-			e->closer = CheckElementCloser(base, e, r, procinfo, collation);
+			e->closer = CheckElementCloser(base, e, r, support);
 		else if (list_length(added) > 0)
 		{
 			/* Keep Valgrind happy for in-memory, parallel builds */
@@ -994,7 +1660,7 @@ SelectNeighbors(char *base, List *c, int lm, int lc, FmgrInfo *procinfo, Oid col
 			 */
 			if (e->closer)
 			{
-				e->closer = CheckElementCloser(base, e, added, procinfo, collation);
+				e->closer = CheckElementCloser(base, e, added, support);
 
 				if (!e->closer)
 					removedAny = true;
@@ -1007,7 +1673,7 @@ SelectNeighbors(char *base, List *c, int lm, int lc, FmgrInfo *procinfo, Oid col
 				 */
 				if (removedAny)
 				{
-					e->closer = CheckElementCloser(base, e, r, procinfo, collation);
+					e->closer = CheckElementCloser(base, e, r, support);
 					if (e->closer)
 						added = lappend(added, e);
 				}
@@ -1015,7 +1681,7 @@ SelectNeighbors(char *base, List *c, int lm, int lc, FmgrInfo *procinfo, Oid col
 		}
 		else if (e == newCandidate)
 		{
-			e->closer = CheckElementCloser(base, e, r, procinfo, collation);
+			e->closer = CheckElementCloser(base, e, r, support);
 			if (e->closer)
 				added = lappend(added, e);
 		}
@@ -1066,7 +1732,7 @@ AddConnections(char *base, HnswElement element, List *neighbors, int lc)
  * Update connections
  */
 void
-HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm, int lc, int *updateIdx, Relation index, FmgrInfo *procinfo, Oid collation)
+HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm, int lc, int *updateIdx, Relation index, HnswSupport * support)
 {
 	HnswElement hce = HnswPtrAccess(base, hc->element);
 	HnswNeighborArray *currentNeighbors = HnswGetNeighbors(base, hce, lc);
@@ -1099,9 +1765,9 @@ HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm
 				HnswElement hc3Element = HnswPtrAccess(base, hc3->element);
 
 				if (HnswPtrIsNull(base, hc3Element->value))
-					HnswLoadElement(hc3Element, &hc3->distance, &q, index, procinfo, collation, true);
+					HnswLoadElement(hc3Element, &hc3->distance, &q, index, support, true);
 				else
-					hc3->distance = GetCandidateDistance(base, hc3, q, procinfo, collation);
+					hc3->distance = GetCandidateDistance(base, hc3, q, support);
 
 				/* Prune element if being deleted */
 				if (hc3Element->heaptidsLength == 0)
@@ -1121,7 +1787,7 @@ HnswUpdateConnection(char *base, HnswElement element, HnswCandidate * hc, int lm
 				c = lappend(c, &currentNeighbors->items[i]);
 			c = lappend(c, &hc2);
 
-			SelectNeighbors(base, c, lm, lc, procinfo, collation, hce, &hc2, &pruned, true);
+			SelectNeighbors(base, c, lm, lc, support, hce, &hc2, &pruned, true);
 
 			/* Should not happen */
 			if (pruned == NULL)
@@ -1184,10 +1850,7 @@ PrecomputeHash(char *base, HnswElement element)
 
 	HnswPtrStore(base, ptr, element);
 
-	if (base == NULL)
-		element->hash = hash_pointer((uintptr_t) HnswPtrPointer(ptr));
-	else
-		element->hash = hash_offset(HnswPtrOffset(ptr));
+	element->hash = hash_offset(HnswPtrOffset(ptr));
 }
 #endif
 
@@ -1195,7 +1858,7 @@ PrecomputeHash(char *base, HnswElement element)
  * Algorithm 1 from paper
  */
 void
-HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint, Relation index, FmgrInfo *procinfo, Oid collation, int m, int efConstruction, bool existing)
+HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint, Relation index, HnswSupport * support, int m, int efConstruction, bool existing)
 {
 	List	   *ep;
 	List	   *w;
@@ -1205,8 +1868,8 @@ HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint
 	HnswElement skipElement = existing ? element : NULL;
 
 #if PG_VERSION_NUM >= 130000
-	/* Precompute hash */
-	if (index == NULL)
+	/* Precompute hash for the visited set of parallel builds */
+	if (index == NULL && base != NULL)
 		PrecomputeHash(base, element);
 #endif
 
@@ -1215,13 +1878,13 @@ HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint
 		return;
 
 	/* Get entry point and level */
-	ep = list_make1(HnswEntryCandidate(base, entryPoint, q, index, procinfo, collation, true));
+	ep = list_make1(HnswEntryCandidate(base, entryPoint, q, index, support, true));
 	entryLevel = entryPoint->level;
 
 	/* 1st phase: greedy search to insert level */
 	for (int lc = entryLevel; lc >= level + 1; lc--)
 	{
-		w = HnswSearchLayer(base, q, ep, 1, lc, index, procinfo, collation, m, true, skipElement);
+		w = HnswSearchLayer(base, q, ep, 1, lc, index, support, m, true, skipElement, NULL, NULL, true, NULL);
 		ep = w;
 	}
 
@@ -1239,7 +1902,7 @@ HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint
 		List	   *neighbors;
 		List	   *lw;
 
-		w = HnswSearchLayer(base, q, ep, efConstruction, lc, index, procinfo, collation, m, true, skipElement);
+		w = HnswSearchLayer(base, q, ep, efConstruction, lc, index, support, m, true, skipElement, NULL, NULL, true, NULL);
 
 		/* Elements being deleted or skipped can help with search */
 		/* but should be removed before selecting neighbors */
@@ -1253,7 +1916,7 @@ HnswFindElementNeighbors(char *base, HnswElement element, HnswElement entryPoint
 		 * sortCandidates to true for in-memory builds to enable closer
 		 * caching, but there does not seem to be a difference in performance.
 		 */
-		neighbors = SelectNeighbors(base, lw, lm, lc, procinfo, collation, element, NULL, NULL, false);
+		neighbors = SelectNeighbors(base, lw, lm, lc, support, element, NULL, NULL, false);
 
 		AddConnections(base, element, neighbors, lc);
 
@@ -0,0 +1,719 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "catalog/pg_operator_d.h"
+#include "catalog/pg_type_d.h"
+#include "commands/progress.h"
+#include "inverted.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/indexfsm.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+
+#if PG_VERSION_NUM >= 140000
+#include "utils/backend_progress.h"
+#else
+#include "pgstat.h"
+#endif
+
+#if PG_VERSION_NUM >= 130000
+#define CALLBACK_ITEM_POINTER ItemPointer tid
+#else
+#define CALLBACK_ITEM_POINTER HeapTuple hup
+#endif
+
+/*
+ * Add a posting to sort
+ */
+static void
+AddPostingToSort(InvertedBuildState * buildstate, int32 dim, ItemPointer tid, float value)
+{
+	TupleTableSlot *slot = buildstate->slot;
+
+	/* Create a virtual tuple */
+	ExecClearTuple(slot);
+	slot->tts_values[0] = Int32GetDatum(dim);
+	slot->tts_isnull[0] = false;
+	slot->tts_values[1] = PointerGetDatum(tid);
+	slot->tts_isnull[1] = false;
+	slot->tts_values[2] = Float4GetDatum(value);
+	slot->tts_isnull[2] = false;
+	ExecStoreVirtualTuple(slot);
+
+	/*
+	 * Add tuple to sort
+	 *
+	 * tuplesort_puttupleslot comment: Input data is always copied; the
+	 * caller need not save it.
+	 */
+	tuplesort_puttupleslot(buildstate->sortstate, slot);
+}
+
+/*
+ * Add postings for a vector to sort
+ */
+static void
+AddVectorToSort(InvertedBuildState * buildstate, ItemPointer tid, SparseVector * vec)
+{
+	float	   *vecvalues = SPARSEVEC_VALUES(vec);
+
+	for (int i = 0; i < vec->nnz; i++)
+		AddPostingToSort(buildstate, vec->indices[i], tid, vecvalues[i]);
+
+	buildstate->npostings += vec->nnz;
+	buildstate->indtuples++;
+}
+
+/*
+ * Add postings for a tuple to sort
+ */
+static void
+AddTupleToSort(ItemPointer tid, Datum *values, InvertedBuildState * buildstate)
+{
+
+	/* Detoast once for all calls */
+	Datum		value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+
+	/* Check here so build and insert accept the same values */
+	InvertedCheckNnz(DatumGetSparseVector(value));
+
+	/* Normalize if needed */
+	if (buildstate->normprocinfo != NULL)
+	{
+		if (!InvertedNormValue(buildstate->normprocinfo, buildstate->collation, &value))
+			return;
+	}
+
+	AddVectorToSort(buildstate, tid, DatumGetSparseVector(value));
+}
+
+/*
+ * Callback for table_index_build_scan
+ */
+static void
+BuildCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
+			  bool *isnull, bool tupleIsAlive, void *state)
+{
+	InvertedBuildState *buildstate = (InvertedBuildState *) state;
+	MemoryContext oldCtx;
+
+#if PG_VERSION_NUM < 130000
+	ItemPointer tid = &hup->t_self;
+#endif
+
+	/* Skip nulls */
+	if (isnull[0])
+		return;
+
+	/* Use memory context since detoast can allocate */
+	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+	/* Add postings to sort */
+	AddTupleToSort(tid, values, buildstate);
+
+	/* Reset memory context */
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextReset(buildstate->tmpCtx);
+}
+
+/*
+ * Initialize the build state
+ */
+static void
+InitBuildState(InvertedBuildState * buildstate, Relation heap, Relation index, IndexInfo *indexInfo)
+{
+	buildstate->heap = heap;
+	buildstate->index = index;
+	buildstate->indexInfo = indexInfo;
+
+	buildstate->dimensions = TupleDescAttr(index->rd_att, 0)->atttypmod;
+
+	/* Require column to have dimensions to be indexed */
+	if (buildstate->dimensions < 0)
+		elog(ERROR, "column does not have dimensions");
+
+	/* The directory has an entry per dimension */
+	if (buildstate->dimensions > INVERTED_MAX_DIM)
+		elog(ERROR, "column cannot have more than %d dimensions for inverted index", INVERTED_MAX_DIM);
+
+	buildstate->reltuples = 0;
+	buildstate->indtuples = 0;
+	buildstate->npostings = 0;
+
+	/* Get support functions */
+	buildstate->normprocinfo = InvertedOptionalProcInfo(index, INVERTED_NORM_PROC);
+	buildstate->collation = index->rd_indcollation[0];
+
+	/* Create tuple description for sorting */
+	buildstate->tupdesc = CreateTemplateTupleDesc(3);
+	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 1, "dim", INT4OID, -1, 0);
+	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 2, "tid", TIDOID, -1, 0);
+	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "value", FLOAT4OID, -1, 0);
+
+	buildstate->slot = MakeSingleTupleTableSlot(buildstate->tupdesc, &TTSOpsVirtual);
+
+	buildstate->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+											   "Inverted build temporary context",
+											   ALLOCSET_DEFAULT_SIZES);
+}
+
+/*
+ * Free resources
+ */
+static void
+FreeBuildState(InvertedBuildState * buildstate)
+{
+	MemoryContextDelete(buildstate->tmpCtx);
+}
+
+/*
+ * Get the number of directory pages
+ */
+static BlockNumber
+GetDirPages(int dimensions)
+{
+	return (dimensions + INVERTED_DIR_ENTRIES_PER_PAGE - 1) / INVERTED_DIR_ENTRIES_PER_PAGE;
+}
+
+/*
+ * Create the metapage
+ */
+static void
+CreateMetaPage(Relation index, int dimensions, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	InvertedMetaPage metap;
+	BlockNumber dirPages = GetDirPages(dimensions);
+
+	buf = InvertedNewBuffer(index, forkNum);
+	InvertedInitRegisterPage(index, &buf, &page, &state, INVERTED_META_PAGE);
+
+	/* Set metapage data */
+	metap = InvertedPageGetMeta(page);
+	metap->magicNumber = INVERTED_MAGIC_NUMBER;
+	metap->version = INVERTED_VERSION;
+	metap->dimensions = dimensions;
+	metap->dirPages = dirPages;
+
+	/* The pending list starts right after the directory */
+	metap->pendingStartPage = INVERTED_HEAD_BLKNO + dirPages;
+	metap->pendingInsertPage = metap->pendingStartPage;
+	metap->pendingPages = 1;
+	metap->postingStartPage = InvalidBlockNumber;
+
+	((PageHeader) page)->pd_lower =
+		((char *) metap + sizeof(InvertedMetaPageData)) - (char *) page;
+
+	InvertedCommitBuffer(buf, state);
+}
+
+/*
+ * Create directory pages with no postings and the first pending page
+ */
+static void
+CreateDirectoryPages(Relation index, int dimensions, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	BlockNumber dirPages = GetDirPages(dimensions);
+
+	for (BlockNumber i = 0; i < dirPages; i++)
+	{
+		InvertedDirEntry entries;
+		int			nentries = Min(dimensions - i * INVERTED_DIR_ENTRIES_PER_PAGE, INVERTED_DIR_ENTRIES_PER_PAGE);
+
+		buf = InvertedNewBuffer(index, forkNum);
+		InvertedInitRegisterPage(index, &buf, &page, &state, INVERTED_DIRECTORY_PAGE);
+
+		Assert(BufferGetBlockNumber(buf) == INVERTED_HEAD_BLKNO + i);
+
+		entries = InvertedPageGetDirEntries(page);
+		for (int j = 0; j < nentries; j++)
+		{
+			entries[j].startPage = InvalidBlockNumber;
+			entries[j].startOffno = InvalidOffsetNumber;
+			entries[j].unused = 0;
+			entries[j].maxValue = 0;
+			entries[j].npostings = 0;
+		}
+
+		((PageHeader) page)->pd_lower =
+			((char *) (entries + nentries)) - (char *) page;
+
+		InvertedCommitBuffer(buf, state);
+	}
+
+	buf = InvertedNewBuffer(index, forkNum);
+	InvertedInitRegisterPage(index, &buf, &page, &state, INVERTED_PENDING_PAGE);
+	Assert(BufferGetBlockNumber(buf) == INVERTED_HEAD_BLKNO + dirPages);
+	InvertedCommitBuffer(buf, state);
+}
+
+/*
+ * Write the posting run and return the directory entries
+ */
+static InvertedDirEntry
+InsertPostings(InvertedBuildState * buildstate, ForkNumber forkNum, BlockNumber *startPage, bool progress)
+{
+	Relation	index = buildstate->index;
+	TupleTableSlot *slot = MakeSingleTupleTableSlot(buildstate->tupdesc, &TTSOpsMinimalTuple);
+	InvertedDirEntry entries;
+	Buffer		buf = InvalidBuffer;
+	Page		page = NULL;
+	GenericXLogState *state = NULL;
+	InvertedPostingData posting;
+	int64		inserted = 0;
+
+	/* Zero padding bytes, since postings are written to disk as is */
+	MemSet(&posting, 0, sizeof(InvertedPostingData));
+
+	entries = palloc_extended(sizeof(InvertedDirEntryData) * buildstate->dimensions, MCXT_ALLOC_HUGE);
+	for (int i = 0; i < buildstate->dimensions; i++)
+	{
+		entries[i].startPage = InvalidBlockNumber;
+		entries[i].startOffno = InvalidOffsetNumber;
+		entries[i].unused = 0;
+		entries[i].maxValue = 0;
+		entries[i].npostings = 0;
+	}
+
+	*startPage = InvalidBlockNumber;
+
+	if (progress)
+	{
+		pgstat_progress_update_param(PROGRESS_CREATEIDX_SUBPHASE, PROGRESS_INVERTED_PHASE_LOAD);
+		pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_TOTAL, buildstate->npostings);
+	}
+
+	while (tuplesort_gettupleslot(buildstate->sortstate, true, false, slot, NULL))
+	{
+		bool		isnull;
+		OffsetNumber offno;
+		InvertedDirEntry entry;
+		int32		dim = DatumGetInt32(slot_getattr(slot, 1, &isnull));
+		ItemPointer heaptid = (ItemPointer) DatumGetPointer(slot_getattr(slot, 2, &isnull));
+
+		/* Skip postings merged twice after an error in an earlier merge */
+		if (inserted > 0 && dim == posting.dim && ItemPointerEquals(heaptid, &posting.heaptid))
+			continue;
+
+		posting.dim = dim;
+		posting.heaptid = *heaptid;
+		posting.value = DatumGetFloat4(slot_getattr(slot, 3, &isnull));
+
+		if (!BufferIsValid(buf))
+		{
+			buf = InvertedAllocBuffer(index, forkNum);
+			InvertedInitRegisterPage(index, &buf, &page, &state, INVERTED_POSTING_PAGE);
+			*startPage = BufferGetBlockNumber(buf);
+		}
+		else if (PageGetFreeSpace(page) < MAXALIGN(sizeof(InvertedPostingData)))
+			InvertedAppendPage(index, &buf, &page, &state, INVERTED_POSTING_PAGE, forkNum);
+
+		/* Add the item */
+		offno = PageAddItem(page, (Item) &posting, MAXALIGN(sizeof(InvertedPostingData)), InvalidOffsetNumber, false, false);
+		if (offno == InvalidOffsetNumber)
+			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+		/* Postings are sorted by dimension, so the first one starts the run */
+		entry = &entries[posting.dim];
+		if (!BlockNumberIsValid(entry->startPage))
+		{
+			entry->startPage = BufferGetBlockNumber(buf);
+			entry->startOffno = offno;
+		}
+
+		if (fabsf(posting.value) > entry->maxValue)
+			entry->maxValue = fabsf(posting.value);
+		entry->npostings++;
+
+		inserted++;
+		if (progress)
+			pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_DONE, inserted);
+	}
+
+	if (BufferIsValid(buf))
+		InvertedCommitBuffer(buf, state);
+
+	/* Postings written, without duplicates */
+	buildstate->npostings = inserted;
+
+	return entries;
+}
+
+/*
+ * Update the directory with the start and max value of each run
+ */
+static void
+UpdateDirectory(Relation index, InvertedDirEntry entries, int dimensions, ForkNumber forkNum)
+{
+	BlockNumber dirPages = GetDirPages(dimensions);
+
+	for (BlockNumber i = 0; i < dirPages; i++)
+	{
+		Buffer		buf;
+		Page		page;
+		GenericXLogState *state;
+		int			start = i * INVERTED_DIR_ENTRIES_PER_PAGE;
+		int			nentries = Min(dimensions - start, INVERTED_DIR_ENTRIES_PER_PAGE);
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(index, forkNum, INVERTED_HEAD_BLKNO + i, RBM_NORMAL, NULL);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, GENERIC_XLOG_FULL_IMAGE);
+
+		memcpy(InvertedPageGetDirEntries(page), entries + start, sizeof(InvertedDirEntryData) * nentries);
+
+		InvertedCommitBuffer(buf, state);
+	}
+}
+
+/*
+ * Update the start of the posting run in the metapage
+ */
+static void
+UpdatePostingStartPage(Relation index, BlockNumber postingStartPage, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+
+	buf = ReadBufferExtended(index, forkNum, INVERTED_METAPAGE_BLKNO, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	InvertedPageGetMeta(page)->postingStartPage = postingStartPage;
+
+	InvertedCommitBuffer(buf, state);
+}
+
+/*
+ * Start sorting postings by dimension and heap TID
+ */
+static void
+BeginSort(InvertedBuildState * buildstate)
+{
+	AttrNumber	attNums[] = {1, 2};
+	Oid			sortOperators[] = {Int4LessOperator, TIDLessOperator};
+	Oid			sortCollations[] = {InvalidOid, InvalidOid};
+	bool		nullsFirstFlags[] = {false, false};
+
+	buildstate->sortstate = tuplesort_begin_heap(buildstate->tupdesc, 2, attNums, sortOperators, sortCollations, nullsFirstFlags, maintenance_work_mem, NULL, false);
+}
+
+/*
+ * Create posting pages
+ */
+static void
+CreatePostingPages(InvertedBuildState * buildstate, ForkNumber forkNum)
+{
+	InvertedDirEntry entries;
+	BlockNumber startPage;
+
+	BeginSort(buildstate);
+
+	/* Add tuples to sort */
+	if (buildstate->heap != NULL)
+		buildstate->reltuples = table_index_build_scan(buildstate->heap, buildstate->index, buildstate->indexInfo,
+													   true, true, BuildCallback, (void *) buildstate, NULL);
+
+	tuplesort_performsort(buildstate->sortstate);
+
+	entries = InsertPostings(buildstate, forkNum, &startPage, buildstate->heap != NULL);
+
+	tuplesort_end(buildstate->sortstate);
+
+	UpdateDirectory(buildstate->index, entries, buildstate->dimensions, forkNum);
+	UpdatePostingStartPage(buildstate->index, startPage, forkNum);
+
+	pfree(entries);
+}
+
+/*
+ * Build the index
+ */
+static void
+BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
+		   InvertedBuildState * buildstate, ForkNumber forkNum)
+{
+	InitBuildState(buildstate, heap, index, indexInfo);
+
+	/* Create pages */
+	CreateMetaPage(index, buildstate->dimensions, forkNum);
+	CreateDirectoryPages(index, buildstate->dimensions, forkNum);
+	CreatePostingPages(buildstate, forkNum);
+
+	FreeBuildState(buildstate);
+}
+
+/*
+ * Build the index for a logged table
+ */
+IndexBuildResult *
+invertedbuild(Relation heap, Relation index, IndexInfo *indexInfo)
+{
+	IndexBuildResult *result;
+	InvertedBuildState buildstate;
+
+	BuildIndex(heap, index, indexInfo, &buildstate, MAIN_FORKNUM);
+
+	result = (IndexBuildResult *) palloc(sizeof(IndexBuildResult));
+	result->heap_tuples = buildstate.reltuples;
+	result->index_tuples = buildstate.npostings;
+
+	return result;
+}
+
+/*
+ * Build the index for an unlogged table
+ */
+void
+invertedbuildempty(Relation index)
+{
+	IndexInfo  *indexInfo = BuildIndexInfo(index);
+	InvertedBuildState buildstate;
+
+	BuildIndex(NULL, index, indexInfo, &buildstate, INIT_FORKNUM);
+}
+
+/*
+ * Add the vectors in the pending list to sort
+ *
+ * Returns the number of vectors
+ */
+static int64
+AddPendingToSort(InvertedBuildState * buildstate, BlockNumber blkno, char *copy)
+{
+	Relation	index = buildstate->index;
+	TupleDesc	tupdesc = RelationGetDescr(index);
+	int64		count = 0;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		/* Copy the page, since sorting can write to disk */
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(copy, BufferGetPage(buf), BLCKSZ);
+		UnlockReleaseBuffer(buf);
+
+		page = (Page) copy;
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+			bool		isnull;
+			Datum		value = index_getattr(itup, 1, tupdesc, &isnull);
+
+			/* Values are already normalized */
+			AddVectorToSort(buildstate, &itup->t_tid, DatumGetSparseVector(value));
+			count++;
+		}
+
+		blkno = InvertedPageGetOpaque(page)->nextblkno;
+	}
+
+	return count;
+}
+
+/*
+ * Add the postings in the posting run to sort, except deleted ones
+ */
+static void
+AddRunToSort(InvertedBuildState * buildstate, BlockNumber blkno, char *copy)
+{
+	Relation	index = buildstate->index;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		/* Can take a while, so ensure we can interrupt */
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(copy, BufferGetPage(buf), BLCKSZ);
+		UnlockReleaseBuffer(buf);
+
+		page = (Page) copy;
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			InvertedPosting posting = (InvertedPosting) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (!ItemPointerIsValid(&posting->heaptid))
+				continue;
+
+			AddPostingToSort(buildstate, posting->dim, &posting->heaptid, posting->value);
+			buildstate->npostings++;
+		}
+
+		blkno = InvertedPageGetOpaque(page)->nextblkno;
+	}
+}
+
+/*
+ * Clear the pending list, keeping the chain for reuse
+ */
+static void
+ClearPendingList(Relation index, BlockNumber blkno)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		BlockNumber nextblkno;
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, GENERIC_XLOG_FULL_IMAGE);
+
+		nextblkno = InvertedPageGetOpaque(page)->nextblkno;
+		InvertedInitPage(buf, page, INVERTED_PENDING_PAGE);
+		InvertedPageGetOpaque(page)->nextblkno = nextblkno;
+
+		InvertedCommitBuffer(buf, state);
+
+		blkno = nextblkno;
+	}
+
+	/* Start over at the first page */
+	buf = ReadBuffer(index, INVERTED_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+	InvertedPageGetMeta(page)->pendingInsertPage = InvertedPageGetMeta(page)->pendingStartPage;
+	InvertedCommitBuffer(buf, state);
+}
+
+/*
+ * Free the pages of a posting run that is no longer in the directory
+ */
+static void
+FreePostingPages(Relation index, BlockNumber blkno)
+{
+	Buffer		buf;
+
+	if (!BlockNumberIsValid(blkno))
+		return;
+
+	/*
+	 * Scans keep the metapage pinned while they read postings, so once no
+	 * other backend has it pinned, no scan can still be reading the old run
+	 */
+	buf = ReadBuffer(index, INVERTED_METAPAGE_BLKNO);
+	LockBufferForCleanup(buf);
+	UnlockReleaseBuffer(buf);
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Page		page;
+		GenericXLogState *state;
+		BlockNumber nextblkno;
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		nextblkno = InvertedPageGetOpaque(page)->nextblkno;
+		InvertedPageGetOpaque(page)->nextblkno = InvalidBlockNumber;
+		InvertedPageGetOpaque(page)->page_type = INVERTED_FREE_PAGE;
+
+		InvertedCommitBuffer(buf, state);
+
+		RecordFreeIndexPage(index, blkno);
+
+		blkno = nextblkno;
+	}
+
+	IndexFreeSpaceMapVacuum(index);
+}
+
+/*
+ * Merge the pending list into the postings
+ *
+ * Postings for a dimension must stay contiguous and sorted by heap TID, so
+ * the live postings and the pending vectors are sorted into a new run. The
+ * directory is updated before the pending list is cleared, so a scan sees
+ * each vector in at least one of them, and scans skip heap TIDs in the
+ * postings that they also found in the list. Returns the number of vectors
+ * merged, and the number of postings after the merge if it happened.
+ */
+int64
+InvertedMergePending(Relation index, bool wait, int64 *npostings)
+{
+	InvertedBuildState buildstate;
+	BlockNumber pendingStartPage;
+	BlockNumber postingStartPage;
+	BlockNumber newStartPage;
+	InvertedDirEntry entries;
+	MemoryContext mergeCtx;
+	MemoryContext oldCtx;
+	char	   *copy;
+	int64		merged;
+
+	if (wait)
+		LockPage(index, INVERTED_PENDING_LOCK, ExclusiveLock);
+	else if (!ConditionalLockPage(index, INVERTED_PENDING_LOCK, ExclusiveLock))
+		return 0;
+
+	mergeCtx = AllocSetContextCreate(CurrentMemoryContext,
+									 "Inverted merge context",
+									 ALLOCSET_DEFAULT_SIZES);
+	oldCtx = MemoryContextSwitchTo(mergeCtx);
+
+	InvertedGetMetaPageInfo(index, NULL, NULL, &pendingStartPage, NULL, &postingStartPage);
+
+	InitBuildState(&buildstate, NULL, index, BuildIndexInfo(index));
+	BeginSort(&buildstate);
+	copy = palloc(BLCKSZ);
+
+	merged = AddPendingToSort(&buildstate, pendingStartPage, copy);
+	if (merged > 0)
+	{
+		AddRunToSort(&buildstate, postingStartPage, copy);
+		tuplesort_performsort(buildstate.sortstate);
+
+		entries = InsertPostings(&buildstate, MAIN_FORKNUM, &newStartPage, false);
+		UpdateDirectory(index, entries, buildstate.dimensions, MAIN_FORKNUM);
+		UpdatePostingStartPage(index, newStartPage, MAIN_FORKNUM);
+
+		ClearPendingList(index, pendingStartPage);
+		FreePostingPages(index, postingStartPage);
+
+		if (npostings != NULL)
+			*npostings = buildstate.npostings;
+	}
+
+	tuplesort_end(buildstate.sortstate);
+	FreeBuildState(&buildstate);
+
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextDelete(mergeCtx);
+
+	UnlockPage(index, INVERTED_PENDING_LOCK, ExclusiveLock);
+
+	return merged;
+}
@@ -0,0 +1,403 @@
+#include "postgres.h"
+
+#include <float.h>
+
+#include "access/amapi.h"
+#include "access/amvalidate.h"
+#include "access/htup_details.h"
+#include "access/reloptions.h"
+#include "catalog/pg_amop.h"
+#include "catalog/pg_amproc.h"
+#include "catalog/pg_opclass.h"
+#include "catalog/pg_type.h"
+#include "commands/progress.h"
+#include "commands/vacuum.h"
+#include "inverted.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "storage/bufmgr.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/regproc.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+
+#if PG_VERSION_NUM < 150000
+#define MarkGUCPrefixReserved(x) EmitWarningsOnPlaceholders(x)
+#endif
+
+int			inverted_top_k;
+int			inverted_pending_list_limit;
+static relopt_kind inverted_relopt_kind;
+
+/* Inverted index options (none yet, but unknown options are rejected) */
+typedef struct InvertedOptions
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+}			InvertedOptions;
+
+/*
+ * Initialize index options and variables
+ */
+void
+InvertedInit(void)
+{
+	inverted_relopt_kind = add_reloption_kind();
+
+	DefineCustomIntVariable("inverted.top_k", "Sets the max number of results for search",
+							"Valid range is 1..10000.", &inverted_top_k,
+							INVERTED_DEFAULT_TOP_K, INVERTED_MIN_TOP_K, INVERTED_MAX_TOP_K, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("inverted.pending_list_limit", "Sets the max size of the pending list for inverted indexes",
+							NULL, &inverted_pending_list_limit,
+							INVERTED_DEFAULT_PENDING_LIST_LIMIT, INVERTED_MIN_PENDING_LIST_LIMIT, MAX_KILOBYTES, PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
+	MarkGUCPrefixReserved("inverted");
+}
+
+/*
+ * Get the name of index build phase
+ */
+static char *
+invertedbuildphasename(int64 phasenum)
+{
+	switch (phasenum)
+	{
+		case PROGRESS_CREATEIDX_SUBPHASE_INITIALIZE:
+			return "initializing";
+		case PROGRESS_INVERTED_PHASE_LOAD:
+			return "loading tuples";
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Count the postings for the dimensions of a constant query, or return -1
+ */
+static double
+EstimatePostings(PlannerInfo *root, IndexPath *path)
+{
+	Node	   *arg = get_rightop((Expr *) linitial(path->indexorderbys));
+	Const	   *c;
+	SparseVector *query;
+	Relation	index;
+	int			dimensions;
+	Buffer		buf = InvalidBuffer;
+	BlockNumber dirPage = InvalidBlockNumber;
+	double		npostings = 0;
+
+	if (arg == NULL)
+		return -1;
+
+	/* Fold stable functions and known parameters */
+	arg = estimate_expression_value(root, arg);
+	if (!IsA(arg, Const))
+		return -1;
+
+	c = (Const *) arg;
+	if (c->constisnull)
+		return 0;
+
+	query = DatumGetSparseVector(c->constvalue);
+
+	index = index_open(path->indexinfo->indexoid, NoLock);
+	InvertedGetMetaPageInfo(index, &dimensions, NULL, NULL, NULL, NULL);
+
+	/* The scan reports an error for this */
+	if (query->dim != dimensions)
+	{
+		index_close(index, NoLock);
+		return -1;
+	}
+
+	for (int i = 0; i < query->nnz; i++)
+	{
+		int32		dim = query->indices[i];
+		BlockNumber blkno = INVERTED_HEAD_BLKNO + dim / INVERTED_DIR_ENTRIES_PER_PAGE;
+
+		/* Query indices are sorted, so directory pages are read in order */
+		if (blkno != dirPage)
+		{
+			if (BufferIsValid(buf))
+				UnlockReleaseBuffer(buf);
+
+			buf = ReadBuffer(index, blkno);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+			dirPage = blkno;
+		}
+
+		npostings += InvertedPageGetDirEntries(BufferGetPage(buf))[dim % INVERTED_DIR_ENTRIES_PER_PAGE].npostings;
+	}
+
+	if (BufferIsValid(buf))
+		UnlockReleaseBuffer(buf);
+
+	index_close(index, NoLock);
+
+	return npostings;
+}
+
+/*
+ * Estimate the cost of an index scan
+ */
+static void
+invertedcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
+					 Cost *indexStartupCost, Cost *indexTotalCost,
+					 Selectivity *indexSelectivity, double *indexCorrelation,
+					 double *indexPages)
+{
+	GenericCosts costs;
+
+	/* Never use index without order */
+	if (path->indexorderbys == NULL)
+	{
+		*indexStartupCost = DBL_MAX;
+		*indexTotalCost = DBL_MAX;
+		*indexSelectivity = 0;
+		*indexCorrelation = 0;
+		*indexPages = 0;
+		return;
+	}
+
+	MemSet(&costs, 0, sizeof(costs));
+
+	/* A scan reads the postings for the query dimensions */
+	costs.numIndexTuples = EstimatePostings(root, path);
+
+	/* Without a constant query, assume a small fraction is visited */
+	if (costs.numIndexTuples < 0)
+		costs.numIndexTuples = path->indexinfo->tuples * 0.1;
+
+	genericcostestimate(root, path, loop_count, &costs);
+
+	/* Use total cost since most work happens before first tuple is returned */
+	*indexStartupCost = costs.indexTotalCost;
+	*indexTotalCost = costs.indexTotalCost;
+	*indexSelectivity = costs.indexSelectivity;
+	*indexCorrelation = costs.indexCorrelation;
+	*indexPages = costs.numIndexPages;
+}
+
+/*
+ * Parse and validate the reloptions
+ */
+static bytea *
+invertedoptions(Datum reloptions, bool validate)
+{
+#if PG_VERSION_NUM >= 130000
+	return (bytea *) build_reloptions(reloptions, validate,
+									  inverted_relopt_kind,
+									  sizeof(InvertedOptions),
+									  NULL, 0);
+#else
+	relopt_value *options;
+	int			numoptions;
+	InvertedOptions *rdopts;
+
+	options = parseRelOptions(reloptions, validate, inverted_relopt_kind, &numoptions);
+	rdopts = allocateReloptStruct(sizeof(InvertedOptions), options, numoptions);
+	fillRelOptions((void *) rdopts, sizeof(InvertedOptions), options, numoptions,
+				   validate, NULL, 0);
+
+	return (bytea *) rdopts;
+#endif
+}
+
+/*
+ * Report whether a column is distance orderable
+ */
+static bool
+invertedproperty(Oid index_oid, int attno, IndexAMProperty prop,
+				 const char *propname, bool *res, bool *isnull)
+{
+	Oid			opclass;
+	Oid			opfamily;
+	Oid			opcintype;
+
+	/* Let the core code handle other properties */
+	if (prop != AMPROP_DISTANCE_ORDERABLE || attno == 0)
+		return false;
+
+	opclass = get_index_column_opclass(index_oid, attno);
+	if (!OidIsValid(opclass) || !get_opclass_opfamily_and_input_type(opclass, &opfamily, &opcintype))
+	{
+		*isnull = true;
+		return true;
+	}
+
+	/* All operators are ordering operators */
+	*res = OidIsValid(get_opfamily_member(opfamily, opcintype, opcintype, INVERTED_DISTANCE_STRATEGY));
+	return true;
+}
+
+/*
+ * Validate catalog entries for the specified operator class
+ */
+static bool
+invertedvalidate(Oid opclassoid)
+{
+	bool		result = true;
+	HeapTuple	classtup;
+	Form_pg_opclass classform;
+	Oid			opfamilyoid;
+	Oid			opcintype;
+	char	   *opclassname;
+	CatCList   *proclist;
+	CatCList   *oprlist;
+	bool		hasDistance = false;
+
+	classtup = SearchSysCache1(CLAOID, ObjectIdGetDatum(opclassoid));
+	if (!HeapTupleIsValid(classtup))
+		elog(ERROR, "cache lookup failed for operator class %u", opclassoid);
+	classform = (Form_pg_opclass) GETSTRUCT(classtup);
+
+	opfamilyoid = classform->opcfamily;
+	opcintype = classform->opcintype;
+	opclassname = NameStr(classform->opcname);
+
+	/* Check the support functions */
+	proclist = SearchSysCacheList1(AMPROCNUM, ObjectIdGetDatum(opfamilyoid));
+	for (int i = 0; i < proclist->n_members; i++)
+	{
+		HeapTuple	proctup = &proclist->members[i]->tuple;
+		Form_pg_amproc procform = (Form_pg_amproc) GETSTRUCT(proctup);
+		bool		ok;
+
+		if (procform->amproclefttype != opcintype || procform->amprocrighttype != opcintype)
+			continue;
+
+		switch (procform->amprocnum)
+		{
+			case INVERTED_DISTANCE_PROC:
+				ok = check_amproc_signature(procform->amproc, FLOAT8OID, true, 2, 2, opcintype, opcintype);
+				hasDistance = true;
+				break;
+			case INVERTED_NORM_PROC:
+				ok = check_amproc_signature(procform->amproc, FLOAT8OID, true, 1, 1, opcintype);
+				break;
+			default:
+				ereport(INFO,
+						(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+						 errmsg("operator class \"%s\" of access method %s contains function %s with invalid support number %d",
+								opclassname, "inverted", format_procedure(procform->amproc), procform->amprocnum)));
+				result = false;
+				continue;
+		}
+
+		if (!ok)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("operator class \"%s\" of access method %s contains function %s with wrong signature for support number %d",
+							opclassname, "inverted", format_procedure(procform->amproc), procform->amprocnum)));
+			result = false;
+		}
+	}
+	ReleaseSysCacheList(proclist);
+
+	if (!hasDistance)
+	{
+		ereport(INFO,
+				(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+				 errmsg("operator class \"%s\" of access method %s is missing support function %d",
+						opclassname, "inverted", INVERTED_DISTANCE_PROC)));
+		result = false;
+	}
+
+	/* Check the operators, which must all be ordering operators */
+	oprlist = SearchSysCacheList1(AMOPSTRATEGY, ObjectIdGetDatum(opfamilyoid));
+	for (int i = 0; i < oprlist->n_members; i++)
+	{
+		HeapTuple	oprtup = &oprlist->members[i]->tuple;
+		Form_pg_amop oprform = (Form_pg_amop) GETSTRUCT(oprtup);
+
+		if (oprform->amopstrategy != INVERTED_DISTANCE_STRATEGY || oprform->amoppurpose != AMOP_ORDER)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("operator family of access method %s contains operator %s with invalid strategy number %d or purpose",
+							"inverted", format_operator(oprform->amopopr), oprform->amopstrategy)));
+			result = false;
+		}
+		else if (!check_amop_signature(oprform->amopopr, FLOAT8OID, oprform->amoplefttype, oprform->amoprighttype))
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("operator family of access method %s contains operator %s with wrong signature",
+							"inverted", format_operator(oprform->amopopr))));
+			result = false;
+		}
+	}
+	ReleaseSysCacheList(oprlist);
+
+	ReleaseSysCache(classtup);
+
+	return result;
+}
+
+/*
+ * Define index handler
+ *
+ * See https://www.postgresql.org/docs/current/index-api.html
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(invertedhandler);
+Datum
+invertedhandler(PG_FUNCTION_ARGS)
+{
+	IndexAmRoutine *amroutine = makeNode(IndexAmRoutine);
+
+	amroutine->amstrategies = 0;
+	amroutine->amsupport = 2;
+#if PG_VERSION_NUM >= 130000
+	amroutine->amoptsprocnum = 0;
+#endif
+	amroutine->amcanorder = false;
+	amroutine->amcanorderbyop = true;
+	amroutine->amcanbackward = false;	/* can change direction mid-scan */
+	amroutine->amcanunique = false;
+	amroutine->amcanmulticol = false;
+	amroutine->amoptionalkey = true;
+	amroutine->amsearcharray = false;
+	amroutine->amsearchnulls = false;
+	amroutine->amstorage = false;
+	amroutine->amclusterable = false;
+	amroutine->ampredlocks = false;
+	amroutine->amcanparallel = false;
+	amroutine->amcaninclude = false;
+#if PG_VERSION_NUM >= 130000
+	amroutine->amusemaintenanceworkmem = false; /* not used during VACUUM */
+	amroutine->amparallelvacuumoptions = VACUUM_OPTION_PARALLEL_BULKDEL;
+#endif
+	amroutine->amkeytype = InvalidOid;
+
+	/* Interface functions */
+	amroutine->ambuild = invertedbuild;
+	amroutine->ambuildempty = invertedbuildempty;
+	amroutine->aminsert = invertedinsert;
+	amroutine->ambulkdelete = invertedbulkdelete;
+	amroutine->amvacuumcleanup = invertedvacuumcleanup;
+	amroutine->amcanreturn = NULL;	/* postings do not store the vector */
+	amroutine->amcostestimate = invertedcostestimate;
+	amroutine->amoptions = invertedoptions;
+	amroutine->amproperty = invertedproperty;
+	amroutine->ambuildphasename = invertedbuildphasename;
+	amroutine->amvalidate = invertedvalidate;
+#if PG_VERSION_NUM >= 140000
+	amroutine->amadjustmembers = NULL;
+#endif
+	amroutine->ambeginscan = invertedbeginscan;
+	amroutine->amrescan = invertedrescan;
+	amroutine->amgettuple = invertedgettuple;
+	amroutine->amgetbitmap = NULL;
+	amroutine->amendscan = invertedendscan;
+	amroutine->ammarkpos = NULL;
+	amroutine->amrestrpos = NULL;
+
+	/* Interface functions to support parallel index scans */
+	amroutine->amestimateparallelscan = NULL;
+	amroutine->aminitparallelscan = NULL;
+	amroutine->amparallelrescan = NULL;
+
+	PG_RETURN_POINTER(amroutine);
+}
@@ -0,0 +1,228 @@
+#ifndef INVERTED_H
+#define INVERTED_H
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/generic_xlog.h"
+#include "nodes/execnodes.h"
+#include "sparsevec.h"
+#include "utils/tuplesort.h"
+
+#define INVERTED_MAX_DIM 1000000
+
+/* Only the pending list stores whole vectors, so they must fit on a page */
+#define INVERTED_MAX_NNZ 1000
+
+/* Support functions */
+#define INVERTED_DISTANCE_PROC 1
+#define INVERTED_NORM_PROC 2
+
+#define INVERTED_DISTANCE_STRATEGY 1
+
+#define INVERTED_VERSION	1
+#define INVERTED_MAGIC_NUMBER 0x1A7E4D3
+#define INVERTED_PAGE_ID	0xFF86
+
+/* Preserved page numbers */
+#define INVERTED_METAPAGE_BLKNO	0
+#define INVERTED_HEAD_BLKNO		1	/* first directory page */
+
+/* Page types */
+#define INVERTED_META_PAGE		0
+#define INVERTED_DIRECTORY_PAGE	1
+#define INVERTED_POSTING_PAGE	2
+#define INVERTED_PENDING_PAGE	3
+#define INVERTED_FREE_PAGE		4	/* old postings, recorded in the FSM */
+
+/* Page lock that prevents appends to the pending list while merging */
+#define INVERTED_PENDING_LOCK	0
+
+/* Inverted parameters */
+#define INVERTED_DEFAULT_TOP_K	40
+#define INVERTED_MIN_TOP_K		1
+#define INVERTED_MAX_TOP_K		10000
+#define INVERTED_DEFAULT_PENDING_LIST_LIMIT	(4 * 1024)	/* kB */
+#define INVERTED_MIN_PENDING_LIST_LIMIT	64	/* kB */
+
+/* Build phases */
+/* PROGRESS_CREATEIDX_SUBPHASE_INITIALIZE is 1 */
+#define PROGRESS_INVERTED_PHASE_LOAD	2
+
+#define INVERTED_DIR_ENTRIES_PER_PAGE \
+	((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(InvertedPageOpaqueData))) / sizeof(InvertedDirEntryData))
+
+#define InvertedPageGetOpaque(page)	((InvertedPageOpaque) PageGetSpecialPointer(page))
+#define InvertedPageGetMeta(page)	((InvertedMetaPageData *) PageGetContents(page))
+#define InvertedPageGetDirEntries(page)	((InvertedDirEntry) PageGetContents(page))
+
+/* Variables */
+extern int	inverted_top_k;
+extern int	inverted_pending_list_limit;
+
+typedef struct InvertedBuildState
+{
+	/* Info */
+	Relation	heap;
+	Relation	index;
+	IndexInfo  *indexInfo;
+
+	/* Settings */
+	int			dimensions;
+
+	/* Statistics */
+	double		indtuples;
+	double		reltuples;
+	int64		npostings;
+
+	/* Support functions */
+	FmgrInfo   *normprocinfo;
+	Oid			collation;
+
+	/* Sorting */
+	Tuplesortstate *sortstate;
+	TupleDesc	tupdesc;
+	TupleTableSlot *slot;
+
+	/* Memory */
+	MemoryContext tmpCtx;
+}			InvertedBuildState;
+
+typedef struct InvertedMetaPageData
+{
+	uint32		magicNumber;
+	uint32		version;
+	int32		dimensions;
+	BlockNumber dirPages;
+	BlockNumber pendingStartPage;
+	BlockNumber pendingInsertPage;
+	uint32		pendingPages;	/* pages in the pending list chain */
+	BlockNumber postingStartPage;	/* invalid if no postings */
+}			InvertedMetaPageData;
+
+typedef InvertedMetaPageData * InvertedMetaPage;
+
+typedef struct InvertedPageOpaqueData
+{
+	BlockNumber nextblkno;
+	uint16		page_type;
+	uint16		page_id;		/* for identification of inverted indexes */
+}			InvertedPageOpaqueData;
+
+typedef InvertedPageOpaqueData * InvertedPageOpaque;
+
+/*
+ * One fixed-size entry per dimension, so the entry for a dimension is found
+ * without a search
+ */
+typedef struct InvertedDirEntryData
+{
+	BlockNumber startPage;		/* invalid if dimension has no postings */
+	OffsetNumber startOffno;
+	uint16		unused;
+	float		maxValue;		/* max absolute value, for upper bounds */
+	uint32		npostings;		/* postings in the run, for cost estimates */
+}			InvertedDirEntryData;
+
+typedef InvertedDirEntryData * InvertedDirEntry;
+
+/*
+ * Postings are stored in one run sorted by dimension and heap TID, so the
+ * postings for a dimension are contiguous and ordered for merging
+ */
+typedef struct InvertedPostingData
+{
+	ItemPointerData heaptid;	/* invalid once deleted by vacuum */
+	int32		dim;
+	float		value;
+}			InvertedPostingData;
+
+typedef InvertedPostingData * InvertedPosting;
+
+/* Posting copied from a page for a scan */
+typedef struct InvertedScanPosting
+{
+	ItemPointerData heaptid;
+	float		value;
+}			InvertedScanPosting;
+
+/* Cursor over the postings for one query dimension */
+typedef struct InvertedCursor
+{
+	int32		dim;
+	float		queryValue;
+	double		upperBound;		/* max contribution to score */
+	BlockNumber nextPage;		/* invalid once run is exhausted */
+	InvertedScanPosting *postings;	/* postings from current page */
+	int			npostings;
+	int			pos;
+}			InvertedCursor;
+
+/* Scan result */
+typedef struct InvertedScanResult
+{
+	ItemPointerData heaptid;
+	double		score;
+}			InvertedScanResult;
+
+typedef struct InvertedScanOpaqueData
+{
+	int			topK;
+	bool		first;
+
+	/* Support functions */
+	FmgrInfo   *procinfo;
+	FmgrInfo   *normprocinfo;
+	Oid			collation;
+
+	/* Cursors */
+	InvertedCursor *cursors;
+	int			ncursors;
+
+	/* Heap TIDs in the pending list, sorted */
+	ItemPointerData *pendingTids;
+	int			npendingTids;
+
+	/* Results */
+	InvertedScanResult *results;	/* min-heap by score during search */
+	int			nresults;
+	int			pos;
+
+	/* Memory */
+	MemoryContext tmpCtx;
+}			InvertedScanOpaqueData;
+
+typedef InvertedScanOpaqueData * InvertedScanOpaque;
+
+/* Methods */
+FmgrInfo   *InvertedOptionalProcInfo(Relation index, uint16 procnum);
+bool		InvertedNormValue(FmgrInfo *procinfo, Oid collation, Datum *value);
+void		InvertedCheckNnz(SparseVector * vec);
+void		InvertedGetMetaPageInfo(Relation index, int *dimensions, BlockNumber *dirPages, BlockNumber *pendingStartPage, BlockNumber *pendingInsertPage, BlockNumber *postingStartPage);
+bool		InvertedUpdatePendingInsertPage(Relation index, BlockNumber insertPage, BlockNumber originalInsertPage, bool newPage);
+void		InvertedCommitBuffer(Buffer buf, GenericXLogState *state);
+void		InvertedAppendPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, uint16 pageType, ForkNumber forkNum);
+Buffer		InvertedNewBuffer(Relation index, ForkNumber forkNum);
+Buffer		InvertedAllocBuffer(Relation index, ForkNumber forkNum);
+void		InvertedInitPage(Buffer buf, Page page, uint16 pageType);
+void		InvertedInitRegisterPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, uint16 pageType);
+int64		InvertedMergePending(Relation index, bool wait, int64 *npostings);
+void		InvertedInit(void);
+
+/* Index access methods */
+IndexBuildResult *invertedbuild(Relation heap, Relation index, IndexInfo *indexInfo);
+void		invertedbuildempty(Relation index);
+bool		invertedinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heap, IndexUniqueCheck checkUnique
+#if PG_VERSION_NUM >= 140000
+						   ,bool indexUnchanged
+#endif
+						   ,IndexInfo *indexInfo
+);
+IndexBulkDeleteResult *invertedbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats, IndexBulkDeleteCallback callback, void *callback_state);
+IndexBulkDeleteResult *invertedvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats);
+IndexScanDesc invertedbeginscan(Relation index, int nkeys, int norderbys);
+void		invertedrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys);
+bool		invertedgettuple(IndexScanDesc scan, ScanDirection dir);
+void		invertedendscan(IndexScanDesc scan);
+
+#endif
@@ -0,0 +1,174 @@
+#include "postgres.h"
+
+#include "access/generic_xlog.h"
+#include "inverted.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+
+/*
+ * Insert a tuple into the pending list
+ *
+ * New vectors are kept whole and scored exactly at scan time until the
+ * pending list is merged into the postings, like the pending list of GIN
+ * indexes. The list is merged when it grows larger than
+ * inverted.pending_list_limit or by vacuum.
+ */
+static void
+InsertTuple(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heapRel)
+{
+	IndexTuple	itup;
+	Datum		value;
+	SparseVector *vec;
+	FmgrInfo   *normprocinfo;
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	Size		itemsz;
+	BlockNumber insertPage;
+	BlockNumber originalInsertPage;
+	bool		newPage = false;
+	bool		merge = false;
+
+	/* Detoast once for all calls */
+	value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+
+	/* Check non-zero elements */
+	vec = DatumGetSparseVector(value);
+	InvertedCheckNnz(vec);
+
+	/* Skip vectors without postings, like build */
+	if (vec->nnz == 0)
+		return;
+
+	/* Normalize if needed */
+	normprocinfo = InvertedOptionalProcInfo(index, INVERTED_NORM_PROC);
+	if (normprocinfo != NULL)
+	{
+		if (!InvertedNormValue(normprocinfo, index->rd_indcollation[0], &value))
+			return;
+	}
+
+	/* Wait for a merge to finish, since it clears the list */
+	LockPage(index, INVERTED_PENDING_LOCK, ShareLock);
+
+	/* Get the insert page */
+	InvertedGetMetaPageInfo(index, NULL, NULL, NULL, &insertPage, NULL);
+	Assert(BlockNumberIsValid(insertPage));
+	originalInsertPage = insertPage;
+
+	/* Form tuple */
+	itup = index_form_tuple(RelationGetDescr(index), &value, isnull);
+	itup->t_tid = *heap_tid;
+
+	/* Get tuple size */
+	itemsz = MAXALIGN(IndexTupleSize(itup));
+	Assert(itemsz <= BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(InvertedPageOpaqueData)) - sizeof(ItemIdData));
+
+	/* Find a page to insert the item */
+	for (;;)
+	{
+		buf = ReadBuffer(index, insertPage);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		if (PageGetFreeSpace(page) >= itemsz)
+			break;
+
+		insertPage = InvertedPageGetOpaque(page)->nextblkno;
+
+		if (BlockNumberIsValid(insertPage))
+		{
+			/* Move to next page */
+			GenericXLogAbort(state);
+			UnlockReleaseBuffer(buf);
+		}
+		else
+		{
+			Buffer		newbuf;
+			Page		newpage;
+
+			/* Add a new page */
+			newbuf = InvertedAllocBuffer(index, MAIN_FORKNUM);
+			newPage = true;
+
+			/* Init new page */
+			newpage = GenericXLogRegisterBuffer(state, newbuf, GENERIC_XLOG_FULL_IMAGE);
+			InvertedInitPage(newbuf, newpage, INVERTED_PENDING_PAGE);
+
+			/* Update insert page */
+			insertPage = BufferGetBlockNumber(newbuf);
+
+			/* Update previous buffer */
+			InvertedPageGetOpaque(page)->nextblkno = insertPage;
+
+			/* Commit */
+			GenericXLogFinish(state);
+
+			/* Unlock previous buffer */
+			UnlockReleaseBuffer(buf);
+
+			/* Prepare new buffer */
+			state = GenericXLogStart(index);
+			buf = newbuf;
+			page = GenericXLogRegisterBuffer(state, buf, 0);
+			break;
+		}
+	}
+
+	/* Add to next offset */
+	if (PageAddItem(page, (Item) itup, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+		elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+	InvertedCommitBuffer(buf, state);
+
+	/* Update the insert page */
+	if (insertPage != originalInsertPage || newPage)
+		merge = InvertedUpdatePendingInsertPage(index, insertPage, originalInsertPage, newPage);
+
+	UnlockPage(index, INVERTED_PENDING_LOCK, ShareLock);
+
+	/* Skip if another backend is already merging */
+	if (merge)
+		InvertedMergePending(index, false, NULL);
+}
+
+/*
+ * Insert a tuple into the index
+ */
+bool
+invertedinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid,
+			   Relation heap, IndexUniqueCheck checkUnique
+#if PG_VERSION_NUM >= 140000
+			   ,bool indexUnchanged
+#endif
+			   ,IndexInfo *indexInfo
+)
+{
+	MemoryContext oldCtx;
+	MemoryContext insertCtx;
+
+	/* Skip nulls */
+	if (isnull[0])
+		return false;
+
+	/*
+	 * Use memory context since detoast, InvertedNormValue, and
+	 * index_form_tuple can allocate
+	 */
+	insertCtx = AllocSetContextCreate(CurrentMemoryContext,
+									  "Inverted insert temporary context",
+									  ALLOCSET_DEFAULT_SIZES);
+	oldCtx = MemoryContextSwitchTo(insertCtx);
+
+	/* Insert tuple */
+	InsertTuple(index, values, isnull, heap_tid, heap);
+
+	/* Delete memory context */
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextDelete(insertCtx);
+
+	return false;
+}
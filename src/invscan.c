@@ -0,0 +1,634 @@
+#include "postgres.h"
+
+#include <float.h>
+#include <math.h>
+
+#include "access/relscan.h"
+#include "inverted.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/bufmgr.h"
+#include "utils/memutils.h"
+
+/*
+ * Add a result to the min-heap of the best topK results
+ */
+static void
+AddResult(InvertedScanOpaque so, ItemPointer heaptid, double score)
+{
+	InvertedScanResult *results = so->results;
+	int			i;
+
+	if (so->nresults < so->topK)
+	{
+		/* Sift up */
+		i = so->nresults++;
+		while (i > 0 && results[(i - 1) / 2].score > score)
+		{
+			results[i] = results[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+	}
+	else if (score > results[0].score)
+	{
+		/* Replace the worst result and sift down */
+		i = 0;
+		for (;;)
+		{
+			int			child = 2 * i + 1;
+
+			if (child >= so->nresults)
+				break;
+
+			if (child + 1 < so->nresults && results[child + 1].score < results[child].score)
+				child++;
+
+			if (results[child].score >= score)
+				break;
+
+			results[i] = results[child];
+			i = child;
+		}
+	}
+	else
+		return;
+
+	results[i].heaptid = *heaptid;
+	results[i].score = score;
+}
+
+/*
+ * Get the score a document must beat to be added
+ */
+static inline double
+GetThreshold(InvertedScanOpaque so)
+{
+	if (so->nresults < so->topK)
+		return -DBL_MAX;
+
+	return so->results[0].score;
+}
+
+/*
+ * Compare results by score, with the best first
+ */
+static int
+CompareResults(const void *a, const void *b)
+{
+	const InvertedScanResult *ra = (const InvertedScanResult *) a;
+	const InvertedScanResult *rb = (const InvertedScanResult *) b;
+
+	if (ra->score > rb->score)
+		return -1;
+
+	if (ra->score < rb->score)
+		return 1;
+
+	return ItemPointerCompare((ItemPointer) &ra->heaptid, (ItemPointer) &rb->heaptid);
+}
+
+/*
+ * Compare heap TIDs
+ */
+static int
+CompareTids(const void *a, const void *b)
+{
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
+
+/*
+ * Check if two vectors share a non-zero element
+ */
+static bool
+SharesElement(SparseVector * a, SparseVector * b)
+{
+	int			i = 0;
+	int			j = 0;
+
+	while (i < a->nnz && j < b->nnz)
+	{
+		if (a->indices[i] == b->indices[j])
+			return true;
+
+		if (a->indices[i] < b->indices[j])
+			i++;
+		else
+			j++;
+	}
+
+	return false;
+}
+
+/*
+ * Score vectors in the pending list, which are not in the posting run
+ *
+ * Only vectors sharing a non-zero element with the query are considered,
+ * like vectors in the posting run
+ */
+static void
+ScanPending(IndexScanDesc scan, Datum value, BlockNumber pendingStartPage, BufferAccessStrategy bas)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+	TupleDesc	tupdesc = RelationGetDescr(scan->indexRelation);
+	SparseVector *query = DatumGetSparseVector(value);
+	BlockNumber searchPage = pendingStartPage;
+	int			maxTids = 0;
+
+	while (BlockNumberIsValid(searchPage))
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		buf = ReadBufferExtended(scan->indexRelation, MAIN_FORKNUM, searchPage, RBM_NORMAL, bas);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+			bool		isnull;
+			Datum		datum = index_getattr(itup, 1, tupdesc, &isnull);
+			double		distance;
+
+			/* Remember heap TIDs in case they are also merged into postings */
+			if (so->npendingTids == maxTids)
+			{
+				maxTids = Max(maxTids * 2, MaxIndexTuplesPerPage);
+				if (so->pendingTids == NULL)
+					so->pendingTids = palloc(sizeof(ItemPointerData) * maxTids);
+				else
+					so->pendingTids = repalloc_huge(so->pendingTids, sizeof(ItemPointerData) * maxTids);
+			}
+			so->pendingTids[so->npendingTids++] = itup->t_tid;
+
+			if (!SharesElement(DatumGetSparseVector(datum), query))
+				continue;
+
+			/* Use procinfo from the index instead of scan key for performance */
+			distance = DatumGetFloat8(FunctionCall2Coll(so->procinfo, so->collation, datum, value));
+
+			AddResult(so, &itup->t_tid, -distance);
+		}
+
+		searchPage = InvertedPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (so->npendingTids > 1)
+		qsort(so->pendingTids, so->npendingTids, sizeof(ItemPointerData), CompareTids);
+}
+
+/*
+ * Check if a heap TID was found in the pending list
+ */
+static bool
+InPendingList(InvertedScanOpaque so, ItemPointer heaptid)
+{
+	if (so->npendingTids == 0)
+		return false;
+
+	return bsearch(heaptid, so->pendingTids, so->npendingTids, sizeof(ItemPointerData), CompareTids) != NULL;
+}
+
+/*
+ * Load the postings for the cursor dimension from a page
+ *
+ * Moves to the next page if none are valid, and leaves the cursor empty
+ * once the run for the dimension ends
+ */
+static void
+CursorLoadPage(IndexScanDesc scan, InvertedCursor * cursor, BlockNumber blkno, OffsetNumber offno, BufferAccessStrategy bas)
+{
+	cursor->npostings = 0;
+	cursor->pos = 0;
+	cursor->nextPage = InvalidBlockNumber;
+
+	while (BlockNumberIsValid(blkno) && cursor->npostings == 0)
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+		bool		ended = false;
+
+		buf = ReadBufferExtended(scan->indexRelation, MAIN_FORKNUM, blkno, RBM_NORMAL, bas);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			InvertedPosting posting = (InvertedPosting) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (posting->dim != cursor->dim)
+			{
+				ended = true;
+				break;
+			}
+
+			/* Skip postings deleted by vacuum */
+			if (!ItemPointerIsValid(&posting->heaptid))
+				continue;
+
+			cursor->postings[cursor->npostings].heaptid = posting->heaptid;
+			cursor->postings[cursor->npostings].value = posting->value;
+			cursor->npostings++;
+		}
+
+		if (!ended)
+			cursor->nextPage = InvertedPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+
+		blkno = cursor->nextPage;
+		offno = FirstOffsetNumber;
+	}
+}
+
+/*
+ * Get the current posting of a cursor, or NULL if exhausted
+ */
+static inline InvertedScanPosting *
+CursorCurrent(InvertedCursor * cursor)
+{
+	if (cursor->pos < cursor->npostings)
+		return &cursor->postings[cursor->pos];
+
+	return NULL;
+}
+
+/*
+ * Move a cursor to the next posting
+ */
+static void
+CursorNext(IndexScanDesc scan, InvertedCursor * cursor, BufferAccessStrategy bas)
+{
+	cursor->pos++;
+
+	if (cursor->pos == cursor->npostings && BlockNumberIsValid(cursor->nextPage))
+		CursorLoadPage(scan, cursor, cursor->nextPage, FirstOffsetNumber, bas);
+}
+
+/*
+ * Move a cursor to the first posting with a heap TID at or after target
+ */
+static void
+CursorSkipTo(IndexScanDesc scan, InvertedCursor * cursor, ItemPointer target, BufferAccessStrategy bas)
+{
+	int			lo;
+	int			hi;
+
+	/* Skip whole pages without looking at their postings */
+	while (cursor->pos < cursor->npostings &&
+		   ItemPointerCompare(&cursor->postings[cursor->npostings - 1].heaptid, target) < 0)
+	{
+		if (BlockNumberIsValid(cursor->nextPage))
+			CursorLoadPage(scan, cursor, cursor->nextPage, FirstOffsetNumber, bas);
+		else
+		{
+			cursor->pos = cursor->npostings;
+			return;
+		}
+	}
+
+	/* Binary search within the page */
+	lo = cursor->pos;
+	hi = cursor->npostings;
+	while (lo < hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (ItemPointerCompare(&cursor->postings[mid].heaptid, target) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	cursor->pos = lo;
+}
+
+/*
+ * Create a cursor for each query dimension with postings
+ */
+static void
+InitCursors(IndexScanDesc scan, SparseVector * query, BufferAccessStrategy bas)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+	float	   *values = SPARSEVEC_VALUES(query);
+	Buffer		buf = InvalidBuffer;
+	BlockNumber dirPage = InvalidBlockNumber;
+
+	so->cursors = palloc(sizeof(InvertedCursor) * query->nnz);
+	so->ncursors = 0;
+
+	for (int i = 0; i < query->nnz; i++)
+	{
+		int32		dim = query->indices[i];
+		BlockNumber blkno = INVERTED_HEAD_BLKNO + dim / INVERTED_DIR_ENTRIES_PER_PAGE;
+		InvertedDirEntryData entry;
+		InvertedCursor *cursor;
+
+		/* Query indices are sorted, so directory pages are read in order */
+		if (blkno != dirPage)
+		{
+			if (BufferIsValid(buf))
+				UnlockReleaseBuffer(buf);
+
+			buf = ReadBufferExtended(scan->indexRelation, MAIN_FORKNUM, blkno, RBM_NORMAL, bas);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+			dirPage = blkno;
+		}
+
+		entry = InvertedPageGetDirEntries(BufferGetPage(buf))[dim % INVERTED_DIR_ENTRIES_PER_PAGE];
+
+		if (!BlockNumberIsValid(entry.startPage))
+			continue;
+
+		cursor = &so->cursors[so->ncursors++];
+		cursor->dim = dim;
+		cursor->queryValue = values[i];
+		cursor->upperBound = fabs((double) values[i]) * entry.maxValue;
+		cursor->postings = palloc(sizeof(InvertedScanPosting) * MaxIndexTuplesPerPage);
+		CursorLoadPage(scan, cursor, entry.startPage, entry.startOffno, bas);
+	}
+
+	if (BufferIsValid(buf))
+		UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Find the topK documents with the highest inner product using WAND
+ *
+ * Cursors are kept ordered by their current heap TID. The pivot is the
+ * first cursor where the sum of upper bounds so far can beat the current
+ * threshold. No document before the pivot TID can beat the threshold, so
+ * the cursors before the pivot skip to it, and the pivot document is only
+ * scored once all cursors up to the pivot are on it.
+ */
+static void
+SearchPostings(IndexScanDesc scan, BufferAccessStrategy bas)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+	InvertedCursor **active = palloc(sizeof(InvertedCursor *) * so->ncursors);
+	int			nactive = 0;
+
+	for (int i = 0; i < so->ncursors; i++)
+	{
+		if (CursorCurrent(&so->cursors[i]) != NULL)
+			active[nactive++] = &so->cursors[i];
+	}
+
+	for (;;)
+	{
+		double		threshold = GetThreshold(so);
+		double		upperBound = 0;
+		int			pivot = -1;
+		ItemPointerData pivotTid;
+		int			n = 0;
+
+		/* Can take a while, so ensure we can interrupt */
+		/* Needs to be called when no buffer locks are held */
+		CHECK_FOR_INTERRUPTS();
+
+		/* Remove exhausted cursors */
+		for (int i = 0; i < nactive; i++)
+		{
+			if (CursorCurrent(active[i]) != NULL)
+				active[n++] = active[i];
+		}
+		nactive = n;
+
+		/* Sort by current heap TID (insertion sort since mostly sorted) */
+		for (int i = 1; i < nactive; i++)
+		{
+			InvertedCursor *cursor = active[i];
+			int			j = i - 1;
+
+			while (j >= 0 && ItemPointerCompare(&CursorCurrent(active[j])->heaptid, &CursorCurrent(cursor)->heaptid) > 0)
+			{
+				active[j + 1] = active[j];
+				j--;
+			}
+			active[j + 1] = cursor;
+		}
+
+		/* Find pivot */
+		for (int i = 0; i < nactive; i++)
+		{
+			upperBound += active[i]->upperBound;
+
+			if (upperBound > threshold)
+			{
+				pivot = i;
+				break;
+			}
+		}
+
+		/* No remaining document can beat the threshold */
+		if (pivot == -1)
+			break;
+
+		pivotTid = CursorCurrent(active[pivot])->heaptid;
+
+		if (ItemPointerEquals(&CursorCurrent(active[0])->heaptid, &pivotTid))
+		{
+			double		score = 0;
+
+			/* Score the pivot document with every cursor on it */
+			for (int i = 0; i < nactive; i++)
+			{
+				InvertedScanPosting *posting = CursorCurrent(active[i]);
+
+				if (!ItemPointerEquals(&posting->heaptid, &pivotTid))
+					break;
+
+				score += (double) active[i]->queryValue * (double) posting->value;
+				CursorNext(scan, active[i], bas);
+			}
+
+			/* Already scored from the pending list during a merge */
+			if (!InPendingList(so, &pivotTid))
+				AddResult(so, &pivotTid, score);
+		}
+		else
+		{
+			for (int i = 0; i < pivot; i++)
+				CursorSkipTo(scan, active[i], &pivotTid, bas);
+		}
+	}
+
+	pfree(active);
+}
+
+/*
+ * Get the topK results
+ */
+static void
+GetScanItems(IndexScanDesc scan, Datum value)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+	SparseVector *query = DatumGetSparseVector(value);
+	int			dimensions;
+	BlockNumber pendingStartPage;
+	Buffer		metabuf;
+
+	/*
+	 * Reuse same set of shared buffers for scan
+	 *
+	 * See postgres/src/backend/storage/buffer/README for description
+	 */
+	BufferAccessStrategy bas = GetAccessStrategy(BAS_BULKREAD);
+
+	/* Keep the metapage pinned so a merge does not free postings being read */
+	metabuf = ReadBuffer(scan->indexRelation, INVERTED_METAPAGE_BLKNO);
+
+	InvertedGetMetaPageInfo(scan->indexRelation, &dimensions, NULL, &pendingStartPage, NULL, NULL);
+
+	if (query->dim != dimensions)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different sparsevec dimensions %d and %d", query->dim, dimensions)));
+
+	/* Pending vectors are scored first to raise the threshold for pruning */
+	ScanPending(scan, value, pendingStartPage, bas);
+
+	InitCursors(scan, query, bas);
+	SearchPostings(scan, bas);
+
+	ReleaseBuffer(metabuf);
+	FreeAccessStrategy(bas);
+
+	qsort(so->results, so->nresults, sizeof(InvertedScanResult), CompareResults);
+}
+
+/*
+ * Prepare for an index scan
+ */
+IndexScanDesc
+invertedbeginscan(Relation index, int nkeys, int norderbys)
+{
+	IndexScanDesc scan;
+	InvertedScanOpaque so;
+
+	scan = RelationGetIndexScan(index, nkeys, norderbys);
+
+	so = (InvertedScanOpaque) palloc(sizeof(InvertedScanOpaqueData));
+	so->first = true;
+	so->topK = inverted_top_k;
+	so->results = palloc(sizeof(InvertedScanResult) * so->topK);
+	so->nresults = 0;
+	so->pendingTids = NULL;
+	so->npendingTids = 0;
+	so->pos = 0;
+	so->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+									   "Inverted scan temporary context",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	/* Set support functions */
+	so->procinfo = index_getprocinfo(index, 1, INVERTED_DISTANCE_PROC);
+	so->normprocinfo = InvertedOptionalProcInfo(index, INVERTED_NORM_PROC);
+	so->collation = index->rd_indcollation[0];
+
+	scan->opaque = so;
+
+	return scan;
+}
+
+/*
+ * Start or restart an index scan
+ */
+void
+invertedrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+
+	so->first = true;
+	so->nresults = 0;
+	so->pendingTids = NULL;
+	so->npendingTids = 0;
+	so->pos = 0;
+	MemoryContextReset(so->tmpCtx);
+
+	if (keys && scan->numberOfKeys > 0)
+		memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
+
+	if (orderbys && scan->numberOfOrderBys > 0)
+		memmove(scan->orderByData, orderbys, scan->numberOfOrderBys * sizeof(ScanKeyData));
+}
+
+/*
+ * Fetch the next tuple in the given scan
+ */
+bool
+invertedgettuple(IndexScanDesc scan, ScanDirection dir)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+
+	/*
+	 * Index can be used to scan backward, but Postgres doesn't support
+	 * backward scan on operators
+	 */
+	Assert(ScanDirectionIsForward(dir));
+
+	if (so->first)
+	{
+		/* Count index scan for stats */
+		pgstat_count_index_scan(scan->indexRelation);
+
+		/* Safety check */
+		if (scan->orderByData == NULL)
+			elog(ERROR, "cannot scan inverted index without order");
+
+		/* Requires MVCC-compliant snapshot as not able to maintain a pin */
+		/* https://www.postgresql.org/docs/current/index-locking.html */
+		if (!IsMVCCSnapshot(scan->xs_snapshot))
+			elog(ERROR, "non-MVCC snapshots are not supported with inverted");
+
+		/* A null query has no postings to match */
+		if (!(scan->orderByData->sk_flags & SK_ISNULL))
+		{
+			MemoryContext oldCtx = MemoryContextSwitchTo(so->tmpCtx);
+			Datum		value = scan->orderByData->sk_argument;
+
+			/* Value should not be compressed or toasted */
+			Assert(!VARATT_IS_COMPRESSED(DatumGetPointer(value)));
+			Assert(!VARATT_IS_EXTENDED(DatumGetPointer(value)));
+
+			/* Fine if normalization fails */
+			if (so->normprocinfo != NULL)
+				InvertedNormValue(so->normprocinfo, so->collation, &value);
+
+			GetScanItems(scan, value);
+
+			MemoryContextSwitchTo(oldCtx);
+		}
+
+		so->first = false;
+	}
+
+	if (so->pos < so->nresults)
+	{
+		scan->xs_heaptid = so->results[so->pos++].heaptid;
+		scan->xs_recheck = false;
+		scan->xs_recheckorderby = false;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * End a scan and release resources
+ */
+void
+invertedendscan(IndexScanDesc scan)
+{
+	InvertedScanOpaque so = (InvertedScanOpaque) scan->opaque;
+
+	MemoryContextDelete(so->tmpCtx);
+
+	pfree(so->results);
+	pfree(so);
+	scan->opaque = NULL;
+}
@@ -0,0 +1,257 @@
+#include "postgres.h"
+
+#include "access/generic_xlog.h"
+#include "inverted.h"
+#include "storage/bufmgr.h"
+#include "storage/indexfsm.h"
+#include "storage/lmgr.h"
+
+PGDLLEXPORT Datum sparsevec_l2_normalize(PG_FUNCTION_ARGS);
+
+/*
+ * Get proc
+ */
+FmgrInfo *
+InvertedOptionalProcInfo(Relation index, uint16 procnum)
+{
+	if (!OidIsValid(index_getprocid(index, 1, procnum)))
+		return NULL;
+
+	return index_getprocinfo(index, 1, procnum);
+}
+
+/*
+ * Divide by the norm
+ *
+ * Returns false if value should not be indexed
+ *
+ * The caller needs to free the pointer stored in value
+ * if it's different than the original value
+ */
+bool
+InvertedNormValue(FmgrInfo *procinfo, Oid collation, Datum *value)
+{
+	double		norm = DatumGetFloat8(FunctionCall1Coll(procinfo, collation, *value));
+
+	if (norm > 0)
+	{
+		*value = DirectFunctionCall1Coll(sparsevec_l2_normalize, collation, *value);
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Ensure the vector fits on a pending page
+ */
+void
+InvertedCheckNnz(SparseVector * vec)
+{
+	if (vec->nnz > INVERTED_MAX_NNZ)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sparsevec cannot have more than %d non-zero elements for inverted index", INVERTED_MAX_NNZ)));
+}
+
+/*
+ * New buffer
+ */
+Buffer
+InvertedNewBuffer(Relation index, ForkNumber forkNum)
+{
+	Buffer		buf = ReadBufferExtended(index, forkNum, P_NEW, RBM_NORMAL, NULL);
+
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	return buf;
+}
+
+/*
+ * Get a page freed by a merge, or a new buffer
+ */
+Buffer
+InvertedAllocBuffer(Relation index, ForkNumber forkNum)
+{
+	Buffer		buf;
+
+	/* The free space map is only used for the main fork */
+	while (forkNum == MAIN_FORKNUM)
+	{
+		BlockNumber blkno = GetFreeIndexPage(index);
+
+		if (!BlockNumberIsValid(blkno))
+			break;
+
+		buf = ReadBuffer(index, blkno);
+
+		/* The free space map can be out of date, so check the page */
+		if (ConditionalLockBuffer(buf))
+		{
+			Page		page = BufferGetPage(buf);
+
+			if (PageIsNew(page) || InvertedPageGetOpaque(page)->page_type == INVERTED_FREE_PAGE)
+				return buf;
+
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		}
+
+		ReleaseBuffer(buf);
+	}
+
+	LockRelationForExtension(index, ExclusiveLock);
+	buf = InvertedNewBuffer(index, forkNum);
+	UnlockRelationForExtension(index, ExclusiveLock);
+
+	return buf;
+}
+
+/*
+ * Init page
+ */
+void
+InvertedInitPage(Buffer buf, Page page, uint16 pageType)
+{
+	PageInit(page, BufferGetPageSize(buf), sizeof(InvertedPageOpaqueData));
+	InvertedPageGetOpaque(page)->nextblkno = InvalidBlockNumber;
+	InvertedPageGetOpaque(page)->page_type = pageType;
+	InvertedPageGetOpaque(page)->page_id = INVERTED_PAGE_ID;
+}
+
+/*
+ * Init and register page
+ */
+void
+InvertedInitRegisterPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, uint16 pageType)
+{
+	*state = GenericXLogStart(index);
+	*page = GenericXLogRegisterBuffer(*state, *buf, GENERIC_XLOG_FULL_IMAGE);
+	InvertedInitPage(*buf, *page, pageType);
+}
+
+/*
+ * Commit buffer
+ */
+void
+InvertedCommitBuffer(Buffer buf, GenericXLogState *state)
+{
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Add a new page
+ *
+ * The order is very important!!
+ */
+void
+InvertedAppendPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, uint16 pageType, ForkNumber forkNum)
+{
+	/* Get new buffer */
+	Buffer		newbuf = InvertedAllocBuffer(index, forkNum);
+	Page		newpage = GenericXLogRegisterBuffer(*state, newbuf, GENERIC_XLOG_FULL_IMAGE);
+
+	/* Update the previous buffer */
+	InvertedPageGetOpaque(*page)->nextblkno = BufferGetBlockNumber(newbuf);
+
+	/* Init new page */
+	InvertedInitPage(newbuf, newpage, pageType);
+
+	/* Commit */
+	GenericXLogFinish(*state);
+
+	/* Unlock */
+	UnlockReleaseBuffer(*buf);
+
+	*state = GenericXLogStart(index);
+	*page = GenericXLogRegisterBuffer(*state, newbuf, GENERIC_XLOG_FULL_IMAGE);
+	*buf = newbuf;
+}
+
+/*
+ * Get the metapage info
+ */
+void
+InvertedGetMetaPageInfo(Relation index, int *dimensions, BlockNumber *dirPages,
+						BlockNumber *pendingStartPage, BlockNumber *pendingInsertPage,
+						BlockNumber *postingStartPage)
+{
+	Buffer		buf;
+	Page		page;
+	InvertedMetaPage metap;
+
+	buf = ReadBuffer(index, INVERTED_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	metap = InvertedPageGetMeta(page);
+
+	if (unlikely(metap->magicNumber != INVERTED_MAGIC_NUMBER))
+		elog(ERROR, "inverted index is not valid");
+
+	if (dimensions != NULL)
+		*dimensions = metap->dimensions;
+
+	if (dirPages != NULL)
+		*dirPages = metap->dirPages;
+
+	if (pendingStartPage != NULL)
+		*pendingStartPage = metap->pendingStartPage;
+
+	if (pendingInsertPage != NULL)
+		*pendingInsertPage = metap->pendingInsertPage;
+
+	if (postingStartPage != NULL)
+		*postingStartPage = metap->postingStartPage;
+
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Update the insert page of the pending list
+ *
+ * Returns true if a new page made the pending list larger than
+ * inverted.pending_list_limit
+ */
+bool
+InvertedUpdatePendingInsertPage(Relation index, BlockNumber insertPage, BlockNumber originalInsertPage, bool newPage)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	InvertedMetaPage metap;
+	bool		changed = false;
+	bool		merge = false;
+
+	buf = ReadBuffer(index, INVERTED_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+	metap = InvertedPageGetMeta(page);
+
+	/* Skip update if insert page is lower than original insert page  */
+	/* This is needed to prevent insert from overwriting vacuum */
+	if (insertPage != metap->pendingInsertPage &&
+		(!BlockNumberIsValid(originalInsertPage) || insertPage >= originalInsertPage))
+	{
+		metap->pendingInsertPage = insertPage;
+		changed = true;
+	}
+
+	/* Pages stay in the chain once added, even after a merge */
+	if (newPage)
+	{
+		metap->pendingPages++;
+		merge = (Size) metap->pendingPages * BLCKSZ > (Size) inverted_pending_list_limit * 1024;
+		changed = true;
+	}
+
+	if (changed)
+		InvertedCommitBuffer(buf, state);
+	else
+	{
+		GenericXLogAbort(state);
+		UnlockReleaseBuffer(buf);
+	}
+
+	return merge;
+}
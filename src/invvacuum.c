@@ -0,0 +1,182 @@
+#include "postgres.h"
+
+#include "access/generic_xlog.h"
+#include "commands/vacuum.h"
+#include "inverted.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+
+/*
+ * Delete tuples from a chain of pending or posting pages
+ *
+ * Postings keep their offsets so directory entries stay valid, so dead
+ * postings are only marked and their space is reclaimed by the next merge
+ *
+ * Returns the first pending page with deleted tuples
+ */
+static BlockNumber
+BulkDeleteChain(Relation index, BlockNumber blkno, IndexBulkDeleteResult *stats,
+				IndexBulkDeleteCallback callback, void *callback_state, BufferAccessStrategy bas)
+{
+	BlockNumber insertPage = InvalidBlockNumber;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf;
+		Page		page;
+		GenericXLogState *state;
+		OffsetNumber offno;
+		OffsetNumber maxoffno;
+		OffsetNumber deletable[MaxOffsetNumber];
+		int			ndeletable = 0;
+		uint16		pageType;
+		BlockNumber nextblkno;
+
+		vacuum_delay_point();
+
+		buf = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, bas);
+
+		/*
+		 * ambulkdelete cannot delete entries from pages that are pinned by
+		 * other backends
+		 *
+		 * https://www.postgresql.org/docs/current/index-locking.html
+		 */
+		LockBufferForCleanup(buf);
+
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		pageType = InvertedPageGetOpaque(page)->page_type;
+		nextblkno = InvertedPageGetOpaque(page)->nextblkno;
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		if (pageType == INVERTED_POSTING_PAGE)
+		{
+			for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+			{
+				InvertedPosting posting = (InvertedPosting) PageGetItem(page, PageGetItemId(page, offno));
+
+				if (!ItemPointerIsValid(&posting->heaptid))
+					continue;
+
+				if (callback(&posting->heaptid, callback_state))
+				{
+					ItemPointerSetInvalid(&posting->heaptid);
+					ndeletable++;
+					stats->tuples_removed++;
+				}
+				else
+					stats->num_index_tuples++;
+			}
+		}
+		else if (pageType == INVERTED_PENDING_PAGE)
+		{
+			/* Find deleted tuples */
+			for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+			{
+				IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+				ItemPointer htup = &(itup->t_tid);
+
+				if (callback(htup, callback_state))
+				{
+					deletable[ndeletable++] = offno;
+					stats->tuples_removed++;
+				}
+				else
+					stats->num_index_tuples++;
+			}
+
+			/* Set to first free page */
+			if (!BlockNumberIsValid(insertPage) && ndeletable > 0)
+				insertPage = blkno;
+
+			if (ndeletable > 0)
+				PageIndexMultiDelete(page, deletable, ndeletable);
+		}
+
+		if (ndeletable > 0)
+			GenericXLogFinish(state);
+		else
+			GenericXLogAbort(state);
+
+		UnlockReleaseBuffer(buf);
+
+		blkno = nextblkno;
+	}
+
+	return insertPage;
+}
+
+/*
+ * Bulk delete tuples from the index
+ */
+IndexBulkDeleteResult *
+invertedbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
+				   IndexBulkDeleteCallback callback, void *callback_state)
+{
+	Relation	index = info->index;
+	BlockNumber pendingStartPage;
+	BlockNumber postingStartPage;
+	BlockNumber insertPage;
+	BufferAccessStrategy bas = GetAccessStrategy(BAS_BULKREAD);
+
+	if (stats == NULL)
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+	/* Count postings and pending vectors from scratch on each pass */
+	stats->num_index_tuples = 0;
+
+	/* Prevent a merge from copying postings before they are deleted */
+	LockPage(index, INVERTED_PENDING_LOCK, ShareLock);
+
+	InvertedGetMetaPageInfo(index, NULL, NULL, &pendingStartPage, NULL, &postingStartPage);
+
+	insertPage = BulkDeleteChain(index, pendingStartPage, stats, callback, callback_state, bas);
+	BulkDeleteChain(index, postingStartPage, stats, callback, callback_state, bas);
+
+	/* Update after all tuples deleted */
+	if (BlockNumberIsValid(insertPage))
+		InvertedUpdatePendingInsertPage(index, insertPage, InvalidBlockNumber, false);
+
+	UnlockPage(index, INVERTED_PENDING_LOCK, ShareLock);
+
+	FreeAccessStrategy(bas);
+
+	return stats;
+}
+
+/*
+ * Clean up after a VACUUM operation
+ */
+IndexBulkDeleteResult *
+invertedvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
+{
+	Relation	rel = info->index;
+	int64		npostings;
+
+	if (info->analyze_only)
+		return stats;
+
+	/* Merge rows inserted since the last vacuum, like GIN */
+	if (InvertedMergePending(rel, true, &npostings) > 0)
+	{
+		if (stats == NULL)
+			stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+		/* Every live posting was rewritten and the pending list is empty */
+		stats->num_index_tuples = npostings;
+	}
+
+	/* stats is NULL if ambulkdelete not called */
+	/* OK to return NULL if index not changed */
+	if (stats == NULL)
+		return NULL;
+
+	stats->num_pages = RelationGetNumberOfBlocks(rel);
+
+	/* Index tuples are postings and pending vectors */
+	stats->estimated_count = false;
+
+	return stats;
+}
@@ -6,6 +6,8 @@
 #include "access/tableam.h"
 #include "access/parallel.h"
 #include "access/xact.h"
+#include "access/xloginsert.h"
+#include "bulkwrite.h"
 #include "catalog/index.h"
 #include "catalog/pg_operator_d.h"
 #include "catalog/pg_type_d.h"
@@ -38,6 +40,7 @@
 #define PARALLEL_KEY_TUPLESORT			UINT64CONST(0xA000000000000002)
 #define PARALLEL_KEY_IVFFLAT_CENTERS	UINT64CONST(0xA000000000000003)
 #define PARALLEL_KEY_QUERY_TEXT			UINT64CONST(0xA000000000000004)
+#define PARALLEL_KEY_IVFFLAT_CODEBOOK	UINT64CONST(0xA000000000000005)
 
 /*
  * Add sample
@@ -46,18 +49,32 @@ static void
 AddSample(Datum *values, IvfflatBuildState * buildstate)
 {
 	VectorArray samples = buildstate->samples;
+	VectorArray pqSamples = buildstate->pqSamples;
 	int			targsamples = samples->maxlen;
+	Datum		pqValue;
 
 	/* Detoast once for all calls */
 	Datum		value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
 
+	/* Run k-means on vectors regardless of the type */
+	if (buildstate->typeInfo->toVector != NULL)
+		value = DirectFunctionCall3(buildstate->typeInfo->toVector, value, Int32GetDatum(-1), BoolGetDatum(false));
+
+	/* Train product quantization on values as they are indexed */
+	pqValue = value;
+	if (pqSamples != NULL && buildstate->normprocinfo != NULL)
+	{
+		if (!IvfflatNormValue(buildstate->typeInfo, buildstate->normprocinfo, buildstate->collation, &pqValue))
+			return;
+	}
+
 	/*
 	 * Normalize with KMEANS_NORM_PROC since spherical distance function
 	 * expects unit vectors
 	 */
 	if (buildstate->kmeansnormprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(buildstate->kmeansnormprocinfo, buildstate->collation, &value, buildstate->normvec))
+		if (!IvfflatNormValue(&IvfflatVectorTypeInfo, buildstate->kmeansnormprocinfo, buildstate->collation, &value))
 			return;
 	}
 
@@ -65,6 +82,12 @@ AddSample(Datum *values, IvfflatBuildState * buildstate)
 	{
 		VectorArraySet(samples, samples->length, DatumGetVector(value));
 		samples->length++;
+
+		if (pqSamples != NULL)
+		{
+			VectorArraySet(pqSamples, pqSamples->length, DatumGetVector(pqValue));
+			pqSamples->length++;
+		}
 	}
 	else
 	{
@@ -81,6 +104,9 @@ AddSample(Datum *values, IvfflatBuildState * buildstate)
 
 			Assert(k >= 0 && k < targsamples);
 			VectorArraySet(samples, k, DatumGetVector(value));
+
+			if (pqSamples != NULL)
+				VectorArraySet(pqSamples, k, DatumGetVector(pqValue));
 		}
 
 		buildstate->rowstoskip -= 1;
@@ -135,16 +161,39 @@ SampleRows(IvfflatBuildState * buildstate)
 	}
 }
 
+/*
+ * Find the list that minimizes the distance
+ */
+static int
+FindClosestCenter(IvfflatBuildState * buildstate, Datum value, double *minDistance)
+{
+	VectorArray centers = buildstate->centers;
+	int			closestCenter = 0;
+
+	*minDistance = DBL_MAX;
+
+	for (int i = 0; i < centers->length; i++)
+	{
+		double		distance = VectorDistance(buildstate->distfunc, buildstate->procinfo, buildstate->collation, value, PointerGetDatum(VectorArrayGet(centers, i)));
+
+		if (distance < *minDistance)
+		{
+			*minDistance = distance;
+			closestCenter = i;
+		}
+	}
+
+	return closestCenter;
+}
+
 /*
  * Add tuple to sort
  */
 static void
 AddTupleToSort(Relation index, ItemPointer tid, Datum *values, IvfflatBuildState * buildstate)
 {
-	double		distance;
-	double		minDistance = DBL_MAX;
-	int			closestCenter = 0;
-	VectorArray centers = buildstate->centers;
+	double		minDistance;
+	int			closestCenter;
 	TupleTableSlot *slot = buildstate->slot;
 
 	/* Detoast once for all calls */
@@ -153,20 +202,21 @@ AddTupleToSort(Relation index, ItemPointer tid, Datum *values, IvfflatBuildState
 	/* Normalize if needed */
 	if (buildstate->normprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(buildstate->normprocinfo, buildstate->collation, &value, buildstate->normvec))
+		if (!IvfflatNormValue(buildstate->typeInfo, buildstate->normprocinfo, buildstate->collation, &value))
 			return;
 	}
 
-	/* Find the list that minimizes the distance */
-	for (int i = 0; i < centers->length; i++)
+	closestCenter = FindClosestCenter(buildstate, value, &minDistance);
+
+	/* Sort codes instead of the value */
+	if (buildstate->pq != NULL)
 	{
-		distance = DatumGetFloat8(FunctionCall2Coll(buildstate->procinfo, buildstate->collation, value, PointerGetDatum(VectorArrayGet(centers, i))));
+		IvfflatPq	pq = buildstate->pq;
+		bytea	   *codes = palloc(VARHDRSZ + pq->subvectors);
 
-		if (distance < minDistance)
-		{
-			minDistance = distance;
-			closestCenter = i;
-		}
+		SET_VARSIZE(codes, VARHDRSZ + pq->subvectors);
+		IvfflatPqEncode(pq, DatumGetVector(value), VectorArrayGet(buildstate->centers, closestCenter), (uint8 *) VARDATA(codes));
+		value = PointerGetDatum(codes);
 	}
 
 #ifdef IVFFLAT_KMEANS_DEBUG
@@ -229,7 +279,7 @@ BuildCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
  * Get index tuple from sort state
  */
 static inline void
-GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot, IndexTuple *itup, int *list)
+GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot, IvfflatPq pq, IndexTuple *itup, int *list)
 {
 	Datum		value;
 	bool		isnull;
@@ -240,15 +290,32 @@ GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot,
 		value = slot_getattr(slot, 3, &isnull);
 
 		/* Form the index tuple */
-		*itup = index_form_tuple(tupdesc, &value, &isnull);
+		if (pq != NULL)
+			*itup = IvfflatPqFormTuple(pq, (uint8 *) VARDATA_ANY(DatumGetPointer(value)));
+		else
+			*itup = index_form_tuple(tupdesc, &value, &isnull);
 		(*itup)->t_tid = *((ItemPointer) DatumGetPointer(slot_getattr(slot, 2, &isnull)));
 	}
 	else
 		*list = -1;
 }
 
+/*
+ * Init a page that is not in shared buffers
+ */
+static void
+InitBulkPage(Page page)
+{
+	PageInit(page, BLCKSZ, sizeof(IvfflatPageOpaqueData));
+	IvfflatPageGetOpaque(page)->nextblkno = InvalidBlockNumber;
+	IvfflatPageGetOpaque(page)->page_id = IVFFLAT_PAGE_ID;
+}
+
 /*
  * Create initial entry pages
+ *
+ * Entry pages are assembled in local memory and written sequentially,
+ * since no other process can access them until the build is finished
  */
 static void
 InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
@@ -256,6 +323,8 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 	int			list;
 	IndexTuple	itup = NULL;	/* silence compiler warning */
 	int64		inserted = 0;
+	BulkWriter	writer;
+	Page		page = BulkWriterGetPage(&writer);
 
 	TupleTableSlot *slot = MakeSingleTupleTableSlot(buildstate->tupdesc, &TTSOpsMinimalTuple);
 	TupleDesc	tupdesc = RelationGetDescr(index);
@@ -264,24 +333,31 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 
 	pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_TOTAL, buildstate->indtuples);
 
-	GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list);
+	GetNextTuple(buildstate->sortstate, tupdesc, slot, buildstate->pq, &itup, &list);
+
+	/* Nothing to write without lists */
+	if (buildstate->centers->length == 0)
+	{
+		ExecDropSingleTupleTableSlot(slot);
+		return;
+	}
+
+	InitBulkWriter(&writer, index, forkNum, RelationNeedsWAL(index));
 
 	for (int i = 0; i < buildstate->centers->length; i++)
 	{
-		Buffer		buf;
-		Page		page;
-		GenericXLogState *state;
 		BlockNumber startPage;
 		BlockNumber insertPage;
 
 		/* Can take a while, so ensure we can interrupt */
-		/* Needs to be called when no buffer locks are held */
 		CHECK_FOR_INTERRUPTS();
 
-		buf = IvfflatNewBuffer(index, forkNum);
-		IvfflatInitRegisterPage(index, &buf, &page, &state);
+		/* Start each list on a new page */
+		if (i > 0)
+			BulkWriterNextPage(&writer);
+		InitBulkPage(page);
 
-		startPage = BufferGetBlockNumber(buf);
+		startPage = writer.blkno;
 
 		/* Get all tuples for list */
 		while (list == i)
@@ -290,7 +366,11 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 			Size		itemsz = MAXALIGN(IndexTupleSize(itup));
 
 			if (PageGetFreeSpace(page) < itemsz)
-				IvfflatAppendPage(index, &buf, &page, &state, forkNum);
+			{
+				IvfflatPageGetOpaque(page)->nextblkno = writer.blkno + 1;
+				BulkWriterNextPage(&writer);
+				InitBulkPage(page);
+			}
 
 			/* Add the item */
 			if (PageAddItem(page, (Item) itup, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
@@ -300,16 +380,19 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 
 			pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_DONE, ++inserted);
 
-			GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list);
+			GetNextTuple(buildstate->sortstate, tupdesc, slot, buildstate->pq, &itup, &list);
 		}
 
-		insertPage = BufferGetBlockNumber(buf);
-
-		IvfflatCommitBuffer(buf, state);
+		insertPage = writer.blkno;
 
 		/* Set the start and insert pages */
 		IvfflatUpdateList(index, buildstate->listInfo[i], insertPage, InvalidBlockNumber, startPage, forkNum);
 	}
+
+	/* Write last page */
+	FinishBulkWriter(&writer);
+
+	ExecDropSingleTupleTableSlot(slot);
 }
 
 /*
@@ -329,17 +412,40 @@ InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, In
 	if (buildstate->dimensions < 0)
 		elog(ERROR, "column does not have dimensions");
 
-	if (buildstate->dimensions > IVFFLAT_MAX_DIM)
-		elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", IVFFLAT_MAX_DIM);
-
-	buildstate->reltuples = 0;
-	buildstate->indtuples = 0;
-
 	/* Get support functions */
 	buildstate->procinfo = index_getprocinfo(index, 1, IVFFLAT_DISTANCE_PROC);
 	buildstate->normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
 	buildstate->kmeansnormprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
 	buildstate->collation = index->rd_indcollation[0];
+	buildstate->distfunc = VectorGetDistanceFunc(buildstate->procinfo);
+	buildstate->typeInfo = IvfflatGetTypeInfo(index);
+
+	if (buildstate->dimensions > buildstate->typeInfo->maxDimensions)
+		elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", buildstate->typeInfo->maxDimensions);
+
+	buildstate->pq = NULL;
+	buildstate->pqSamples = NULL;
+
+	if (IvfflatGetQuantization(index) == IVFFLAT_QUANTIZATION_PQ)
+	{
+		int			subvectors = IvfflatGetSubvectors(index, buildstate->dimensions);
+
+		/* Lookup tables are built with the distance kernels */
+		if (buildstate->distfunc == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("pq quantization requires vector with L2 distance, inner product, or cosine distance")));
+
+		if (subvectors > buildstate->dimensions)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("subvectors cannot be greater than dimensions")));
+
+		buildstate->pq = IvfflatInitPq(buildstate->dimensions, subvectors);
+	}
+
+	buildstate->reltuples = 0;
+	buildstate->indtuples = 0;
 
 	/* Require more than one dimension for spherical k-means */
 	if (buildstate->kmeansnormprocinfo != NULL && buildstate->dimensions == 1)
@@ -349,16 +455,17 @@ InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, In
 	buildstate->tupdesc = CreateTemplateTupleDesc(3);
 	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 1, "list", INT4OID, -1, 0);
 	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 2, "tid", TIDOID, -1, 0);
-	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "vector", RelationGetDescr(index)->attrs[0].atttypid, -1, 0);
+	if (buildstate->pq != NULL)
+		TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "codes", BYTEAOID, -1, 0);
+	else
+		TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "vector", RelationGetDescr(index)->attrs[0].atttypid, -1, 0);
 
 	buildstate->slot = MakeSingleTupleTableSlot(buildstate->tupdesc, &TTSOpsVirtual);
 
-	buildstate->centers = VectorArrayInit(buildstate->lists, buildstate->dimensions);
+	/* Centers are stored with the type of the index */
+	buildstate->centers = VectorArrayInit(buildstate->lists, buildstate->dimensions, buildstate->typeInfo->itemSize(buildstate->dimensions));
 	buildstate->listInfo = palloc(sizeof(ListInfo) * buildstate->lists);
 
-	/* Reuse for each tuple */
-	buildstate->normvec = InitVector(buildstate->dimensions);
-
 	buildstate->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
 											   "Ivfflat build temporary context",
 											   ALLOCSET_DEFAULT_SIZES);
@@ -380,7 +487,12 @@ FreeBuildState(IvfflatBuildState * buildstate)
 {
 	VectorArrayFree(buildstate->centers);
 	pfree(buildstate->listInfo);
-	pfree(buildstate->normvec);
+
+	if (buildstate->pq != NULL)
+	{
+		pfree(buildstate->pq->codebook);
+		pfree(buildstate->pq);
+	}
 
 #ifdef IVFFLAT_KMEANS_DEBUG
 	pfree(buildstate->listSums);
@@ -390,6 +502,36 @@ FreeBuildState(IvfflatBuildState * buildstate)
 	MemoryContextDelete(buildstate->tmpCtx);
 }
 
+/*
+ * Train the product quantization codebook on residuals from the centers
+ */
+static void
+TrainPq(IvfflatBuildState * buildstate)
+{
+	VectorArray pqSamples = buildstate->pqSamples;
+	int			numResiduals = Min(pqSamples->length, IVFFLAT_PQ_MAX_SAMPLES);
+	VectorArray residuals = VectorArrayInit(numResiduals, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+
+	/* Samples are in random order, so any subset is a random sample */
+	for (int i = 0; i < numResiduals; i++)
+	{
+		Vector	   *vec = VectorArrayGet(pqSamples, i);
+		Vector	   *residual = VectorArrayGet(residuals, i);
+		double		minDistance;
+		Vector	   *center = VectorArrayGet(buildstate->centers, FindClosestCenter(buildstate, PointerGetDatum(vec), &minDistance));
+
+		SET_VARSIZE(residual, VECTOR_SIZE(vec->dim));
+		residual->dim = vec->dim;
+		for (int j = 0; j < vec->dim; j++)
+			residual->x[j] = vec->x[j] - center->x[j];
+	}
+	residuals->length = numResiduals;
+
+	IvfflatPqTrain(buildstate->pq, residuals);
+
+	VectorArrayFree(residuals);
+}
+
 /*
  * Compute centers
  */
@@ -412,7 +554,9 @@ ComputeCenters(IvfflatBuildState * buildstate)
 
 	/* Sample rows */
 	/* TODO Ensure within maintenance_work_mem */
-	buildstate->samples = VectorArrayInit(numSamples, buildstate->dimensions);
+	buildstate->samples = VectorArrayInit(numSamples, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+	if (buildstate->pq != NULL)
+		buildstate->pqSamples = VectorArrayInit(numSamples, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
 	if (buildstate->heap != NULL)
 	{
 		SampleRows(buildstate);
@@ -427,7 +571,34 @@ ComputeCenters(IvfflatBuildState * buildstate)
 	}
 
 	/* Calculate centers */
-	IvfflatBench("k-means", IvfflatKmeans(buildstate->index, buildstate->samples, buildstate->centers));
+	if (buildstate->typeInfo->fromVector == NULL)
+		IvfflatBench("k-means", IvfflatKmeans(buildstate->index, buildstate->samples, buildstate->centers));
+	else
+	{
+		VectorArray centers = VectorArrayInit(buildstate->lists, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+
+		IvfflatBench("k-means", IvfflatKmeans(buildstate->index, buildstate->samples, centers));
+
+		/* Convert centers to the type of the index */
+		for (int i = 0; i < centers->length; i++)
+		{
+			Datum		center = DirectFunctionCall3(buildstate->typeInfo->fromVector, PointerGetDatum(VectorArrayGet(centers, i)), Int32GetDatum(-1), BoolGetDatum(false));
+
+			VectorArraySet(buildstate->centers, i, DatumGetPointer(center));
+			pfree(DatumGetPointer(center));
+		}
+		buildstate->centers->length = centers->length;
+
+		VectorArrayFree(centers);
+	}
+
+	/* Train codebook */
+	if (buildstate->pq != NULL)
+	{
+		IvfflatBench("pq training", TrainPq(buildstate));
+		VectorArrayFree(buildstate->pqSamples);
+		buildstate->pqSamples = NULL;
+	}
 
 	/* Free samples before we allocate more memory */
 	VectorArrayFree(buildstate->samples);
@@ -453,6 +624,9 @@ CreateMetaPage(Relation index, int dimensions, int lists, ForkNumber forkNum)
 	metap->version = IVFFLAT_VERSION;
 	metap->dimensions = dimensions;
 	metap->lists = lists;
+	metap->quantization = IVFFLAT_QUANTIZATION_NONE;
+	metap->subvectors = 0;
+	metap->codebookPage = InvalidBlockNumber;
 	((PageHeader) page)->pd_lower =
 		((char *) metap + sizeof(IvfflatMetaPageData)) - (char *) page;
 
@@ -469,10 +643,13 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 	Buffer		buf;
 	Page		page;
 	GenericXLogState *state;
+	Size		centerSize;
 	Size		listSize;
 	IvfflatList list;
 
-	listSize = MAXALIGN(IVFFLAT_LIST_SIZE(dimensions));
+	/* Use the size of the value rather than the padded array item */
+	centerSize = VARSIZE_ANY(VectorArrayGet(centers, 0));
+	listSize = MAXALIGN(IVFFLAT_LIST_SIZE(centerSize));
 	list = palloc0(listSize);
 
 	buf = IvfflatNewBuffer(index, forkNum);
@@ -485,7 +662,7 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 		/* Load list */
 		list->startPage = InvalidBlockNumber;
 		list->insertPage = InvalidBlockNumber;
-		memcpy(&list->center, VectorArrayGet(centers, i), VECTOR_SIZE(dimensions));
+		memcpy(&list->center, VectorArrayGet(centers, i), centerSize);
 
 		/* Ensure free space */
 		if (PageGetFreeSpace(page) < listSize)
@@ -506,6 +683,53 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 	pfree(list);
 }
 
+/*
+ * Create codebook pages and record them in the metapage
+ */
+static void
+CreatePqPages(Relation index, IvfflatPq pq, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	IvfflatMetaPage metap;
+	BlockNumber codebookPage;
+	Size		size = sizeof(float) * IVFFLAT_PQ_CENTROIDS * pq->dimensions;
+	Size		chunkSize = sizeof(float) * IVFFLAT_PQ_PAGE_FLOATS;
+
+	buf = IvfflatNewBuffer(index, forkNum);
+	IvfflatInitRegisterPage(index, &buf, &page, &state);
+
+	codebookPage = BufferGetBlockNumber(buf);
+
+	/* Fill each page with one chunk of the codebook */
+	for (Size offset = 0; offset < size; offset += chunkSize)
+	{
+		Size		itemsz = Min(chunkSize, size - offset);
+
+		if (offset > 0)
+			IvfflatAppendPage(index, &buf, &page, &state, forkNum);
+
+		if (PageAddItem(page, (Item) ((char *) pq->codebook + offset), itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+	}
+
+	IvfflatCommitBuffer(buf, state);
+
+	/* Update the metapage */
+	buf = ReadBufferExtended(index, forkNum, IVFFLAT_METAPAGE_BLKNO, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	metap = IvfflatPageGetMeta(page);
+	metap->quantization = IVFFLAT_QUANTIZATION_PQ;
+	metap->subvectors = pq->subvectors;
+	metap->codebookPage = codebookPage;
+
+	IvfflatCommitBuffer(buf, state);
+}
+
 #ifdef IVFFLAT_KMEANS_DEBUG
 /*
  * Print k-means metrics
@@ -590,7 +814,7 @@ ParallelHeapScan(IvfflatBuildState * buildstate)
  * Perform a worker's portion of a parallel sort
  */
 static void
-IvfflatParallelScanAndSort(IvfflatSpool * ivfspool, IvfflatShared * ivfshared, Sharedsort *sharedsort, Vector * ivfcenters, int sortmem, bool progress)
+IvfflatParallelScanAndSort(IvfflatSpool * ivfspool, IvfflatShared * ivfshared, Sharedsort *sharedsort, char *ivfcenters, float *ivfcodebook, int sortmem, bool progress)
 {
 	SortCoordinate coordinate;
 	IvfflatBuildState buildstate;
@@ -614,8 +838,10 @@ IvfflatParallelScanAndSort(IvfflatSpool * ivfspool, IvfflatShared * ivfshared, S
 	indexInfo = BuildIndexInfo(ivfspool->index);
 	indexInfo->ii_Concurrent = ivfshared->isconcurrent;
 	InitBuildState(&buildstate, ivfspool->heap, ivfspool->index, indexInfo);
-	memcpy(buildstate.centers->items, ivfcenters, VECTOR_SIZE(buildstate.centers->dim) * buildstate.centers->maxlen);
+	memcpy(buildstate.centers->items, ivfcenters, buildstate.centers->itemsize * buildstate.centers->maxlen);
 	buildstate.centers->length = buildstate.centers->maxlen;
+	if (buildstate.pq != NULL)
+		memcpy(buildstate.pq->codebook, ivfcodebook, sizeof(float) * IVFFLAT_PQ_CENTROIDS * buildstate.pq->dimensions);
 	ivfspool->sortstate = tuplesort_begin_heap(buildstate.tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, sortmem, coordinate, false);
 	buildstate.sortstate = ivfspool->sortstate;
 	scan = table_beginscan_parallel(ivfspool->heap,
@@ -662,7 +888,8 @@ IvfflatParallelBuildMain(dsm_segment *seg, shm_toc *toc)
 	IvfflatSpool *ivfspool;
 	IvfflatShared *ivfshared;
 	Sharedsort *sharedsort;
-	Vector	   *ivfcenters;
+	char	   *ivfcenters;
+	float	   *ivfcodebook;
 	Relation	heapRel;
 	Relation	indexRel;
 	LOCKMODE	heapLockmode;
@@ -706,9 +933,12 @@ IvfflatParallelBuildMain(dsm_segment *seg, shm_toc *toc)
 
 	ivfcenters = shm_toc_lookup(toc, PARALLEL_KEY_IVFFLAT_CENTERS, false);
 
+	/* Only present for product quantization */
+	ivfcodebook = shm_toc_lookup(toc, PARALLEL_KEY_IVFFLAT_CODEBOOK, true);
+
 	/* Perform sorting */
 	sortmem = maintenance_work_mem / ivfshared->scantuplesortstates;
-	IvfflatParallelScanAndSort(ivfspool, ivfshared, sharedsort, ivfcenters, sortmem, false);
+	IvfflatParallelScanAndSort(ivfspool, ivfshared, sharedsort, ivfcenters, ivfcodebook, sortmem, false);
 
 	/* Close relations within worker */
 	index_close(indexRel, indexLockmode);
@@ -759,7 +989,7 @@ IvfflatLeaderParticipateAsWorker(IvfflatBuildState * buildstate)
 	sortmem = maintenance_work_mem / ivfleader->nparticipanttuplesorts;
 	IvfflatParallelScanAndSort(leaderworker, ivfleader->ivfshared,
 							   ivfleader->sharedsort, ivfleader->ivfcenters,
-							   sortmem, true);
+							   ivfleader->ivfcodebook, sortmem, true);
 }
 
 /*
@@ -774,9 +1004,11 @@ IvfflatBeginParallel(IvfflatBuildState * buildstate, bool isconcurrent, int requ
 	Size		estivfshared;
 	Size		estsort;
 	Size		estcenters;
+	Size		estcodebook = 0;
 	IvfflatShared *ivfshared;
 	Sharedsort *sharedsort;
-	Vector	   *ivfcenters;
+	char	   *ivfcenters;
+	float	   *ivfcodebook = NULL;
 	IvfflatLeader *ivfleader = (IvfflatLeader *) palloc0(sizeof(IvfflatLeader));
 	bool		leaderparticipates = true;
 	int			querylen;
@@ -803,10 +1035,17 @@ IvfflatBeginParallel(IvfflatBuildState * buildstate, bool isconcurrent, int requ
 	shm_toc_estimate_chunk(&pcxt->estimator, estivfshared);
 	estsort = tuplesort_estimate_shared(scantuplesortstates);
 	shm_toc_estimate_chunk(&pcxt->estimator, estsort);
-	estcenters = VECTOR_SIZE(buildstate->dimensions) * buildstate->lists;
+	estcenters = buildstate->centers->itemsize * buildstate->lists;
 	shm_toc_estimate_chunk(&pcxt->estimator, estcenters);
 	shm_toc_estimate_keys(&pcxt->estimator, 3);
 
+	if (buildstate->pq != NULL)
+	{
+		estcodebook = sizeof(float) * IVFFLAT_PQ_CENTROIDS * buildstate->pq->dimensions;
+		shm_toc_estimate_chunk(&pcxt->estimator, estcodebook);
+		shm_toc_estimate_keys(&pcxt->estimator, 1);
+	}
+
 	/* Finally, estimate PARALLEL_KEY_QUERY_TEXT space */
 	if (debug_query_string)
 	{
@@ -855,13 +1094,20 @@ IvfflatBeginParallel(IvfflatBuildState * buildstate, bool isconcurrent, int requ
 	tuplesort_initialize_shared(sharedsort, scantuplesortstates,
 								pcxt->seg);
 
-	ivfcenters = (Vector *) shm_toc_allocate(pcxt->toc, estcenters);
+	ivfcenters = (char *) shm_toc_allocate(pcxt->toc, estcenters);
 	memcpy(ivfcenters, buildstate->centers->items, estcenters);
 
 	shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFFLAT_SHARED, ivfshared);
 	shm_toc_insert(pcxt->toc, PARALLEL_KEY_TUPLESORT, sharedsort);
 	shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFFLAT_CENTERS, ivfcenters);
 
+	if (buildstate->pq != NULL)
+	{
+		ivfcodebook = (float *) shm_toc_allocate(pcxt->toc, estcodebook);
+		memcpy(ivfcodebook, buildstate->pq->codebook, estcodebook);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFFLAT_CODEBOOK, ivfcodebook);
+	}
+
 	/* Store query string for workers */
 	if (debug_query_string)
 	{
@@ -882,6 +1128,7 @@ IvfflatBeginParallel(IvfflatBuildState * buildstate, bool isconcurrent, int requ
 	ivfleader->sharedsort = sharedsort;
 	ivfleader->snapshot = snapshot;
 	ivfleader->ivfcenters = ivfcenters;
+	ivfleader->ivfcodebook = ivfcodebook;
 
 	/* If no workers were successfully launched, back out (do serial build) */
 	if (pcxt->nworkers_launched == 0)
@@ -986,6 +1233,8 @@ static void
 BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
 		   IvfflatBuildState * buildstate, ForkNumber forkNum)
 {
+	BlockNumber entryStart;
+
 	InitBuildState(buildstate, heap, index, indexInfo);
 
 	ComputeCenters(buildstate);
@@ -993,8 +1242,16 @@ BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
 	/* Create pages */
 	CreateMetaPage(index, buildstate->dimensions, buildstate->lists, forkNum);
 	CreateListPages(index, buildstate->centers, buildstate->dimensions, buildstate->lists, forkNum, &buildstate->listInfo);
+	if (buildstate->pq != NULL)
+		CreatePqPages(index, buildstate->pq, forkNum);
+	entryStart = RelationGetNumberOfBlocksInFork(index, forkNum);
 	CreateEntryPages(buildstate, forkNum);
 
+	/* Entry pages are logged by the bulk writer */
+	/* GenericXLog functions do not write WAL for the initialization fork */
+	if (forkNum == INIT_FORKNUM)
+		log_newpage_range(index, forkNum, 0, entryStart, true);
+
 	FreeBuildState(buildstate);
 }
 
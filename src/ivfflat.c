@@ -4,8 +4,10 @@
 
 #include "access/amapi.h"
 #include "access/reloptions.h"
+#include "bitvec.h"
 #include "commands/progress.h"
 #include "commands/vacuum.h"
+#include "halfvec.h"
 #include "ivfflat.h"
 #include "utils/guc.h"
 #include "utils/selfuncs.h"
@@ -16,8 +18,33 @@
 #endif
 
 int			ivfflat_probes;
+int			ivfflat_iterative_scan;
+int			ivfflat_max_probes;
+int			ivfflat_pq_rerank;
 static relopt_kind ivfflat_relopt_kind;
 
+static const struct config_enum_entry ivfflat_iterative_scan_options[] = {
+	{"off", IVFFLAT_ITERATIVE_SCAN_OFF, false},
+	{"relaxed_order", IVFFLAT_ITERATIVE_SCAN_RELAXED, false},
+	{NULL, 0, false}
+};
+
+/*
+ * Validate the quantization option
+ */
+static void
+IvfflatQuantizationValidator(const char *value)
+{
+	if (value == NULL)
+		return;
+
+	if (strcmp(value, "none") != 0 && strcmp(value, "pq") != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for \"quantization\" option"),
+				 errdetail("Valid values are \"none\" and \"pq\".")));
+}
+
 /*
  * Initialize index options and variables
  */
@@ -29,6 +56,18 @@ IvfflatInit(void)
 					  IVFFLAT_DEFAULT_LISTS, IVFFLAT_MIN_LISTS, IVFFLAT_MAX_LISTS
 #if PG_VERSION_NUM >= 130000
 					  ,AccessExclusiveLock
+#endif
+		);
+	add_string_reloption(ivfflat_relopt_kind, "quantization", "Quantization for values in the lists",
+						 "none", IvfflatQuantizationValidator
+#if PG_VERSION_NUM >= 130000
+						 ,AccessExclusiveLock
+#endif
+		);
+	add_int_reloption(ivfflat_relopt_kind, "subvectors", "Number of subvectors for product quantization",
+					  IVFFLAT_DEFAULT_SUBVECTORS, IVFFLAT_MIN_SUBVECTORS, IVFFLAT_MAX_SUBVECTORS
+#if PG_VERSION_NUM >= 130000
+					  ,AccessExclusiveLock
 #endif
 		);
 
@@ -36,6 +75,18 @@ IvfflatInit(void)
 							"Valid range is 1..lists.", &ivfflat_probes,
 							IVFFLAT_DEFAULT_PROBES, IVFFLAT_MIN_LISTS, IVFFLAT_MAX_LISTS, PGC_USERSET, 0, NULL, NULL, NULL);
 
+	DefineCustomEnumVariable("ivfflat.iterative_scan", "Sets the mode for iterative scans",
+							 NULL, &ivfflat_iterative_scan,
+							 IVFFLAT_ITERATIVE_SCAN_OFF, ivfflat_iterative_scan_options, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ivfflat.max_probes", "Sets the max number of probes for iterative scans",
+							"Valid range is 1..lists.", &ivfflat_max_probes,
+							IVFFLAT_DEFAULT_MAX_PROBES, IVFFLAT_MIN_LISTS, IVFFLAT_MAX_LISTS, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ivfflat.pq_rerank", "Sets the number of candidates to re-rank with exact distances for product quantization",
+							"Valid range is 0..100000.", &ivfflat_pq_rerank,
+							IVFFLAT_DEFAULT_PQ_RERANK, IVFFLAT_MIN_PQ_RERANK, IVFFLAT_MAX_PQ_RERANK, PGC_USERSET, 0, NULL, NULL, NULL);
+
 	MarkGUCPrefixReserved("ivfflat");
 }
 
@@ -146,6 +197,8 @@ ivfflatoptions(Datum reloptions, bool validate)
 {
 	static const relopt_parse_elt tab[] = {
 		{"lists", RELOPT_TYPE_INT, offsetof(IvfflatOptions, lists)},
+		{"quantization", RELOPT_TYPE_STRING, offsetof(IvfflatOptions, quantizationOffset)},
+		{"subvectors", RELOPT_TYPE_INT, offsetof(IvfflatOptions, subvectors)},
 	};
 
 #if PG_VERSION_NUM >= 130000
@@ -188,7 +241,7 @@ ivfflathandler(PG_FUNCTION_ARGS)
 	IndexAmRoutine *amroutine = makeNode(IndexAmRoutine);
 
 	amroutine->amstrategies = 0;
-	amroutine->amsupport = 4;
+	amroutine->amsupport = 5;
 #if PG_VERSION_NUM >= 130000
 	amroutine->amoptsprocnum = 0;
 #endif
@@ -203,7 +256,7 @@ ivfflathandler(PG_FUNCTION_ARGS)
 	amroutine->amstorage = false;
 	amroutine->amclusterable = false;
 	amroutine->ampredlocks = false;
-	amroutine->amcanparallel = false;
+	amroutine->amcanparallel = true;
 	amroutine->amcaninclude = false;
 #if PG_VERSION_NUM >= 130000
 	amroutine->amusemaintenanceworkmem = false; /* not used during VACUUM */
@@ -235,9 +288,102 @@ ivfflathandler(PG_FUNCTION_ARGS)
 	amroutine->amrestrpos = NULL;
 
 	/* Interface functions to support parallel index scans */
-	amroutine->amestimateparallelscan = NULL;
-	amroutine->aminitparallelscan = NULL;
-	amroutine->amparallelrescan = NULL;
+	amroutine->amestimateparallelscan = ivfflatestimateparallelscan;
+	amroutine->aminitparallelscan = ivfflatinitparallelscan;
+	amroutine->amparallelrescan = ivfflatparallelrescan;
 
 	PG_RETURN_POINTER(amroutine);
 }
+
+PGDLLEXPORT Datum halfvec_l2_normalize(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum halfvec_to_vector(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum vector_to_halfvec(PG_FUNCTION_ARGS);
+
+/*
+ * Get the size of a half vector
+ */
+static Size
+HalfvecItemSize(int dimensions)
+{
+	return HALFVEC_SIZE(dimensions);
+}
+
+/*
+ * Get type info for halfvec
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(ivfflat_halfvec_support);
+Datum
+ivfflat_halfvec_support(PG_FUNCTION_ARGS)
+{
+	static const IvfflatTypeInfo typeInfo = {
+		/* Elements are half the size, so twice as many fit on a page */
+		.maxDimensions = IVFFLAT_MAX_DIM * 2,
+		.normalize = halfvec_l2_normalize,
+		.itemSize = HalfvecItemSize,
+		.toVector = halfvec_to_vector,
+		.fromVector = vector_to_halfvec
+	};
+
+	PG_RETURN_POINTER(&typeInfo);
+}
+
+/*
+ * Get the size of a bit vector
+ */
+static Size
+BitItemSize(int dimensions)
+{
+	return VARBITTOTALLEN(dimensions);
+}
+
+/*
+ * Convert a bit vector to a vector of zeros and ones for k-means
+ */
+static Datum
+BitToVector(PG_FUNCTION_ARGS)
+{
+	VarBit	   *a = PG_GETARG_VARBIT_P(0);
+	unsigned char *ax = VARBITS(a);
+	Vector	   *result = InitVector(VARBITLEN(a));
+
+	for (int i = 0; i < VARBITLEN(a); i++)
+		result->x[i] = (ax[i / 8] >> (7 - (i % 8))) & 1;
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert a k-means center to the nearest bit vector
+ */
+static Datum
+BitFromVector(PG_FUNCTION_ARGS)
+{
+	Vector	   *a = PG_GETARG_VECTOR_P(0);
+	VarBit	   *result = InitBitVector(a->dim);
+	unsigned char *rx = VARBITS(result);
+
+	/* Each element is the fraction of ones */
+	for (int i = 0; i < a->dim; i++)
+		rx[i / 8] |= (a->x[i] > 0.5) << (7 - (i % 8));
+
+	PG_RETURN_VARBIT_P(result);
+}
+
+/*
+ * Get type info for bit
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(ivfflat_bit_support);
+Datum
+ivfflat_bit_support(PG_FUNCTION_ARGS)
+{
+	static const IvfflatTypeInfo typeInfo = {
+		/* k-means runs on vectors, so the vector limit applies */
+		.maxDimensions = VECTOR_MAX_DIM,
+		.normalize = NULL,
+		.itemSize = BitItemSize,
+		.toVector = BitToVector,
+		.fromVector = BitFromVector
+	};
+
+	PG_RETURN_POINTER(&typeInfo);
+}
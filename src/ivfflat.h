@@ -9,9 +9,11 @@
 #include "lib/pairingheap.h"
 #include "nodes/execnodes.h"
 #include "port.h"				/* for random() */
+#include "port/atomics.h"
 #include "utils/sampling.h"
 #include "utils/tuplesort.h"
 #include "vector.h"
+#include "vectorutils.h"
 
 #if PG_VERSION_NUM >= 150000
 #include "common/pg_prng.h"
@@ -28,6 +30,7 @@
 #define IVFFLAT_NORM_PROC 2
 #define IVFFLAT_KMEANS_DISTANCE_PROC 3
 #define IVFFLAT_KMEANS_NORM_PROC 4
+#define IVFFLAT_TYPE_INFO_PROC 5
 
 #define IVFFLAT_VERSION	1
 #define IVFFLAT_MAGIC_NUMBER 0x14FF1A7
@@ -42,6 +45,19 @@
 #define IVFFLAT_MIN_LISTS		1
 #define IVFFLAT_MAX_LISTS		32768
 #define IVFFLAT_DEFAULT_PROBES	1
+#define IVFFLAT_DEFAULT_MAX_PROBES	IVFFLAT_MAX_LISTS
+
+/* Quantization */
+#define IVFFLAT_QUANTIZATION_NONE	0
+#define IVFFLAT_QUANTIZATION_PQ		1
+#define IVFFLAT_PQ_CENTROIDS		256	/* codes are one byte */
+#define IVFFLAT_PQ_MAX_SAMPLES		25600
+#define IVFFLAT_DEFAULT_SUBVECTORS	0	/* one subvector per 4 dimensions */
+#define IVFFLAT_MIN_SUBVECTORS		0
+#define IVFFLAT_MAX_SUBVECTORS		IVFFLAT_MAX_DIM
+#define IVFFLAT_DEFAULT_PQ_RERANK	100
+#define IVFFLAT_MIN_PQ_RERANK		0
+#define IVFFLAT_MAX_PQ_RERANK		100000
 
 /* Build phases */
 /* PROGRESS_CREATEIDX_SUBPHASE_INITIALIZE is 1 */
@@ -49,10 +65,13 @@
 #define PROGRESS_IVFFLAT_PHASE_ASSIGN	3
 #define PROGRESS_IVFFLAT_PHASE_LOAD		4
 
-#define IVFFLAT_LIST_SIZE(_dim)	(offsetof(IvfflatListData, center) + VECTOR_SIZE(_dim))
+#define IVFFLAT_LIST_SIZE(size)	(offsetof(IvfflatListData, center) + (size))
+#define IVFFLAT_PQ_TUPLE_SIZE(_subvectors)	(sizeof(IndexTupleData) + (_subvectors))
+#define IVFFLAT_PQ_PAGE_FLOATS	(MAXALIGN_DOWN(BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(IvfflatPageOpaqueData)) - sizeof(ItemIdData)) / sizeof(float))
 
 #define IvfflatPageGetOpaque(page)	((IvfflatPageOpaque) PageGetSpecialPointer(page))
 #define IvfflatPageGetMeta(page)	((IvfflatMetaPageData *) PageGetContents(page))
+#define IvfflatPqTupleGetCodes(itup)	((uint8 *) (itup) + sizeof(IndexTupleData))
 
 #ifdef IVFFLAT_BENCH
 #define IvfflatBench(name, code) \
@@ -79,17 +98,39 @@
 
 /* Variables */
 extern int	ivfflat_probes;
+extern int	ivfflat_iterative_scan;
+extern int	ivfflat_max_probes;
+extern int	ivfflat_pq_rerank;
+
+typedef enum IvfflatIterativeScanMode
+{
+	IVFFLAT_ITERATIVE_SCAN_OFF,
+	IVFFLAT_ITERATIVE_SCAN_RELAXED
+}			IvfflatIterativeScanMode;
 
 typedef struct VectorArrayData
 {
 	int			length;
 	int			maxlen;
 	int			dim;
-	Vector	   *items;
+	Size		itemsize;
+	char	   *items;
 }			VectorArrayData;
 
 typedef VectorArrayData * VectorArray;
 
+/* Type-specific behavior, returned by the optional TYPE_INFO_PROC */
+typedef struct IvfflatTypeInfo
+{
+	int			maxDimensions;
+	PGFunction	normalize;
+	Size		(*itemSize) (int dimensions);
+	PGFunction	toVector;		/* NULL if the type is vector */
+	PGFunction	fromVector;		/* NULL if the type is vector */
+}			IvfflatTypeInfo;
+
+extern const IvfflatTypeInfo IvfflatVectorTypeInfo;
+
 typedef struct ListInfo
 {
 	BlockNumber blkno;
@@ -101,8 +142,31 @@ typedef struct IvfflatOptions
 {
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
 	int			lists;			/* number of lists */
+	int			quantizationOffset; /* offset to quantization string */
+	int			subvectors;		/* number of subvectors for pq */
 }			IvfflatOptions;
 
+/*
+ * Product quantization codebook
+ *
+ * Subvector j covers dimensions [j * dimensions / subvectors, (j + 1) *
+ * dimensions / subvectors), and its centroids are stored one after another
+ * starting at IVFFLAT_PQ_CENTROIDS times its first dimension
+ */
+typedef struct IvfflatPqData
+{
+	int			dimensions;
+	int			subvectors;
+	float	   *codebook;
+}			IvfflatPqData;
+
+typedef IvfflatPqData * IvfflatPq;
+
+#define IvfflatPqSubvectorStart(_pq, _j) ((_j) * (_pq)->dimensions / (_pq)->subvectors)
+#define IvfflatPqCentroid(_pq, _j, _k) \
+	((_pq)->codebook + IVFFLAT_PQ_CENTROIDS * IvfflatPqSubvectorStart(_pq, _j) + \
+	 (_k) * (IvfflatPqSubvectorStart(_pq, (_j) + 1) - IvfflatPqSubvectorStart(_pq, _j)))
+
 typedef struct IvfflatSpool
 {
 	Tuplesortstate *sortstate;
@@ -144,7 +208,8 @@ typedef struct IvfflatLeader
 	IvfflatShared *ivfshared;
 	Sharedsort *sharedsort;
 	Snapshot	snapshot;
-	Vector	   *ivfcenters;
+	char	   *ivfcenters;
+	float	   *ivfcodebook;
 }			IvfflatLeader;
 
 typedef struct IvfflatBuildState
@@ -167,12 +232,17 @@ typedef struct IvfflatBuildState
 	FmgrInfo   *normprocinfo;
 	FmgrInfo   *kmeansnormprocinfo;
 	Oid			collation;
+	VectorDistanceFunc distfunc;
+	const IvfflatTypeInfo *typeInfo;
 
 	/* Variables */
 	VectorArray samples;
 	VectorArray centers;
 	ListInfo   *listInfo;
-	Vector	   *normvec;
+
+	/* Product quantization (NULL if not quantized) */
+	IvfflatPq	pq;
+	VectorArray pqSamples;
 
 #ifdef IVFFLAT_KMEANS_DEBUG
 	double		inertia;
@@ -203,6 +273,9 @@ typedef struct IvfflatMetaPageData
 	uint32		version;
 	uint16		dimensions;
 	uint16		lists;
+	uint16		quantization;	/* zero for indexes created before it existed */
+	uint16		subvectors;
+	BlockNumber codebookPage;
 }			IvfflatMetaPageData;
 
 typedef IvfflatMetaPageData * IvfflatMetaPage;
@@ -230,46 +303,97 @@ typedef struct IvfflatScanList
 	pairingheap_node ph_node;
 	BlockNumber startPage;
 	double		distance;
+	Vector	   *center;			/* only set for pq with L2 distance */
 }			IvfflatScanList;
 
+typedef struct IvfflatScanItem
+{
+	ItemPointerData heaptid;
+	double		distance;
+}			IvfflatScanItem;
+
+/* Shared state for parallel index scans */
+typedef struct IvfflatParallelScanData
+{
+	pg_atomic_uint32 nextList;	/* index of the next list to search */
+}			IvfflatParallelScanData;
+
+typedef IvfflatParallelScanData * IvfflatParallelScan;
+
 typedef struct IvfflatScanOpaqueData
 {
 	int			probes;
+	int			maxProbes;
 	int			dimensions;
 	bool		first;
+	Datum		value;
 
-	/* Sorting */
+	/* Items from the searched lists, as a min-heap on distance */
+	IvfflatScanItem *items;
+	Size		itemCount;
+	Size		maxItems;
+	Size		itemLimit;		/* from work_mem */
+
+	/* Items are sorted instead past the limit (NULL until needed) */
 	Tuplesortstate *sortstate;
 	TupleDesc	tupdesc;
 	TupleTableSlot *slot;
-	bool		isnull;
 
 	/* Support functions */
 	FmgrInfo   *procinfo;
 	FmgrInfo   *normprocinfo;
 	Oid			collation;
+	VectorDistanceFunc distfunc;
+	const IvfflatTypeInfo *typeInfo;
+
+	/* Product quantization (NULL if not quantized) */
+	IvfflatPq	pq;
+	float	   *pqTable;
+	float	   *residual;
+
+	/* Re-ranking */
+	IndexInfo  *indexInfo;
+	EState	   *estate;
+	struct IndexFetchTableData *fetch;
+	TupleTableSlot *heapSlot;
+	IvfflatScanItem *rerankItems;
+	int			rerankLength;
+	int			rerankPos;
 
 	/* Lists */
 	pairingheap *listQueue;
+	int			listCount;
+	int			listIndex;		/* next list to search if not parallel */
 	IvfflatScanList lists[FLEXIBLE_ARRAY_MEMBER];	/* must come last */
 }			IvfflatScanOpaqueData;
 
 typedef IvfflatScanOpaqueData * IvfflatScanOpaque;
 
-#define VECTOR_ARRAY_SIZE(_length, _dim) (sizeof(VectorArrayData) + (_length) * VECTOR_SIZE(_dim))
-#define VECTOR_ARRAY_OFFSET(_arr, _offset) ((char*) (_arr)->items + (_offset) * VECTOR_SIZE((_arr)->dim))
-#define VectorArrayGet(_arr, _offset) ((Vector *) VECTOR_ARRAY_OFFSET(_arr, _offset))
-#define VectorArraySet(_arr, _offset, _val) memcpy(VECTOR_ARRAY_OFFSET(_arr, _offset), _val, VECTOR_SIZE((_arr)->dim))
+#define VECTOR_ARRAY_SIZE(_length, _itemsize) (sizeof(VectorArrayData) + (_length) * (_itemsize))
+#define VECTOR_ARRAY_OFFSET(_arr, _offset) ((_arr)->items + (_offset) * (_arr)->itemsize)
+#define VectorArrayGet(_arr, _offset) ((void *) VECTOR_ARRAY_OFFSET(_arr, _offset))
+#define VectorArraySet(_arr, _offset, _val) memcpy(VECTOR_ARRAY_OFFSET(_arr, _offset), _val, VARSIZE_ANY(_val))
 
 /* Methods */
-VectorArray VectorArrayInit(int maxlen, int dimensions);
+VectorArray VectorArrayInit(int maxlen, int dimensions, Size itemsize);
 void		VectorArrayFree(VectorArray arr);
 void		PrintVectorArray(char *msg, VectorArray arr);
 void		IvfflatKmeans(Relation index, VectorArray samples, VectorArray centers);
+void		IvfflatPqKmeans(VectorArray samples, VectorArray centers);
 FmgrInfo   *IvfflatOptionalProcInfo(Relation index, uint16 procnum);
-bool		IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result);
+const IvfflatTypeInfo *IvfflatGetTypeInfo(Relation index);
+bool		IvfflatNormValue(const IvfflatTypeInfo * typeInfo, FmgrInfo *procinfo, Oid collation, Datum *value);
 int			IvfflatGetLists(Relation index);
 void		IvfflatGetMetaPageInfo(Relation index, int *lists, int *dimensions);
+int			IvfflatGetQuantization(Relation index);
+int			IvfflatGetSubvectors(Relation index, int dimensions);
+IvfflatPq	IvfflatInitPq(int dimensions, int subvectors);
+IvfflatPq	IvfflatGetPq(Relation index);
+void		IvfflatPqTrain(IvfflatPq pq, VectorArray residuals);
+void		IvfflatPqEncode(IvfflatPq pq, Vector * vec, Vector * center, uint8 *codes);
+IndexTuple	IvfflatPqFormTuple(IvfflatPq pq, uint8 *codes);
+void		IvfflatPqL2Table(IvfflatPq pq, Vector * q, Vector * center, float *residual, float *table);
+void		IvfflatPqInnerProductTable(IvfflatPq pq, Vector * q, float *table);
 void		IvfflatUpdateList(Relation index, ListInfo listInfo, BlockNumber insertPage, BlockNumber originalInsertPage, BlockNumber startPage, ForkNumber forkNum);
 void		IvfflatCommitBuffer(Buffer buf, GenericXLogState *state);
 void		IvfflatAppendPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, ForkNumber forkNum);
@@ -294,5 +418,14 @@ IndexScanDesc ivfflatbeginscan(Relation index, int nkeys, int norderbys);
 void		ivfflatrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys);
 bool		ivfflatgettuple(IndexScanDesc scan, ScanDirection dir);
 void		ivfflatendscan(IndexScanDesc scan);
+#if PG_VERSION_NUM >= 180000
+Size		ivfflatestimateparallelscan(Relation index, int nkeys, int norderbys);
+#elif PG_VERSION_NUM >= 170000
+Size		ivfflatestimateparallelscan(int nkeys, int norderbys);
+#else
+Size		ivfflatestimateparallelscan(void);
+#endif
+void		ivfflatinitparallelscan(void *target);
+void		ivfflatparallelrescan(IndexScanDesc scan);
 
 #endif
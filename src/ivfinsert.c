@@ -10,14 +10,17 @@
 
 /*
  * Find the list that minimizes the distance function
+ *
+ * Also copies the center of the list if center is not NULL
  */
 static void
-FindInsertPage(Relation index, Datum *values, BlockNumber *insertPage, ListInfo * listInfo)
+FindInsertPage(Relation index, Datum *values, BlockNumber *insertPage, ListInfo * listInfo, Vector * center)
 {
 	double		minDistance = DBL_MAX;
 	BlockNumber nextblkno = IVFFLAT_HEAD_BLKNO;
 	FmgrInfo   *procinfo;
 	Oid			collation;
+	VectorDistanceFunc distfunc;
 
 	/* Avoid compiler warning */
 	listInfo->blkno = nextblkno;
@@ -25,6 +28,7 @@ FindInsertPage(Relation index, Datum *values, BlockNumber *insertPage, ListInfo
 
 	procinfo = index_getprocinfo(index, 1, IVFFLAT_DISTANCE_PROC);
 	collation = index->rd_indcollation[0];
+	distfunc = VectorGetDistanceFunc(procinfo);
 
 	/* Search all list pages */
 	while (BlockNumberIsValid(nextblkno))
@@ -44,7 +48,7 @@ FindInsertPage(Relation index, Datum *values, BlockNumber *insertPage, ListInfo
 			double		distance;
 
 			list = (IvfflatList) PageGetItem(cpage, PageGetItemId(cpage, offno));
-			distance = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, values[0], PointerGetDatum(&list->center)));
+			distance = VectorDistance(distfunc, procinfo, collation, values[0], PointerGetDatum(&list->center));
 
 			if (distance < minDistance || !BlockNumberIsValid(*insertPage))
 			{
@@ -52,6 +56,9 @@ FindInsertPage(Relation index, Datum *values, BlockNumber *insertPage, ListInfo
 				listInfo->blkno = nextblkno;
 				listInfo->offno = offno;
 				minDistance = distance;
+
+				if (center != NULL)
+					memcpy(center, &list->center, VARSIZE_ANY(&list->center));
 			}
 		}
 
@@ -77,6 +84,8 @@ InsertTuple(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, R
 	BlockNumber insertPage = InvalidBlockNumber;
 	ListInfo	listInfo;
 	BlockNumber originalInsertPage;
+	IvfflatPq	pq;
+	Vector	   *center = NULL;
 
 	/* Detoast once for all calls */
 	value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
@@ -85,17 +94,30 @@ InsertTuple(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, R
 	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
 	if (normprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(normprocinfo, index->rd_indcollation[0], &value, NULL))
+		if (!IvfflatNormValue(IvfflatGetTypeInfo(index), normprocinfo, index->rd_indcollation[0], &value))
 			return;
 	}
 
+	/* Codes are residuals from the center of the list */
+	pq = IvfflatGetPq(index);
+	if (pq != NULL)
+		center = InitVector(pq->dimensions);
+
 	/* Find the insert page - sets the page and list info */
-	FindInsertPage(index, values, &insertPage, &listInfo);
+	FindInsertPage(index, values, &insertPage, &listInfo, center);
 	Assert(BlockNumberIsValid(insertPage));
 	originalInsertPage = insertPage;
 
 	/* Form tuple */
-	itup = index_form_tuple(RelationGetDescr(index), &value, isnull);
+	if (pq != NULL)
+	{
+		uint8	   *codes = palloc(pq->subvectors);
+
+		IvfflatPqEncode(pq, DatumGetVector(value), center, codes);
+		itup = IvfflatPqFormTuple(pq, codes);
+	}
+	else
+		itup = index_form_tuple(RelationGetDescr(index), &value, isnull);
 	itup->t_tid = *heap_tid;
 
 	/* Get tuple size */
@@ -10,24 +10,22 @@
 #include "utils/memutils.h"
 #endif
 
+PGDLLEXPORT Datum l2_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum vector_norm(PG_FUNCTION_ARGS);
+
 /*
  * Initialize with kmeans++
  *
  * https://theory.stanford.edu/~sergei/papers/kMeansPP-soda.pdf
  */
 static void
-InitCenters(Relation index, VectorArray samples, VectorArray centers, float *lowerBound)
+InitCenters(FmgrInfo *procinfo, Oid collation, VectorArray samples, VectorArray centers, float *lowerBound)
 {
-	FmgrInfo   *procinfo;
-	Oid			collation;
 	int64		j;
 	float	   *weight = palloc(samples->length * sizeof(float));
 	int			numCenters = centers->maxlen;
 	int			numSamples = samples->length;
 
-	procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
-	collation = index->rd_indcollation[0];
-
 	/* Choose an initial center uniformly at random */
 	VectorArraySet(centers, 0, VectorArrayGet(samples, RandomInt() % samples->length));
 	centers->length++;
@@ -114,16 +112,14 @@ CompareVectors(const void *a, const void *b)
  * Quick approach if we have little data
  */
 static void
-QuickCenters(Relation index, VectorArray samples, VectorArray centers)
+QuickCenters(FmgrInfo *normprocinfo, Oid collation, VectorArray samples, VectorArray centers)
 {
 	int			dimensions = centers->dim;
-	Oid			collation = index->rd_indcollation[0];
-	FmgrInfo   *normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
 
 	/* Copy existing vectors while avoiding duplicates */
 	if (samples->length > 0)
 	{
-		qsort(samples->items, samples->length, VECTOR_SIZE(samples->dim), CompareVectors);
+		qsort(samples->items, samples->length, samples->itemsize, CompareVectors);
 		for (int i = 0; i < samples->length; i++)
 		{
 			Vector	   *vec = VectorArrayGet(samples, i);
@@ -181,11 +177,8 @@ ShowMemoryUsage(Size estimatedSize)
  * https://www.aaai.org/Papers/ICML/2003/ICML03-022.pdf
  */
 static void
-ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
+ElkanKmeans(FmgrInfo *procinfo, FmgrInfo *normprocinfo, Oid collation, VectorArray samples, VectorArray centers)
 {
-	FmgrInfo   *procinfo;
-	FmgrInfo   *normprocinfo;
-	Oid			collation;
 	Vector	   *vec;
 	Vector	   *newCenter;
 	int64		j;
@@ -203,9 +196,9 @@ ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
 	float	   *newcdist;
 
 	/* Calculate allocation sizes */
-	Size		samplesSize = VECTOR_ARRAY_SIZE(samples->maxlen, samples->dim);
-	Size		centersSize = VECTOR_ARRAY_SIZE(centers->maxlen, centers->dim);
-	Size		newCentersSize = VECTOR_ARRAY_SIZE(numCenters, dimensions);
+	Size		samplesSize = VECTOR_ARRAY_SIZE(samples->maxlen, samples->itemsize);
+	Size		centersSize = VECTOR_ARRAY_SIZE(centers->maxlen, centers->itemsize);
+	Size		newCentersSize = VECTOR_ARRAY_SIZE(numCenters, centers->itemsize);
 	Size		centerCountsSize = sizeof(int) * numCenters;
 	Size		closestCentersSize = sizeof(int) * numSamples;
 	Size		lowerBoundSize = sizeof(float) * numSamples * numCenters;
@@ -229,11 +222,6 @@ ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
 	if (numCenters * numCenters > INT_MAX)
 		elog(ERROR, "Indexing overflow detected. Please report a bug.");
 
-	/* Set support functions */
-	procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
-	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
-	collation = index->rd_indcollation[0];
-
 	/* Allocate space */
 	/* Use float instead of double to save memory */
 	centerCounts = palloc(centerCountsSize);
@@ -244,7 +232,7 @@ ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
 	halfcdist = palloc_extended(halfcdistSize, MCXT_ALLOC_HUGE);
 	newcdist = palloc(newcdistSize);
 
-	newCenters = VectorArrayInit(numCenters, dimensions);
+	newCenters = VectorArrayInit(numCenters, dimensions, centers->itemsize);
 	for (j = 0; j < numCenters; j++)
 	{
 		vec = VectorArrayGet(newCenters, j);
@@ -257,7 +245,7 @@ ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
 #endif
 
 	/* Pick initial centers */
-	InitCenters(index, samples, centers, lowerBound);
+	InitCenters(procinfo, collation, samples, centers, lowerBound);
 
 	/* Assign each x to its closest initial center c(x) = argmin d(x,c) */
 	for (j = 0; j < numSamples; j++)
@@ -488,8 +476,6 @@ ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
 static void
 CheckCenters(Relation index, VectorArray centers)
 {
-	FmgrInfo   *normprocinfo;
-
 	if (centers->length != centers->maxlen)
 		elog(ERROR, "Not enough centers. Please report a bug.");
 
@@ -510,7 +496,7 @@ CheckCenters(Relation index, VectorArray centers)
 
 	/* Ensure no duplicate centers */
 	/* Fine to sort in-place */
-	qsort(centers->items, centers->length, VECTOR_SIZE(centers->dim), CompareVectors);
+	qsort(centers->items, centers->length, centers->itemsize, CompareVectors);
 	for (int i = 1; i < centers->length; i++)
 	{
 		if (CompareVectors(VectorArrayGet(centers, i), VectorArrayGet(centers, i - 1)) == 0)
@@ -519,14 +505,15 @@ CheckCenters(Relation index, VectorArray centers)
 
 	/* Ensure no zero vectors for cosine distance */
 	/* Check NORM_PROC instead of KMEANS_NORM_PROC */
-	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
-	if (normprocinfo != NULL)
+	/* Centers are always vectors, so use the vector norm */
+	/* Codebooks (without an index) are never normalized */
+	if (index != NULL && OidIsValid(index_getprocid(index, 1, IVFFLAT_NORM_PROC)))
 	{
 		Oid			collation = index->rd_indcollation[0];
 
 		for (int i = 0; i < centers->length; i++)
 		{
-			double		norm = DatumGetFloat8(FunctionCall1Coll(normprocinfo, collation, PointerGetDatum(VectorArrayGet(centers, i))));
+			double		norm = DatumGetFloat8(DirectFunctionCall1Coll(vector_norm, collation, PointerGetDatum(VectorArrayGet(centers, i))));
 
 			if (norm == 0)
 				elog(ERROR, "Zero norm detected. Please report a bug.");
@@ -534,6 +521,18 @@ CheckCenters(Relation index, VectorArray centers)
 	}
 }
 
+/*
+ * Run k-means with the given support functions
+ */
+static void
+Kmeans(FmgrInfo *procinfo, FmgrInfo *normprocinfo, Oid collation, VectorArray samples, VectorArray centers)
+{
+	if (samples->length <= centers->maxlen)
+		QuickCenters(normprocinfo, collation, samples, centers);
+	else
+		ElkanKmeans(procinfo, normprocinfo, collation, samples, centers);
+}
+
 /*
  * Perform naive k-means centering
  * We use spherical k-means for inner product and cosine
@@ -541,10 +540,35 @@ CheckCenters(Relation index, VectorArray centers)
 void
 IvfflatKmeans(Relation index, VectorArray samples, VectorArray centers)
 {
-	if (samples->length <= centers->maxlen)
-		QuickCenters(index, samples, centers);
-	else
-		ElkanKmeans(index, samples, centers);
+	FmgrInfo   *procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
+	FmgrInfo   *normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
+	Oid			collation = index->rd_indcollation[0];
+
+	Kmeans(procinfo, normprocinfo, collation, samples, centers);
 
 	CheckCenters(index, centers);
 }
+
+/*
+ * Perform k-means for a product quantization codebook
+ *
+ * Residuals are compared with L2 distance for all opclasses, so the support
+ * functions of the index do not apply
+ */
+void
+IvfflatPqKmeans(VectorArray samples, VectorArray centers)
+{
+	FmgrInfo	procinfo;
+
+	/* Call the function directly, since there is no catalog entry to look up */
+	MemSet(&procinfo, 0, sizeof(FmgrInfo));
+	procinfo.fn_addr = l2_distance;
+	procinfo.fn_oid = InvalidOid;
+	procinfo.fn_nargs = 2;
+	procinfo.fn_strict = true;
+	procinfo.fn_mcxt = CurrentMemoryContext;
+
+	Kmeans(&procinfo, NULL, InvalidOid, samples, centers);
+
+	CheckCenters(NULL, centers);
+}
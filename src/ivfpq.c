@@ -0,0 +1,253 @@
+#include "postgres.h"
+
+#include <float.h>
+
+#include "ivfflat.h"
+#include "storage/bufmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "vectorutils.h"
+
+/* Product quantizer cached in rd_amcache */
+typedef struct IvfflatPqCache
+{
+	bool		quantized;
+	IvfflatPqData pq;
+}			IvfflatPqCache;
+
+/*
+ * Allocate a product quantizer
+ */
+IvfflatPq
+IvfflatInitPq(int dimensions, int subvectors)
+{
+	IvfflatPq	pq = palloc(sizeof(IvfflatPqData));
+
+	pq->dimensions = dimensions;
+	pq->subvectors = subvectors;
+	pq->codebook = palloc0(sizeof(float) * IVFFLAT_PQ_CENTROIDS * dimensions);
+	return pq;
+}
+
+/*
+ * Read the product quantizer from the index
+ *
+ * Returns NULL if the index is not quantized
+ */
+static IvfflatPq
+ReadPq(Relation index)
+{
+	Buffer		buf;
+	Page		page;
+	IvfflatMetaPage metap;
+	IvfflatPq	pq;
+	BlockNumber nextblkno;
+	Size		size;
+	Size		offset = 0;
+
+	buf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	metap = IvfflatPageGetMeta(page);
+
+	if (metap->quantization == IVFFLAT_QUANTIZATION_NONE)
+	{
+		UnlockReleaseBuffer(buf);
+		return NULL;
+	}
+
+	pq = IvfflatInitPq(metap->dimensions, metap->subvectors);
+	nextblkno = metap->codebookPage;
+
+	UnlockReleaseBuffer(buf);
+
+	/* Read codebook pages */
+	size = sizeof(float) * IVFFLAT_PQ_CENTROIDS * pq->dimensions;
+	while (BlockNumberIsValid(nextblkno))
+	{
+		ItemId		itemid;
+
+		buf = ReadBuffer(index, nextblkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		itemid = PageGetItemId(page, FirstOffsetNumber);
+
+		if (offset + ItemIdGetLength(itemid) > size)
+			elog(ERROR, "invalid codebook in \"%s\"", RelationGetRelationName(index));
+
+		memcpy((char *) pq->codebook + offset, PageGetItem(page, itemid), ItemIdGetLength(itemid));
+		offset += ItemIdGetLength(itemid);
+
+		nextblkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (offset != size)
+		elog(ERROR, "invalid codebook in \"%s\"", RelationGetRelationName(index));
+
+	return pq;
+}
+
+/*
+ * Get the product quantizer from the index
+ *
+ * The codebook does not change until the index is rebuilt, so it is cached in
+ * the relcache entry instead of being read for each insert and scan. Returns
+ * NULL if the index is not quantized, and the result must not be modified.
+ */
+IvfflatPq
+IvfflatGetPq(Relation index)
+{
+	IvfflatPqCache *cache = (IvfflatPqCache *) index->rd_amcache;
+
+	if (cache == NULL)
+	{
+		IvfflatPq	pq = ReadPq(index);
+		Size		codebookSize = 0;
+
+		/* Copy to the index context once read, so errors do not leak memory */
+		if (pq != NULL)
+			codebookSize = sizeof(float) * IVFFLAT_PQ_CENTROIDS * pq->dimensions;
+
+		cache = MemoryContextAlloc(index->rd_indexcxt, MAXALIGN(sizeof(IvfflatPqCache)) + codebookSize);
+		cache->quantized = pq != NULL;
+		if (pq != NULL)
+		{
+			cache->pq = *pq;
+			cache->pq.codebook = (float *) ((char *) cache + MAXALIGN(sizeof(IvfflatPqCache)));
+			memcpy(cache->pq.codebook, pq->codebook, codebookSize);
+			pfree(pq->codebook);
+			pfree(pq);
+		}
+
+		index->rd_amcache = cache;
+	}
+
+	return cache->quantized ? &cache->pq : NULL;
+}
+
+/*
+ * Train the codebook with k-means on each subvector of the residuals
+ */
+void
+IvfflatPqTrain(IvfflatPq pq, VectorArray residuals)
+{
+	for (int j = 0; j < pq->subvectors; j++)
+	{
+		int			start = IvfflatPqSubvectorStart(pq, j);
+		int			dim = IvfflatPqSubvectorStart(pq, j + 1) - start;
+		VectorArray samples = VectorArrayInit(residuals->length, dim, VECTOR_SIZE(dim));
+		VectorArray centers = VectorArrayInit(IVFFLAT_PQ_CENTROIDS, dim, VECTOR_SIZE(dim));
+
+		for (int i = 0; i < residuals->length; i++)
+		{
+			Vector	   *residual = VectorArrayGet(residuals, i);
+			Vector	   *vec = VectorArrayGet(samples, i);
+
+			SET_VARSIZE(vec, VECTOR_SIZE(dim));
+			vec->dim = dim;
+			memcpy(vec->x, residual->x + start, sizeof(float) * dim);
+		}
+		samples->length = residuals->length;
+
+		IvfflatPqKmeans(samples, centers);
+
+		for (int k = 0; k < IVFFLAT_PQ_CENTROIDS; k++)
+			memcpy(IvfflatPqCentroid(pq, j, k), ((Vector *) VectorArrayGet(centers, k))->x, sizeof(float) * dim);
+
+		VectorArrayFree(samples);
+		VectorArrayFree(centers);
+	}
+}
+
+/*
+ * Encode the residual of a vector from its list center
+ */
+void
+IvfflatPqEncode(IvfflatPq pq, Vector * vec, Vector * center, uint8 *codes)
+{
+	float	   *residual = palloc(sizeof(float) * pq->dimensions);
+
+	for (int i = 0; i < pq->dimensions; i++)
+		residual[i] = vec->x[i] - center->x[i];
+
+	for (int j = 0; j < pq->subvectors; j++)
+	{
+		int			start = IvfflatPqSubvectorStart(pq, j);
+		int			dim = IvfflatPqSubvectorStart(pq, j + 1) - start;
+		float		minDistance = FLT_MAX;
+		int			closest = 0;
+
+		for (int k = 0; k < IVFFLAT_PQ_CENTROIDS; k++)
+		{
+			float		distance = VectorL2SquaredDistance(residual + start, IvfflatPqCentroid(pq, j, k), dim);
+
+			if (distance < minDistance)
+			{
+				minDistance = distance;
+				closest = k;
+			}
+		}
+
+		codes[j] = closest;
+	}
+
+	pfree(residual);
+}
+
+/*
+ * Form an index tuple with codes instead of a vector
+ *
+ * The caller sets the heap TID
+ */
+IndexTuple
+IvfflatPqFormTuple(IvfflatPq pq, uint8 *codes)
+{
+	Size		size = IVFFLAT_PQ_TUPLE_SIZE(pq->subvectors);
+	IndexTuple	itup = palloc0(size);
+
+	itup->t_info = size;
+	memcpy(IvfflatPqTupleGetCodes(itup), codes, pq->subvectors);
+	return itup;
+}
+
+/*
+ * Build the lookup table for L2 distance within a list
+ *
+ * The distance to a tuple is the sum of the entries for its codes
+ */
+void
+IvfflatPqL2Table(IvfflatPq pq, Vector * q, Vector * center, float *residual, float *table)
+{
+	for (int i = 0; i < pq->dimensions; i++)
+		residual[i] = q->x[i] - center->x[i];
+
+	for (int j = 0; j < pq->subvectors; j++)
+	{
+		int			start = IvfflatPqSubvectorStart(pq, j);
+		int			dim = IvfflatPqSubvectorStart(pq, j + 1) - start;
+
+		for (int k = 0; k < IVFFLAT_PQ_CENTROIDS; k++)
+			table[j * IVFFLAT_PQ_CENTROIDS + k] = VectorL2SquaredDistance(residual + start, IvfflatPqCentroid(pq, j, k), dim);
+	}
+}
+
+/*
+ * Build the lookup table for negative inner product
+ *
+ * The table does not depend on the list, since the inner product with the
+ * center is added separately
+ */
+void
+IvfflatPqInnerProductTable(IvfflatPq pq, Vector * q, float *table)
+{
+	for (int j = 0; j < pq->subvectors; j++)
+	{
+		int			start = IvfflatPqSubvectorStart(pq, j);
+		int			dim = IvfflatPqSubvectorStart(pq, j + 1) - start;
+
+		for (int k = 0; k < IVFFLAT_PQ_CENTROIDS; k++)
+			table[j * IVFFLAT_PQ_CENTROIDS + k] = -VectorInnerProduct(q->x + start, IvfflatPqCentroid(pq, j, k), dim);
+	}
+}
@@ -3,13 +3,17 @@
 #include <float.h>
 
 #include "access/relscan.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
 #include "catalog/pg_operator_d.h"
 #include "catalog/pg_type_d.h"
+#include "executor/executor.h"
 #include "lib/pairingheap.h"
 #include "ivfflat.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
+#include "utils/memutils.h"
 
 /*
  * Compare list distances
@@ -26,8 +30,26 @@ CompareLists(const pairingheap_node *a, const pairingheap_node *b, void *arg)
 	return 0;
 }
 
+/*
+ * Compare scan lists by distance for sorting
+ */
+static int
+CompareScanLists(const void *a, const void *b)
+{
+	if (((const IvfflatScanList *) a)->distance < ((const IvfflatScanList *) b)->distance)
+		return -1;
+
+	if (((const IvfflatScanList *) a)->distance > ((const IvfflatScanList *) b)->distance)
+		return 1;
+
+	return 0;
+}
+
 /*
  * Get lists and sort by distance
+ *
+ * Iterative scans keep up to max probes lists, which are searched in order
+ * as each batch of tuples runs out
  */
 static void
 GetScanLists(IndexScanDesc scan, Datum value)
@@ -56,22 +78,24 @@ GetScanLists(IndexScanDesc scan, Datum value)
 			double		distance;
 
 			/* Use procinfo from the index instead of scan key for performance */
-			distance = DatumGetFloat8(FunctionCall2Coll(so->procinfo, so->collation, PointerGetDatum(&list->center), value));
+			distance = VectorDistance(so->distfunc, so->procinfo, so->collation, PointerGetDatum(&list->center), value);
 
-			if (listCount < so->probes)
+			if (listCount < so->maxProbes)
 			{
 				IvfflatScanList *scanlist;
 
 				scanlist = &so->lists[listCount];
 				scanlist->startPage = list->startPage;
 				scanlist->distance = distance;
+				if (scanlist->center != NULL)
+					memcpy(scanlist->center, &list->center, VARSIZE_ANY(&list->center));
 				listCount++;
 
 				/* Add to heap */
 				pairingheap_add(so->listQueue, &scanlist->ph_node);
 
 				/* Calculate max distance */
-				if (listCount == so->probes)
+				if (listCount == so->maxProbes)
 					maxDistance = ((IvfflatScanList *) pairingheap_first(so->listQueue))->distance;
 			}
 			else if (distance < maxDistance)
@@ -84,6 +108,8 @@ GetScanLists(IndexScanDesc scan, Datum value)
 				/* Reuse */
 				scanlist->startPage = list->startPage;
 				scanlist->distance = distance;
+				if (scanlist->center != NULL)
+					memcpy(scanlist->center, &list->center, VARSIZE_ANY(&list->center));
 				pairingheap_add(so->listQueue, &scanlist->ph_node);
 
 				/* Update max distance */
@@ -95,18 +121,248 @@ GetScanLists(IndexScanDesc scan, Datum value)
 
 		UnlockReleaseBuffer(cbuf);
 	}
+
+	/* The heap is only needed for selection */
+	pairingheap_reset(so->listQueue);
+	qsort(so->lists, listCount, sizeof(IvfflatScanList), CompareScanLists);
+
+	so->listCount = listCount;
+	so->listIndex = 0;
+}
+
+/*
+ * Get the approximate distance from the lookup table
+ */
+static inline double
+PqDistance(const float *table, const uint8 *codes, int subvectors)
+{
+	float		distance = 0.0;
+
+	for (int j = 0; j < subvectors; j++)
+		distance += table[j * IVFFLAT_PQ_CENTROIDS + codes[j]];
+
+	return (double) distance;
+}
+
+/*
+ * Restore the heap property below an item
+ */
+static inline void
+SiftDownScanItem(IvfflatScanItem * items, Size length, Size i)
+{
+	IvfflatScanItem item = items[i];
+
+	for (;;)
+	{
+		Size		child = 2 * i + 1;
+
+		if (child >= length)
+			break;
+
+		if (child + 1 < length && items[child + 1].distance < items[child].distance)
+			child++;
+
+		if (item.distance <= items[child].distance)
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+
+	items[i] = item;
+}
+
+/*
+ * Add an item to the sort
+ */
+static void
+PutSortItem(IvfflatScanOpaque so, ItemPointer heaptid, double distance)
+{
+	ExecClearTuple(so->slot);
+	so->slot->tts_values[0] = Float8GetDatum(distance);
+	so->slot->tts_isnull[0] = false;
+	so->slot->tts_values[1] = PointerGetDatum(heaptid);
+	so->slot->tts_isnull[1] = false;
+	ExecStoreVirtualTuple(so->slot);
+
+	tuplesort_puttupleslot(so->sortstate, so->slot);
 }
 
 /*
- * Get items
+ * Move the items to a sort once they reach work_mem, so it can spill to disk
  */
 static void
-GetScanItems(IndexScanDesc scan, Datum value)
+SpillScanItems(IvfflatScanOpaque so)
+{
+	MemoryContext oldCtx = MemoryContextSwitchTo(GetMemoryChunkContext(so));
+	AttrNumber	attNums[] = {1};
+	Oid			sortOperators[] = {Float8LessOperator};
+	Oid			sortCollations[] = {InvalidOid};
+	bool		nullsFirstFlags[] = {false};
+
+	if (so->tupdesc == NULL)
+	{
+		so->tupdesc = CreateTemplateTupleDesc(2);
+		TupleDescInitEntry(so->tupdesc, (AttrNumber) 1, "distance", FLOAT8OID, -1, 0);
+		TupleDescInitEntry(so->tupdesc, (AttrNumber) 2, "heaptid", TIDOID, -1, 0);
+		so->slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsVirtual);
+	}
+
+	so->sortstate = tuplesort_begin_heap(so->tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, work_mem, NULL, false);
+
+	for (Size i = 0; i < so->itemCount; i++)
+		PutSortItem(so, &so->items[i].heaptid, so->items[i].distance);
+
+	/* Shrink the array, since the sort has its own memory */
+	pfree(so->items);
+	so->maxItems = Min(1024, so->itemLimit);
+	so->items = palloc(sizeof(IvfflatScanItem) * so->maxItems);
+	so->itemCount = 0;
+
+	MemoryContextSwitchTo(oldCtx);
+}
+
+/*
+ * End the sort, if any
+ */
+static void
+EndScanSort(IvfflatScanOpaque so)
+{
+	if (so->sortstate != NULL)
+	{
+		tuplesort_end(so->sortstate);
+		so->sortstate = NULL;
+	}
+}
+
+/*
+ * Add an item to the end of the array, or to the sort past work_mem
+ */
+static inline void
+AddScanItem(IvfflatScanOpaque so, ItemPointer heaptid, double distance)
+{
+	IvfflatScanItem *item;
+
+	if (so->itemCount == so->maxItems && so->sortstate == NULL)
+	{
+		if (so->maxItems >= so->itemLimit)
+			SpillScanItems(so);
+		else
+		{
+			so->maxItems = Min(so->maxItems * 2, so->itemLimit);
+			so->items = repalloc_huge(so->items, sizeof(IvfflatScanItem) * so->maxItems);
+		}
+	}
+
+	if (so->sortstate != NULL)
+	{
+		PutSortItem(so, heaptid, distance);
+		return;
+	}
+
+	item = &so->items[so->itemCount++];
+	item->heaptid = *heaptid;
+	item->distance = distance;
+}
+
+/*
+ * Remove the closest item
+ *
+ * Only as many items as the scan returns are ordered, which is usually far
+ * fewer than the number of items
+ */
+static bool
+PopScanItem(IvfflatScanOpaque so, ItemPointer heaptid)
+{
+	if (so->sortstate != NULL)
+	{
+		bool		isnull;
+
+		if (!tuplesort_gettupleslot(so->sortstate, true, false, so->slot, NULL))
+			return false;
+
+		*heaptid = *((ItemPointer) DatumGetPointer(slot_getattr(so->slot, 2, &isnull)));
+		return true;
+	}
+
+	if (so->itemCount == 0)
+		return false;
+
+	*heaptid = so->items[0].heaptid;
+
+	so->itemCount--;
+	if (so->itemCount > 0)
+	{
+		so->items[0] = so->items[so->itemCount];
+		SiftDownScanItem(so->items, so->itemCount, 0);
+	}
+
+	return true;
+}
+
+/*
+ * Get the shared state of a parallel scan
+ */
+static inline IvfflatParallelScan
+GetParallelScan(IndexScanDesc scan)
+{
+#if PG_VERSION_NUM >= 180000
+	return (IvfflatParallelScan) OffsetToPointer(scan->parallel_scan, scan->parallel_scan->ps_offset_am);
+#else
+	return (IvfflatParallelScan) OffsetToPointer(scan->parallel_scan, scan->parallel_scan->ps_offset);
+#endif
+}
+
+/*
+ * Claim the next list to search, or return -1 if none is left before the
+ * end index
+ *
+ * Participants in a parallel scan get the same lists in the same order, so
+ * a shared cursor hands out each list once
+ */
+static int
+GetNextScanList(IndexScanDesc scan, int endIndex)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	IvfflatParallelScan pscan;
+	uint32		listIndex;
+
+	if (scan->parallel_scan == NULL)
+	{
+		if (so->listIndex >= endIndex)
+			return -1;
+
+		return so->listIndex++;
+	}
+
+	pscan = GetParallelScan(scan);
+	listIndex = pg_atomic_read_u32(&pscan->nextList);
+
+	/* Do not move past the end, so later lists stay available */
+	while (listIndex < (uint32) endIndex)
+	{
+		if (pg_atomic_compare_exchange_u32(&pscan->nextList, &listIndex, listIndex + 1))
+			return listIndex;
+	}
+
+	return -1;
+}
+
+/*
+ * Get items from the closest probes lists, or from the next list for
+ * iterative scans
+ *
+ * Returns false if there are no lists left
+ */
+static bool
+GetScanItems(IndexScanDesc scan, Datum value, bool first)
 {
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
 	TupleDesc	tupdesc = RelationGetDescr(scan->indexRelation);
 	double		tuples = 0;
-	TupleTableSlot *slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsVirtual);
+	int			endIndex = first ? Min(so->probes, so->listCount) : so->listCount;
+	int			listIndex;
+	bool		found = false;
 
 	/*
 	 * Reuse same set of shared buffers for scan
@@ -115,10 +371,30 @@ GetScanItems(IndexScanDesc scan, Datum value)
 	 */
 	BufferAccessStrategy bas = GetAccessStrategy(BAS_BULKREAD);
 
+	/* Items from the previous batch were all returned */
+	EndScanSort(so);
+
+	/* The table for inner product is the same for all lists */
+	if (so->pq != NULL && so->residual == NULL)
+		IvfflatPqInnerProductTable(so->pq, DatumGetVector(value), so->pqTable);
+
 	/* Search closest probes lists */
-	while (!pairingheap_is_empty(so->listQueue))
+	while ((listIndex = GetNextScanList(scan, endIndex)) >= 0)
 	{
-		BlockNumber searchPage = ((IvfflatScanList *) pairingheap_remove_first(so->listQueue))->startPage;
+		IvfflatScanList *scanlist = &so->lists[listIndex];
+		BlockNumber searchPage = scanlist->startPage;
+		double		listDistance = 0.0;
+
+		if (so->pq != NULL)
+		{
+			if (so->residual != NULL)
+				IvfflatPqL2Table(so->pq, DatumGetVector(value), scanlist->center, so->residual, so->pqTable);
+			else
+			{
+				/* The negative inner product with the center */
+				listDistance = scanlist->distance;
+			}
+		}
 
 		/* Search all entry pages for list */
 		while (BlockNumberIsValid(searchPage))
@@ -138,24 +414,24 @@ GetScanItems(IndexScanDesc scan, Datum value)
 				Datum		datum;
 				bool		isnull;
 				ItemId		itemid = PageGetItemId(page, offno);
+				double		distance;
 
 				itup = (IndexTuple) PageGetItem(page, itemid);
-				datum = index_getattr(itup, 1, tupdesc, &isnull);
-
-				/*
-				 * Add virtual tuple
-				 *
-				 * Use procinfo from the index instead of scan key for
-				 * performance
-				 */
-				ExecClearTuple(slot);
-				slot->tts_values[0] = FunctionCall2Coll(so->procinfo, so->collation, datum, value);
-				slot->tts_isnull[0] = false;
-				slot->tts_values[1] = PointerGetDatum(&itup->t_tid);
-				slot->tts_isnull[1] = false;
-				ExecStoreVirtualTuple(slot);
-
-				tuplesort_puttupleslot(so->sortstate, slot);
+
+				if (so->pq != NULL)
+					distance = listDistance + PqDistance(so->pqTable, IvfflatPqTupleGetCodes(itup), so->pq->subvectors);
+				else
+				{
+					datum = index_getattr(itup, 1, tupdesc, &isnull);
+
+					/*
+					 * Use procinfo from the index instead of scan key for
+					 * performance
+					 */
+					distance = VectorDistance(so->distfunc, so->procinfo, so->collation, datum, value);
+				}
+
+				AddScanItem(so, &itup->t_tid, distance);
 
 				tuples++;
 			}
@@ -164,17 +440,187 @@ GetScanItems(IndexScanDesc scan, Datum value)
 
 			UnlockReleaseBuffer(buf);
 		}
+
+		found = true;
+
+		/* Search one list at a time after the first batch */
+		if (!first)
+			break;
 	}
 
 	FreeAccessStrategy(bas);
 
-	if (tuples < 100)
+	/* Participants in a parallel scan only see some of the tuples */
+	if (first && tuples < 100 && scan->parallel_scan == NULL)
 		ereport(DEBUG1,
 				(errmsg("index scan found few tuples"),
 				 errdetail("Index may have been created with little data."),
 				 errhint("Recreate the index and possibly decrease lists.")));
 
-	tuplesort_performsort(so->sortstate);
+	/* Sort or build the heap */
+	if (so->sortstate != NULL)
+		tuplesort_performsort(so->sortstate);
+	else
+	{
+		for (Size i = so->itemCount / 2; i > 0; i--)
+			SiftDownScanItem(so->items, so->itemCount, i - 1);
+	}
+
+	return found;
+}
+
+/*
+ * Compare scan items by distance
+ */
+static int
+CompareScanItems(const void *a, const void *b)
+{
+	if (((const IvfflatScanItem *) a)->distance < ((const IvfflatScanItem *) b)->distance)
+		return -1;
+
+	if (((const IvfflatScanItem *) a)->distance > ((const IvfflatScanItem *) b)->distance)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Set up fetching heap values for re-ranking
+ *
+ * The heap relation is not available until after beginscan
+ */
+static void
+InitRerank(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	MemoryContext oldCtx = MemoryContextSwitchTo(GetMemoryChunkContext(so));
+
+	so->indexInfo = BuildIndexInfo(scan->indexRelation);
+	so->estate = CreateExecutorState();
+	so->heapSlot = table_slot_create(scan->heapRelation, NULL);
+	GetPerTupleExprContext(so->estate)->ecxt_scantuple = so->heapSlot;
+	so->fetch = table_index_fetch_begin(scan->heapRelation);
+
+	MemoryContextSwitchTo(oldCtx);
+}
+
+/*
+ * Re-rank the closest candidates by the distance to their heap values
+ *
+ * Candidates after these are returned in the order of their approximate
+ * distance
+ */
+static void
+RerankScanItems(IndexScanDesc scan, Datum value)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	ExprContext *econtext;
+
+	if (so->fetch == NULL)
+		InitRerank(scan);
+
+	econtext = GetPerTupleExprContext(so->estate);
+
+	if (so->rerankItems != NULL)
+		pfree(so->rerankItems);
+
+	so->rerankItems = MemoryContextAlloc(GetMemoryChunkContext(so), sizeof(IvfflatScanItem) * ivfflat_pq_rerank);
+	so->rerankLength = 0;
+	so->rerankPos = 0;
+
+	for (int i = 0; i < ivfflat_pq_rerank; i++)
+	{
+		ItemPointerData heaptid;
+		bool		call_again = false;
+		bool		all_dead = false;
+		Datum		values[INDEX_MAX_KEYS];
+		bool		isnull[INDEX_MAX_KEYS];
+		MemoryContext oldCtx;
+
+		if (!PopScanItem(so, &heaptid))
+			break;
+
+		/* Skip if no visible tuple, like the executor would */
+		if (!table_index_fetch_tuple(so->fetch, &heaptid, scan->xs_snapshot, so->heapSlot, &call_again, &all_dead))
+			continue;
+
+		oldCtx = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+		/* Get the indexed value, which may be an expression */
+		FormIndexDatum(so->indexInfo, so->heapSlot, so->estate, values, isnull);
+
+		if (!isnull[0])
+		{
+			Datum		heapValue = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
+			IvfflatScanItem *item = &so->rerankItems[so->rerankLength++];
+
+			/* Fine if normalization fails */
+			if (so->normprocinfo != NULL)
+				IvfflatNormValue(so->typeInfo, so->normprocinfo, so->collation, &heapValue);
+
+			item->heaptid = heaptid;
+			item->distance = VectorDistance(so->distfunc, so->procinfo, so->collation, value, heapValue);
+		}
+
+		MemoryContextSwitchTo(oldCtx);
+		ResetExprContext(econtext);
+	}
+
+	/* Release the heap buffer */
+	ExecClearTuple(so->heapSlot);
+	table_index_fetch_reset(so->fetch);
+
+	qsort(so->rerankItems, so->rerankLength, sizeof(IvfflatScanItem), CompareScanItems);
+}
+
+/*
+ * Get scan value
+ *
+ * Allocated with the scan, since iterative scans use it after the first call
+ */
+static Datum
+GetScanValue(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	MemoryContext oldCtx = MemoryContextSwitchTo(GetMemoryChunkContext(so));
+	Datum		value;
+
+	if (scan->orderByData->sk_flags & SK_ISNULL)
+	{
+		value = PointerGetDatum(InitVector(so->dimensions));
+
+		/* Convert the zero vector to the type of the index */
+		if (so->typeInfo->fromVector != NULL)
+			value = DirectFunctionCall3(so->typeInfo->fromVector, value, Int32GetDatum(-1), BoolGetDatum(false));
+	}
+	else
+	{
+		value = scan->orderByData->sk_argument;
+
+		/* Value should not be compressed or toasted */
+		Assert(!VARATT_IS_COMPRESSED(DatumGetPointer(value)));
+		Assert(!VARATT_IS_EXTENDED(DatumGetPointer(value)));
+
+		/* Fine if normalization fails */
+		if (so->normprocinfo != NULL)
+			IvfflatNormValue(so->typeInfo, so->normprocinfo, so->collation, &value);
+	}
+
+	MemoryContextSwitchTo(oldCtx);
+
+	return value;
+}
+
+/*
+ * Free the scan value if it was allocated
+ */
+static void
+FreeScanValue(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+
+	if (!so->first && so->value != scan->orderByData->sk_argument)
+		pfree(DatumGetPointer(so->value));
 }
 
 /*
@@ -187,11 +633,8 @@ ivfflatbeginscan(Relation index, int nkeys, int norderbys)
 	IvfflatScanOpaque so;
 	int			lists;
 	int			dimensions;
-	AttrNumber	attNums[] = {1};
-	Oid			sortOperators[] = {Float8LessOperator};
-	Oid			sortCollations[] = {InvalidOid};
-	bool		nullsFirstFlags[] = {false};
 	int			probes = ivfflat_probes;
+	int			maxProbes;
 
 	scan = RelationGetIndexScan(index, nkeys, norderbys);
 
@@ -201,25 +644,69 @@ ivfflatbeginscan(Relation index, int nkeys, int norderbys)
 	if (probes > lists)
 		probes = lists;
 
-	so = (IvfflatScanOpaque) palloc(offsetof(IvfflatScanOpaqueData, lists) + probes * sizeof(IvfflatScanList));
+	/* Keep more lists for iterative scans */
+	maxProbes = probes;
+	if (ivfflat_iterative_scan != IVFFLAT_ITERATIVE_SCAN_OFF)
+		maxProbes = Min(Max(ivfflat_max_probes, probes), lists);
+
+	so = (IvfflatScanOpaque) palloc(offsetof(IvfflatScanOpaqueData, lists) + maxProbes * sizeof(IvfflatScanList));
 	so->first = true;
 	so->probes = probes;
+	so->maxProbes = maxProbes;
+	so->value = (Datum) 0;
+	so->listCount = 0;
+	so->listIndex = 0;
 	so->dimensions = dimensions;
 
 	/* Set support functions */
 	so->procinfo = index_getprocinfo(index, 1, IVFFLAT_DISTANCE_PROC);
 	so->normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
 	so->collation = index->rd_indcollation[0];
+	so->distfunc = VectorGetDistanceFunc(so->procinfo);
+	so->typeInfo = IvfflatGetTypeInfo(index);
 
-	/* Create tuple description for sorting */
-	so->tupdesc = CreateTemplateTupleDesc(2);
-	TupleDescInitEntry(so->tupdesc, (AttrNumber) 1, "distance", FLOAT8OID, -1, 0);
-	TupleDescInitEntry(so->tupdesc, (AttrNumber) 2, "heaptid", TIDOID, -1, 0);
+	/* Get codebook if quantized */
+	so->pq = IvfflatGetPq(index);
+	so->pqTable = NULL;
+	so->residual = NULL;
 
-	/* Prep sort */
-	so->sortstate = tuplesort_begin_heap(so->tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, work_mem, NULL, false);
+	for (int i = 0; i < maxProbes; i++)
+		so->lists[i].center = NULL;
 
-	so->slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsMinimalTuple);
+	if (so->pq != NULL)
+	{
+		so->pqTable = palloc(sizeof(float) * IVFFLAT_PQ_CENTROIDS * so->pq->subvectors);
+
+		/* Tables for L2 distance depend on the center of each list */
+		if (so->distfunc == VectorL2SquaredDistance)
+		{
+			Size		centerSize = MAXALIGN(VECTOR_SIZE(dimensions));
+			char	   *centers = palloc(maxProbes * centerSize);
+
+			so->residual = palloc(sizeof(float) * dimensions);
+
+			for (int i = 0; i < maxProbes; i++)
+				so->lists[i].center = (Vector *) (centers + i * centerSize);
+		}
+	}
+
+	/* Set up on first re-rank */
+	so->indexInfo = NULL;
+	so->estate = NULL;
+	so->fetch = NULL;
+	so->heapSlot = NULL;
+	so->rerankItems = NULL;
+	so->rerankLength = 0;
+	so->rerankPos = 0;
+
+	/* Grows as needed up to work_mem, then items are sorted instead */
+	so->itemLimit = Max((Size) work_mem * 1024 / sizeof(IvfflatScanItem), 1);
+	so->maxItems = Min(1024, so->itemLimit);
+	so->items = palloc(sizeof(IvfflatScanItem) * so->maxItems);
+	so->itemCount = 0;
+	so->sortstate = NULL;
+	so->tupdesc = NULL;
+	so->slot = NULL;
 
 	so->listQueue = pairingheap_allocate(CompareLists, scan);
 
@@ -236,14 +723,22 @@ ivfflatrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int
 {
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
 
-#if PG_VERSION_NUM >= 130000
 	if (!so->first)
-		tuplesort_reset(so->sortstate);
-#endif
+		FreeScanValue(scan);
 
 	so->first = true;
+	so->itemCount = 0;
+	EndScanSort(so);
 	pairingheap_reset(so->listQueue);
 
+	if (so->rerankItems != NULL)
+	{
+		pfree(so->rerankItems);
+		so->rerankItems = NULL;
+	}
+	so->rerankLength = 0;
+	so->rerankPos = 0;
+
 	if (keys && scan->numberOfKeys > 0)
 		memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
 
@@ -267,8 +762,6 @@ ivfflatgettuple(IndexScanDesc scan, ScanDirection dir)
 
 	if (so->first)
 	{
-		Datum		value;
-
 		/* Count index scan for stats */
 		pgstat_count_index_scan(scan->indexRelation);
 
@@ -281,38 +774,44 @@ ivfflatgettuple(IndexScanDesc scan, ScanDirection dir)
 		if (!IsMVCCSnapshot(scan->xs_snapshot))
 			elog(ERROR, "non-MVCC snapshots are not supported with ivfflat");
 
-		if (scan->orderByData->sk_flags & SK_ISNULL)
-			value = PointerGetDatum(InitVector(so->dimensions));
-		else
-		{
-			value = scan->orderByData->sk_argument;
+		so->value = GetScanValue(scan);
 
-			/* Value should not be compressed or toasted */
-			Assert(!VARATT_IS_COMPRESSED(DatumGetPointer(value)));
-			Assert(!VARATT_IS_EXTENDED(DatumGetPointer(value)));
+		IvfflatBench("GetScanLists", GetScanLists(scan, so->value));
+		IvfflatBench("GetScanItems", GetScanItems(scan, so->value, true));
 
-			/* Fine if normalization fails */
-			if (so->normprocinfo != NULL)
-				IvfflatNormValue(so->normprocinfo, so->collation, &value, NULL);
-		}
+		/* Order the closest candidates by exact distance */
+		if (so->pq != NULL && ivfflat_pq_rerank > 0)
+			IvfflatBench("RerankScanItems", RerankScanItems(scan, so->value));
 
-		IvfflatBench("GetScanLists", GetScanLists(scan, value));
-		IvfflatBench("GetScanItems", GetScanItems(scan, value));
 		so->first = false;
-
-		/* Clean up if we allocated a new value */
-		if (value != scan->orderByData->sk_argument)
-			pfree(DatumGetPointer(value));
 	}
 
-	if (tuplesort_gettupleslot(so->sortstate, true, false, so->slot, NULL))
+	for (;;)
 	{
-		ItemPointer heaptid = (ItemPointer) DatumGetPointer(slot_getattr(so->slot, 2, &so->isnull));
+		if (so->rerankPos < so->rerankLength)
+		{
+			scan->xs_heaptid = so->rerankItems[so->rerankPos++].heaptid;
+			scan->xs_recheck = false;
+			scan->xs_recheckorderby = false;
+			return true;
+		}
 
-		scan->xs_heaptid = *heaptid;
-		scan->xs_recheck = false;
-		scan->xs_recheckorderby = false;
-		return true;
+		if (PopScanItem(so, &scan->xs_heaptid))
+		{
+			scan->xs_recheck = false;
+			scan->xs_recheckorderby = false;
+			return true;
+		}
+
+		/* Search the next list for iterative scans */
+		if (ivfflat_iterative_scan == IVFFLAT_ITERATIVE_SCAN_OFF)
+			break;
+
+		if (!GetScanItems(scan, so->value, false))
+			break;
+
+		if (so->pq != NULL && ivfflat_pq_rerank > 0)
+			RerankScanItems(scan, so->value);
 	}
 
 	return false;
@@ -326,9 +825,56 @@ ivfflatendscan(IndexScanDesc scan)
 {
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
 
+	FreeScanValue(scan);
+
 	pairingheap_free(so->listQueue);
-	tuplesort_end(so->sortstate);
+	pfree(so->items);
+	EndScanSort(so);
+	if (so->slot != NULL)
+		ExecDropSingleTupleTableSlot(so->slot);
+
+	if (so->fetch != NULL)
+	{
+		table_index_fetch_end(so->fetch);
+		ExecDropSingleTupleTableSlot(so->heapSlot);
+		FreeExecutorState(so->estate);
+	}
 
 	pfree(so);
 	scan->opaque = NULL;
 }
+
+/*
+ * Estimate the size of the shared state for a parallel scan
+ */
+Size
+#if PG_VERSION_NUM >= 180000
+ivfflatestimateparallelscan(Relation index, int nkeys, int norderbys)
+#elif PG_VERSION_NUM >= 170000
+ivfflatestimateparallelscan(int nkeys, int norderbys)
+#else
+ivfflatestimateparallelscan(void)
+#endif
+{
+	return sizeof(IvfflatParallelScanData);
+}
+
+/*
+ * Initialize the shared state for a parallel scan
+ */
+void
+ivfflatinitparallelscan(void *target)
+{
+	IvfflatParallelScan pscan = (IvfflatParallelScan) target;
+
+	pg_atomic_init_u32(&pscan->nextList, 0);
+}
+
+/*
+ * Reset the shared state before a parallel scan is restarted
+ */
+void
+ivfflatparallelrescan(IndexScanDesc scan)
+{
+	pg_atomic_write_u32(&GetParallelScan(scan)->nextList, 0);
+}
@@ -5,18 +5,39 @@
 #include "storage/bufmgr.h"
 #include "vector.h"
 
+PGDLLEXPORT Datum l2_normalize(PG_FUNCTION_ARGS);
+
+/*
+ * Get the size of a vector
+ */
+static Size
+VectorItemSize(int dimensions)
+{
+	return VECTOR_SIZE(dimensions);
+}
+
+/* Type info for vector, which is also used for k-means */
+const IvfflatTypeInfo IvfflatVectorTypeInfo = {
+	.maxDimensions = IVFFLAT_MAX_DIM,
+	.normalize = l2_normalize,
+	.itemSize = VectorItemSize,
+	.toVector = NULL,
+	.fromVector = NULL
+};
+
 /*
  * Allocate a vector array
  */
 VectorArray
-VectorArrayInit(int maxlen, int dimensions)
+VectorArrayInit(int maxlen, int dimensions, Size itemsize)
 {
 	VectorArray res = palloc(sizeof(VectorArrayData));
 
 	res->length = 0;
 	res->maxlen = maxlen;
 	res->dim = dimensions;
-	res->items = palloc_extended(maxlen * VECTOR_SIZE(dimensions), MCXT_ALLOC_ZERO | MCXT_ALLOC_HUGE);
+	res->itemsize = MAXALIGN(itemsize);
+	res->items = palloc_extended(maxlen * res->itemsize, MCXT_ALLOC_ZERO | MCXT_ALLOC_HUGE);
 	return res;
 }
 
@@ -54,6 +75,42 @@ IvfflatGetLists(Relation index)
 	return IVFFLAT_DEFAULT_LISTS;
 }
 
+/*
+ * Get the quantization in the index options
+ *
+ * Only used when building, since the metapage records the quantization used
+ */
+int
+IvfflatGetQuantization(Relation index)
+{
+	IvfflatOptions *opts = (IvfflatOptions *) index->rd_options;
+
+	if (opts && opts->quantizationOffset > 0)
+	{
+		char	   *quantization = (char *) opts + opts->quantizationOffset;
+
+		if (strcmp(quantization, "pq") == 0)
+			return IVFFLAT_QUANTIZATION_PQ;
+	}
+
+	return IVFFLAT_QUANTIZATION_NONE;
+}
+
+/*
+ * Get the number of subvectors for product quantization
+ */
+int
+IvfflatGetSubvectors(Relation index, int dimensions)
+{
+	IvfflatOptions *opts = (IvfflatOptions *) index->rd_options;
+
+	if (opts && opts->subvectors > 0)
+		return opts->subvectors;
+
+	/* One byte for every 4 dimensions */
+	return Max(dimensions / 4, 1);
+}
+
 /*
  * Get proc
  */
@@ -66,6 +123,20 @@ IvfflatOptionalProcInfo(Relation index, uint16 procnum)
 	return index_getprocinfo(index, 1, procnum);
 }
 
+/*
+ * Get type info
+ */
+const IvfflatTypeInfo *
+IvfflatGetTypeInfo(Relation index)
+{
+	FmgrInfo   *procinfo = IvfflatOptionalProcInfo(index, IVFFLAT_TYPE_INFO_PROC);
+
+	if (procinfo == NULL)
+		return &IvfflatVectorTypeInfo;
+	else
+		return (const IvfflatTypeInfo *) DatumGetPointer(FunctionCall0Coll(procinfo, InvalidOid));
+}
+
 /*
  * Divide by the norm
  *
@@ -75,21 +146,13 @@ IvfflatOptionalProcInfo(Relation index, uint16 procnum)
  * if it's different than the original value
  */
 bool
-IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result)
+IvfflatNormValue(const IvfflatTypeInfo * typeInfo, FmgrInfo *procinfo, Oid collation, Datum *value)
 {
 	double		norm = DatumGetFloat8(FunctionCall1Coll(procinfo, collation, *value));
 
 	if (norm > 0)
 	{
-		Vector	   *v = DatumGetVector(*value);
-
-		if (result == NULL)
-			result = InitVector(v->dim);
-
-		for (int i = 0; i < v->dim; i++)
-			result->x[i] = v->x[i] / norm;
-
-		*value = PointerGetDatum(result);
+		*value = DirectFunctionCall1Coll(typeInfo->normalize, collation, *value);
 
 		return true;
 	}
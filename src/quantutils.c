@@ -0,0 +1,200 @@
+#include "postgres.h"
+
+#include "quantutils.h"
+#include "vectorutils.h"
+
+#ifdef USE_DISPATCH
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#define TARGET_AVX512VNNI
+#else
+#define TARGET_AVX2 __attribute__((target("avx,avx2")))
+#define TARGET_AVX512VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+#endif
+#endif
+
+uint32		(*QuantizedL2SquaredDistance) (const uint8 *ax, const uint8 *bx, int dim);
+uint32		(*QuantizedInnerProduct) (const uint8 *ax, const uint8 *bx, int dim);
+
+/*
+ * Allocate and initialize a new quantized vector
+ */
+QuantizedVector *
+InitQuantizedVector(int dim)
+{
+	QuantizedVector *result;
+	int			size;
+
+	size = QUANTIZED_VECTOR_SIZE(dim);
+	result = (QuantizedVector *) palloc0(size);
+	SET_VARSIZE(result, size);
+	result->dim = dim;
+
+	return result;
+}
+
+static uint32
+QuantizedL2SquaredDistanceDefault(const uint8 *ax, const uint8 *bx, int dim)
+{
+	uint32		distance = 0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		int32		diff = (int32) ax[i] - (int32) bx[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static uint32
+QuantizedInnerProductDefault(const uint8 *ax, const uint8 *bx, int dim)
+{
+	uint32		distance = 0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += (uint32) ax[i] * (uint32) bx[i];
+
+	return distance;
+}
+
+#ifdef USE_DISPATCH
+TARGET_AVX2 static uint32
+QuantizedL2SquaredDistanceAvx2(const uint8 *ax, const uint8 *bx, int dim)
+{
+	__m256i		dist = _mm256_setzero_si256();
+	__m128i		sum;
+	uint32		distance;
+	int			i = 0;
+
+	/* Widen to 16 bits so the difference fits */
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256i		axs = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (ax + i)));
+		__m256i		bxs = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bx + i)));
+		__m256i		diff = _mm256_sub_epi16(axs, bxs);
+
+		dist = _mm256_add_epi32(dist, _mm256_madd_epi16(diff, diff));
+	}
+
+	sum = _mm_add_epi32(_mm256_castsi256_si128(dist), _mm256_extracti128_si256(dist, 1));
+	sum = _mm_hadd_epi32(sum, sum);
+	sum = _mm_hadd_epi32(sum, sum);
+	distance = (uint32) _mm_cvtsi128_si32(sum);
+
+	for (; i < dim; i++)
+	{
+		int32		diff = (int32) ax[i] - (int32) bx[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+TARGET_AVX2 static uint32
+QuantizedInnerProductAvx2(const uint8 *ax, const uint8 *bx, int dim)
+{
+	__m256i		dist = _mm256_setzero_si256();
+	__m128i		sum;
+	uint32		distance;
+	int			i = 0;
+
+	/* Codes fit in signed 16 bits, so the pairwise sums cannot overflow */
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256i		axs = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (ax + i)));
+		__m256i		bxs = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bx + i)));
+
+		dist = _mm256_add_epi32(dist, _mm256_madd_epi16(axs, bxs));
+	}
+
+	sum = _mm_add_epi32(_mm256_castsi256_si128(dist), _mm256_extracti128_si256(dist, 1));
+	sum = _mm_hadd_epi32(sum, sum);
+	sum = _mm_hadd_epi32(sum, sum);
+	distance = (uint32) _mm_cvtsi128_si32(sum);
+
+	for (; i < dim; i++)
+		distance += (uint32) ax[i] * (uint32) bx[i];
+
+	return distance;
+}
+
+TARGET_AVX512VNNI static uint32
+QuantizedL2SquaredDistanceAvx512Vnni(const uint8 *ax, const uint8 *bx, int dim)
+{
+	__m512i		dist = _mm512_setzero_si512();
+	int			i = 0;
+
+	/* Widen each half to 16 bits so the difference fits */
+	for (; i < dim; i += 64)
+	{
+		__mmask64	mask = i + 64 <= dim ? UINT64CONST(0xFFFFFFFFFFFFFFFF) : (UINT64CONST(1) << (dim - i)) - 1;
+		__m512i		axs = _mm512_maskz_loadu_epi8(mask, ax + i);
+		__m512i		bxs = _mm512_maskz_loadu_epi8(mask, bx + i);
+		__m512i		lo = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm512_castsi512_si256(axs)), _mm512_cvtepu8_epi16(_mm512_castsi512_si256(bxs)));
+		__m512i		hi = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(axs, 1)), _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(bxs, 1)));
+
+		dist = _mm512_dpwssd_epi32(dist, lo, lo);
+		dist = _mm512_dpwssd_epi32(dist, hi, hi);
+	}
+
+	return (uint32) _mm512_reduce_add_epi32(dist);
+}
+
+TARGET_AVX512VNNI static uint32
+QuantizedInnerProductAvx512Vnni(const uint8 *ax, const uint8 *bx, int dim)
+{
+	__m512i		dist = _mm512_setzero_si512();
+	__m512i		asum = _mm512_setzero_si512();
+	__m512i		flip = _mm512_set1_epi8((char) 0x80);
+	__m512i		ones = _mm512_set1_epi8(1);
+	int			i = 0;
+
+	/*
+	 * VPDPBUSD multiplies unsigned by signed bytes, so flip the sign bit of b
+	 * to get b - 128 and add 128 * sum(a) back at the end
+	 */
+	for (; i < dim; i += 64)
+	{
+		__mmask64	mask = i + 64 <= dim ? UINT64CONST(0xFFFFFFFFFFFFFFFF) : (UINT64CONST(1) << (dim - i)) - 1;
+		__m512i		axs = _mm512_maskz_loadu_epi8(mask, ax + i);
+		__m512i		bxs = _mm512_maskz_loadu_epi8(mask, bx + i);
+
+		dist = _mm512_dpbusd_epi32(dist, axs, _mm512_xor_si512(bxs, flip));
+		asum = _mm512_dpbusd_epi32(asum, axs, ones);
+	}
+
+	return (uint32) (_mm512_reduce_add_epi32(dist) + 128 * _mm512_reduce_add_epi32(asum));
+}
+#endif
+
+/*
+ * Choose the quantized distance functions for the CPU
+ *
+ * Must be called after VectorInit, which detects the CPU features
+ */
+void
+QuantizedInit(void)
+{
+	QuantizedL2SquaredDistance = QuantizedL2SquaredDistanceDefault;
+	QuantizedInnerProduct = QuantizedInnerProductDefault;
+
+#ifdef USE_DISPATCH
+	if (SupportsCpuFeature(CPU_FEATURE_AVX512VNNI | CPU_FEATURE_AVX512BW))
+	{
+		QuantizedL2SquaredDistance = QuantizedL2SquaredDistanceAvx512Vnni;
+		QuantizedInnerProduct = QuantizedInnerProductAvx512Vnni;
+	}
+	else if (SupportsCpuFeature(CPU_FEATURE_AVX2))
+	{
+		QuantizedL2SquaredDistance = QuantizedL2SquaredDistanceAvx2;
+		QuantizedInnerProduct = QuantizedInnerProductAvx2;
+	}
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef QUANTUTILS_H
+#define QUANTUTILS_H
+
+#include "vectorutils.h"
+
+#define QUANTIZED_VECTOR_SIZE(_dim)		(offsetof(QuantizedVector, x) + sizeof(uint8)*(_dim))
+
+/*
+ * Vector with each element stored as an unsigned code
+ *
+ * Element i is approximately offset + scale * x[i], with scale and offset
+ * kept by the index rather than in each value
+ */
+typedef struct QuantizedVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int16		dim;			/* number of dimensions */
+	int16		unused;			/* reserved for future use, always zero */
+	int32		sum;			/* sum of codes, for inner product */
+	uint8		x[FLEXIBLE_ARRAY_MEMBER];
+}			QuantizedVector;
+
+extern uint32 (*QuantizedL2SquaredDistance) (const uint8 *ax, const uint8 *bx, int dim);
+extern uint32 (*QuantizedInnerProduct) (const uint8 *ax, const uint8 *bx, int dim);
+
+QuantizedVector *InitQuantizedVector(int dim);
+void		QuantizedInit(void);
+
+#endif
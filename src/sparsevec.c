@@ -0,0 +1,999 @@
+#include "postgres.h"
+
+#include <limits.h>
+#include <math.h>
+
+#include "common/shortest_dec.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "port.h"				/* for strtof() */
+#include "sparsevec.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "vector.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+typedef struct SparseInputElement
+{
+	int32		index;
+	float		value;
+}			SparseInputElement;
+
+/*
+ * Ensure same dimensions
+ */
+static inline void
+CheckDims(SparseVector * a, SparseVector * b)
+{
+	if (a->dim != b->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different sparsevec dimensions %d and %d", a->dim, b->dim)));
+}
+
+/*
+ * Ensure expected dimensions
+ */
+static inline void
+CheckExpectedDim(int32 typmod, int dim)
+{
+	if (typmod != -1 && typmod != dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected %d dimensions, not %d", typmod, dim)));
+}
+
+/*
+ * Ensure valid dimensions
+ */
+static inline void
+CheckDim(int dim)
+{
+	if (dim < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec must have at least 1 dimension")));
+
+	if (dim > SPARSEVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sparsevec cannot have more than %d dimensions", SPARSEVEC_MAX_DIM)));
+}
+
+/*
+ * Ensure valid number of non-zero elements
+ */
+static inline void
+CheckNnz(int nnz, int dim)
+{
+	if (nnz < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec cannot have negative number of elements")));
+
+	if (nnz > SPARSEVEC_MAX_NNZ)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sparsevec cannot have more than %d non-zero elements", SPARSEVEC_MAX_NNZ)));
+
+	if (nnz > dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec cannot have more elements than dimensions")));
+}
+
+/*
+ * Ensure valid index, given the previous index (or -1)
+ */
+static inline void
+CheckIndex(int32 index, int32 prev, int dim)
+{
+	if (index < 0 || index >= dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec index out of bounds")));
+
+	if (index == prev)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec indices must not contain duplicates")));
+
+	if (index < prev)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec indices must be in ascending order")));
+}
+
+/*
+ * Ensure finite element
+ */
+static inline void
+CheckElement(float value)
+{
+	if (isnan(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("NaN not allowed in sparsevec")));
+
+	if (isinf(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("infinite value not allowed in sparsevec")));
+}
+
+/*
+ * Allocate and initialize a new sparse vector
+ */
+SparseVector *
+InitSparseVector(int dim, int nnz)
+{
+	SparseVector *result;
+	int			size;
+
+	size = SPARSEVEC_SIZE(nnz);
+	result = (SparseVector *) palloc0(size);
+	SET_VARSIZE(result, size);
+	result->dim = dim;
+	result->nnz = nnz;
+
+	return result;
+}
+
+/*
+ * Check for whitespace, since array_isspace() is static
+ */
+static inline bool
+sparsevec_isspace(char ch)
+{
+	if (ch == ' ' ||
+		ch == '\t' ||
+		ch == '\n' ||
+		ch == '\r' ||
+		ch == '\v' ||
+		ch == '\f')
+		return true;
+	return false;
+}
+
+/*
+ * Compare input elements by index
+ */
+static int
+CompareInputElements(const void *a, const void *b)
+{
+	int32		ai = ((const SparseInputElement *) a)->index;
+	int32		bi = ((const SparseInputElement *) b)->index;
+
+	if (ai < bi)
+		return -1;
+
+	if (ai > bi)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Parse an integer for sparsevec input
+ */
+static int32
+ParseInt32(char *str, char **end, char *lit)
+{
+	long		value;
+
+	errno = 0;
+	value = strtol(str, end, 10);
+
+	if (*end == str)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+
+	if (errno == ERANGE || value < INT_MIN || value > INT_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("\"%s\" is out of range for type sparsevec", lit)));
+
+	return (int32) value;
+}
+
+/*
+ * Convert textual representation to internal representation
+ *
+ * The format is {index:value,...}/dimensions with one-based indices
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_in);
+Datum
+sparsevec_in(PG_FUNCTION_ARGS)
+{
+	char	   *lit = PG_GETARG_CSTRING(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	char	   *str = lit;
+	char	   *stringEnd;
+	SparseInputElement *elements;
+	int			maxElements = 16;
+	int			n = 0;
+	int			nnz = 0;
+	int32		dim;
+	SparseVector *result;
+	float	   *rvalues;
+
+	elements = palloc(sizeof(SparseInputElement) * maxElements);
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '{')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Vector contents must start with \"{\".")));
+
+	str++;
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '}')
+	{
+		for (;;)
+		{
+			int32		index;
+			float		value;
+
+			if (n == SPARSEVEC_MAX_NNZ)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("sparsevec cannot have more than %d non-zero elements", SPARSEVEC_MAX_NNZ)));
+
+			while (sparsevec_isspace(*str))
+				str++;
+
+			index = ParseInt32(str, &stringEnd, lit);
+			str = stringEnd;
+
+			while (sparsevec_isspace(*str))
+				str++;
+
+			if (*str != ':')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+
+			str++;
+
+			while (sparsevec_isspace(*str))
+				str++;
+
+			/* Use strtof like float4in to avoid a double-rounding problem */
+			value = strtof(str, &stringEnd);
+
+			if (stringEnd == str)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+
+			CheckElement(value);
+			str = stringEnd;
+
+			if (n == maxElements)
+			{
+				maxElements *= 2;
+				elements = repalloc(elements, sizeof(SparseInputElement) * maxElements);
+			}
+
+			/* Convert to zero-based (non-positive indices are out of bounds) */
+			elements[n].index = index > 0 ? index - 1 : -1;
+			elements[n].value = value;
+			n++;
+
+			while (sparsevec_isspace(*str))
+				str++;
+
+			if (*str == ',')
+				str++;
+			else if (*str == '}')
+				break;
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+		}
+	}
+
+	/* Skip closing brace */
+	str++;
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '/')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Unexpected end of input.")));
+
+	str++;
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	dim = ParseInt32(str, &stringEnd, lit);
+	str = stringEnd;
+
+	/* Only whitespace is allowed after the dimensions */
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '\0')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Junk after dimensions.")));
+
+	CheckDim(dim);
+	CheckExpectedDim(typmod, dim);
+
+	/* Allow any order in text, but store in ascending order */
+	qsort(elements, n, sizeof(SparseInputElement), CompareInputElements);
+
+	for (int i = 0; i < n; i++)
+	{
+		CheckIndex(elements[i].index, i > 0 ? elements[i - 1].index : -1, dim);
+
+		if (elements[i].value != 0)
+			nnz++;
+	}
+
+	result = InitSparseVector(dim, nnz);
+	rvalues = SPARSEVEC_VALUES(result);
+
+	/* Zeros are not stored */
+	for (int i = 0, j = 0; i < n; i++)
+	{
+		if (elements[i].value == 0)
+			continue;
+
+		result->indices[j] = elements[i].index;
+		rvalues[j] = elements[i].value;
+		j++;
+	}
+
+	pfree(elements);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to textual representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_out);
+Datum
+sparsevec_out(PG_FUNCTION_ARGS)
+{
+	SparseVector *svec = PG_GETARG_SPARSEVEC_P(0);
+	float	   *values = SPARSEVEC_VALUES(svec);
+	StringInfoData buf;
+	char		floatbuf[FLOAT_SHORTEST_DECIMAL_LEN];
+
+	initStringInfo(&buf);
+	appendStringInfoChar(&buf, '{');
+
+	for (int i = 0; i < svec->nnz; i++)
+	{
+		if (i > 0)
+			appendStringInfoChar(&buf, ',');
+
+		float_to_shortest_decimal_buf(values[i], floatbuf);
+
+		/* Output one-based indices */
+		appendStringInfo(&buf, "%d:%s", svec->indices[i] + 1, floatbuf);
+	}
+
+	appendStringInfo(&buf, "}/%d", svec->dim);
+
+	PG_FREE_IF_COPY(svec, 0);
+	PG_RETURN_CSTRING(buf.data);
+}
+
+/*
+ * Convert type modifier
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_typmod_in);
+Datum
+sparsevec_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType  *ta = PG_GETARG_ARRAYTYPE_P(0);
+	int32	   *tl;
+	int			n;
+
+	tl = ArrayGetIntegerTypmods(ta, &n);
+
+	if (n != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid type modifier")));
+
+	if (*tl < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type sparsevec must be at least 1")));
+
+	if (*tl > SPARSEVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type sparsevec cannot exceed %d", SPARSEVEC_MAX_DIM)));
+
+	PG_RETURN_INT32(*tl);
+}
+
+/*
+ * Convert external binary representation to internal representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_recv);
+Datum
+sparsevec_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	SparseVector *result;
+	float	   *values;
+	int32		dim;
+	int32		nnz;
+	int32		unused;
+
+	dim = pq_getmsgint(buf, sizeof(int32));
+	nnz = pq_getmsgint(buf, sizeof(int32));
+	unused = pq_getmsgint(buf, sizeof(int32));
+
+	CheckDim(dim);
+	CheckNnz(nnz, dim);
+	CheckExpectedDim(typmod, dim);
+
+	if (unused != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected unused to be 0, not %d", unused)));
+
+	result = InitSparseVector(dim, nnz);
+	values = SPARSEVEC_VALUES(result);
+
+	for (int i = 0; i < nnz; i++)
+	{
+		result->indices[i] = pq_getmsgint(buf, sizeof(int32));
+		CheckIndex(result->indices[i], i > 0 ? result->indices[i - 1] : -1, dim);
+	}
+
+	for (int i = 0; i < nnz; i++)
+	{
+		values[i] = pq_getmsgfloat4(buf);
+		CheckElement(values[i]);
+
+		if (values[i] == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("binary representation of sparsevec cannot contain zero values")));
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to the external binary representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_send);
+Datum
+sparsevec_send(PG_FUNCTION_ARGS)
+{
+	SparseVector *svec = PG_GETARG_SPARSEVEC_P(0);
+	float	   *values = SPARSEVEC_VALUES(svec);
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, svec->dim, sizeof(int32));
+	pq_sendint(&buf, svec->nnz, sizeof(int32));
+	pq_sendint(&buf, svec->unused, sizeof(int32));
+	for (int i = 0; i < svec->nnz; i++)
+		pq_sendint(&buf, svec->indices[i], sizeof(int32));
+	for (int i = 0; i < svec->nnz; i++)
+		pq_sendfloat4(&buf, values[i]);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Convert sparse vector to sparse vector
+ * This is needed to check the type modifier
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec);
+Datum
+sparsevec(PG_FUNCTION_ARGS)
+{
+	SparseVector *svec = PG_GETARG_SPARSEVEC_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+
+	CheckExpectedDim(typmod, svec->dim);
+
+	PG_RETURN_POINTER(svec);
+}
+
+/*
+ * Convert vector to sparse vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_to_sparsevec);
+Datum
+vector_to_sparsevec(PG_FUNCTION_ARGS)
+{
+	Vector	   *vec = PG_GETARG_VECTOR_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+	SparseVector *result;
+	float	   *values;
+	int			nnz = 0;
+	int			j = 0;
+
+	CheckDim(vec->dim);
+	CheckExpectedDim(typmod, vec->dim);
+
+	for (int i = 0; i < vec->dim; i++)
+	{
+		if (vec->x[i] != 0)
+			nnz++;
+	}
+
+	result = InitSparseVector(vec->dim, nnz);
+	values = SPARSEVEC_VALUES(result);
+
+	for (int i = 0; i < vec->dim; i++)
+	{
+		if (vec->x[i] != 0)
+		{
+			result->indices[j] = i;
+			values[j] = vec->x[i];
+			j++;
+		}
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert sparse vector to vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_to_vector);
+Datum
+sparsevec_to_vector(PG_FUNCTION_ARGS)
+{
+	SparseVector *svec = PG_GETARG_SPARSEVEC_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+	float	   *values = SPARSEVEC_VALUES(svec);
+	Vector	   *result;
+
+	if (svec->dim > VECTOR_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("vector cannot have more than %d dimensions", VECTOR_MAX_DIM)));
+
+	CheckExpectedDim(typmod, svec->dim);
+
+	result = InitVector(svec->dim);
+
+	for (int i = 0; i < svec->nnz; i++)
+		result->x[svec->indices[i]] = values[i];
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Get the inner product of two sparse vectors
+ *
+ * Both index arrays are sorted, so this is a merge
+ */
+float
+SparsevecInnerProduct(SparseVector * a, SparseVector * b)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	float		distance = 0.0;
+	int			i = 0;
+	int			j = 0;
+
+	while (i < a->nnz && j < b->nnz)
+	{
+		int32		ai = a->indices[i];
+		int32		bj = b->indices[j];
+
+		if (ai == bj)
+		{
+			distance += ax[i] * bx[j];
+			i++;
+			j++;
+		}
+		else if (ai < bj)
+			i++;
+		else
+			j++;
+	}
+
+	return distance;
+}
+
+/*
+ * Get the L2 squared distance between sparse vectors
+ */
+static float
+SparsevecL2SquaredDistance(SparseVector * a, SparseVector * b)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	float		distance = 0.0;
+	int			i = 0;
+	int			j = 0;
+
+	while (i < a->nnz || j < b->nnz)
+	{
+		int32		ai = i < a->nnz ? a->indices[i] : INT_MAX;
+		int32		bj = j < b->nnz ? b->indices[j] : INT_MAX;
+		float		diff;
+
+		if (ai == bj)
+			diff = ax[i++] - bx[j++];
+		else if (ai < bj)
+			diff = ax[i++];
+		else
+			diff = bx[j++];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+/*
+ * Get the L2 distance between sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_distance);
+Datum
+sparsevec_l2_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(sqrt((double) SparsevecL2SquaredDistance(a, b)));
+}
+
+/*
+ * Get the L2 squared distance between sparse vectors
+ * This saves a sqrt calculation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_squared_distance);
+Datum
+sparsevec_l2_squared_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8((double) SparsevecL2SquaredDistance(a, b));
+}
+
+/*
+ * Get the inner product of two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_inner_product);
+Datum
+sparsevec_inner_product(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8((double) SparsevecInnerProduct(a, b));
+}
+
+/*
+ * Get the negative inner product of two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_negative_inner_product);
+Datum
+sparsevec_negative_inner_product(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8((double) SparsevecInnerProduct(a, b) * -1);
+}
+
+/*
+ * Get the squared L2 norm of a sparse vector
+ */
+static double
+SparsevecSquaredNorm(SparseVector * a)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	double		norm = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < a->nnz; i++)
+		norm += (double) ax[i] * (double) ax[i];
+
+	return norm;
+}
+
+/*
+ * Get the cosine distance between two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_cosine_distance);
+Datum
+sparsevec_cosine_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+	double		similarity;
+
+	CheckDims(a, b);
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	similarity = (double) SparsevecInnerProduct(a, b) / sqrt(SparsevecSquaredNorm(a) * SparsevecSquaredNorm(b));
+
+#ifdef _MSC_VER
+	/* /fp:fast may not propagate NaN */
+	if (isnan(similarity))
+		PG_RETURN_FLOAT8(NAN);
+#endif
+
+	/* Keep in range */
+	if (similarity > 1)
+		similarity = 1.0;
+	else if (similarity < -1)
+		similarity = -1.0;
+
+	PG_RETURN_FLOAT8(1.0 - similarity);
+}
+
+/*
+ * Get the L1 distance between two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l1_distance);
+Datum
+sparsevec_l1_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	float		distance = 0.0;
+	int			i = 0;
+	int			j = 0;
+
+	CheckDims(a, b);
+
+	while (i < a->nnz || j < b->nnz)
+	{
+		int32		ai = i < a->nnz ? a->indices[i] : INT_MAX;
+		int32		bj = j < b->nnz ? b->indices[j] : INT_MAX;
+
+		if (ai == bj)
+			distance += fabsf(ax[i++] - bx[j++]);
+		else if (ai < bj)
+			distance += fabsf(ax[i++]);
+		else
+			distance += fabsf(bx[j++]);
+	}
+
+	PG_RETURN_FLOAT8((double) distance);
+}
+
+/*
+ * Get the dimensions of a sparse vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_vector_dims);
+Datum
+sparsevec_vector_dims(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+
+	PG_RETURN_INT32(a->dim);
+}
+
+/*
+ * Get the L2 norm of a sparse vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_norm);
+Datum
+sparsevec_l2_norm(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+
+	PG_RETURN_FLOAT8(sqrt(SparsevecSquaredNorm(a)));
+}
+
+/*
+ * Normalize a sparse vector with the L2 norm
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_normalize);
+Datum
+sparsevec_l2_normalize(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	float	   *ax = SPARSEVEC_VALUES(a);
+	double		norm = sqrt(SparsevecSquaredNorm(a));
+	SparseVector *result;
+	float	   *rx;
+	int			nnz = 0;
+	int			j = 0;
+
+	/* Return zero vector for zero norm */
+	if (norm == 0)
+		PG_RETURN_POINTER(InitSparseVector(a->dim, 0));
+
+	/* Small elements can underflow to zero, which are not stored */
+	for (int i = 0; i < a->nnz; i++)
+	{
+		if ((float) (ax[i] / norm) != 0)
+			nnz++;
+	}
+
+	result = InitSparseVector(a->dim, nnz);
+	rx = SPARSEVEC_VALUES(result);
+
+	for (int i = 0; i < a->nnz; i++)
+	{
+		float		value = ax[i] / norm;
+
+		if (value != 0)
+		{
+			result->indices[j] = a->indices[i];
+			rx[j] = value;
+			j++;
+		}
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Internal helper to compare sparse vectors
+ *
+ * Compares like the equivalent dense vectors
+ */
+static int
+sparsevec_cmp_internal(SparseVector * a, SparseVector * b)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	int			dim = Min(a->dim, b->dim);
+	int			i = 0;
+	int			j = 0;
+
+	/* Check values before dimensions to be consistent with Postgres arrays */
+	for (;;)
+	{
+		int32		ai = i < a->nnz ? a->indices[i] : INT_MAX;
+		int32		bj = j < b->nnz ? b->indices[j] : INT_MAX;
+		float		av = 0;
+		float		bv = 0;
+
+		if (Min(ai, bj) >= dim)
+			break;
+
+		if (ai <= bj)
+			av = ax[i++];
+		if (bj <= ai)
+			bv = bx[j++];
+
+		if (av < bv)
+			return -1;
+
+		if (av > bv)
+			return 1;
+	}
+
+	if (a->dim < b->dim)
+		return -1;
+
+	if (a->dim > b->dim)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Less than
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_lt);
+Datum
+sparsevec_lt(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) < 0);
+}
+
+/*
+ * Less than or equal
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_le);
+Datum
+sparsevec_le(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) <= 0);
+}
+
+/*
+ * Equal
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_eq);
+Datum
+sparsevec_eq(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) == 0);
+}
+
+/*
+ * Not equal
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_ne);
+Datum
+sparsevec_ne(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) != 0);
+}
+
+/*
+ * Greater than or equal
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_ge);
+Datum
+sparsevec_ge(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) >= 0);
+}
+
+/*
+ * Greater than
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_gt);
+Datum
+sparsevec_gt(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_BOOL(sparsevec_cmp_internal(a, b) > 0);
+}
+
+/*
+ * Compare sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_cmp);
+Datum
+sparsevec_cmp(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	PG_RETURN_INT32(sparsevec_cmp_internal(a, b));
+}
@@ -0,0 +1,26 @@
+#ifndef SPARSEVEC_H
+#define SPARSEVEC_H
+
+#define SPARSEVEC_MAX_DIM 1000000000
+#define SPARSEVEC_MAX_NNZ 16000
+
+/* Indices are followed by values */
+#define SPARSEVEC_VALUES(x)		((float *) (((char *) (x)) + offsetof(SparseVector, indices) + (x)->nnz * sizeof(int32)))
+#define SPARSEVEC_SIZE(_nnz)	(offsetof(SparseVector, indices) + (_nnz) * (sizeof(int32) + sizeof(float)))
+#define DatumGetSparseVector(x)	((SparseVector *) PG_DETOAST_DATUM(x))
+#define PG_GETARG_SPARSEVEC_P(x)	DatumGetSparseVector(PG_GETARG_DATUM(x))
+#define PG_RETURN_SPARSEVEC_P(x)	PG_RETURN_POINTER(x)
+
+typedef struct SparseVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int32		dim;			/* number of dimensions */
+	int32		nnz;			/* number of non-zero elements */
+	int32		unused;
+	int32		indices[FLEXIBLE_ARRAY_MEMBER];	/* zero-based and ascending */
+}			SparseVector;
+
+SparseVector *InitSparseVector(int dim, int nnz);
+float		SparsevecInnerProduct(SparseVector * a, SparseVector * b);
+
+#endif
@@ -0,0 +1,633 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "vectorutils.h"
+
+#ifdef USE_DISPATCH
+#include <immintrin.h>
+
+#if defined(USE__GET_CPUID)
+#include <cpuid.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#define TARGET_AVX512F
+#else
+#define TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#define TARGET_AVX512F __attribute__((target("avx512f")))
+#endif
+#endif
+
+#ifdef USE_NEON
+#include <arm_neon.h>
+#endif
+
+/* Support functions that have a matching kernel */
+PGDLLEXPORT Datum vector_l2_squared_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum vector_negative_inner_product(PG_FUNCTION_ARGS);
+
+float		(*VectorL2SquaredDistance) (const float *ax, const float *bx, int dim);
+float		(*VectorInnerProduct) (const float *ax, const float *bx, int dim);
+double		(*VectorCosineSimilarity) (const float *ax, const float *bx, int dim);
+float		(*VectorL1Distance) (const float *ax, const float *bx, int dim);
+
+static int	cpu_features = 0;
+
+static float
+VectorL2SquaredDistanceDefault(const float *ax, const float *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		float		diff = ax[i] - bx[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static float
+VectorInnerProductDefault(const float *ax, const float *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += ax[i] * bx[i];
+
+	return distance;
+}
+
+static double
+VectorCosineSimilarityDefault(const float *ax, const float *bx, int dim)
+{
+	float		similarity = 0.0;
+	float		norma = 0.0;
+	float		normb = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		similarity += ax[i] * bx[i];
+		norma += ax[i] * ax[i];
+		normb += bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+static float
+VectorL1DistanceDefault(const float *ax, const float *bx, int dim)
+{
+	float		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += fabsf(ax[i] - bx[i]);
+
+	return distance;
+}
+
+#ifdef USE_DISPATCH
+TARGET_AVX2 static inline float
+HorizontalSumAvx2(__m256 v)
+{
+	__m128		sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX2 static float
+VectorL2SquaredDistanceAvx2(const float *ax, const float *bx, int dim)
+{
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256		diff0 = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+		__m256		diff1 = _mm256_sub_ps(_mm256_loadu_ps(ax + i + 8), _mm256_loadu_ps(bx + i + 8));
+
+		dist0 = _mm256_fmadd_ps(diff0, diff0, dist0);
+		dist1 = _mm256_fmadd_ps(diff1, diff1, dist1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+
+		dist0 = _mm256_fmadd_ps(diff, diff, dist0);
+	}
+
+	distance = HorizontalSumAvx2(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+	{
+		float		diff = ax[i] - bx[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+TARGET_AVX2 static float
+VectorInnerProductAvx2(const float *ax, const float *bx, int dim)
+{
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 16 <= dim; i += 16)
+	{
+		dist0 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i), dist0);
+		dist1 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i + 8), _mm256_loadu_ps(bx + i + 8), dist1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+		dist0 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i), dist0);
+
+	distance = HorizontalSumAvx2(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += ax[i] * bx[i];
+
+	return distance;
+}
+
+TARGET_AVX2 static double
+VectorCosineSimilarityAvx2(const float *ax, const float *bx, int dim)
+{
+	__m256		sim = _mm256_setzero_ps();
+	__m256		na = _mm256_setzero_ps();
+	__m256		nb = _mm256_setzero_ps();
+	float		similarity;
+	float		norma;
+	float		normb;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		a = _mm256_loadu_ps(ax + i);
+		__m256		b = _mm256_loadu_ps(bx + i);
+
+		sim = _mm256_fmadd_ps(a, b, sim);
+		na = _mm256_fmadd_ps(a, a, na);
+		nb = _mm256_fmadd_ps(b, b, nb);
+	}
+
+	similarity = HorizontalSumAvx2(sim);
+	norma = HorizontalSumAvx2(na);
+	normb = HorizontalSumAvx2(nb);
+
+	for (; i < dim; i++)
+	{
+		similarity += ax[i] * bx[i];
+		norma += ax[i] * ax[i];
+		normb += bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+TARGET_AVX2 static float
+VectorL1DistanceAvx2(const float *ax, const float *bx, int dim)
+{
+	__m256		signMask = _mm256_set1_ps(-0.0f);
+	__m256		dist0 = _mm256_setzero_ps();
+	__m256		dist1 = _mm256_setzero_ps();
+	float		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m256		diff0 = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+		__m256		diff1 = _mm256_sub_ps(_mm256_loadu_ps(ax + i + 8), _mm256_loadu_ps(bx + i + 8));
+
+		dist0 = _mm256_add_ps(dist0, _mm256_andnot_ps(signMask, diff0));
+		dist1 = _mm256_add_ps(dist1, _mm256_andnot_ps(signMask, diff1));
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+
+		dist0 = _mm256_add_ps(dist0, _mm256_andnot_ps(signMask, diff));
+	}
+
+	distance = HorizontalSumAvx2(_mm256_add_ps(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += fabsf(ax[i] - bx[i]);
+
+	return distance;
+}
+
+TARGET_AVX512F static float
+VectorL2SquaredDistanceAvx512(const float *ax, const float *bx, int dim)
+{
+	__m512		dist = _mm512_setzero_ps();
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m512		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i));
+
+		dist = _mm512_fmadd_ps(diff, diff, dist);
+	}
+
+	/* Masked loads do not touch memory past the end */
+	if (i < dim)
+	{
+		__mmask16	mask = (__mmask16) ((1 << (dim - i)) - 1);
+		__m512		diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ax + i), _mm512_maskz_loadu_ps(mask, bx + i));
+
+		dist = _mm512_fmadd_ps(diff, diff, dist);
+	}
+
+	return _mm512_reduce_add_ps(dist);
+}
+
+TARGET_AVX512F static float
+VectorInnerProductAvx512(const float *ax, const float *bx, int dim)
+{
+	__m512		dist = _mm512_setzero_ps();
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+		dist = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i), dist);
+
+	/* Masked loads do not touch memory past the end */
+	if (i < dim)
+	{
+		__mmask16	mask = (__mmask16) ((1 << (dim - i)) - 1);
+
+		dist = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, ax + i), _mm512_maskz_loadu_ps(mask, bx + i), dist);
+	}
+
+	return _mm512_reduce_add_ps(dist);
+}
+
+TARGET_AVX512F static double
+VectorCosineSimilarityAvx512(const float *ax, const float *bx, int dim)
+{
+	__m512		sim = _mm512_setzero_ps();
+	__m512		na = _mm512_setzero_ps();
+	__m512		nb = _mm512_setzero_ps();
+	float		similarity;
+	float		norma;
+	float		normb;
+	int			i = 0;
+
+	for (; i < dim; i += 16)
+	{
+		/* Masked loads do not touch memory past the end */
+		__mmask16	mask = dim - i >= 16 ? (__mmask16) 0xFFFF : (__mmask16) ((1 << (dim - i)) - 1);
+		__m512		a = _mm512_maskz_loadu_ps(mask, ax + i);
+		__m512		b = _mm512_maskz_loadu_ps(mask, bx + i);
+
+		sim = _mm512_fmadd_ps(a, b, sim);
+		na = _mm512_fmadd_ps(a, a, na);
+		nb = _mm512_fmadd_ps(b, b, nb);
+	}
+
+	similarity = _mm512_reduce_add_ps(sim);
+	norma = _mm512_reduce_add_ps(na);
+	normb = _mm512_reduce_add_ps(nb);
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+TARGET_AVX512F static float
+VectorL1DistanceAvx512(const float *ax, const float *bx, int dim)
+{
+	__m512		dist = _mm512_setzero_ps();
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		__m512		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i));
+
+		dist = _mm512_add_ps(dist, _mm512_abs_ps(diff));
+	}
+
+	/* Masked loads do not touch memory past the end */
+	if (i < dim)
+	{
+		__mmask16	mask = (__mmask16) ((1 << (dim - i)) - 1);
+		__m512		diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ax + i), _mm512_maskz_loadu_ps(mask, bx + i));
+
+		dist = _mm512_add_ps(dist, _mm512_abs_ps(diff));
+	}
+
+	return _mm512_reduce_add_ps(dist);
+}
+
+#define CPUID_1_ECX_FMA		(1 << 12)
+#define CPUID_1_ECX_POPCNT	(1 << 23)
+#define CPUID_1_ECX_OSXSAVE	(1 << 27)
+#define CPUID_1_ECX_AVX		(1 << 28)
+#define CPUID_1_ECX_F16C	(1 << 29)
+#define CPUID_7_EBX_AVX2	(1 << 5)
+#define CPUID_7_EBX_AVX512F	(1 << 16)
+#define CPUID_7_EBX_AVX512BW	(1 << 30)
+#define CPUID_7_ECX_AVX512VNNI	(1 << 11)
+#define CPUID_7_ECX_AVX512VPOPCNTDQ	(1 << 14)
+
+/* XMM and YMM state */
+#define XCR0_AVX			0x06
+/* XMM, YMM, opmask, and ZMM state */
+#define XCR0_AVX512			0xE6
+
+/*
+ * Run the CPUID instruction
+ */
+static void
+Cpuid(unsigned int leaf, unsigned int subleaf, unsigned int exx[4])
+{
+#if defined(USE__GET_CPUID)
+	__get_cpuid_count(leaf, subleaf, &exx[0], &exx[1], &exx[2], &exx[3]);
+#elif defined(_MSC_VER)
+	__cpuidex((int *) exx, leaf, subleaf);
+#endif
+}
+
+/*
+ * Get the extended control register enabled by the OS
+ */
+static uint64
+Xgetbv(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32		eax;
+	uint32		edx;
+
+	/* Use inline assembly so it does not require the xsave target */
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64) edx << 32) | eax;
+#endif
+}
+
+/*
+ * Detect CPU features
+ */
+static int
+GetCpuFeatures(void)
+{
+	unsigned int exx1[4] = {0, 0, 0, 0};
+	unsigned int exx7[4] = {0, 0, 0, 0};
+	uint64		xcr0;
+	int			features = 0;
+
+	Cpuid(1, 0, exx1);
+
+	/* Does not use any extended registers */
+	if ((exx1[2] & CPUID_1_ECX_POPCNT) == CPUID_1_ECX_POPCNT)
+		features |= CPU_FEATURE_POPCNT;
+
+	/* Check OS supports XSAVE */
+	if ((exx1[2] & CPUID_1_ECX_OSXSAVE) != CPUID_1_ECX_OSXSAVE)
+		return features;
+
+	xcr0 = Xgetbv();
+
+	/* Check XMM and YMM registers are enabled */
+	if ((xcr0 & XCR0_AVX) != XCR0_AVX || (exx1[2] & CPUID_1_ECX_AVX) != CPUID_1_ECX_AVX)
+		return features;
+
+	Cpuid(7, 0, exx7);
+
+	if ((exx1[2] & CPUID_1_ECX_FMA) == CPUID_1_ECX_FMA)
+		features |= CPU_FEATURE_FMA;
+
+	if ((exx1[2] & CPUID_1_ECX_F16C) == CPUID_1_ECX_F16C)
+		features |= CPU_FEATURE_F16C;
+
+	if ((exx7[1] & CPUID_7_EBX_AVX2) == CPUID_7_EBX_AVX2)
+		features |= CPU_FEATURE_AVX2;
+
+	/* Also check opmask and ZMM registers are enabled */
+	if ((xcr0 & XCR0_AVX512) == XCR0_AVX512 && (exx7[1] & CPUID_7_EBX_AVX512F) == CPUID_7_EBX_AVX512F)
+	{
+		features |= CPU_FEATURE_AVX512F;
+
+		if ((exx7[2] & CPUID_7_ECX_AVX512VPOPCNTDQ) == CPUID_7_ECX_AVX512VPOPCNTDQ)
+			features |= CPU_FEATURE_AVX512VPOPCNTDQ;
+
+		if ((exx7[1] & CPUID_7_EBX_AVX512BW) == CPUID_7_EBX_AVX512BW)
+			features |= CPU_FEATURE_AVX512BW;
+
+		if ((exx7[2] & CPUID_7_ECX_AVX512VNNI) == CPUID_7_ECX_AVX512VNNI)
+			features |= CPU_FEATURE_AVX512VNNI;
+	}
+
+	return features;
+}
+#endif
+
+#ifdef USE_NEON
+static float
+VectorL2SquaredDistanceNeon(const float *ax, const float *bx, int dim)
+{
+	float32x4_t dist0 = vdupq_n_f32(0.0f);
+	float32x4_t dist1 = vdupq_n_f32(0.0f);
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 8 <= dim; i += 8)
+	{
+		float32x4_t diff0 = vsubq_f32(vld1q_f32(ax + i), vld1q_f32(bx + i));
+		float32x4_t diff1 = vsubq_f32(vld1q_f32(ax + i + 4), vld1q_f32(bx + i + 4));
+
+		dist0 = vfmaq_f32(dist0, diff0, diff0);
+		dist1 = vfmaq_f32(dist1, diff1, diff1);
+	}
+
+	distance = vaddvq_f32(vaddq_f32(dist0, dist1));
+
+	for (; i < dim; i++)
+	{
+		float		diff = ax[i] - bx[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static float
+VectorInnerProductNeon(const float *ax, const float *bx, int dim)
+{
+	float32x4_t dist0 = vdupq_n_f32(0.0f);
+	float32x4_t dist1 = vdupq_n_f32(0.0f);
+	float		distance;
+	int			i = 0;
+
+	/* Use two accumulators to hide FMA latency */
+	for (; i + 8 <= dim; i += 8)
+	{
+		dist0 = vfmaq_f32(dist0, vld1q_f32(ax + i), vld1q_f32(bx + i));
+		dist1 = vfmaq_f32(dist1, vld1q_f32(ax + i + 4), vld1q_f32(bx + i + 4));
+	}
+
+	distance = vaddvq_f32(vaddq_f32(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += ax[i] * bx[i];
+
+	return distance;
+}
+
+static double
+VectorCosineSimilarityNeon(const float *ax, const float *bx, int dim)
+{
+	float32x4_t sim = vdupq_n_f32(0.0f);
+	float32x4_t na = vdupq_n_f32(0.0f);
+	float32x4_t nb = vdupq_n_f32(0.0f);
+	float		similarity;
+	float		norma;
+	float		normb;
+	int			i = 0;
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		float32x4_t a = vld1q_f32(ax + i);
+		float32x4_t b = vld1q_f32(bx + i);
+
+		sim = vfmaq_f32(sim, a, b);
+		na = vfmaq_f32(na, a, a);
+		nb = vfmaq_f32(nb, b, b);
+	}
+
+	similarity = vaddvq_f32(sim);
+	norma = vaddvq_f32(na);
+	normb = vaddvq_f32(nb);
+
+	for (; i < dim; i++)
+	{
+		similarity += ax[i] * bx[i];
+		norma += ax[i] * ax[i];
+		normb += bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return (double) similarity / sqrt((double) norma * (double) normb);
+}
+
+static float
+VectorL1DistanceNeon(const float *ax, const float *bx, int dim)
+{
+	float32x4_t dist0 = vdupq_n_f32(0.0f);
+	float32x4_t dist1 = vdupq_n_f32(0.0f);
+	float		distance;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		dist0 = vaddq_f32(dist0, vabdq_f32(vld1q_f32(ax + i), vld1q_f32(bx + i)));
+		dist1 = vaddq_f32(dist1, vabdq_f32(vld1q_f32(ax + i + 4), vld1q_f32(bx + i + 4)));
+	}
+
+	distance = vaddvq_f32(vaddq_f32(dist0, dist1));
+
+	for (; i < dim; i++)
+		distance += fabsf(ax[i] - bx[i]);
+
+	return distance;
+}
+#endif
+
+/*
+ * Get the negative inner product
+ */
+static float
+VectorNegativeInnerProduct(const float *ax, const float *bx, int dim)
+{
+	return -VectorInnerProduct(ax, bx, dim);
+}
+
+/*
+ * Get the kernel for a distance support function
+ *
+ * Returns NULL if there is no kernel, in which case callers should use the
+ * support function
+ */
+VectorDistanceFunc
+VectorGetDistanceFunc(FmgrInfo *procinfo)
+{
+	if (procinfo->fn_addr == vector_l2_squared_distance)
+		return VectorL2SquaredDistance;
+
+	if (procinfo->fn_addr == vector_negative_inner_product)
+		return VectorNegativeInnerProduct;
+
+	return NULL;
+}
+
+/*
+ * Check if the CPU supports all of the given features
+ */
+bool
+SupportsCpuFeature(int feature)
+{
+	return (cpu_features & feature) == feature;
+}
+
+/*
+ * Choose the distance functions for the CPU
+ *
+ * This is done once when the library is loaded, so the extension can be
+ * compiled for a baseline architecture and still use wider instructions
+ */
+void
+VectorInit(void)
+{
+	VectorL2SquaredDistance = VectorL2SquaredDistanceDefault;
+	VectorInnerProduct = VectorInnerProductDefault;
+	VectorCosineSimilarity = VectorCosineSimilarityDefault;
+	VectorL1Distance = VectorL1DistanceDefault;
+
+#ifdef USE_DISPATCH
+	cpu_features = GetCpuFeatures();
+
+	if (SupportsCpuFeature(CPU_FEATURE_AVX512F))
+	{
+		VectorL2SquaredDistance = VectorL2SquaredDistanceAvx512;
+		VectorInnerProduct = VectorInnerProductAvx512;
+		VectorCosineSimilarity = VectorCosineSimilarityAvx512;
+		VectorL1Distance = VectorL1DistanceAvx512;
+	}
+	else if (SupportsCpuFeature(CPU_FEATURE_AVX2 | CPU_FEATURE_FMA))
+	{
+		VectorL2SquaredDistance = VectorL2SquaredDistanceAvx2;
+		VectorInnerProduct = VectorInnerProductAvx2;
+		VectorCosineSimilarity = VectorCosineSimilarityAvx2;
+		VectorL1Distance = VectorL1DistanceAvx2;
+	}
+#elif defined(USE_NEON)
+	VectorL2SquaredDistance = VectorL2SquaredDistanceNeon;
+	VectorInnerProduct = VectorInnerProductNeon;
+	VectorCosineSimilarity = VectorCosineSimilarityNeon;
+	VectorL1Distance = VectorL1DistanceNeon;
+#endif
+}
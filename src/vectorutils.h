@@ -0,0 +1,75 @@
+#ifndef VECTORUTILS_H
+#define VECTORUTILS_H
+
+#include "fmgr.h"
+#include "vector.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+/* Use intrinsics with runtime dispatch on x86-64 */
+#ifndef DISABLE_DISPATCH
+/* Only enable for more recent compilers to keep build process simple */
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 9
+#define USE_DISPATCH
+#elif defined(__x86_64__) && defined(__clang_major__) && __clang_major__ >= 7
+#define USE_DISPATCH
+#elif defined(_M_AMD64) && defined(_MSC_VER) && _MSC_VER >= 1920
+#define USE_DISPATCH
+#endif
+#endif
+
+/* Apple clang check needed for universal binaries on Mac */
+#if defined(USE_DISPATCH) && (defined(HAVE__GET_CPUID) || defined(__apple_build_version__))
+#define USE__GET_CPUID
+#endif
+
+/* NEON is part of the base instruction set for AArch64 */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON
+#endif
+
+/* CPU features */
+#define CPU_FEATURE_AVX2		(1 << 0)
+#define CPU_FEATURE_FMA			(1 << 1)
+#define CPU_FEATURE_AVX512F		(1 << 2)
+#define CPU_FEATURE_F16C		(1 << 3)
+#define CPU_FEATURE_POPCNT		(1 << 4)
+#define CPU_FEATURE_AVX512VPOPCNTDQ	(1 << 5)
+#define CPU_FEATURE_AVX512BW	(1 << 6)
+#define CPU_FEATURE_AVX512VNNI	(1 << 7)
+
+typedef float (*VectorDistanceFunc) (const float *ax, const float *bx, int dim);
+
+extern float (*VectorL2SquaredDistance) (const float *ax, const float *bx, int dim);
+extern float (*VectorInnerProduct) (const float *ax, const float *bx, int dim);
+extern double (*VectorCosineSimilarity) (const float *ax, const float *bx, int dim);
+extern float (*VectorL1Distance) (const float *ax, const float *bx, int dim);
+
+bool		SupportsCpuFeature(int feature);
+VectorDistanceFunc VectorGetDistanceFunc(FmgrInfo *procinfo);
+void		VectorInit(void);
+
+/*
+ * Get the distance between two vectors
+ *
+ * Uses the kernel directly when possible and falls back to the support
+ * function for packed values and to report different dimensions
+ */
+static inline double
+VectorDistance(VectorDistanceFunc distfunc, FmgrInfo *procinfo, Oid collation, Datum a, Datum b)
+{
+	if (distfunc != NULL)
+	{
+		Vector	   *av = (Vector *) DatumGetPointer(a);
+		Vector	   *bv = (Vector *) DatumGetPointer(b);
+
+		if (VARATT_IS_4B_U(av) && VARATT_IS_4B_U(bv) && av->dim == bv->dim)
+			return (double) distfunc(av->x, bv->x, av->dim);
+	}
+
+	return DatumGetFloat8(FunctionCall2Coll(procinfo, collation, a, b));
+}
+
+#endif
@@ -0,0 +1,22 @@
+SELECT hamming_distance(B'111', B'111');
+SELECT hamming_distance(B'111', B'110');
+SELECT hamming_distance(B'111', B'100');
+SELECT hamming_distance(B'111', B'000');
+SELECT hamming_distance(B'', B'');
+SELECT hamming_distance(B'111', B'00');
+SELECT hamming_distance(repeat('1', 1000)::bit(1000), repeat('01', 500)::bit(1000));
+SELECT B'111' <~> B'101';
+
+SELECT jaccard_distance(B'1111', B'1111');
+SELECT jaccard_distance(B'1111', B'1110');
+SELECT jaccard_distance(B'1111', B'1100');
+SELECT jaccard_distance(B'1111', B'0000');
+SELECT jaccard_distance(B'0000', B'0000');
+SELECT jaccard_distance(B'', B'');
+SELECT jaccard_distance(B'1111', B'000');
+SELECT jaccard_distance(repeat('1', 1000)::bit(1000), repeat('01', 500)::bit(1000));
+SELECT B'1010' <%> B'0110';
+
+SELECT binary_quantize('[1,0,-1]'::vector);
+SELECT binary_quantize('[0,0.1,-0.2,-0.3,0.4,0.5,0.6,-0.7,0.8,-0.9,1]'::vector);
+SELECT binary_quantize('[1,0,-1]'::halfvec);
@@ -17,36 +17,40 @@ SELECT vector_cmp('[1,2,3]', '[1,2]');
 SELECT vector_cmp('[1,2]', '[2,3,4]');
 SELECT vector_cmp('[2,3]', '[1,2,3]');
 
-SELECT vector_dims('[1,2,3]');
+SELECT vector_dims('[1,2,3]'::vector);
 
 SELECT round(vector_norm('[1,1]')::numeric, 5);
 SELECT vector_norm('[3,4]');
 SELECT vector_norm('[0,1]');
 SELECT vector_norm('[3e37,4e37]')::real;
 
-SELECT l2_distance('[0,0]', '[3,4]');
-SELECT l2_distance('[0,0]', '[0,1]');
-SELECT l2_distance('[1,2]', '[3]');
-SELECT l2_distance('[3e38]', '[-3e38]');
-
-SELECT inner_product('[1,2]', '[3,4]');
-SELECT inner_product('[1,2]', '[3]');
-SELECT inner_product('[3e38]', '[3e38]');
-
-SELECT cosine_distance('[1,2]', '[2,4]');
-SELECT cosine_distance('[1,2]', '[0,0]');
-SELECT cosine_distance('[1,1]', '[1,1]');
-SELECT cosine_distance('[1,0]', '[0,2]');
-SELECT cosine_distance('[1,1]', '[-1,-1]');
-SELECT cosine_distance('[1,2]', '[3]');
-SELECT cosine_distance('[1,1]', '[1.1,1.1]');
-SELECT cosine_distance('[1,1]', '[-1.1,-1.1]');
-SELECT cosine_distance('[3e38]', '[3e38]');
-
-SELECT l1_distance('[0,0]', '[3,4]');
-SELECT l1_distance('[0,0]', '[0,1]');
-SELECT l1_distance('[1,2]', '[3]');
-SELECT l1_distance('[3e38]', '[-3e38]');
+SELECT l2_distance('[0,0]'::vector, '[3,4]');
+SELECT l2_distance('[0,0]'::vector, '[0,1]');
+SELECT l2_distance('[1,2]'::vector, '[3]');
+SELECT l2_distance('[3e38]'::vector, '[-3e38]');
+SELECT l2_distance(array_fill(1, ARRAY[36])::vector, array_fill(0, ARRAY[36])::vector);
+
+SELECT inner_product('[1,2]'::vector, '[3,4]');
+SELECT inner_product('[1,2]'::vector, '[3]');
+SELECT inner_product('[3e38]'::vector, '[3e38]');
+SELECT inner_product(array_fill(1, ARRAY[37])::vector, array_fill(2, ARRAY[37])::vector);
+
+SELECT cosine_distance('[1,2]'::vector, '[2,4]');
+SELECT cosine_distance('[1,2]'::vector, '[0,0]');
+SELECT cosine_distance('[1,1]'::vector, '[1,1]');
+SELECT cosine_distance('[1,0]'::vector, '[0,2]');
+SELECT cosine_distance('[1,1]'::vector, '[-1,-1]');
+SELECT cosine_distance('[1,2]'::vector, '[3]');
+SELECT cosine_distance('[1,1]'::vector, '[1.1,1.1]');
+SELECT cosine_distance('[1,1]'::vector, '[-1.1,-1.1]');
+SELECT cosine_distance('[3e38]'::vector, '[3e38]');
+SELECT cosine_distance(array_fill(1, ARRAY[37])::vector, array_fill(2, ARRAY[37])::vector);
+
+SELECT l1_distance('[0,0]'::vector, '[3,4]');
+SELECT l1_distance('[0,0]'::vector, '[0,1]');
+SELECT l1_distance('[1,2]'::vector, '[3]');
+SELECT l1_distance('[3e38]'::vector, '[-3e38]');
+SELECT l1_distance(array_fill(1, ARRAY[37])::vector, array_fill(-2, ARRAY[37])::vector);
 
 SELECT avg(v) FROM unnest(ARRAY['[1,2,3]'::vector, '[3,5,7]']) v;
 SELECT avg(v) FROM unnest(ARRAY['[1,2,3]'::vector, '[3,5,7]', NULL]) v;
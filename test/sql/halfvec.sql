@@ -0,0 +1,50 @@
+SELECT '[1,2,3]'::halfvec;
+SELECT '[-1,-2,-3]'::halfvec;
+SELECT ' [ 1,  2 ,    3  ] '::halfvec;
+SELECT '[1.5,0.25]'::halfvec;
+SELECT '[65504,-65504]'::halfvec;
+SELECT '[65520,1]'::halfvec;
+SELECT '[hello,1]'::halfvec;
+SELECT '[NaN,1]'::halfvec;
+SELECT '[Infinity,1]'::halfvec;
+SELECT '[-Infinity,1]'::halfvec;
+SELECT '[]'::halfvec;
+SELECT '[1,2,3]'::halfvec(2);
+
+SELECT '[1,2,3]'::vector::halfvec;
+SELECT '[1e5]'::vector::halfvec;
+SELECT '[1,2,3]'::halfvec::vector;
+SELECT ARRAY[1,2,3]::halfvec;
+SELECT ARRAY[1.5,2.5]::float8[]::halfvec;
+SELECT '{NaN}'::real[]::halfvec;
+SELECT '[1,2,3]'::halfvec::real[];
+SELECT array_agg(n)::halfvec FROM generate_series(1, 16001) n;
+
+SELECT '[1,2,3]'::halfvec = '[1,2,3]';
+SELECT '[1,2,3]'::halfvec < '[1,2,4]';
+SELECT halfvec_cmp('[1,2,3]', '[0,0,0]');
+SELECT halfvec_cmp('[1,2]', '[1,2,3]');
+
+SELECT vector_dims('[1,2,3]'::halfvec);
+SELECT l2_norm('[3,4]'::halfvec);
+SELECT l2_normalize('[0,5]'::halfvec);
+SELECT l2_normalize('[0,0]'::halfvec);
+SELECT l2_normalize('[3,4]'::vector);
+
+SELECT l2_distance('[0,0]'::halfvec, '[3,4]');
+SELECT l2_distance('[1,2]'::halfvec, '[3]');
+SELECT l2_distance(array_fill(1, ARRAY[37])::halfvec, array_fill(0, ARRAY[37])::halfvec);
+SELECT '[0,0]'::halfvec <-> '[3,4]';
+
+SELECT inner_product('[1,2]'::halfvec, '[3,4]');
+SELECT inner_product(array_fill(1, ARRAY[37])::halfvec, array_fill(2, ARRAY[37])::halfvec);
+SELECT '[1,2]'::halfvec <#> '[3,4]';
+
+SELECT cosine_distance('[1,2]'::halfvec, '[2,4]');
+SELECT cosine_distance('[1,2]'::halfvec, '[0,0]');
+SELECT cosine_distance('[1,1]'::halfvec, '[-1,-1]');
+SELECT cosine_distance(array_fill(1, ARRAY[37])::halfvec, array_fill(2, ARRAY[37])::halfvec);
+SELECT '[1,0]'::halfvec <=> '[0,2]';
+
+SELECT l1_distance('[0,0]'::halfvec, '[3,4]');
+SELECT l1_distance(array_fill(1, ARRAY[37])::halfvec, array_fill(-2, ARRAY[37])::halfvec);
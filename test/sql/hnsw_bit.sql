@@ -0,0 +1,25 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val bit(3));
+INSERT INTO t (val) VALUES (B'000'), (B'100'), (B'111'), (NULL);
+CREATE INDEX ON t USING hnsw (val bit_hamming_ops);
+
+INSERT INTO t (val) VALUES (B'110');
+
+SELECT * FROM t ORDER BY val <~> B'111';
+SELECT * FROM t ORDER BY val <~> (SELECT NULL::bit);
+SELECT * FROM t ORDER BY val <~> B'11';
+SELECT COUNT(*) FROM t;
+
+DROP TABLE t;
+
+CREATE TABLE t (val bit(4));
+INSERT INTO t (val) VALUES (B'0000'), (B'1100'), (B'1111'), (NULL);
+CREATE INDEX ON t USING hnsw (val bit_jaccard_ops);
+
+INSERT INTO t (val) VALUES (B'1110');
+
+SELECT * FROM t ORDER BY val <%> B'1111';
+SELECT COUNT(*) FROM t;
+
+DROP TABLE t;
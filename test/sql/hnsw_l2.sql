@@ -8,8 +8,16 @@ INSERT INTO t (val) VALUES ('[1,2,4]');
 
 SELECT * FROM t ORDER BY val <-> '[3,3,3]';
 SELECT * FROM t ORDER BY val <-> (SELECT NULL::vector);
+SELECT * FROM t ORDER BY val <-> '[0,0]';
 SELECT COUNT(*) FROM t;
 
+SET hnsw.ef_search = 1;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+SET hnsw.iterative_scan = relaxed_order;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+RESET hnsw.iterative_scan;
+RESET hnsw.ef_search;
+
 TRUNCATE t;
 SELECT * FROM t ORDER BY val <-> '[3,3,3]';
 
@@ -4,10 +4,40 @@ CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (m = 101);
 CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (ef_construction = 3);
 CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (ef_construction = 1001);
 CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (m = 16, ef_construction = 31);
+CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (quantization = 'int4');
+CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (separate_neighbors = 'maybe');
 
 SHOW hnsw.ef_search;
 
 SET hnsw.ef_search = 0;
 SET hnsw.ef_search = 1001;
 
+SHOW hnsw.iterative_scan;
+
+SET hnsw.iterative_scan = on;
+
+SHOW hnsw.max_scan_tuples;
+
+SET hnsw.max_scan_tuples = 0;
+
+SHOW hnsw.upper_cache_size;
+
+SET hnsw.upper_cache_size = 0;
+
+SHOW hnsw.build_reorder;
+
+SHOW hnsw.max_build_memory;
+
+SET hnsw.max_build_memory = -2;
+
+SHOW hnsw.build_spill;
+
+SHOW hnsw.build_partitions;
+
+SET hnsw.build_partitions = -1;
+
+SHOW hnsw.pending_list_limit;
+
+SET hnsw.pending_list_limit = 32;
+
 DROP TABLE t;
@@ -0,0 +1,30 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX idx ON t USING hnsw (val vector_l2_ops) WITH (fastupdate = on);
+
+INSERT INTO t (val) VALUES ('[1,2,4]'), ('[1,1,2]'), (NULL);
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+SELECT hnsw_merge_pending('idx');
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+SELECT hnsw_merge_pending('idx');
+
+INSERT INTO t (val) VALUES ('[2,2,2]');
+
+SET hnsw.ef_search = 1;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+SET hnsw.iterative_scan = relaxed_order;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+RESET hnsw.iterative_scan;
+RESET hnsw.ef_search;
+
+VACUUM t;
+SELECT hnsw_merge_pending('idx');
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+CREATE INDEX btree_idx ON t (val);
+SELECT hnsw_merge_pending('btree_idx');
+
+DROP TABLE t;
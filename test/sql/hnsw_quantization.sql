@@ -0,0 +1,33 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX idx_l2 ON t USING hnsw (val vector_l2_ops) WITH (quantization = 'int8');
+CREATE INDEX idx_ip ON t USING hnsw (val vector_ip_ops) WITH (quantization = 'int8');
+CREATE INDEX idx_cosine ON t USING hnsw (val vector_cosine_ops) WITH (quantization = 'int8');
+
+INSERT INTO t (val) VALUES ('[1,2,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> (SELECT NULL::vector)) t2;
+SELECT * FROM t ORDER BY val <-> '[1,2]';
+SELECT * FROM t ORDER BY val <#> '[3,3,3]';
+SELECT * FROM t ORDER BY val <=> '[3,3,3]';
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <=> '[0,0,0]') t2;
+
+DELETE FROM t WHERE val = '[1,2,3]';
+VACUUM t;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+DROP TABLE t;
+
+CREATE TABLE t (val vector(3));
+CREATE INDEX ON t USING hnsw (val vector_l2_ops) WITH (quantization = 'int8');
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+INSERT INTO t (val) VALUES ('[1,2,3]'), ('[4,5,6]'), ('[-1,0,1]');
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+DROP TABLE t;
+
+CREATE TABLE t (val halfvec(3));
+CREATE INDEX ON t USING hnsw (val halfvec_l2_ops) WITH (quantization = 'int8');
+DROP TABLE t;
@@ -0,0 +1,13 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val sparsevec(3));
+INSERT INTO t (val) VALUES ('{}/3'), ('{1:1,2:2,3:3}/3'), ('{1:1,2:1,3:1}/3'), (NULL);
+CREATE INDEX ON t USING inverted (val sparsevec_cosine_ops);
+
+INSERT INTO t (val) VALUES ('{1:1,2:2,3:4}/3');
+
+SELECT * FROM t ORDER BY val <=> '{1:3,2:3,3:3}/3';
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <=> '{}/3') t2;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <=> (SELECT NULL::sparsevec)) t2;
+
+DROP TABLE t;
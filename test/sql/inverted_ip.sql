@@ -0,0 +1,25 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val sparsevec(3));
+INSERT INTO t (val) VALUES ('{}/3'), ('{1:1,2:2,3:3}/3'), ('{1:1,2:1,3:1}/3'), (NULL);
+CREATE INDEX ON t USING inverted (val sparsevec_ip_ops);
+
+INSERT INTO t (val) VALUES ('{1:1,2:2,3:4}/3');
+
+SELECT * FROM t ORDER BY val <#> '{1:3,2:3,3:3}/3';
+SELECT * FROM t ORDER BY val <#> '{2:-1}/3';
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <#> (SELECT NULL::sparsevec)) t2;
+SELECT * FROM t ORDER BY val <#> '{1:1}/4';
+
+VACUUM t;
+INSERT INTO t (val) VALUES ('{1:5}/3');
+SELECT * FROM t ORDER BY val <#> '{1:3,2:3,3:3}/3';
+
+SET inverted.top_k = 1;
+SELECT * FROM t ORDER BY val <#> '{1:3,2:3,3:3}/3';
+RESET inverted.top_k;
+
+SELECT pg_index_column_has_property('t_val_idx', 1, 'distance_orderable');
+SELECT opcname, amvalidate(oid) FROM pg_opclass WHERE opcmethod = (SELECT oid FROM pg_am WHERE amname = 'inverted') ORDER BY opcname;
+
+DROP TABLE t;
@@ -0,0 +1,14 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val bit(3));
+INSERT INTO t (val) VALUES (B'000'), (B'100'), (B'111'), (NULL);
+CREATE INDEX ON t USING ivfflat (val bit_hamming_ops) WITH (lists = 1);
+
+INSERT INTO t (val) VALUES (B'110');
+
+SELECT * FROM t ORDER BY val <~> B'111';
+SELECT * FROM t ORDER BY val <~> (SELECT NULL::bit);
+SELECT * FROM t ORDER BY val <~> B'11';
+SELECT COUNT(*) FROM t;
+
+DROP TABLE t;
@@ -8,9 +8,21 @@ INSERT INTO t (val) VALUES ('[1,2,4]');
 
 SELECT * FROM t ORDER BY val <-> '[3,3,3]';
 SELECT * FROM t ORDER BY val <-> (SELECT NULL::vector);
+SELECT * FROM t ORDER BY val <-> '[0,0]';
 SELECT COUNT(*) FROM t;
 
 TRUNCATE t;
 SELECT * FROM t ORDER BY val <-> '[3,3,3]';
 
 DROP TABLE t;
+
+CREATE TABLE t (val vector(1));
+INSERT INTO t (val) SELECT ARRAY[i] FROM generate_series(1, 10000) i;
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (lists = 1);
+
+SET work_mem = '64kB';
+SELECT * FROM t ORDER BY val <-> '[0]' LIMIT 3;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[0]') t2;
+RESET work_mem;
+
+DROP TABLE t;
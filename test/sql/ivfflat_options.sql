@@ -1,7 +1,17 @@
 CREATE TABLE t (val vector(3));
 CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (lists = 0);
 CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (lists = 32769);
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (quantization = 'int8');
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (subvectors = 2001);
 
 SHOW ivfflat.probes;
 
+SHOW ivfflat.iterative_scan;
+
+SET ivfflat.iterative_scan = on;
+
+SHOW ivfflat.max_probes;
+
+SHOW ivfflat.pq_rerank;
+
 DROP TABLE t;
@@ -0,0 +1,34 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX idx_l2 ON t USING ivfflat (val vector_l2_ops) WITH (lists = 1, quantization = 'pq', subvectors = 3);
+CREATE INDEX idx_ip ON t USING ivfflat (val vector_ip_ops) WITH (lists = 1, quantization = 'pq');
+CREATE INDEX idx_cosine ON t USING ivfflat (val vector_cosine_ops) WITH (lists = 1, quantization = 'pq');
+
+INSERT INTO t (val) VALUES ('[1,2,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+SELECT * FROM t ORDER BY val <-> (SELECT NULL::vector);
+SELECT * FROM t ORDER BY val <-> '[0,0]';
+SELECT * FROM t ORDER BY val <#> '[3,3,3]';
+SELECT * FROM t ORDER BY val <=> '[3,3,3]';
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <=> (SELECT NULL::vector)) t2;
+
+SET ivfflat.pq_rerank = 0;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+RESET ivfflat.pq_rerank;
+
+DELETE FROM t WHERE val = '[1,2,3]';
+VACUUM t;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+DROP TABLE t;
+
+CREATE TABLE t (val vector(3));
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (quantization = 'pq', subvectors = 4);
+DROP TABLE t;
+
+CREATE TABLE t (val halfvec(3));
+CREATE INDEX ON t USING ivfflat (val halfvec_l2_ops) WITH (quantization = 'pq');
+DROP TABLE t;
@@ -0,0 +1,43 @@
+SELECT '{1:1.5,3:2}/5'::sparsevec;
+SELECT ' { 3 : 2 , 1:1.5 } / 5 '::sparsevec;
+SELECT '{}/3'::sparsevec;
+SELECT '{1:0,2:1}/2'::sparsevec;
+SELECT '{1:1,1:2}/2'::sparsevec;
+SELECT '{0:1}/2'::sparsevec;
+SELECT '{3:1}/2'::sparsevec;
+SELECT '{1:1}/0'::sparsevec;
+SELECT '{1:1}'::sparsevec;
+SELECT '[1,2]'::sparsevec;
+SELECT '{1:1}/2x'::sparsevec;
+SELECT '{1:NaN}/2'::sparsevec;
+SELECT '{1:Infinity}/2'::sparsevec;
+SELECT '{1:}/2'::sparsevec;
+SELECT '{1:1}/1000000001'::sparsevec;
+SELECT '{1:1}/3'::sparsevec(2);
+
+SELECT '[0,2,0,-1]'::vector::sparsevec;
+SELECT '{2:2,4:-1}/4'::sparsevec::vector;
+SELECT '{1:1}/16001'::sparsevec::vector;
+
+SELECT '{1:1}/3'::sparsevec = '{1:1}/3';
+SELECT '{1:1}/3'::sparsevec < '{1:2}/3';
+SELECT sparsevec_cmp('{1:1}/3', '{2:1}/3');
+SELECT sparsevec_cmp('{}/3', '{}/4');
+
+SELECT vector_dims('{1:1}/3'::sparsevec);
+SELECT l2_norm('{1:3,3:4}/3'::sparsevec);
+SELECT l2_normalize('{1:3,3:4}/3'::sparsevec);
+SELECT l2_normalize('{}/3'::sparsevec);
+
+SELECT l2_distance('{}/2'::sparsevec, '{1:3,2:4}/2');
+SELECT l2_distance('{1:1}/2'::sparsevec, '{1:1}/3');
+SELECT '{1:1,2:2}/3'::sparsevec <-> '{2:2,3:1}/3';
+
+SELECT inner_product('{1:1,2:2}/3'::sparsevec, '{2:3,3:4}/3');
+SELECT '{1:1,2:2}/3'::sparsevec <#> '{2:3,3:4}/3';
+
+SELECT cosine_distance('{1:1,2:2}/2'::sparsevec, '{1:2,2:4}/2');
+SELECT cosine_distance('{1:1}/2'::sparsevec, '{}/2');
+SELECT '{1:1}/2'::sparsevec <=> '{2:2}/2';
+
+SELECT l1_distance('{1:1,2:2}/3'::sparsevec, '{2:-2,3:4}/3');
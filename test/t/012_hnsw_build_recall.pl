@@ -95,8 +95,51 @@ for my $i (0 .. $#operators)
 
 	$node->safe_psql("postgres", "DROP INDEX idx;");
 
-	# Build index in parallel in memory
+	# Build index serially with separate neighbor pages
+	$node->safe_psql("postgres", qq(
+		SET max_parallel_maintenance_workers = 0;
+		CREATE INDEX idx ON tst USING hnsw (v $opclass) WITH (separate_neighbors = on);
+	));
+
+	# Test approximate results
+	test_recall($min, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Build index serially without reordering
+	$node->safe_psql("postgres", qq(
+		SET max_parallel_maintenance_workers = 0;
+		SET hnsw.build_reorder = off;
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+	));
+
+	# Test approximate results
+	test_recall($min, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Build index serially with spill files
 	my ($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		SET max_parallel_maintenance_workers = 0;
+		SET maintenance_work_mem = '1MB';
+		SET hnsw.build_spill = on;
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+	));
+	is($ret, 0, $stderr);
+
+	# Spill files are not supported on Windows
+	if ($^O ne 'MSWin32')
+	{
+		like($stderr, qr/Building will continue using temporary files/);
+	}
+
+	# Test approximate results
+	test_recall($min, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Build index in parallel in memory
+	($ret, $stdout, $stderr) = $node->psql("postgres", qq(
 		SET client_min_messages = DEBUG;
 		SET min_parallel_table_scan_size = 1;
 		CREATE INDEX idx ON tst USING hnsw (v $opclass);
@@ -123,6 +166,25 @@ for my $i (0 .. $#operators)
 	like($stderr, qr/hnsw graph no longer fits into maintenance_work_mem/);
 
 	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Build index in parallel in memory with a separate limit
+	($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		ALTER TABLE tst SET (parallel_workers = 2);
+		SET client_min_messages = DEBUG;
+		SET maintenance_work_mem = '4MB';
+		SET hnsw.max_build_memory = '64MB';
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+		ALTER TABLE tst RESET (parallel_workers);
+	));
+	is($ret, 0, $stderr);
+	like($stderr, qr/using \d+ parallel workers/);
+	like($stderr, qr/hnsw graph estimated to use \d+ MB/);
+	unlike($stderr, qr/hnsw graph no longer fits/);
+
+	# Test approximate results
+	test_recall($min, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
 }
 
 done_testing();
@@ -0,0 +1,139 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node;
+my @queries = ();
+my @expected;
+my $limit = 20;
+my $dim = 1000;
+
+sub random_sparsevec
+{
+	my %elements;
+	for (1 .. 10)
+	{
+		$elements{int(rand($dim)) + 1} = int(rand(100)) + 1;
+	}
+	my @pairs = map { "$_:$elements{$_}" } sort { $a <=> $b } keys %elements;
+	return "{" . join(",", @pairs) . "}/$dim";
+}
+
+sub insert_rows
+{
+	my ($count, $settings) = @_;
+	$settings //= "";
+	my @values = map { "('" . random_sparsevec() . "')" } 1 .. $count;
+	$node->safe_psql("postgres", $settings . "INSERT INTO tst (v) VALUES " . join(", ", @values) . ";");
+}
+
+sub get_expected
+{
+	my ($operator) = @_;
+	@expected = ();
+	foreach (@queries)
+	{
+		my $res = $node->safe_psql("postgres", qq(
+			SET enable_indexscan = off;
+			SELECT i FROM tst ORDER BY v $operator '$_' LIMIT $limit;
+		));
+		push(@expected, $res);
+	}
+}
+
+sub test_recall
+{
+	my ($min, $operator) = @_;
+	my $correct = 0;
+	my $total = 0;
+
+	my $explain = $node->safe_psql("postgres", qq(
+		SET enable_seqscan = off;
+		EXPLAIN ANALYZE SELECT i FROM tst ORDER BY v $operator '$queries[0]' LIMIT $limit;
+	));
+	like($explain, qr/Index Scan using idx on tst/);
+
+	for my $i (0 .. $#queries)
+	{
+		my $actual = $node->safe_psql("postgres", qq(
+			SET enable_seqscan = off;
+			SELECT i FROM tst ORDER BY v $operator '$queries[$i]' LIMIT $limit;
+		));
+		my @actual_ids = split("\n", $actual);
+		my %actual_set = map { $_ => 1 } @actual_ids;
+
+		my @expected_ids = split("\n", $expected[$i]);
+
+		foreach (@expected_ids)
+		{
+			if (exists($actual_set{$_}))
+			{
+				$correct++;
+			}
+			$total++;
+		}
+	}
+
+	cmp_ok($correct / $total, ">=", $min, $operator);
+}
+
+# Initialize node
+$node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i serial, v sparsevec($dim));");
+$node->safe_psql("postgres", "ALTER TABLE tst SET (autovacuum_enabled = false);");
+
+# Generate queries
+for (1 .. 20)
+{
+	push(@queries, random_sparsevec());
+}
+
+# Check each index type
+my @operators = ("<#>", "<=>");
+my @opclasses = ("sparsevec_ip_ops", "sparsevec_cosine_ops");
+
+for my $i (0 .. $#operators)
+{
+	my $operator = $operators[$i];
+	my $opclass = $opclasses[$i];
+
+	# Add index
+	insert_rows(5000);
+	$node->safe_psql("postgres", "CREATE INDEX idx ON tst USING inverted (v $opclass);");
+
+	# Add rows to the pending list
+	insert_rows(1000);
+
+	# Delete rows from postings and the pending list
+	$node->safe_psql("postgres", "DELETE FROM tst WHERE i % 3 = 0;");
+	$node->safe_psql("postgres", "VACUUM tst;");
+
+	# Get exact results
+	get_expected($operator);
+
+	# Scans are exact within inverted.top_k, so only account for equal distances
+	test_recall(0.99, $operator);
+
+	# Merge the pending list during inserts
+	insert_rows(2000, "SET inverted.pending_list_limit = 64; ");
+	insert_rows(1000);
+
+	# Delete rows from merged postings
+	$node->safe_psql("postgres", "DELETE FROM tst WHERE i % 5 = 0;");
+	$node->safe_psql("postgres", "VACUUM tst;");
+
+	get_expected($operator);
+	test_recall(0.99, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+	$node->safe_psql("postgres", "TRUNCATE tst;");
+}
+
+done_testing();
@@ -0,0 +1,144 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node;
+my @queries = ();
+my @expected;
+my $limit = 20;
+my $dim = 8;
+
+sub test_recall
+{
+	my ($min, $rerank, $operator) = @_;
+	my $correct = 0;
+	my $total = 0;
+
+	my $explain = $node->safe_psql("postgres", qq(
+		SET enable_seqscan = off;
+		SET ivfflat.probes = 10;
+		EXPLAIN ANALYZE SELECT i FROM tst ORDER BY v $operator '$queries[0]' LIMIT $limit;
+	));
+	like($explain, qr/Index Scan/);
+
+	for my $i (0 .. $#queries)
+	{
+		my $actual = $node->safe_psql("postgres", qq(
+			SET enable_seqscan = off;
+			SET ivfflat.probes = 10;
+			SET ivfflat.pq_rerank = $rerank;
+			SELECT i FROM tst ORDER BY v $operator '$queries[$i]' LIMIT $limit;
+		));
+		my @actual_ids = split("\n", $actual);
+		my %actual_set = map { $_ => 1 } @actual_ids;
+
+		my @expected_ids = split("\n", $expected[$i]);
+
+		foreach (@expected_ids)
+		{
+			if (exists($actual_set{$_}))
+			{
+				$correct++;
+			}
+			$total++;
+		}
+	}
+
+	cmp_ok($correct / $total, ">=", $min, "$operator rerank $rerank");
+}
+
+sub get_expected
+{
+	my ($operator) = @_;
+
+	@expected = ();
+	foreach (@queries)
+	{
+		my $res = $node->safe_psql("postgres", "SELECT i FROM tst ORDER BY v $operator '$_' LIMIT $limit;");
+		push(@expected, $res);
+	}
+}
+
+# Initialize node
+$node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector($dim));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[random(), random(), random(), random(), random(), random(), random(), random()] FROM generate_series(1, 10000) i;"
+);
+
+# Generate queries
+for (1 .. 20)
+{
+	my @r = map { rand() } (1 .. $dim);
+	push(@queries, "[" . join(",", @r) . "]");
+}
+
+# Check each index type
+my @operators = ("<->", "<#>", "<=>");
+my @opclasses = ("vector_l2_ops", "vector_ip_ops", "vector_cosine_ops");
+
+for my $i (0 .. $#operators)
+{
+	my $operator = $operators[$i];
+	my $opclass = $opclasses[$i];
+	my $min = $operator eq "<#>" ? 0.80 : 0.95;
+
+	get_expected($operator);
+
+	# Build index serially
+	$node->safe_psql("postgres", qq(
+		SET max_parallel_maintenance_workers = 0;
+		CREATE INDEX idx ON tst USING ivfflat (v $opclass) WITH (lists = 10, quantization = 'pq');
+	));
+
+	# Test approximate results with and without re-ranking
+	test_recall($min, 100, $operator);
+	test_recall(0.40, 0, $operator);
+
+	# Test results are in exact order after re-ranking
+	my $actual = $node->safe_psql("postgres", qq(
+		SET enable_seqscan = off;
+		SET ivfflat.probes = 10;
+		SELECT i FROM tst ORDER BY v $operator '$queries[0]' LIMIT $limit;
+	));
+	my $sorted = $node->safe_psql("postgres", qq(
+		SET enable_seqscan = off;
+		SET ivfflat.probes = 10;
+		SELECT i FROM (SELECT i, v FROM tst ORDER BY v $operator '$queries[0]' LIMIT $limit) t ORDER BY v $operator '$queries[0]';
+	));
+	is($actual, $sorted, "$operator order");
+
+	# Test inserts
+	$node->safe_psql("postgres",
+		"INSERT INTO tst SELECT i, ARRAY[random(), random(), random(), random(), random(), random(), random(), random()] FROM generate_series(10001, 11000) i;"
+	);
+	get_expected($operator);
+	test_recall($min, 100, $operator);
+
+	$node->safe_psql("postgres", "DELETE FROM tst WHERE i > 10000;");
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+	get_expected($operator);
+
+	# Build index in parallel
+	my ($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		SET client_min_messages = DEBUG;
+		SET min_parallel_table_scan_size = 1;
+		CREATE INDEX idx ON tst USING ivfflat (v $opclass) WITH (lists = 10, quantization = 'pq');
+	));
+	is($ret, 0, $stderr);
+	like($stderr, qr/using \d+ parallel workers/);
+
+	# Test approximate results
+	test_recall($min, 100, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+}
+
+done_testing();
@@ -0,0 +1,84 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $dim = 3;
+my $nc = 50;
+my $limit = 20;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+# Initialize node
+my $node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and index
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector($dim), c int4);");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql], i % $nc FROM generate_series(1, 10000) i;"
+);
+$node->safe_psql("postgres", "CREATE INDEX idx ON tst USING ivfflat (v vector_l2_ops) WITH (lists = 100);");
+
+# Generate query
+my @r = ();
+for (1 .. $dim)
+{
+	push(@r, rand());
+}
+my $query = "[" . join(",", @r) . "]";
+my $c = int(rand() * $nc);
+
+# Test filtering without iterative scans
+my $count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SELECT COUNT(*) FROM (SELECT i FROM tst WHERE c = $c ORDER BY v <-> '$query' LIMIT $limit) t;
+));
+cmp_ok($count, "<", $limit);
+
+# Test filtering with iterative scans
+$count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.iterative_scan = relaxed_order;
+	SELECT COUNT(*) FROM (SELECT i FROM tst WHERE c = $c ORDER BY v <-> '$query' LIMIT $limit) t;
+));
+is($count, $limit);
+
+# Test recall with iterative scans
+my $expected = $node->safe_psql("postgres", qq(
+	SET enable_indexscan = off;
+	SELECT i FROM tst WHERE c = $c ORDER BY v <-> '$query' LIMIT $limit;
+));
+my %expected_set = map { $_ => 1 } split("\n", $expected);
+
+my $actual = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.iterative_scan = relaxed_order;
+	SELECT i FROM tst WHERE c = $c ORDER BY v <-> '$query' LIMIT $limit;
+));
+my $correct = grep { exists($expected_set{$_}) } split("\n", $actual);
+cmp_ok($correct / $limit, ">=", 0.8);
+
+# Test max probes
+$count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.iterative_scan = relaxed_order;
+	SET ivfflat.max_probes = 1;
+	SELECT COUNT(*) FROM (SELECT i FROM tst WHERE c = $c ORDER BY v <-> '$query' LIMIT $limit) t;
+));
+cmp_ok($count, "<", $limit);
+
+# Test all tuples are returned once
+$count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.iterative_scan = relaxed_order;
+	SELECT COUNT(DISTINCT i), COUNT(*) FROM (SELECT i FROM tst ORDER BY v <-> '$query') t;
+));
+my ($distinct, $total) = split(/\|/, $count);
+is($distinct, $total);
+is($total, 10000);
+
+done_testing();
@@ -0,0 +1,89 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node;
+my @queries = ();
+my $limit = 20;
+my $dim = 3;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+sub test_recall
+{
+	my ($min, $cache_size) = @_;
+	my $correct = 0;
+	my $total = 0;
+
+	$node->safe_psql("postgres", "ALTER SYSTEM SET hnsw.upper_cache_size = '$cache_size';");
+	$node->safe_psql("postgres", "SELECT pg_reload_conf();");
+
+	for my $query (@queries)
+	{
+		my $expected = $node->safe_psql("postgres", qq(
+			SET enable_indexscan = off;
+			SELECT i FROM tst ORDER BY v <-> '$query' LIMIT $limit;
+		));
+		my %expected_set = map { $_ => 1 } split("\n", $expected);
+
+		my $actual = $node->safe_psql("postgres", qq(
+			SET enable_seqscan = off;
+			SELECT i FROM tst ORDER BY v <-> '$query' LIMIT $limit;
+		));
+
+		foreach (split("\n", $actual))
+		{
+			if (exists($expected_set{$_}))
+			{
+				$correct++;
+			}
+		}
+		$total += $limit;
+	}
+
+	cmp_ok($correct / $total, ">=", $min, "cache size $cache_size");
+}
+
+# Initialize node
+$node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and index
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector($dim));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(1, 20000) i;"
+);
+$node->safe_psql("postgres", "CREATE INDEX idx ON tst USING hnsw (v vector_l2_ops);");
+
+# Generate queries
+for (1 .. 20)
+{
+	my @r = ();
+	for (1 .. $dim)
+	{
+		push(@r, rand());
+	}
+	push(@queries, "[" . join(",", @r) . "]");
+}
+
+test_recall(0.95, '16MB');
+test_recall(0.95, '0');
+
+# Test only some layers fit
+test_recall(0.95, '64kB');
+
+# Test cache is invalidated by inserts and vacuum
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(20001, 30000) i;"
+);
+test_recall(0.95, '16MB');
+
+$node->safe_psql("postgres", "DELETE FROM tst WHERE i % 2 = 0;");
+$node->safe_psql("postgres", "VACUUM tst;");
+test_recall(0.95, '16MB');
+
+done_testing();
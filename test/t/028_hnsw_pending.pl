@@ -0,0 +1,115 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node;
+my @queries = ();
+my $limit = 20;
+my $dim = 3;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+sub test_recall
+{
+	my ($min, $name) = @_;
+	my $correct = 0;
+	my $total = 0;
+
+	for my $query (@queries)
+	{
+		my $expected = $node->safe_psql("postgres", qq(
+			SET enable_indexscan = off;
+			SELECT i FROM tst ORDER BY v <-> '$query' LIMIT $limit;
+		));
+		my %expected_set = map { $_ => 1 } split("\n", $expected);
+
+		my $actual = $node->safe_psql("postgres", qq(
+			SET enable_seqscan = off;
+			SELECT i FROM tst ORDER BY v <-> '$query' LIMIT $limit;
+		));
+		my @actual_ids = split("\n", $actual);
+		my %actual_set = map { $_ => 1 } @actual_ids;
+
+		is(scalar(keys %actual_set), scalar(@actual_ids), "no duplicates");
+
+		foreach (@actual_ids)
+		{
+			if (exists($expected_set{$_}))
+			{
+				$correct++;
+			}
+		}
+		$total += $limit;
+	}
+
+	cmp_ok($correct / $total, ">=", $min, $name);
+}
+
+# Initialize node
+$node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and index
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector($dim));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(1, 10000) i;"
+);
+$node->safe_psql("postgres", "CREATE INDEX idx ON tst USING hnsw (v vector_l2_ops) WITH (fastupdate = on);");
+
+# Generate queries
+for (1 .. 20)
+{
+	my @r = ();
+	for (1 .. $dim)
+	{
+		push(@r, rand());
+	}
+	push(@queries, "[" . join(",", @r) . "]");
+}
+
+# Test pending list
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(10001, 12000) i;"
+);
+test_recall(0.95, "pending list");
+
+# Test merging
+my $merged = $node->safe_psql("postgres", "SELECT hnsw_merge_pending('idx');");
+is($merged, 2000);
+test_recall(0.95, "merged");
+
+# Test merging when the pending list passes the limit
+$node->safe_psql("postgres", qq(
+	SET hnsw.pending_list_limit = '64kB';
+	INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(12001, 15000) i;
+));
+$merged = $node->safe_psql("postgres", "SELECT hnsw_merge_pending('idx');");
+cmp_ok($merged, "<", 3000);
+test_recall(0.95, "limit");
+
+# Test all tuples are returned once with iterative scans
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(15001, 16000) i;"
+);
+my $count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET hnsw.iterative_scan = relaxed_order;
+	SET hnsw.max_scan_tuples = 100000;
+	SELECT COUNT(DISTINCT i), COUNT(*) FROM (SELECT i FROM tst ORDER BY v <-> '$queries[0]') t;
+));
+my ($distinct, $total) = split(/\|/, $count);
+is($distinct, $total);
+cmp_ok($total, ">=", 15800);
+
+# Test vacuum merges pending list
+$node->safe_psql("postgres", "DELETE FROM tst WHERE i % 2 = 0;");
+$node->safe_psql("postgres", "VACUUM tst;");
+$merged = $node->safe_psql("postgres", "SELECT hnsw_merge_pending('idx');");
+is($merged, 0);
+test_recall(0.95, "vacuum");
+
+done_testing();
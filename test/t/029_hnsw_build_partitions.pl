@@ -0,0 +1,164 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node;
+my @queries = ();
+my @expected;
+my $limit = 20;
+my $dim = 3;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+sub test_recall
+{
+	my ($min, $operator) = @_;
+	my $correct = 0;
+	my $total = 0;
+
+	for my $i (0 .. $#queries)
+	{
+		my $actual = $node->safe_psql("postgres", qq(
+			SET enable_seqscan = off;
+			SELECT i FROM tst ORDER BY v $operator '$queries[$i]' LIMIT $limit;
+		));
+		my %actual_set = map { $_ => 1 } split("\n", $actual);
+
+		my @expected_ids = split("\n", $expected[$i]);
+
+		foreach (@expected_ids)
+		{
+			if (exists($actual_set{$_}))
+			{
+				$correct++;
+			}
+			$total++;
+		}
+	}
+
+	cmp_ok($correct / $total, ">=", $min, $operator);
+}
+
+# Initialize node
+$node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector($dim));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(1, 20000) i;"
+);
+
+# Generate queries
+for (1 .. 20)
+{
+	my @r = ();
+	for (1 .. $dim)
+	{
+		push(@r, rand());
+	}
+	push(@queries, "[" . join(",", @r) . "]");
+}
+
+my @operators = ("<->", "<#>");
+my @opclasses = ("vector_l2_ops", "vector_ip_ops");
+
+for my $i (0 .. $#operators)
+{
+	my $operator = $operators[$i];
+	my $opclass = $opclasses[$i];
+
+	# Get exact results
+	@expected = ();
+	foreach (@queries)
+	{
+		my $res = $node->safe_psql("postgres", "SELECT i FROM tst ORDER BY v $operator '$_' LIMIT $limit;");
+		push(@expected, $res);
+	}
+
+	# Test serial build
+	my ($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		SET client_min_messages = debug1;
+		SET hnsw.build_partitions = 4;
+		SET max_parallel_maintenance_workers = 0;
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+	));
+	is($ret, 0, $stderr);
+	like($stderr, qr/using \d+ partitions/);
+	like($stderr, qr/linking \d+ elements across \d+ partitions/);
+
+	test_recall(0.9, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Test parallel build
+	($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		SET client_min_messages = debug1;
+		SET hnsw.build_partitions = 4;
+		SET min_parallel_table_scan_size = 1;
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+	));
+	is($ret, 0, $stderr);
+	like($stderr, qr/using \d+ parallel workers/);
+	like($stderr, qr/linking \d+ elements across \d+ partitions/);
+
+	test_recall(0.9, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+
+	# Test parallel build with partitions that do not fit into memory
+	# Set parallel_workers on table to use workers with low maintenance_work_mem
+	($ret, $stdout, $stderr) = $node->psql("postgres", qq(
+		ALTER TABLE tst SET (parallel_workers = 2);
+		SET client_min_messages = debug1;
+		SET hnsw.build_partitions = 4;
+		SET maintenance_work_mem = '1MB';
+		CREATE INDEX idx ON tst USING hnsw (v $opclass);
+		ALTER TABLE tst RESET (parallel_workers);
+	));
+	is($ret, 0, $stderr);
+	like($stderr, qr/using \d+ parallel workers/);
+	like($stderr, qr/hnsw graph no longer fits into maintenance_work_mem/);
+	like($stderr, qr/linking \d+ elements across \d+ partitions/);
+
+	test_recall(0.9, $operator);
+
+	$node->safe_psql("postgres", "DROP INDEX idx;");
+}
+
+# Test vacuum after partitioned build
+$node->safe_psql("postgres", qq(
+	SET hnsw.build_partitions = 4;
+	SET max_parallel_maintenance_workers = 0;
+	CREATE INDEX idx ON tst USING hnsw (v vector_l2_ops);
+));
+$node->safe_psql("postgres", "DELETE FROM tst WHERE i % 2 = 0;");
+
+# Vacuum must reach the pages of every partition
+my ($ret, $stdout, $stderr) = $node->psql("postgres", "VACUUM VERBOSE tst;");
+is($ret, 0, $stderr);
+like($stderr, qr/index "idx" now contains 10000 row versions/);
+
+# Get exact results
+@expected = ();
+foreach (@queries)
+{
+	my $res = $node->safe_psql("postgres", "SELECT i FROM tst ORDER BY v <-> '$_' LIMIT $limit;");
+	push(@expected, $res);
+}
+
+test_recall(0.9, "<->");
+
+# Test deleted rows are not returned
+my $count = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET hnsw.ef_search = 1000;
+	SELECT COUNT(*) FROM (SELECT i FROM tst ORDER BY v <-> '$queries[0]' LIMIT 1000) t WHERE i % 2 = 0;
+));
+is($count, 0);
+
+done_testing();
@@ -0,0 +1,49 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $dim = 3;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+# Initialize node
+my $node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and indexes
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE UNLOGGED TABLE tst (i int4, v vector($dim));");
+$node->safe_psql("postgres", "CREATE INDEX hnsw_idx ON tst USING hnsw (v vector_l2_ops);");
+$node->safe_psql("postgres", "CREATE INDEX ivfflat_idx ON tst USING ivfflat (v vector_l2_ops) WITH (lists = 10);");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(1, 1000) i;"
+);
+
+# Reset unlogged relations from their initialization forks
+$node->stop('immediate');
+$node->start;
+
+my $count = $node->safe_psql("postgres", "SELECT COUNT(*) FROM tst;");
+is($count, 0);
+
+# Test indexes are usable after recovery
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[$array_sql] FROM generate_series(1, 1000) i;"
+);
+
+for my $idx ("hnsw_idx", "ivfflat_idx")
+{
+	my $res = $node->safe_psql("postgres", qq(
+		SET enable_seqscan = off;
+		SET ivfflat.probes = 10;
+		SELECT COUNT(*) FROM (SELECT i FROM tst ORDER BY v <-> '[0,0,0]' LIMIT 10) t;
+	));
+	is($res, 10, $idx);
+
+	$node->safe_psql("postgres", "DROP INDEX $idx;");
+}
+
+done_testing();